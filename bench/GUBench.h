@@ -0,0 +1,340 @@
+#ifndef _GUBENCH_H_
+#define _GUBENCH_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace GUBench
+{
+	/*********************************************************/
+	// Keeps the compiler from removing a computation whose result is unused
+	template<typename T>
+	inline void DoNotOptimize(const T &value)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		asm volatile("" : : "m"(value) : "memory");
+#else
+		static const void* volatile sink;
+		sink = &value;
+#endif
+	}
+
+	inline double Seconds()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	/*********************************************************/
+	struct Options
+	{
+		const char* format = "table";	// table, json or csv
+		const char* output = nullptr;	// file for the report, stdout if null
+		const char* filter = nullptr;	// only the benchmarks whose name contains it
+		double minTime = 0.1;			// seconds of one measurement
+		int repeats = 3;				// measurements per benchmark, the fastest is reported
+		size_t count = 0;				// elements of the array forms, 0 = default of the benchmark
+		bool check = false;				// correctness pass only
+	};
+
+	inline void PrintUsage(const char* program)
+	{
+		fprintf(stderr, "usage: %s [--format=table|json|csv] [--output=file] [--filter=text]\n"
+			"\t[--min-time=seconds] [--repeats=n] [--count=n] [--check]\n", program);
+	}
+
+	// False and the usage on stderr if an argument is unknown
+	inline bool ParseOptions(int argc, char** argv, Options &options)
+	{
+		for(int i = 1; i < argc; i++)
+		{
+			const char* a = argv[i];
+			const char* v = strchr(a, '=');
+			v = v ? v + 1 : "";
+			if(strncmp(a, "--format=", 9) == 0 &&
+				(strcmp(v, "table") == 0 || strcmp(v, "json") == 0 || strcmp(v, "csv") == 0))
+				options.format = v;
+			else if(strncmp(a, "--output=", 9) == 0)
+				options.output = v;
+			else if(strncmp(a, "--filter=", 9) == 0)
+				options.filter = v;
+			else if(strncmp(a, "--min-time=", 11) == 0)
+				options.minTime = atof(v);
+			else if(strncmp(a, "--repeats=", 10) == 0)
+				options.repeats = atoi(v) > 0 ? atoi(v) : 1;
+			else if(strncmp(a, "--count=", 8) == 0)
+				options.count = (size_t)strtoull(v, nullptr, 10);
+			else if(strcmp(a, "--check") == 0)
+				options.check = true;
+			else
+			{
+				PrintUsage(argv[0]);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/*********************************************************/
+	// One measurement. ops and bytes are per second, speedup is the
+	// time per operation of the baseline divided by the own one.
+	struct Result
+	{
+		std::string name, form, unit, baseline;
+		double nsPerOp = 0.0, opsPerSecond = 0.0, bytesPerSecond = 0.0, speedup = 0.0;
+	};
+
+	// Maximum error of an operation against the reference
+	struct Check
+	{
+		std::string name;
+		double maxError = 0.0, tolerance = 0.0;
+		bool passed = false;
+	};
+
+	class Runner
+	{
+		public:
+			Runner(const Options &options) : _options(options) { }
+
+			const Options& options() const { return _options; }
+			bool selected(const std::string &name) const
+			{ return !_options.filter || name.find(_options.filter) != std::string::npos; }
+
+			// func(n) runs n iterations of opsPerIteration operations, unit
+			// names the operations. bytesPerIteration may be 0 if the memory
+			// traffic is not meaningful. With a baseline, the result is
+			// compared with the earlier one of that name and form.
+			template<typename Func>
+			void run(const std::string &name, const char* form, const char* unit, double opsPerIteration,
+				double bytesPerIteration, Func func, const std::string &baseline = std::string());
+
+			void check(const std::string &name, double maxError, double tolerance);
+			bool passed() const;
+
+			// Describes the run, e.g. the instruction set the library was built for
+			void info(const std::string &key, const std::string &value) { _info.push_back({ key, value }); }
+
+			const std::vector<Result>& results() const { return _results; }
+
+			// Writes the results in the requested format, false if the output cannot be opened
+			bool report() const;
+
+		private:
+			const Result* _find(const std::string &name, const std::string &form) const;
+			void _writeTable(FILE* file) const;
+			void _writeJson(FILE* file) const;
+			void _writeCsv(FILE* file) const;
+
+		private:
+			Options _options;
+			std::vector<std::pair<std::string, std::string>> _info;
+			std::vector<Result> _results;
+			std::vector<Check> _checks;
+	};
+
+	template<typename Func>
+	inline void Runner::run(const std::string &name, const char* form, const char* unit, double opsPerIteration,
+		double bytesPerIteration, Func func, const std::string &baseline)
+	{
+		if(!selected(name))
+			return;
+
+		// Grows the iteration count until one measurement takes minTime
+		size_t n = 1;
+		double time = 0.0;
+		for(;;)
+		{
+			double start = Seconds();
+			func(n);
+			time = Seconds() - start;
+			if(time >= _options.minTime)
+				break;
+			double scale = time > 0.0 ? 1.2 * _options.minTime / time : 10.0;
+			n = (size_t)((double)n * (scale < 2.0 ? 2.0 : scale > 10.0 ? 10.0 : scale));
+		}
+		for(int i = 1; i < _options.repeats; i++)
+		{
+			double start = Seconds();
+			func(n);
+			double t = Seconds() - start;
+			if(t < time)
+				time = t;
+		}
+
+		Result r;
+		r.name = name;
+		r.form = form;
+		r.unit = unit;
+		r.nsPerOp = time * 1e9 / ((double)n * opsPerIteration);
+		r.opsPerSecond = (double)n * opsPerIteration / time;
+		r.bytesPerSecond = (double)n * bytesPerIteration / time;
+		if(!baseline.empty())
+		{
+			const Result* b = _find(baseline, form);
+			if(b)
+			{
+				r.baseline = baseline;
+				r.speedup = b->nsPerOp / r.nsPerOp;
+			}
+		}
+		_results.push_back(r);
+	}
+
+	inline void Runner::check(const std::string &name, double maxError, double tolerance)
+	{
+		Check c;
+		c.name = name;
+		c.maxError = maxError;
+		c.tolerance = tolerance;
+		c.passed = maxError <= tolerance;
+		_checks.push_back(c);
+	}
+
+	inline bool Runner::passed() const
+	{
+		for(const Check &c : _checks)
+			if(!c.passed)
+				return false;
+		return true;
+	}
+
+	inline const Result* Runner::_find(const std::string &name, const std::string &form) const
+	{
+		for(const Result &r : _results)
+			if(r.name == name && r.form == form)
+				return &r;
+		return nullptr;
+	}
+
+	inline bool Runner::report() const
+	{
+		FILE* file = _options.output ? fopen(_options.output, "w") : stdout;
+		if(!file)
+		{
+			fprintf(stderr, "cannot open %s\n", _options.output);
+			return false;
+		}
+		if(strcmp(_options.format, "json") == 0)
+			_writeJson(file);
+		else if(strcmp(_options.format, "csv") == 0)
+			_writeCsv(file);
+		else
+			_writeTable(file);
+		if(file != stdout)
+			fclose(file);
+		return true;
+	}
+
+	inline void Runner::_writeTable(FILE* file) const
+	{
+		for(const auto &i : _info)
+			fprintf(file, "%s: %s\n", i.first.c_str(), i.second.c_str());
+		if(!_info.empty())
+			fprintf(file, "\n");
+		if(!_checks.empty())
+		{
+			fprintf(file, "%-48s %12s %12s  %s\n", "check", "max error", "tolerance", "result");
+			for(const Check &c : _checks)
+				fprintf(file, "%-48s %12.3e %12.3e  %s\n", c.name.c_str(), c.maxError, c.tolerance,
+					c.passed ? "ok" : "FAILED");
+			if(!_results.empty())
+				fprintf(file, "\n");
+		}
+		if(!_results.empty())
+		{
+			fprintf(file, "%-36s %-10s %12s %14s %10s %9s\n", "benchmark", "form", "ns/op", "op/s", "GB/s", "speedup");
+			for(const Result &r : _results)
+			{
+				char ops[32], bytes[16] = "-", speedup[16] = "-";
+				snprintf(ops, sizeof(ops), "%.4g %s", r.opsPerSecond, r.unit.c_str());
+				if(r.bytesPerSecond > 0.0)
+					snprintf(bytes, sizeof(bytes), "%.2f", r.bytesPerSecond * 1e-9);
+				if(!r.baseline.empty())
+					snprintf(speedup, sizeof(speedup), "%.2fx", r.speedup);
+				fprintf(file, "%-36s %-10s %12.3f %14s %10s %9s\n", r.name.c_str(), r.form.c_str(), r.nsPerOp,
+					ops, bytes, speedup);
+			}
+		}
+	}
+
+	inline void _WriteJsonString(FILE* file, const std::string &s)
+	{
+		fputc('"', file);
+		for(char c : s)
+		{
+			if(c == '"' || c == '\\')
+				fputc('\\', file);
+			fputc(c, file);
+		}
+		fputc('"', file);
+	}
+
+	inline void Runner::_writeJson(FILE* file) const
+	{
+		fprintf(file, "{\n\t\"info\": {");
+		for(size_t i = 0; i < _info.size(); i++)
+		{
+			fprintf(file, "%s ", i ? "," : "");
+			_WriteJsonString(file, _info[i].first);
+			fprintf(file, ": ");
+			_WriteJsonString(file, _info[i].second);
+		}
+		fprintf(file, " },\n\t\"benchmarks\": [");
+		for(size_t i = 0; i < _results.size(); i++)
+		{
+			const Result &r = _results[i];
+			fprintf(file, "%s\n\t\t{ \"name\": ", i ? "," : "");
+			_WriteJsonString(file, r.name);
+			fprintf(file, ", \"form\": ");
+			_WriteJsonString(file, r.form);
+			fprintf(file, ", \"unit\": ");
+			_WriteJsonString(file, r.unit);
+			fprintf(file, ", \"ns_per_op\": %.6g, \"ops_per_second\": %.6g, \"bytes_per_second\": %.6g",
+				r.nsPerOp, r.opsPerSecond, r.bytesPerSecond);
+			if(!r.baseline.empty())
+			{
+				fprintf(file, ", \"baseline\": ");
+				_WriteJsonString(file, r.baseline);
+				fprintf(file, ", \"speedup\": %.6g", r.speedup);
+			}
+			fprintf(file, " }");
+		}
+		fprintf(file, "%s],\n\t\"checks\": [", _results.empty() ? "" : "\n\t");
+		for(size_t i = 0; i < _checks.size(); i++)
+		{
+			const Check &c = _checks[i];
+			fprintf(file, "%s\n\t\t{ \"name\": ", i ? "," : "");
+			_WriteJsonString(file, c.name);
+			fprintf(file, ", \"max_error\": %.6g, \"tolerance\": %.6g, \"passed\": %s }",
+				c.maxError, c.tolerance, c.passed ? "true" : "false");
+		}
+		fprintf(file, "%s]\n}\n", _checks.empty() ? "" : "\n\t");
+	}
+
+	// One table for both kinds of rows, the columns of the other kind are
+	// empty. The info lines come first as comments.
+	inline void Runner::_writeCsv(FILE* file) const
+	{
+		for(const auto &i : _info)
+			fprintf(file, "# %s: %s\n", i.first.c_str(), i.second.c_str());
+		fprintf(file, "type,name,form,unit,ns_per_op,ops_per_second,bytes_per_second,baseline,speedup,"
+			"max_error,tolerance,passed\n");
+		for(const Result &r : _results)
+		{
+			fprintf(file, "benchmark,%s,%s,%s,%.6g,%.6g,%.6g,%s,", r.name.c_str(), r.form.c_str(), r.unit.c_str(),
+				r.nsPerOp, r.opsPerSecond, r.bytesPerSecond, r.baseline.c_str());
+			if(!r.baseline.empty())
+				fprintf(file, "%.6g", r.speedup);
+			fprintf(file, ",,,\n");
+		}
+		for(const Check &c : _checks)
+			fprintf(file, "check,%s,,,,,,,,%.6g,%.6g,%d\n", c.name.c_str(), c.maxError, c.tolerance, c.passed ? 1 : 0);
+	}
+}
+
+#endif
@@ -0,0 +1,317 @@
+// Benchmarks of GUMath.h. Every operation is measured as a single call
+// on inputs that stay in the L1 cache and as a loop over large arrays.
+// The correctness pass compares the results with double precision
+// reference code first, --check runs only that pass.
+
+#include <math.h>
+#include <vector>
+
+#include <GU/GUMath.h>
+
+#include "GUBench.h"
+#include "GUMathReference.h"
+
+using namespace GU;
+using GUBench::DoNotOptimize;
+
+namespace
+{
+	constexpr size_t SingleCount = 256;			// inputs of the single call form, a power of two
+	constexpr size_t DefaultCount = 1 << 18;	// elements of the array form
+	constexpr size_t CheckCount = 4099;			// samples of the correctness pass, not a multiple of the lanes
+
+	const char* SimdName()
+	{
+#if defined(GU_AVX)
+		return "avx";
+#elif defined(GU_SSE)
+		return "sse";
+#else
+		return "none";
+#endif
+	}
+
+	/*********************************************************/
+	// Maximum error of sample(random) over CheckCount samples
+	template<typename Sample>
+	void Check(GUBench::Runner &runner, const char* name, double tolerance, Sample sample)
+	{
+		GURef::Random random(1);
+		double e = 0.0;
+		for(size_t i = 0; i < CheckCount; i++)
+			e = fmax(e, sample(random));
+		runner.check(name, e, tolerance);
+	}
+
+	void RunChecks(GUBench::Runner &runner)
+	{
+		using namespace GURef;
+
+		Check(runner, "Vector4 + Vector4", 1e-6, [](Random &r) {
+			Vector4 a = r.vector4(), b = r.vector4();
+			return Error(a + b, Add(ToDouble(a), ToDouble(b)));
+		});
+		Check(runner, "Vector4 - Vector4", 1e-6, [](Random &r) {
+			Vector4 a = r.vector4(), b = r.vector4();
+			return Error(a - b, Sub(ToDouble(a), ToDouble(b)));
+		});
+		Check(runner, "Vector4 * Vector4", 1e-6, [](Random &r) {
+			Vector4 a = r.vector4(), b = r.vector4();
+			return Error(a * b, Mul(ToDouble(a), ToDouble(b)));
+		});
+		Check(runner, "Vector4 * float", 1e-6, [](Random &r) {
+			Vector4 a = r.vector4();
+			float s = r.uniform(-4.0f, 4.0f);
+			return Error(a * s, Scale(ToDouble(a), s));
+		});
+		Check(runner, "Vector4::dot", 1e-6, [](Random &r) {
+			Vector4 a = r.vector4(), b = r.vector4();
+			return Error(a.dot(b), Dot3(ToDouble(a), ToDouble(b)));
+		});
+		Check(runner, "Vector4::cross", 1e-6, [](Random &r) {
+			Vector4 a = r.vector4(), b = r.vector4();
+			return Error(a.cross(b), Cross3(ToDouble(a), ToDouble(b)));
+		});
+		Check(runner, "Vector4::length", 1e-6, [](Random &r) {
+			Vector4 a = r.vector4();
+			return Error(a.length(), Length3(ToDouble(a)));
+		});
+		Check(runner, "Vector4::normalize", 1e-6, [](Random &r) {
+			Vector4 a = r.vector4(0.1f, 1.0f);
+			return Error(a.normalize(), Normalize3(ToDouble(a)));
+		});
+		Check(runner, "Vector4::reflect", 1e-6, [](Random &r) {
+			Vector4 a = r.vector4(), n = r.vector4(0.1f, 1.0f).normalize();
+			return Error(a.reflect(n), Reflect3(ToDouble(a), ToDouble(n)));
+		});
+		Check(runner, "Vector3::dot", 1e-6, [](Random &r) {
+			Vector3 a = r.vector3(), b = r.vector3();
+			return Error(a.dot(b), Dot3(ToDouble(a), ToDouble(b)));
+		});
+		Check(runner, "Vector3::cross", 1e-6, [](Random &r) {
+			Vector3 a = r.vector3(), b = r.vector3();
+			return Error(a.cross(b), Cross3(ToDouble(a), ToDouble(b)));
+		});
+		Check(runner, "Vector3::normalize", 1e-6, [](Random &r) {
+			Vector3 a = r.vector3(0.1f, 1.0f);
+			return Error(a.normalize(), Normalize3(ToDouble(a)));
+		});
+
+		Check(runner, "Matrix4x4 * Matrix4x4", 1e-6, [](Random &r) {
+			Matrix4x4 a = r.matrix(), b = r.matrix();
+			return Error(a * b, Mul(ToDouble(a), ToDouble(b)));
+		});
+		Check(runner, "Matrix4x4 * Vector4", 1e-6, [](Random &r) {
+			Matrix4x4 a = r.matrix();
+			Vector4 b = r.vector4();
+			return Error(a * b, Mul(ToDouble(a), ToDouble(b)));
+		});
+		Check(runner, "Matrix4x4::inverse", 1e-5, [](Random &r) {
+			Matrix4x4 a = r.invertible();
+			Mat4 inv;
+			Inverse(ToDouble(a), inv);
+			return NormError(a.inverse(), inv);
+		});
+		Check(runner, "Matrix4x4::transpose", 0.0, [](Random &r) {
+			Matrix4x4 a = r.matrix();
+			return Error(a.transpose(), Transpose(ToDouble(a)));
+		});
+		Check(runner, "MatrixRotateXYZ", 1e-6, [](Random &r) {
+			float x = r.uniform(-3.2f, 3.2f), y = r.uniform(-3.2f, 3.2f), z = r.uniform(-3.2f, 3.2f);
+			return Error(MatrixRotateXYZ(x, y, z), RotateXYZ(x, y, z));
+		});
+		Check(runner, "MatrixLookAt", 1e-6, [](Random &r) {
+			Vector4 eye = r.vector4(-10.0f, 10.0f), at = r.vector4(-10.0f, 10.0f);
+			Vector4 up = r.vector4(0.1f, 1.0f).normalize();
+			return Error(MatrixLookAt(eye, at, up), LookAt(ToDouble(eye), ToDouble(at), ToDouble(up)));
+		});
+
+		// Array functions, over a count that leaves a tail after the SIMD lanes
+		Random r(2);
+		Matrix4x4 m = r.invertible();
+		Mat4 md = ToDouble(m);
+		std::vector<Vector3> p3(CheckCount), o3(CheckCount);
+		std::vector<Vector4> a4(CheckCount), b4(CheckCount), c4(CheckCount), o4(CheckCount);
+		for(size_t i = 0; i < CheckCount; i++)
+		{
+			p3[i] = r.vector3(-10.0f, 10.0f);
+			a4[i] = r.vector4();
+			b4[i] = r.vector4();
+			c4[i] = r.vector4();
+		}
+
+		double e = 0.0;
+		TransformPoints(m, p3.data(), o3.data(), CheckCount);
+		for(size_t i = 0; i < CheckCount; i++)
+		{
+			Vec4 p = ToDouble(p3[i]);
+			p.v[3] = 1.0;
+			e = fmax(e, Error(o3[i], Mul(md, p)));
+		}
+		runner.check("TransformPoints", e, 1e-5);
+
+		e = 0.0;
+		TransformVectors(m, a4.data(), o4.data(), CheckCount);
+		for(size_t i = 0; i < CheckCount; i++)
+			e = fmax(e, Error(o4[i], Mul(md, ToDouble(a4[i]))));
+		runner.check("TransformVectors", e, 1e-5);
+
+		e = 0.0;
+		MulAdd(a4.data(), b4.data(), c4.data(), o4.data(), CheckCount);
+		for(size_t i = 0; i < CheckCount; i++)
+			e = fmax(e, Error(o4[i], Add(ToDouble(a4[i]), Mul(ToDouble(b4[i]), ToDouble(c4[i])))));
+		runner.check("MulAdd[Vector4]", e, 1e-6);
+
+		e = 0.0;
+		Lerp(a4.data(), b4.data(), 0.3f, o4.data(), CheckCount);
+		for(size_t i = 0; i < CheckCount; i++)
+			e = fmax(e, Error(o4[i], Add(ToDouble(a4[i]), Scale(Sub(ToDouble(b4[i]), ToDouble(a4[i])), 0.3f))));
+		runner.check("Lerp[Vector4]", e, 1e-6);
+
+		e = 0.0;
+		std::vector<Matrix4x4> rotations(CheckCount);
+		MatrixRotateEuler(p3.data(), rotations.data(), CheckCount, EulerOrder::XYZ);
+		for(size_t i = 0; i < CheckCount; i++)
+			e = fmax(e, Error(rotations[i], RotateXYZ(p3[i]._x, p3[i]._y, p3[i]._z)));
+		runner.check("MatrixRotateEuler[XYZ]", e, 1e-5);
+	}
+
+	/*********************************************************/
+	// op(a[i]) in both forms, the single call form on the first SingleCount inputs
+	template<typename A, typename Op>
+	void Unary(GUBench::Runner &runner, const char* name, const std::vector<A> &a, Op op)
+	{
+		typedef decltype(op(a[0])) R;
+		runner.run(name, "single", "op", 1.0, 0.0, [&](size_t n) {
+			for(size_t i = 0; i < n; i++)
+			{
+				R r = op(a[i & (SingleCount - 1)]);
+				DoNotOptimize(r);
+			}
+		});
+
+		std::vector<R> out(a.size());
+		runner.run(name, "array", "op", (double)a.size(), (double)(a.size() * (sizeof(A) + sizeof(R))), [&](size_t n) {
+			for(size_t k = 0; k < n; k++)
+			{
+				for(size_t i = 0; i < a.size(); i++)
+					out[i] = op(a[i]);
+				DoNotOptimize(out[0]);
+			}
+		});
+	}
+
+	// op(a[i], b[i]) in both forms
+	template<typename A, typename B, typename Op>
+	void Binary(GUBench::Runner &runner, const char* name, const std::vector<A> &a, const std::vector<B> &b, Op op)
+	{
+		typedef decltype(op(a[0], b[0])) R;
+		runner.run(name, "single", "op", 1.0, 0.0, [&](size_t n) {
+			for(size_t i = 0; i < n; i++)
+			{
+				R r = op(a[i & (SingleCount - 1)], b[i & (SingleCount - 1)]);
+				DoNotOptimize(r);
+			}
+		});
+
+		std::vector<R> out(a.size());
+		double bytes = (double)(a.size() * (sizeof(A) + sizeof(B) + sizeof(R)));
+		runner.run(name, "array", "op", (double)a.size(), bytes, [&](size_t n) {
+			for(size_t k = 0; k < n; k++)
+			{
+				for(size_t i = 0; i < a.size(); i++)
+					out[i] = op(a[i], b[i]);
+				DoNotOptimize(out[0]);
+			}
+		});
+	}
+
+	void RunBenchmarks(GUBench::Runner &runner, size_t count)
+	{
+		count = count < SingleCount ? SingleCount : count;
+		GURef::Random r(3);
+		std::vector<Vector3> a3(count), b3(count), angles(count);
+		std::vector<Vector4> a4(count), b4(count), c4(count);
+		std::vector<Matrix4x4> ma(count), mb(count), mi(count);
+		for(size_t i = 0; i < count; i++)
+		{
+			a3[i] = r.vector3(0.1f, 1.0f);
+			b3[i] = r.vector3(0.1f, 1.0f);
+			angles[i] = r.vector3(-3.2f, 3.2f);
+			a4[i] = r.vector4(0.1f, 1.0f);
+			b4[i] = r.vector4(0.1f, 1.0f);
+			c4[i] = r.vector4(0.1f, 1.0f);
+			ma[i] = r.matrix();
+			mb[i] = r.matrix();
+			mi[i] = r.invertible();
+		}
+
+		Binary(runner, "Vector4 + Vector4", a4, b4, [](const Vector4 &a, const Vector4 &b) { return a + b; });
+		Binary(runner, "Vector4 - Vector4", a4, b4, [](const Vector4 &a, const Vector4 &b) { return a - b; });
+		Binary(runner, "Vector4 * Vector4", a4, b4, [](const Vector4 &a, const Vector4 &b) { return a * b; });
+		Unary(runner, "Vector4 * float", a4, [](const Vector4 &a) { return a * 0.5f; });
+		Binary(runner, "Vector4::dot", a4, b4, [](const Vector4 &a, const Vector4 &b) { return a.dot(b); });
+		Binary(runner, "Vector4::cross", a4, b4, [](const Vector4 &a, const Vector4 &b) { return a.cross(b); });
+		Unary(runner, "Vector4::length", a4, [](const Vector4 &a) { return a.length(); });
+		Unary(runner, "Vector4::normalize", a4, [](const Vector4 &a) { return a.normalize(); });
+		Binary(runner, "Vector4::reflect", a4, b4, [](const Vector4 &a, const Vector4 &b) { return a.reflect(b); });
+		Binary(runner, "Vector3 + Vector3", a3, b3, [](const Vector3 &a, const Vector3 &b) { return a + b; });
+		Binary(runner, "Vector3::dot", a3, b3, [](const Vector3 &a, const Vector3 &b) { return a.dot(b); });
+		Binary(runner, "Vector3::cross", a3, b3, [](const Vector3 &a, const Vector3 &b) { return a.cross(b); });
+		Unary(runner, "Vector3::normalize", a3, [](const Vector3 &a) { return a.normalize(); });
+
+		Binary(runner, "Matrix4x4 * Matrix4x4", ma, mb, [](const Matrix4x4 &a, const Matrix4x4 &b) { return a * b; });
+		Binary(runner, "Matrix4x4 * Vector4", ma, a4, [](const Matrix4x4 &a, const Vector4 &b) { return a * b; });
+		Unary(runner, "Matrix4x4::inverse", mi, [](const Matrix4x4 &a) { return a.inverse(); });
+		Unary(runner, "Matrix4x4::transpose", ma, [](const Matrix4x4 &a) { return a.transpose(); });
+		Unary(runner, "MatrixRotateXYZ", angles, [](const Vector3 &a) { return MatrixRotateXYZ(a._x, a._y, a._z); });
+		Vector4 up(0.0f, 1.0f, 0.0f, 0.0f);
+		Binary(runner, "MatrixLookAt", a4, b4, [&up](const Vector4 &eye, const Vector4 &at) {
+			return MatrixLookAt(eye, at, up);
+		});
+
+		// Array functions, compared with the loops over the single operations above
+		Matrix4x4 m = mi[0];
+		std::vector<Vector3> o3(count);
+		std::vector<Vector4> o4(count);
+		std::vector<Matrix4x4> om(count);
+		double bytes3 = (double)(count * 2 * sizeof(Vector3)), bytes4 = (double)(count * sizeof(Vector4));
+		runner.run("TransformPoints", "array", "op", (double)count, bytes3, [&](size_t n) {
+			for(size_t k = 0; k < n; k++)
+				TransformPoints(m, a3.data(), o3.data(), count);
+		});
+		runner.run("TransformVectors", "array", "op", (double)count, 2.0 * bytes4, [&](size_t n) {
+			for(size_t k = 0; k < n; k++)
+				TransformVectors(m, a4.data(), o4.data(), count);
+		});
+		runner.run("MulAdd[Vector4]", "array", "op", (double)count, 4.0 * bytes4, [&](size_t n) {
+			for(size_t k = 0; k < n; k++)
+				MulAdd(a4.data(), b4.data(), c4.data(), o4.data(), count);
+		});
+		runner.run("Lerp[Vector4]", "array", "op", (double)count, 3.0 * bytes4, [&](size_t n) {
+			for(size_t k = 0; k < n; k++)
+				Lerp(a4.data(), b4.data(), 0.3f, o4.data(), count);
+		});
+		runner.run("MatrixRotateEuler[XYZ]", "array", "op", (double)count,
+			(double)(count * (sizeof(Vector3) + sizeof(Matrix4x4))), [&](size_t n) {
+			for(size_t k = 0; k < n; k++)
+				MatrixRotateEuler(angles.data(), om.data(), count, EulerOrder::XYZ);
+		}, "MatrixRotateXYZ");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	GUBench::Options options;
+	if(!GUBench::ParseOptions(argc, argv, options))
+		return 2;
+
+	GUBench::Runner runner(options);
+	runner.info("simd", SimdName());
+	RunChecks(runner);
+	if(!options.check)
+		RunBenchmarks(runner, options.count ? options.count : DefaultCount);
+	if(!runner.report())
+		return 2;
+	return runner.passed() ? 0 : 1;
+}
@@ -0,0 +1,298 @@
+#ifndef _GUMATHREFERENCE_H_
+#define _GUMATHREFERENCE_H_
+
+#include <math.h>
+#include <random>
+
+#include <GU/GUMath.h>
+
+// Plain double precision versions of the GUMath operations, written
+// without any of its code so that both SIMD and scalar builds can be
+// checked against them.
+namespace GURef
+{
+	struct Vec4 { double v[4]; };
+	struct Mat4 { double m[4][4]; };
+
+	/*********************************************************/
+	inline Vec4 ToDouble(const GU::Vector4 &a)
+	{
+		return { { a._x, a._y, a._z, a._w } };
+	}
+
+	inline Vec4 ToDouble(const GU::Vector3 &a)
+	{
+		return { { a._x, a._y, a._z, 0.0 } };
+	}
+
+	inline Mat4 ToDouble(const GU::Matrix4x4 &a)
+	{
+		Mat4 r;
+		for(int i = 0; i < 4; i++)
+			for(int j = 0; j < 4; j++)
+				r.m[i][j] = a(i, j);
+		return r;
+	}
+
+	// Largest difference, relative for components with a magnitude above one
+	inline double Error(double a, double ref)
+	{
+		double scale = fabs(ref) > 1.0 ? fabs(ref) : 1.0;
+		return fabs(a - ref) / scale;
+	}
+
+	inline double Error(float a, double ref)
+	{
+		return Error((double)a, ref);
+	}
+
+	inline double Error(const GU::Vector4 &a, const Vec4 &ref)
+	{
+		double e = 0.0;
+		for(int i = 0; i < 4; i++)
+			e = fmax(e, Error((double)a[i], ref.v[i]));
+		return e;
+	}
+
+	inline double Error(const GU::Vector3 &a, const Vec4 &ref)
+	{
+		double e = 0.0;
+		for(int i = 0; i < 3; i++)
+			e = fmax(e, Error((double)a[i], ref.v[i]));
+		return e;
+	}
+
+	inline double Error(const GU::Matrix4x4 &a, const Mat4 &ref)
+	{
+		double e = 0.0;
+		for(int i = 0; i < 4; i++)
+			for(int j = 0; j < 4; j++)
+				e = fmax(e, Error((double)a(i, j), ref.m[i][j]));
+		return e;
+	}
+
+	// Largest difference relative to the largest entry of ref, for results
+	// whose accuracy depends on the magnitude of the whole matrix
+	inline double NormError(const GU::Matrix4x4 &a, const Mat4 &ref)
+	{
+		double e = 0.0, scale = 1.0;
+		for(int i = 0; i < 4; i++)
+			for(int j = 0; j < 4; j++)
+			{
+				e = fmax(e, fabs((double)a(i, j) - ref.m[i][j]));
+				scale = fmax(scale, fabs(ref.m[i][j]));
+			}
+		return e / scale;
+	}
+
+	/*********************************************************/
+	// Vector4 is homogeneous: dot, length and normalize use x, y and z,
+	// cross, normalize and reflect return w = 1
+	inline Vec4 Add(const Vec4 &a, const Vec4 &b)
+	{
+		return { { a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3] } };
+	}
+
+	inline Vec4 Sub(const Vec4 &a, const Vec4 &b)
+	{
+		return { { a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3] } };
+	}
+
+	inline Vec4 Mul(const Vec4 &a, const Vec4 &b)
+	{
+		return { { a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3] } };
+	}
+
+	inline Vec4 Scale(const Vec4 &a, double s)
+	{
+		return { { a.v[0] * s, a.v[1] * s, a.v[2] * s, a.v[3] * s } };
+	}
+
+	inline double Dot3(const Vec4 &a, const Vec4 &b)
+	{
+		return a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2];
+	}
+
+	inline double Length3(const Vec4 &a)
+	{
+		return sqrt(Dot3(a, a));
+	}
+
+	inline Vec4 Cross3(const Vec4 &a, const Vec4 &b)
+	{
+		return { { a.v[1] * b.v[2] - a.v[2] * b.v[1], a.v[2] * b.v[0] - a.v[0] * b.v[2],
+			a.v[0] * b.v[1] - a.v[1] * b.v[0], 1.0 } };
+	}
+
+	inline Vec4 Normalize3(const Vec4 &a)
+	{
+		Vec4 r = Scale(a, 1.0 / Length3(a));
+		r.v[3] = 1.0;
+		return r;
+	}
+
+	inline Vec4 Reflect3(const Vec4 &a, const Vec4 &n)
+	{
+		Vec4 r = Sub(a, Scale(n, 2.0 * Dot3(a, n)));
+		r.v[3] = 1.0;
+		return r;
+	}
+
+	/*********************************************************/
+	inline Mat4 Identity()
+	{
+		Mat4 r = {};
+		for(int i = 0; i < 4; i++)
+			r.m[i][i] = 1.0;
+		return r;
+	}
+
+	inline Mat4 Mul(const Mat4 &a, const Mat4 &b)
+	{
+		Mat4 r;
+		for(int i = 0; i < 4; i++)
+			for(int j = 0; j < 4; j++)
+			{
+				double s = 0.0;
+				for(int k = 0; k < 4; k++)
+					s += a.m[i][k] * b.m[k][j];
+				r.m[i][j] = s;
+			}
+		return r;
+	}
+
+	inline Vec4 Mul(const Mat4 &a, const Vec4 &b)
+	{
+		Vec4 r;
+		for(int i = 0; i < 4; i++)
+			r.v[i] = a.m[i][0] * b.v[0] + a.m[i][1] * b.v[1] + a.m[i][2] * b.v[2] + a.m[i][3] * b.v[3];
+		return r;
+	}
+
+	inline Mat4 Transpose(const Mat4 &a)
+	{
+		Mat4 r;
+		for(int i = 0; i < 4; i++)
+			for(int j = 0; j < 4; j++)
+				r.m[i][j] = a.m[j][i];
+		return r;
+	}
+
+	// Gauss-Jordan elimination with partial pivoting, false if singular
+	inline bool Inverse(const Mat4 &a, Mat4 &inv)
+	{
+		Mat4 m = a;
+		inv = Identity();
+		for(int c = 0; c < 4; c++)
+		{
+			int p = c;
+			for(int r = c + 1; r < 4; r++)
+				if(fabs(m.m[r][c]) > fabs(m.m[p][c]))
+					p = r;
+			if(m.m[p][c] == 0.0)
+				return false;
+			for(int j = 0; j < 4; j++)
+			{
+				double t = m.m[c][j]; m.m[c][j] = m.m[p][j]; m.m[p][j] = t;
+				t = inv.m[c][j]; inv.m[c][j] = inv.m[p][j]; inv.m[p][j] = t;
+			}
+			double d = 1.0 / m.m[c][c];
+			for(int j = 0; j < 4; j++)
+			{
+				m.m[c][j] *= d;
+				inv.m[c][j] *= d;
+			}
+			for(int r = 0; r < 4; r++)
+			{
+				if(r == c)
+					continue;
+				double f = m.m[r][c];
+				for(int j = 0; j < 4; j++)
+				{
+					m.m[r][j] -= f * m.m[c][j];
+					inv.m[r][j] -= f * inv.m[c][j];
+				}
+			}
+		}
+		return true;
+	}
+
+	// The single axis rotations of GUMath, XYZ is RotateX * RotateY * RotateZ
+	inline Mat4 RotateXYZ(double x, double y, double z)
+	{
+		Mat4 rx = Identity(), ry = Identity(), rz = Identity();
+		rx.m[1][1] = cos(x);	rx.m[1][2] = -sin(x);
+		rx.m[2][1] = sin(x);	rx.m[2][2] = cos(x);
+		ry.m[0][0] = cos(y);	ry.m[0][2] = -sin(y);
+		ry.m[2][0] = sin(y);	ry.m[2][2] = cos(y);
+		rz.m[0][0] = cos(z);	rz.m[0][1] = -sin(z);
+		rz.m[1][0] = sin(z);	rz.m[1][1] = cos(z);
+		return Mul(Mul(rx, ry), rz);
+	}
+
+	// Columns X = up x Z, Y = Z x X, Z = normalize(eye - lookAt) and eye
+	inline Mat4 LookAt(const Vec4 &eye, const Vec4 &lookAt, const Vec4 &up)
+	{
+		Vec4 z = Normalize3(Sub(eye, lookAt));
+		Vec4 x = Cross3(up, z);
+		Vec4 y = Cross3(z, x);
+		Mat4 r = Identity();
+		for(int i = 0; i < 3; i++)
+		{
+			r.m[i][0] = x.v[i];
+			r.m[i][1] = y.v[i];
+			r.m[i][2] = z.v[i];
+			r.m[i][3] = eye.v[i];
+		}
+		return r;
+	}
+
+	/*********************************************************/
+	// Deterministic inputs
+	class Random
+	{
+		public:
+			Random(unsigned seed = 1) : _engine(seed) { }
+
+			float uniform(float lo, float hi) { return std::uniform_real_distribution<float>(lo, hi)(_engine); }
+
+			GU::Vector3 vector3(float lo = -1.0f, float hi = 1.0f)
+			{ return GU::Vector3(uniform(lo, hi), uniform(lo, hi), uniform(lo, hi)); }
+			GU::Vector4 vector4(float lo = -1.0f, float hi = 1.0f)
+			{ return GU::Vector4(uniform(lo, hi), uniform(lo, hi), uniform(lo, hi), uniform(lo, hi)); }
+
+			// Any entries in [-1, 1]
+			GU::Matrix4x4 matrix()
+			{
+				GU::Matrix4x4 m;
+				for(int i = 0; i < 4; i++)
+					for(int j = 0; j < 4; j++)
+						m(i, j) = uniform(-1.0f, 1.0f);
+				return m;
+			}
+
+			// Well conditioned: rotation with the rows scaled by [0.5, 2],
+			// translation in [-10, 10] and a projective row small enough
+			// that it cannot cancel m44 through the translation
+			GU::Matrix4x4 invertible()
+			{
+				GU::Matrix4x4 m = GU::MatrixRotateXYZ(uniform(-3.0f, 3.0f), uniform(-3.0f, 3.0f), uniform(-3.0f, 3.0f));
+				for(int i = 0; i < 3; i++)
+				{
+					float s = uniform(0.5f, 2.0f);
+					for(int j = 0; j < 3; j++)
+						m(i, j) *= s;
+					m(i, 3) = uniform(-10.0f, 10.0f);
+				}
+				for(int j = 0; j < 3; j++)
+					m(3, j) = uniform(-0.01f, 0.01f);
+				m(3, 3) = uniform(1.0f, 2.0f);
+				return m;
+			}
+
+		private:
+			std::mt19937 _engine;
+	};
+}
+
+#endif
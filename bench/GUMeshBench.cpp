@@ -0,0 +1,286 @@
+// Binary mesh files of GUMeshFile.h on a generated .obj grid. The checks
+// compare SaveMesh and LoadObjCached with LoadObj, test when the cache is
+// used or rebuilt and that damaged files are rejected. The benchmarks
+// time a cache hit against LoadObj and against mapping and touching the
+// cache file alone, the page fault cost the cache cannot go below.
+// --count sets the quads per side of the grid, --check runs only the
+// checks.
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <GU/GUMeshFile.h>
+
+#include "GUBench.h"
+
+using namespace GU;
+using GUBench::DoNotOptimize;
+
+namespace
+{
+	constexpr size_t DefaultGrid = 500;		// about 36 MB of .obj, 26 MB of cache
+	constexpr size_t PageSize = 4096;
+
+	const char* ObjName = "GUMeshBench.obj";
+	const char* CacheName = "GUMeshBench.gumesh";
+	const char* DamagedName = "GUMeshBenchDamaged.gumesh";
+
+	bool WriteObj(const char* filename, size_t size)
+	{
+		std::string text = "mtllib bench.mtl\nusemtl first\n";
+		char line[256];
+		for(size_t z = 0; z <= size; z++)
+		{
+			for(size_t x = 0; x <= size; x++)
+			{
+				float fx = (float)x * 0.25f, fz = (float)z * 0.25f;
+				snprintf(line, sizeof(line), "v %.6f %.6f %.6f\nvt %.6f %.6f\nvn 0 1 0\n", fx,
+					sinf(fx * 0.3f) * cosf(fz * 0.2f), fz, (float)x / (float)size, (float)z / (float)size);
+				text += line;
+			}
+		}
+		for(size_t z = 0; z < size; z++)
+		{
+			if(z == size / 2)
+				text += "usemtl second\n";
+			for(size_t x = 0; x < size; x++)
+			{
+				size_t a = z * (size + 1) + x + 1, b = a + 1, c = a + size + 1, d = c + 1;
+				snprintf(line, sizeof(line), "f %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu\n",
+					a, a, a, c, c, c, d, d, d, b, b, b);
+				text += line;
+			}
+		}
+
+		FILE* file = fopen(filename, "wb");
+		if(!file)
+			return false;
+		bool written = fwrite(text.data(), 1, text.size(), file) == text.size();
+		return fclose(file) == 0 && written;
+	}
+
+	bool WriteBytes(const char* filename, const void* data, size_t size)
+	{
+		FILE* file = fopen(filename, "wb");
+		if(!file)
+			return false;
+		bool written = fwrite(data, 1, size, file) == size;
+		return fclose(file) == 0 && written;
+	}
+
+	size_t FileSize(const char* filename)
+	{
+		uint64_t size = 0, time;
+		_FileInfo(filename, size, time);
+		return (size_t)size;
+	}
+
+	struct Mesh
+	{
+		std::vector<Vertex> vertices;
+		std::vector<Index> indices, subsets;
+		std::string materialFile;
+		std::vector<std::string> materials;
+	};
+
+	// Byte for byte equality of the mesh file with the output of LoadObj
+	bool Same(const MeshFile &file, const Mesh &mesh)
+	{
+		return file.isOpen() && file.vertexCount() == mesh.vertices.size() && file.indexCount() == mesh.indices.size() &&
+			file.subsetCount() == mesh.subsets.size() && file.materialFile() == mesh.materialFile &&
+			file.materials() == mesh.materials &&
+			memcmp(file.vertices(), mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex)) == 0 &&
+			memcmp(file.indices(), mesh.indices.data(), mesh.indices.size() * sizeof(Index)) == 0 &&
+			memcmp(file.subsets(), mesh.subsets.data(), mesh.subsets.size() * sizeof(Index)) == 0;
+	}
+
+	/*********************************************************/
+	// A cache with these contents is recognizable when LoadObjCached uses it
+	bool SaveMarker(uint64_t sourceSize, uint64_t sourceTime, uint32_t flags)
+	{
+		return SaveMesh(CacheName, std::vector<Vertex>(), std::vector<Index>(), std::vector<Index>(), "marker",
+			std::vector<std::string>(), sourceSize, sourceTime, flags);
+	}
+
+	// Number of cases in which LoadObjCached used a cache it should have
+	// rebuilt or the other way round
+	double CacheError(const Mesh &mesh, const Mesh &smooth)
+	{
+		uint64_t size, time;
+		if(!_FileInfo(ObjName, size, time))
+			return 1.0;
+		uint32_t flags = _MeshFlags(true, false);
+
+		double e = 0.0;
+		MeshFile file;
+		e += SaveMarker(size, time, flags) && LoadObjCached(ObjName, CacheName, file) &&
+			file.materialFile() == "marker" ? 0.0 : 1.0;
+
+		// A different size, time or option set rebuilds the cache
+		e += SaveMarker(size + 1, time, flags) && LoadObjCached(ObjName, CacheName, file) &&
+			Same(file, mesh) && file.isMapped() ? 0.0 : 1.0;
+		e += SaveMarker(size, time + 1, flags) && LoadObjCached(ObjName, CacheName, file) &&
+			Same(file, mesh) && file.isMapped() ? 0.0 : 1.0;
+		e += SaveMarker(size, time, flags) && LoadObjCached(ObjName, CacheName, file, true, true) &&
+			Same(file, smooth) && file.isMapped() ? 0.0 : 1.0;
+
+		// The rebuilt cache is used by the next call
+		MeshFile again;
+		e += LoadObjCached(ObjName, CacheName, again, true, true) && Same(again, smooth) ? 0.0 : 1.0;
+		return e;
+	}
+
+	// Number of damaged copies of a valid file that MeshFile accepts
+	double DamagedError(const Mesh &mesh)
+	{
+		_MeshBytes bytes = _SerializeMesh(mesh.vertices, mesh.indices, mesh.subsets, mesh.materialFile,
+			mesh.materials, 0, 0, 0);
+		_MeshHeader header;
+		memcpy(&header, bytes.Data.data(), sizeof(header));
+
+		std::vector<std::pair<size_t, _MeshHeader> > cases;
+		auto add = [&](size_t size, void (*change)(_MeshHeader&)) {
+			_MeshHeader h = header;
+			change(h);
+			cases.push_back({ size, h });
+		};
+		add(bytes.Size - 1, [](_MeshHeader&) { });
+		add(sizeof(_MeshHeader) - 1, [](_MeshHeader&) { });
+		add(bytes.Size, [](_MeshHeader &h) { h.Magic[0] = 'X'; });
+		add(bytes.Size, [](_MeshHeader &h) { h.Version++; });
+		add(bytes.Size, [](_MeshHeader &h) { h.VertexSize++; });
+		add(bytes.Size, [](_MeshHeader &h) { h.FileSize++; });
+		add(bytes.Size, [](_MeshHeader &h) { h.NameOffset = h.FileSize + 1; });
+		add(bytes.Size, [](_MeshHeader &h) { h.VertexOffset = h.FileSize + _MeshAlignment; });
+		add(bytes.Size, [](_MeshHeader &h) { h.IndexOffset += 8; });
+		add(bytes.Size, [](_MeshHeader &h) { h.Vertices = h.FileSize / sizeof(Vertex) + 1; });
+		add(bytes.Size, [](_MeshHeader &h) { h.Indices = ~(uint64_t)0 / sizeof(Index); });
+		add(bytes.Size, [](_MeshHeader &h) { h.Subsets = h.FileSize; });
+		add(bytes.Size, [](_MeshHeader &h) { h.Materials++; });
+
+		double e = 0.0;
+		std::vector<uint64_t> copy;
+		for(const auto &c : cases)
+		{
+			copy = bytes.Data;
+			memcpy(copy.data(), &c.second, sizeof(_MeshHeader));
+			MeshFile file;
+			if(!WriteBytes(DamagedName, copy.data(), c.first) || file.open(DamagedName))
+				e += 1.0;
+		}
+
+		// The undamaged copy is accepted
+		MeshFile file;
+		if(!WriteBytes(DamagedName, bytes.Data.data(), bytes.Size) || !file.open(DamagedName) || !Same(file, mesh))
+			e += 1.0;
+		file.close();
+		remove(DamagedName);
+		return e;
+	}
+
+	// Sum of one value per page, so every page of the arrays is faulted in
+	float TouchPages(const char* data, size_t size)
+	{
+		float sum = 0.0f;
+		for(size_t i = 0; i + sizeof(float) <= size; i += PageSize)
+		{
+			float v;
+			memcpy(&v, data + i, sizeof(v));
+			sum += v;
+		}
+		return sum;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	GUBench::Options options;
+	if(!GUBench::ParseOptions(argc, argv, options))
+		return 2;
+
+	size_t size = options.count ? options.count : DefaultGrid;
+	if(!WriteObj(ObjName, size < 2 ? 2 : size))
+	{
+		fprintf(stderr, "cannot write %s\n", ObjName);
+		return 2;
+	}
+	remove(CacheName);
+
+	GUBench::Runner runner(options);
+	Mesh mesh, smooth;
+	LoadObj(ObjName, mesh.vertices, mesh.indices, mesh.subsets, mesh.materialFile, mesh.materials);
+	LoadObj(ObjName, smooth.vertices, smooth.indices, smooth.subsets, smooth.materialFile, smooth.materials, true, true);
+
+	MeshFile file;
+	bool saved = SaveMesh(CacheName, mesh.vertices, mesh.indices, mesh.subsets, mesh.materialFile, mesh.materials);
+	runner.check("SaveMesh and MeshFile::open vs LoadObj", saved && file.open(CacheName) && Same(file, mesh) ? 0.0 : 1.0, 0.0);
+	file.close();
+	remove(CacheName);
+
+	runner.check("LoadObjCached without a cache vs LoadObj", LoadObjCached(ObjName, CacheName, file) &&
+		file.isMapped() && Same(file, mesh) ? 0.0 : 1.0, 0.0);
+	file.close();
+	runner.check("LoadObjCached hits and rebuilds", CacheError(mesh, smooth), 0.0);
+	runner.check("MeshFile::open of damaged files", DamagedError(mesh), 0.0);
+
+	// A directory that does not exist cannot take the cache
+	runner.check("LoadObjCached with an unwritable cache", LoadObjCached(ObjName, "GUMeshBench.missing/cache.gumesh", file) &&
+		!file.isMapped() && Same(file, mesh) ? 0.0 : 1.0, 0.0);
+	file.close();
+
+	double cacheBytes = 0.0;
+	if(LoadObjCached(ObjName, CacheName, file))
+		cacheBytes = (double)FileSize(CacheName);
+	file.close();
+	runner.info("obj size", std::to_string(FileSize(ObjName)) + " bytes");
+	runner.info("cache size", std::to_string((long long)cacheBytes) + " bytes");
+
+	if(!options.check)
+	{
+		runner.run("LoadObj", "single", "file", 1.0, cacheBytes, [&](size_t n) {
+			Mesh m;
+			for(size_t k = 0; k < n; k++)
+				LoadObj(ObjName, m.vertices, m.indices, m.subsets, m.materialFile, m.materials);
+			DoNotOptimize(m.indices.size());
+		});
+		runner.run("LoadObjCached hit", "single", "file", 1.0, cacheBytes, [&](size_t n) {
+			for(size_t k = 0; k < n; k++)
+			{
+				MeshFile m;
+				LoadObjCached(ObjName, CacheName, m);
+				DoNotOptimize(TouchPages((const char*)m.vertices(), m.vertexCount() * sizeof(Vertex)) +
+					TouchPages((const char*)m.indices(), m.indexCount() * sizeof(Index)));
+			}
+		}, "LoadObj");
+		runner.run("map and touch cache", "single", "file", 1.0, cacheBytes, [&](size_t n) {
+			for(size_t k = 0; k < n; k++)
+			{
+				_MappedFile m;
+				m.open(CacheName);
+				DoNotOptimize(TouchPages(m.data(), m.size()));
+			}
+		}, "LoadObj");
+
+		// The cache hit against the page fault cost of its file
+		double hit = 0.0, floor = 0.0;
+		for(const GUBench::Result &r : runner.results())
+		{
+			if(r.name == "LoadObjCached hit")
+				hit = r.nsPerOp;
+			else if(r.name == "map and touch cache")
+				floor = r.nsPerOp;
+		}
+		char share[64];
+		snprintf(share, sizeof(share), "%.0f%% of a cache hit", hit > 0.0 ? 100.0 * floor / hit : 0.0);
+		runner.info("mapping and page faults", share);
+	}
+	remove(CacheName);
+	remove(ObjName);
+
+	if(!runner.report())
+		return 2;
+	return runner.passed() ? 0 : 1;
+}
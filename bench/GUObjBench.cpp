@@ -0,0 +1,453 @@
+// Loading speed of LoadObj against the loader it replaced (GUObjBaseline.h)
+// on a generated file: a grid with positions, texture coordinates and
+// normals, split into several material groups. --count sets the quads
+// per side of the grid. The baseline only parses, "ObjParse" measures
+// the same step of LoadObj without building the vertices. The
+// correctness pass compares the loaded mesh and its smooth normals and
+// tangents with the generated and analytic values and other thread
+// counts with one thread, --check runs only that pass.
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <GU/GUWavefrontObj.h>
+
+#include "GUBench.h"
+#include "GUMathReference.h"
+#include "GUObjBaseline.h"
+
+using namespace GU;
+using GUBench::DoNotOptimize;
+
+namespace
+{
+	constexpr size_t DefaultGrid = 500;		// about 52 MB
+	constexpr int Groups = 4;
+	constexpr double Target = 10.0;			// speedup over the baseline the parser was written for
+	constexpr size_t ChunkedSize = 6 << 20;	// several of the 1 MB chunks of the parallel parse
+	constexpr double NormalTolerance = 2e-2;		// discrete against analytic, largest at the border
+
+	// The generated values as LoadObj returns them: z negated and v = 1 - v
+	struct Grid
+	{
+		size_t size;
+		std::vector<Vector3> positions, normals;
+		std::vector<Vector2> texCoords;
+	};
+
+	// Appends the value with six decimals and returns it as written
+	float Append(std::string &text, float value)
+	{
+		char buffer[32];
+		int length = snprintf(buffer, sizeof(buffer), " %.6f", value);
+		text.append(buffer, (size_t)length);
+		return strtof(buffer, nullptr);
+	}
+
+	bool WriteObj(const char* filename, size_t size, Grid &grid)
+	{
+		grid.size = size;
+		std::string text = "# Generated by GUObjBench\nmtllib bench.mtl\n";
+		for(size_t z = 0; z <= size; z++)
+		{
+			for(size_t x = 0; x <= size; x++)
+			{
+				float fx = (float)x * 0.37f - 50.0f, fz = (float)z * 0.37f - 50.0f;
+				float fy = 3.0f * sinf(fx * 0.1f) * cosf(fz * 0.13f);
+				text += "v";
+				float px = Append(text, fx), py = Append(text, fy), pz = Append(text, fz);
+				text += "\nvt";
+				float u = Append(text, (float)x / (float)size), v = Append(text, (float)z / (float)size);
+				Vector3 n = Vector3(-0.3f * cosf(fx * 0.1f) * cosf(fz * 0.13f), 1.0f,
+					0.39f * sinf(fx * 0.1f) * sinf(fz * 0.13f)).normalize();
+				text += "\nvn";
+				float nx = Append(text, n._x), ny = Append(text, n._y), nz = Append(text, n._z);
+				text += "\n";
+
+				grid.positions.push_back(Vector3(px, py, -pz));
+				grid.texCoords.push_back(Vector2(u, 1.0f - v));
+				grid.normals.push_back(Vector3(nx, ny, -nz));
+			}
+		}
+
+		// Two triangles per quad, the rows are split into the material groups
+		char line[256];
+		for(size_t z = 0; z < size; z++)
+		{
+			if(z == 0 || z * Groups / size != (z - 1) * Groups / size)
+			{
+				snprintf(line, sizeof(line), "usemtl material%d\ns off\n", (int)(z * Groups / size));
+				text += line;
+			}
+			for(size_t x = 0; x < size; x++)
+			{
+				size_t a = z * (size + 1) + x + 1, b = a + 1, c = a + size + 1, d = c + 1;
+				snprintf(line, sizeof(line), "f %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu\nf %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu\n",
+					a, a, a, c, c, c, b, b, b, b, b, b, c, c, c, d, d, d);
+				text += line;
+			}
+		}
+
+		FILE* file = fopen(filename, "wb");
+		if(!file)
+			return false;
+		bool written = fwrite(text.data(), 1, text.size(), file) == text.size();
+		return fclose(file) == 0 && written;
+	}
+
+	/*********************************************************/
+	// Largest error of the loaded vertices, every triangle is compared
+	// with its quad in either winding. 1 if the structure differs.
+	double MeshError(const Grid &grid, const std::vector<Vertex> &vertices, const std::vector<Index> &indices,
+		const std::vector<Index> &subsets, const std::vector<std::string> &materials)
+	{
+		size_t size = grid.size;
+		if(indices.size() != 6 * size * size || subsets.size() != Groups + 1 || materials.size() != Groups ||
+			subsets[Groups] != indices.size() || materials[0] != "material0")
+			return 1.0;
+
+		auto vertexError = [&](Index index, size_t expected) {
+			if(index >= vertices.size())
+				return 1.0;
+			const Vertex &v = vertices[index];
+			double e = 0.0;
+			for(int i = 0; i < 3; i++)
+			{
+				e = fmax(e, GURef::Error(v.pos[i], (double)grid.positions[expected][i]));
+				e = fmax(e, GURef::Error(v.normal[i], (double)grid.normals[expected][i]));
+			}
+			for(int i = 0; i < 2; i++)
+				e = fmax(e, GURef::Error(v.texCoord[i], (double)grid.texCoords[expected][i]));
+			return e;
+		};
+
+		double e = 0.0;
+		for(size_t t = 0; t < indices.size() / 3; t++)
+		{
+			size_t quad = t / 2, x = quad % size, z = quad / size;
+			size_t a = z * (size + 1) + x, b = a + 1, c = a + size + 1, d = c + 1;
+			size_t corners[3] = { a, c, b };
+			if(t % 2)
+			{
+				corners[0] = b;
+				corners[2] = d;
+			}
+			const Index* tri = &indices[3 * t];
+			double same = fmax(vertexError(tri[0], corners[0]), fmax(vertexError(tri[1], corners[1]), vertexError(tri[2], corners[2])));
+			double flipped = fmax(vertexError(tri[0], corners[0]), fmax(vertexError(tri[1], corners[2]), vertexError(tri[2], corners[1])));
+			e = fmax(e, fmin(same, flipped));
+		}
+		return e;
+	}
+
+	// Triangles with a position index out of range or before the start of
+	// the file are dropped, with them the group that only had such faces.
+	// 1 if anything else than the one valid triangle is loaded.
+	double InvalidIndexError(const char* filename)
+	{
+		FILE* file = fopen(filename, "wb");
+		if(!file)
+			return 1.0;
+		fputs("v 0 0 0\nv 1 0 0\nv 0 1 0\nv 1 1 0\n"
+			"usemtl invalid\nf 1 2 9\nf -1 -2 -5\nf 0 1 2\n"
+			"usemtl valid\nf 1 2 3\nf 1 9 3 8\n", file);
+		fclose(file);
+
+		std::vector<Vertex> vertices;
+		std::vector<Index> indices, subsets;
+		std::string materialFile;
+		std::vector<std::string> materials;
+		bool loaded = LoadObj(filename, vertices, indices, subsets, materialFile, materials, false, true);
+		remove(filename);
+		if(!loaded || vertices.size() != 3 || indices.size() != 3 || subsets.size() != 2 || subsets[1] != 3 ||
+			materials.size() != 1 || materials[0] != "valid")
+			return 1.0;
+
+		double e = 0.0;
+		for(int i = 0; i < 3; i++)
+		{
+			Vector3 expected((float)(i == 1), (float)(i == 2), 0.0f);
+			for(int j = 0; j < 3; j++)
+			{
+				e = fmax(e, fabs(vertices[indices[i]].pos[j] - expected[j]));
+				e = fmax(e, fabs(vertices[indices[i]].normal[j] - (j == 2 ? 1.0f : 0.0f)));
+			}
+		}
+		return e;
+	}
+
+	// Largest error of the smooth normals and tangents of a grid loaded
+	// with calculateNormals against the analytic ones of the height field.
+	// The tangents are compared with dPos/du made orthogonal to the
+	// normal, u grows with x.
+	void FrameError(const Grid &grid, const std::vector<Vertex> &vertices, double &normalError,
+		double &tangentError, double &unitError)
+	{
+		normalError = tangentError = unitError = vertices.size() == grid.positions.size() ? 0.0 : 1.0;
+		for(const Vertex &v : vertices)
+		{
+			long x = lroundf((v.pos._x + 50.0f) / 0.37f), z = lroundf((-v.pos._z + 50.0f) / 0.37f);
+			if(x < 0 || z < 0 || x > (long)grid.size || z > (long)grid.size)
+			{
+				normalError = tangentError = unitError = 1.0;
+				return;
+			}
+			Vector3 n = grid.normals[(size_t)z * (grid.size + 1) + (size_t)x];
+			float fx = v.pos._x, fz = -v.pos._z;
+			Vector3 du(1.0f, 0.3f * cosf(fx * 0.1f) * cosf(fz * 0.13f), 0.0f);
+			Vector3 t = (du - n * du.dot(n)).normalize();
+
+			for(int i = 0; i < 3; i++)
+			{
+				normalError = fmax(normalError, fabs(v.normal[i] - n[i]));
+				tangentError = fmax(tangentError, fabs(v.tangent[i] - t[i]));
+			}
+
+			// Unit length and orthogonal to each other
+			Vector3 c = v.normal.cross(v.tangent);
+			unitError = fmax(unitError, fabs(v.normal.length() - 1.0f));
+			unitError = fmax(unitError, fabs(v.tangent.length() - 1.0f));
+			unitError = fmax(unitError, fabs(v.normal.dot(v.tangent)));
+			for(int i = 0; i < 3; i++)
+				unitError = fmax(unitError, fmin(fabs(v.bitangent[i] - c[i]), fabs(v.bitangent[i] + c[i])));
+		}
+	}
+
+	/*********************************************************/
+	// A file the chunks of the parallel parse cannot split cleanly: CRLF
+	// lines, vertices between the faces, faces with absolute and relative
+	// indices reaching back across chunk bounds, polygons, material
+	// switches and groups that span the bounds, and faces before the
+	// first usemtl
+	bool WriteChunkedObj(const char* filename, size_t bytes)
+	{
+		std::mt19937 random(17);
+		std::string text = "# Generated by GUObjBench\r\nmtllib chunked.mtl\r\n";
+		char line[256];
+		size_t vertices = 0;
+		for(int block = 0; text.size() < bytes; block++)
+		{
+			for(int i = 0; i < 64; i++, vertices++)
+			{
+				float x = (float)(random() % 20000) * 0.01f, y = (float)(random() % 20000) * 0.01f;
+				snprintf(line, sizeof(line), "v %.4f %.4f %.4f\r\nvt %.4f %.4f\r\n\tvn %.4f 1 0\r\n",
+					x, y, x - y, x * 0.005f, y * 0.005f, x * 0.01f);
+				text += line;
+			}
+			if(block > 0 && block % 3 == 0)
+			{
+				snprintf(line, sizeof(line), "usemtl material%d\r\ng group%d\r\ns %d\r\n", block % 7, block, block % 2);
+				text += line;
+			}
+
+			for(int f = 0; f < 100; f++)
+			{
+				text += "f";
+				int corners = 3 + (int)(random() % 3);
+				for(int k = 0; k < corners; k++)
+				{
+					// Up to 4096 vertices back, which crosses several KB of the file
+					size_t back = 1 + random() % (vertices < 4096 ? vertices : 4096);
+					size_t index = vertices - back + 1;
+					switch(random() % 4)
+					{
+						case 0: snprintf(line, sizeof(line), " %zu/%zu/%zu", index, index, index); break;
+						case 1: snprintf(line, sizeof(line), " -%zu/-%zu/-%zu", back, back, back); break;
+						case 2: snprintf(line, sizeof(line), " %zu//-%zu", index, back); break;
+						default: snprintf(line, sizeof(line), " -%zu/%zu", back, index); break;
+					}
+					text += line;
+				}
+				text += "\r\n";
+			}
+		}
+
+		FILE* file = fopen(filename, "wb");
+		if(!file)
+			return false;
+		bool written = fwrite(text.data(), 1, text.size(), file) == text.size();
+		return fclose(file) == 0 && written;
+	}
+
+	template<typename T>
+	bool SameBytes(const std::vector<T> &a, const std::vector<T> &b)
+	{
+		return a.size() == b.size() && (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+	}
+
+	// Number of thread counts whose result differs from the one of a
+	// single thread in any byte
+	double ThreadsError(const char* filename)
+	{
+		if(!WriteChunkedObj(filename, ChunkedSize))
+			return 1.0;
+
+		double e = 0.0;
+		for(bool calculateNormals : { false, true })
+		{
+			std::vector<Vertex> vertices[2];
+			std::vector<Index> indices[2], subsets[2];
+			std::string materialFiles[2];
+			std::vector<std::string> materials[2];
+			e += LoadObj(filename, vertices[0], indices[0], subsets[0], materialFiles[0], materials[0],
+				true, calculateNormals, 1) && !subsets[0].empty() ? 0.0 : 1.0;
+
+			// 0 is all hardware threads, the others force chunks on any machine
+			for(unsigned threads : { 0u, 2u, 3u, 5u, 8u })
+			{
+				bool loaded = LoadObj(filename, vertices[1], indices[1], subsets[1], materialFiles[1], materials[1],
+					true, calculateNormals, threads);
+				if(!loaded || !SameBytes(vertices[0], vertices[1]) || !SameBytes(indices[0], indices[1]) ||
+					!SameBytes(subsets[0], subsets[1]) || materials[0] != materials[1] || materialFiles[0] != materialFiles[1])
+					e += 1.0;
+			}
+		}
+		remove(filename);
+		return e;
+	}
+
+	// The same for CalculateNormals and CalculateTangents on a mesh with
+	// more than GU_BATCH_GRAIN vertices and triangles, built in memory
+	double FramesThreadsError()
+	{
+		const size_t size = 200;
+		std::vector<Vertex> mesh;
+		std::vector<Index> indices;
+		for(size_t z = 0; z <= size; z++)
+		{
+			for(size_t x = 0; x <= size; x++)
+			{
+				Vertex v = {};
+				float fx = (float)x * 0.37f, fz = (float)z * 0.37f;
+				v.pos = Vector3(fx, 3.0f * sinf(fx * 0.1f) * cosf(fz * 0.13f), fz);
+				v.texCoord = Vector2((float)x / (float)size, (float)z / (float)size);
+				mesh.push_back(v);
+			}
+		}
+		for(size_t z = 0; z < size; z++)
+		{
+			for(size_t x = 0; x < size; x++)
+			{
+				Index a = (Index)(z * (size + 1) + x), b = a + 1, c = a + (Index)size + 1, d = c + 1;
+				indices.insert(indices.end(), { a, c, b, b, c, d });
+			}
+		}
+
+		auto frames = [&](unsigned threads) {
+			std::vector<Vertex> vertices = mesh;
+			CalculateNormals(vertices, indices, NormalWeight::Angle, threads);
+			CalculateTangents(vertices, indices, NormalWeight::Area, threads);
+			return vertices;
+		};
+		std::vector<Vertex> single = frames(1);
+		double e = 0.0;
+		for(unsigned threads : { 0u, 2u, 3u, 5u, 8u })
+			e += SameBytes(single, frames(threads)) ? 0.0 : 1.0;
+		return e;
+	}
+
+	std::string Format(double value)
+	{
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), "%.2f", value);
+		return buffer;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	GUBench::Options options;
+	if(!GUBench::ParseOptions(argc, argv, options))
+		return 2;
+
+	const char* filename = "GUObjBench.obj";
+	Grid grid;
+	size_t size = options.count ? options.count : DefaultGrid;
+	if(!WriteObj(filename, size < Groups ? Groups : size, grid))
+	{
+		fprintf(stderr, "cannot write %s\n", filename);
+		return 2;
+	}
+	FILE* file = fopen(filename, "rb");
+	fseek(file, 0, SEEK_END);
+	double bytes = (double)ftell(file);
+	fclose(file);
+
+	GUBench::Runner runner(options);
+	runner.info("file size", std::to_string((long long)bytes) + " bytes");
+
+	std::vector<Vertex> vertices;
+	std::vector<Index> indices, subsets;
+	std::string materialFile;
+	std::vector<std::string> materials;
+	bool loaded = LoadObj(filename, vertices, indices, subsets, materialFile, materials);
+	runner.check("LoadObj", loaded && materialFile == "bench.mtl" ?
+		MeshError(grid, vertices, indices, subsets, materials) : 1.0, 1e-6);
+	runner.check("LoadObj invalid position indices", InvalidIndexError("GUObjBenchInvalid.obj"), 1e-6);
+	runner.check("LoadObj chunked, threads 0, 2, 3, 5, 8 vs 1", ThreadsError("GUObjBenchChunked.obj"), 0.0);
+	runner.check("CalculateTangents, threads 0, 2, 3, 5, 8 vs 1", FramesThreadsError(), 0.0);
+
+	// Smooth frames of the grid against the analytic ones
+	std::vector<Vertex> smooth;
+	double normalError = 1.0, tangentError = 1.0, unitError = 1.0;
+	if(LoadObj(filename, smooth, indices, subsets, materialFile, materials, true, true))
+		FrameError(grid, smooth, normalError, tangentError, unitError);
+	runner.check("LoadObj calculateNormals vs analytic normals", normalError, NormalTolerance);
+	runner.check("LoadObj calculateNormals vs analytic tangents", tangentError, NormalTolerance);
+	runner.check("LoadObj calculateNormals unit orthogonal frames", unitError, 1e-5);
+
+	unsigned hardwareThreads = std::thread::hardware_concurrency();
+	if(!options.check)
+	{
+		runner.run("LoadObj baseline", "single", "file", 1.0, bytes, [&](size_t n) {
+			for(size_t k = 0; k < n; k++)
+				GUBaseline::LoadObj(filename, vertices, indices, subsets, materialFile, materials);
+		});
+		runner.run("ObjParse", "single", "file", 1.0, bytes, [&](size_t n) {
+			for(size_t k = 0; k < n; k++)
+			{
+				_MappedFile file;
+				_ObjData obj;
+				if(file.open(filename))
+					_ParseObjParallel(file.data(), file.size(), true, 1, obj);
+				DoNotOptimize(obj.Fac.size());
+			}
+		}, "LoadObj baseline");
+		runner.run("LoadObj", "single", "file", 1.0, bytes, [&](size_t n) {
+			for(size_t k = 0; k < n; k++)
+				LoadObj(filename, vertices, indices, subsets, materialFile, materials);
+		}, "LoadObj baseline");
+		if(hardwareThreads > 1)
+		{
+			runner.run("LoadObj all threads", "single", "file", 1.0, bytes, [&](size_t n) {
+				for(size_t k = 0; k < n; k++)
+					LoadObj(filename, vertices, indices, subsets, materialFile, materials, true, false, 0);
+			}, "LoadObj baseline");
+		}
+		runner.run("LoadObj calculateNormals", "single", "file", 1.0, bytes, [&](size_t n) {
+			for(size_t k = 0; k < n; k++)
+				LoadObj(filename, vertices, indices, subsets, materialFile, materials, true, true);
+		}, "LoadObj baseline");
+
+		// The target is for one thread, the baseline has no other mode
+		for(const GUBench::Result &r : runner.results())
+		{
+			if(r.name == "LoadObj")
+			{
+				runner.info("target", Format(Target) + "x on one thread, " + (r.speedup >= Target ? "met with " :
+					"missed by " + Format(Target / r.speedup) + "x, reached ") + Format(r.speedup) + "x");
+			}
+		}
+	}
+	runner.info("threads", std::to_string(hardwareThreads));
+	remove(filename);
+
+	if(!runner.report())
+		return 2;
+	return runner.passed() ? 0 : 1;
+}
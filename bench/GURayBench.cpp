@@ -0,0 +1,269 @@
+// Ray queries of MeshBVH on a generated level: a height field terrain
+// with scattered boxes on it. Every query is measured one ray at a time
+// and through the batch functions in both modes, for camera rays
+// (coherent) and rays with random origins and directions (incoherent).
+// The correctness pass compares the batch results with the single ray
+// ones and those with a brute force search, --check runs only that pass.
+
+#include <math.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <GU/GUCollision.h>
+
+#include "GUBench.h"
+#include "GUMathReference.h"
+
+using namespace GU;
+using GUBench::DoNotOptimize;
+
+namespace
+{
+	constexpr int GridSize = 256;			// quads per side of the terrain
+	constexpr int Boxes = 2000;
+	constexpr float Extent = 100.0f;		// the terrain covers [-Extent, Extent] in x and z
+	constexpr size_t DefaultRays = 1 << 16;
+	constexpr size_t BruteForceRays = 256;
+
+	struct Scene
+	{
+		std::vector<Vertex> vertices;
+		std::vector<Index> indices;
+		MeshBVH bvh;
+	};
+
+	float Height(float x, float z)
+	{
+		return 4.0f * sinf(x * 0.11f) * cosf(z * 0.07f) + 1.5f * sinf(x * 0.5f + z * 0.3f);
+	}
+
+	void AddVertex(Scene &scene, const Vector3 &p)
+	{
+		Vertex v = {};
+		v.pos = p;
+		scene.vertices.push_back(v);
+	}
+
+	void BuildScene(Scene &scene)
+	{
+		const float step = 2.0f * Extent / GridSize;
+		for(int z = 0; z <= GridSize; z++)
+		{
+			for(int x = 0; x <= GridSize; x++)
+			{
+				float px = -Extent + x * step, pz = -Extent + z * step;
+				AddVertex(scene, Vector3(px, Height(px, pz), pz));
+			}
+		}
+		for(int z = 0; z < GridSize; z++)
+		{
+			for(int x = 0; x < GridSize; x++)
+			{
+				Index i = (Index)(z * (GridSize + 1) + x);
+				Index quad[6] = { i, i + GridSize + 1, i + 1, i + 1, i + GridSize + 1, i + GridSize + 2 };
+				scene.indices.insert(scene.indices.end(), quad, quad + 6);
+			}
+		}
+
+		// Boxes standing on the terrain, 12 triangles each
+		static const int faces[36] = {
+			0, 2, 1, 1, 2, 3,  4, 5, 6, 5, 7, 6,  0, 1, 4, 1, 5, 4,
+			2, 6, 3, 3, 6, 7,  0, 4, 2, 2, 4, 6,  1, 3, 5, 3, 7, 5 };
+		GURef::Random random(11);
+		for(int b = 0; b < Boxes; b++)
+		{
+			float cx = random.uniform(-Extent, Extent), cz = random.uniform(-Extent, Extent);
+			Vector3 size(random.uniform(0.5f, 3.0f), random.uniform(1.0f, 8.0f), random.uniform(0.5f, 3.0f));
+			Vector3 base(cx, Height(cx, cz) - 1.0f, cz);
+			Index first = (Index)scene.vertices.size();
+			for(int c = 0; c < 8; c++)
+				AddVertex(scene, base + Vector3(c & 1 ? size._x : -size._x, c & 2 ? size._y : 0.0f, c & 4 ? size._z : -size._z));
+			for(int f : faces)
+				scene.indices.push_back(first + (Index)f);
+		}
+
+		scene.bvh.build(scene.vertices, scene.indices);
+	}
+
+	// Pinhole camera above the terrain looking across it, in scanline
+	// order so that neighbouring rays form the packets
+	std::vector<Ray> CameraRays(size_t count)
+	{
+		size_t width = (size_t)sqrt((double)count);
+		size_t height = (count + width - 1) / width;
+		Vector3 eye(-Extent * 0.8f, 25.0f, -Extent * 0.8f);
+		Vector3 forward = (Vector3(0.0f, 0.0f, 0.0f) - eye).normalize();
+		Vector3 right = forward.cross(Vector3(0.0f, 1.0f, 0.0f)).normalize();
+		Vector3 up = right.cross(forward);
+
+		std::vector<Ray> rays(count);
+		for(size_t i = 0; i < count; i++)
+		{
+			float u = ((float)(i % width) + 0.5f) / (float)width * 2.0f - 1.0f;
+			float v = ((float)(i / width) + 0.5f) / (float)height * 2.0f - 1.0f;
+			rays[i] = Ray(eye, (forward + right * (u * 0.8f) + up * (v * 0.8f)).normalize());
+		}
+		return rays;
+	}
+
+	// Origins anywhere in the level, directions uniform on the sphere
+	std::vector<Ray> RandomRays(size_t count)
+	{
+		GURef::Random random(13);
+		std::vector<Ray> rays(count);
+		for(Ray &ray : rays)
+		{
+			Vector3 d;
+			do
+				d = random.vector3();
+			while(d.length2() < 0.01f || d.length2() > 1.0f);
+			ray = Ray(Vector3(random.uniform(-Extent, Extent), random.uniform(-5.0f, 20.0f),
+				random.uniform(-Extent, Extent)), d.normalize());
+		}
+		return rays;
+	}
+
+	/*********************************************************/
+	// Difference of t, a hit against a miss counts as 1. Triangles
+	// sharing the hit point may differ.
+	double HitError(const RayHit &a, const RayHit &b)
+	{
+		if(a._triangle == MeshBVH::None || b._triangle == MeshBVH::None)
+			return a._triangle == b._triangle ? 0.0 : 1.0;
+		return GURef::Error(a._t, (double)b._t);
+	}
+
+	void RunChecks(GUBench::Runner &runner, const Scene &scene, const char* form, const std::vector<Ray> &rays)
+	{
+		std::string suffix = std::string(" (") + form + ")";
+		size_t count = rays.size();
+		std::vector<RayHit> single(count), batch(count);
+		for(size_t i = 0; i < count; i++)
+			scene.bvh.intersect(rays[i], single[i]);
+
+		// Brute force over every triangle for a few rays
+		double e = 0.0;
+		for(size_t r = 0; r < BruteForceRays; r++)
+		{
+			size_t i = r * (count / BruteForceRays);
+			RayHit best = { 1e30f, 0.0f, 0.0f, MeshBVH::None };
+			for(size_t f = 0; f < scene.indices.size() / 3; f++)
+			{
+				const Vector3 &v0 = scene.vertices[scene.indices[3 * f]].pos;
+				Vector3 e1 = scene.vertices[scene.indices[3 * f + 1]].pos - v0;
+				Vector3 e2 = scene.vertices[scene.indices[3 * f + 2]].pos - v0;
+				float t, u, v;
+				if(_RayTriangle(rays[i]._origin, rays[i]._direction, v0, e1, e2, best._t, t, u, v))
+					best = { t, u, v, (uint32_t)f };
+			}
+			e = fmax(e, HitError(single[i], best));
+		}
+		runner.check("intersect single vs brute force" + suffix, e, 1e-5);
+
+		RayMode modes[2] = { RayMode::Coherent, RayMode::Incoherent };
+		const char* names[2] = { "intersect packet vs single", "intersect stream vs single" };
+		for(int m = 0; m < 2; m++)
+		{
+			scene.bvh.intersect(rays.data(), count, batch.data(), nullptr, modes[m]);
+			e = 0.0;
+			for(size_t i = 0; i < count; i++)
+				e = fmax(e, HitError(batch[i], single[i]));
+			runner.check(names[m] + suffix, e, 1e-5);
+		}
+
+		// Occlusion up to the closest hit of a slightly longer ray
+		std::vector<float> tMax(count);
+		for(size_t i = 0; i < count; i++)
+			tMax[i] = single[i]._triangle == MeshBVH::None ? 1e30f : single[i]._t * (i % 2 ? 1.01f : 0.99f);
+		std::unique_ptr<bool[]> occluded(new bool[count]);
+		scene.bvh.occluded(rays.data(), count, occluded.get(), tMax.data(), RayMode::Coherent);
+		size_t wrong = 0;
+		for(size_t i = 0; i < count; i++)
+			wrong += occluded[i] != scene.bvh.occluded(rays[i], tMax[i]) ? 1 : 0;
+		runner.check("occluded packet vs single" + suffix, (double)wrong / (double)count, 0.0);
+	}
+
+	/*********************************************************/
+	void RunBenchmarks(GUBench::Runner &runner, const Scene &scene, const char* form, const std::vector<Ray> &rays)
+	{
+		size_t count = rays.size();
+		double n = (double)count;
+		std::vector<RayHit> hits(count);
+		std::unique_ptr<bool[]> occluded(new bool[count]);
+
+		runner.run("intersect single", form, "ray", n, 0.0, [&](size_t iterations) {
+			for(size_t k = 0; k < iterations; k++)
+			{
+				for(size_t i = 0; i < count; i++)
+					scene.bvh.intersect(rays[i], hits[i]);
+				DoNotOptimize(hits[0]);
+			}
+		});
+		runner.run("intersect packet", form, "ray", n, 0.0, [&](size_t iterations) {
+			for(size_t k = 0; k < iterations; k++)
+			{
+				scene.bvh.intersect(rays.data(), count, hits.data(), nullptr, RayMode::Coherent);
+				DoNotOptimize(hits[0]);
+			}
+		}, "intersect single");
+		runner.run("intersect stream", form, "ray", n, 0.0, [&](size_t iterations) {
+			for(size_t k = 0; k < iterations; k++)
+			{
+				scene.bvh.intersect(rays.data(), count, hits.data(), nullptr, RayMode::Incoherent);
+				DoNotOptimize(hits[0]);
+			}
+		}, "intersect single");
+
+		runner.run("occluded single", form, "ray", n, 0.0, [&](size_t iterations) {
+			for(size_t k = 0; k < iterations; k++)
+			{
+				for(size_t i = 0; i < count; i++)
+					occluded[i] = scene.bvh.occluded(rays[i]);
+				DoNotOptimize(occluded[0]);
+			}
+		});
+		runner.run("occluded packet", form, "ray", n, 0.0, [&](size_t iterations) {
+			for(size_t k = 0; k < iterations; k++)
+			{
+				scene.bvh.occluded(rays.data(), count, occluded.get(), nullptr, RayMode::Coherent);
+				DoNotOptimize(occluded[0]);
+			}
+		}, "occluded single");
+		runner.run("occluded stream", form, "ray", n, 0.0, [&](size_t iterations) {
+			for(size_t k = 0; k < iterations; k++)
+			{
+				scene.bvh.occluded(rays.data(), count, occluded.get(), nullptr, RayMode::Incoherent);
+				DoNotOptimize(occluded[0]);
+			}
+		}, "occluded single");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	GUBench::Options options;
+	if(!GUBench::ParseOptions(argc, argv, options))
+		return 2;
+
+	Scene scene;
+	BuildScene(scene);
+	size_t count = options.count ? options.count : DefaultRays;
+	count = count < BruteForceRays ? BruteForceRays : count;
+	std::vector<Ray> camera = CameraRays(count), random = RandomRays(count);
+
+	GUBench::Runner runner(options);
+	runner.info("lanes", std::to_string(GU_LANES));
+	runner.info("triangles", std::to_string(scene.indices.size() / 3));
+	runner.info("rays", std::to_string(count));
+	RunChecks(runner, scene, "coherent", camera);
+	RunChecks(runner, scene, "incoherent", random);
+	if(!options.check)
+	{
+		RunBenchmarks(runner, scene, "coherent", camera);
+		RunBenchmarks(runner, scene, "incoherent", random);
+	}
+	if(!runner.report())
+		return 2;
+	return runner.passed() ? 0 : 1;
+}
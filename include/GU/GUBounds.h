@@ -0,0 +1,286 @@
+#ifndef _GUBOUNDS_H_
+#define _GUBOUNDS_H_
+
+#include <stdint.h>
+
+#include "GUMath.h"
+#include "GUParallel.h"
+#include "GUStream.h"
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+namespace GU
+{
+	/*********************************************************/
+	// Points p with dot(normal, p) + d = 0, the normal points to the inside
+	class Plane
+	{
+		public:
+			Plane() : _d(0.0f) { }
+			Plane(const Vector3 &normal, float d) : _normal(normal), _d(d) { }
+			Plane(float a, float b, float c, float d) : _normal(a, b, c), _d(d) { }
+
+			float distance(const Vector3 &p) const { return _normal.dot(p) + _d; }
+			Plane normalize() const;
+
+		public:
+			Vector3 _normal;
+			float _d;
+	};
+
+	inline Plane Plane::normalize() const
+	{
+		float l = _normal.length();
+		return l > 0.0f ? Plane(_normal / l, _d / l) : *this;
+	}
+
+	/*********************************************************/
+	class Sphere
+	{
+		public:
+			Sphere() : _radius(0.0f) { }
+			Sphere(const Vector3 &center, float radius) : _center(center), _radius(radius) { }
+
+			bool contains(const Vector3 &p) const { return (p - _center).length2() <= _radius * _radius; }
+
+		public:
+			Vector3 _center;
+			float _radius;
+	};
+
+	/*********************************************************/
+	// The default box is empty, grow() on it yields the box of the argument
+	class AABB
+	{
+		public:
+			AABB() : _min(1e30f, 1e30f, 1e30f), _max(-1e30f, -1e30f, -1e30f) { }
+			AABB(const Vector3 &min, const Vector3 &max) : _min(min), _max(max) { }
+
+			Vector3 center() const { return (_min + _max) * 0.5f; }
+			Vector3 extents() const { return (_max - _min) * 0.5f; }
+			float area() const;
+			bool empty() const { return _min._x > _max._x || _min._y > _max._y || _min._z > _max._z; }
+
+			void grow(const Vector3 &p);
+			void grow(const AABB &b);
+
+			bool contains(const Vector3 &p) const;
+			bool overlaps(const AABB &b) const;
+
+		public:
+			Vector3 _min;
+			Vector3 _max;
+	};
+
+	inline float AABB::area() const
+	{
+		Vector3 e = _max - _min;
+		return 2.0f * (e._x * e._y + e._y * e._z + e._z * e._x);
+	}
+
+	inline void AABB::grow(const Vector3 &p)
+	{
+		_min = Vector3(min(_min._x, p._x), min(_min._y, p._y), min(_min._z, p._z));
+		_max = Vector3(max(_max._x, p._x), max(_max._y, p._y), max(_max._z, p._z));
+	}
+
+	inline void AABB::grow(const AABB &b)
+	{
+		_min = Vector3(min(_min._x, b._min._x), min(_min._y, b._min._y), min(_min._z, b._min._z));
+		_max = Vector3(max(_max._x, b._max._x), max(_max._y, b._max._y), max(_max._z, b._max._z));
+	}
+
+	inline bool AABB::contains(const Vector3 &p) const
+	{
+		return p._x >= _min._x && p._x <= _max._x &&
+			p._y >= _min._y && p._y <= _max._y &&
+			p._z >= _min._z && p._z <= _max._z;
+	}
+
+	inline bool AABB::overlaps(const AABB &b) const
+	{
+		return _min._x <= b._max._x && _max._x >= b._min._x &&
+			_min._y <= b._max._y && _max._y >= b._min._y &&
+			_min._z <= b._max._z && _max._z >= b._min._z;
+	}
+
+	/*********************************************************/
+	// Six normalized planes (left, right, bottom, top, near, far) pointing
+	// inside. Objects outside of one plane are culled, objects near the
+	// corners may be kept although they are outside.
+	class Frustum
+	{
+		public:
+			Frustum() { }
+			// Extracts the planes of a view projection matrix. With
+			// zeroToOneDepth the clip space z range is [0, w] instead of [-w, w].
+			explicit Frustum(const Matrix4x4 &viewProj, bool zeroToOneDepth = false);
+
+			bool intersects(const Vector3 &p) const;
+			bool intersects(const Sphere &s) const;
+			bool intersects(const AABB &b) const;
+
+		public:
+			Plane _planes[6];
+	};
+
+	inline Frustum::Frustum(const Matrix4x4 &m, bool zeroToOneDepth)
+	{
+		Vector4 r1(m._m11, m._m12, m._m13, m._m14);
+		Vector4 r2(m._m21, m._m22, m._m23, m._m24);
+		Vector4 r3(m._m31, m._m32, m._m33, m._m34);
+		Vector4 r4(m._m41, m._m42, m._m43, m._m44);
+
+		Vector4 p[6] = { r4 + r1, r4 - r1, r4 + r2, r4 - r2, zeroToOneDepth ? r3 : r4 + r3, r4 - r3 };
+		for(int i = 0; i < 6; i++)
+			_planes[i] = Plane(p[i]._x, p[i]._y, p[i]._z, p[i]._w).normalize();
+	}
+
+	inline bool Frustum::intersects(const Vector3 &p) const
+	{
+		for(int i = 0; i < 6; i++)
+			if(_planes[i].distance(p) < 0.0f)
+				return false;
+		return true;
+	}
+
+	inline bool Frustum::intersects(const Sphere &s) const
+	{
+		for(int i = 0; i < 6; i++)
+			if(_planes[i].distance(s._center) < -s._radius)
+				return false;
+		return true;
+	}
+
+	inline bool Frustum::intersects(const AABB &b) const
+	{
+		// Test the corner farthest along the plane normal
+		Vector3 c = b.center(), e = b.extents();
+		for(int i = 0; i < 6; i++)
+		{
+			const Vector3 &n = _planes[i]._normal;
+			float r = fabsf(n._x) * e._x + fabsf(n._y) * e._y + fabsf(n._z) * e._z;
+			if(_planes[i].distance(c) < -r)
+				return false;
+		}
+		return true;
+	}
+
+	/*********************************************************/
+	// Batch culling of structure of arrays data. The result is a bitmask
+	// with one bit per object, bit i % 32 of visible[i / 32] is set if the
+	// object i intersects the frustum. visible needs (count + 31) / 32
+	// words. Lists larger than GU_BATCH_GRAIN objects are split across
+	// the requested number of threads (0 = all hardware threads).
+	template<typename TestN, typename Test>
+	inline void _CullBatch(size_t count, uint32_t* visible, unsigned threads, TestN testN, Test test)
+	{
+		size_t words = (count + 31) / 32;
+		ParallelFor(words, GU_BATCH_GRAIN / 32, [&](size_t begin, size_t end) {
+			for(size_t w = begin; w < end; w++)
+			{
+				size_t i = w * 32, last = i + 32 < count ? i + 32 : count;
+				uint32_t bits = 0;
+				for(; i + GU_LANES <= last; i += GU_LANES)
+					bits |= (uint32_t)testN(i) << (i & 31);
+				for(; i < last; i++)
+					bits |= (test(i) ? 1u : 0u) << (i & 31);
+				visible[w] = bits;
+			}
+		}, threads);
+	}
+
+	inline void CullSpheres(const Frustum &f, const Vector3Stream &centers, const float* radii,
+		uint32_t* visible, unsigned threads = 1)
+	{
+		FloatN nx[6], ny[6], nz[6], d[6];
+		for(int p = 0; p < 6; p++)
+		{
+			nx[p] = _SetN(f._planes[p]._normal._x);
+			ny[p] = _SetN(f._planes[p]._normal._y);
+			nz[p] = _SetN(f._planes[p]._normal._z);
+			d[p] = _SetN(f._planes[p]._d);
+		}
+
+		const float *x = centers.x(), *y = centers.y(), *z = centers.z();
+		_CullBatch(centers.size(), visible, threads, [&](size_t i) {
+			FloatN cx = _LoadN(x + i), cy = _LoadN(y + i), cz = _LoadN(z + i);
+			FloatN r = _LoadUN(radii + i);
+			// Smallest signed distance of the sphere surface, negative = outside
+			FloatN m = _SetN(1e30f);
+			for(int p = 0; p < 6; p++)
+			{
+				FloatN dist = _AddN(_AddN(_MulN(nx[p], cx), _MulN(ny[p], cy)), _AddN(_MulN(nz[p], cz), d[p]));
+				m = _MinN(m, _AddN(dist, r));
+			}
+			return ~_SignMaskN(m) & ((1 << GU_LANES) - 1);
+		}, [&](size_t i) {
+			return f.intersects(Sphere(centers.get(i), radii[i]));
+		});
+	}
+
+	inline void CullAABBs(const Frustum &f, const Vector3Stream &mins, const Vector3Stream &maxs,
+		uint32_t* visible, unsigned threads = 1)
+	{
+		FloatN nx[6], ny[6], nz[6], ax[6], ay[6], az[6], d[6];
+		for(int p = 0; p < 6; p++)
+		{
+			const Vector3 &n = f._planes[p]._normal;
+			nx[p] = _SetN(n._x);
+			ny[p] = _SetN(n._y);
+			nz[p] = _SetN(n._z);
+			ax[p] = _SetN(fabsf(n._x));
+			ay[p] = _SetN(fabsf(n._y));
+			az[p] = _SetN(fabsf(n._z));
+			d[p] = _SetN(f._planes[p]._d);
+		}
+
+		FloatN half = _SetN(0.5f);
+		_CullBatch(mins.size(), visible, threads, [&](size_t i) {
+			FloatN lx = _LoadN(mins.x() + i), ly = _LoadN(mins.y() + i), lz = _LoadN(mins.z() + i);
+			FloatN hx = _LoadN(maxs.x() + i), hy = _LoadN(maxs.y() + i), hz = _LoadN(maxs.z() + i);
+			FloatN cx = _MulN(_AddN(lx, hx), half), ex = _MulN(_SubN(hx, lx), half);
+			FloatN cy = _MulN(_AddN(ly, hy), half), ey = _MulN(_SubN(hy, ly), half);
+			FloatN cz = _MulN(_AddN(lz, hz), half), ez = _MulN(_SubN(hz, lz), half);
+			FloatN m = _SetN(1e30f);
+			for(int p = 0; p < 6; p++)
+			{
+				FloatN dist = _AddN(_AddN(_MulN(nx[p], cx), _MulN(ny[p], cy)), _AddN(_MulN(nz[p], cz), d[p]));
+				FloatN r = _AddN(_AddN(_MulN(ax[p], ex), _MulN(ay[p], ey)), _MulN(az[p], ez));
+				m = _MinN(m, _AddN(dist, r));
+			}
+			return ~_SignMaskN(m) & ((1 << GU_LANES) - 1);
+		}, [&](size_t i) {
+			return f.intersects(AABB(mins.get(i), maxs.get(i)));
+		});
+	}
+
+	/*********************************************************/
+	inline int _LowestBit(uint32_t bits)
+	{
+#if defined(_MSC_VER)
+		unsigned long i;
+		_BitScanForward(&i, bits);
+		return (int)i;
+#else
+		return __builtin_ctz(bits);
+#endif
+	}
+
+	// Writes the indices of the set bits of a culling mask to indices,
+	// which needs room for count entries. Returns the number of indices.
+	inline size_t CompactVisible(const uint32_t* visible, size_t count, uint32_t* indices)
+	{
+		size_t n = 0;
+		for(size_t w = 0; w < (count + 31) / 32; w++)
+		{
+			for(uint32_t bits = visible[w]; bits; bits &= bits - 1)
+				indices[n++] = (uint32_t)(w * 32 + _LowestBit(bits));
+		}
+		return n;
+	}
+}
+
+#endif
@@ -1,9 +1,3385 @@
 #ifndef _GUCOLLISION_H_
 #define _GUCOLLISION_H_
 
-namesapce GU
+#include <stdint.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "GUMath.h"
+#include "GUBounds.h"
+#include "GUParallel.h"
+#include "GUWavefrontObj.h"
+
+namespace GU
 {
-  
+	/*********************************************************/
+	class Ray
+	{
+		public:
+			Ray() { }
+			Ray(const Vector3 &origin, const Vector3 &direction) : _origin(origin), _direction(direction) { }
+
+			Vector3 at(float t) const { return _origin + _direction * t; }
+
+		public:
+			Vector3 _origin;
+			Vector3 _direction;
+	};
+
+	struct RayHit
+	{
+		float _t;
+		float _u, _v;			// Barycentric coordinates of the hit point
+		uint32_t _triangle;		// Triangle index, i.e. the offset in the index buffer / 3
+	};
+
+	// Coherent rays, e.g. from a camera or a light, are traced in packets of
+	// GU_LANES rays that walk the tree together. Incoherent rays are traced
+	// one by one.
+	enum class RayMode { Coherent, Incoherent };
+
+	// Möller-Trumbore, t in [0, tMax)
+	inline bool _RayTriangle(const Vector3 &o, const Vector3 &d,
+		const Vector3 &v0, const Vector3 &e1, const Vector3 &e2, float tMax, float &t, float &u, float &v)
+	{
+		Vector3 p = d.cross(e2);
+		float det = e1.dot(p);
+		if(det == 0.0f)
+			return false;
+
+		float inv = 1.0f / det;
+		Vector3 s = o - v0;
+		u = s.dot(p) * inv;
+		if(u < 0.0f || u > 1.0f)
+			return false;
+
+		Vector3 q = s.cross(e1);
+		v = d.dot(q) * inv;
+		if(v < 0.0f || u + v > 1.0f)
+			return false;
+
+		t = e2.dot(q) * inv;
+		return t >= 0.0f && t < tMax;
+	}
+
+	// Slab test with the inverse ray direction, tEntry is the distance
+	// where the ray enters the box
+	inline bool _RayBox(const Vector3 &min, const Vector3 &max, const Vector3 &o, const Vector3 &inv,
+		float tMax, float &tEntry)
+	{
+		float x1 = (min._x - o._x) * inv._x, x2 = (max._x - o._x) * inv._x;
+		float y1 = (min._y - o._y) * inv._y, y2 = (max._y - o._y) * inv._y;
+		float z1 = (min._z - o._z) * inv._z, z2 = (max._z - o._z) * inv._z;
+		float t0 = GU::max(GU::max(GU::min(x1, x2), GU::min(y1, y2)), GU::max(GU::min(z1, z2), 0.0f));
+		float t1 = GU::min(GU::min(GU::max(x1, x2), GU::max(y1, y2)), GU::min(GU::max(z1, z2), tMax));
+		tEntry = t0;
+		return t0 <= t1;
+	}
+
+	// Separating axis test of a triangle against a box, the triangle is
+	// given relative to the box center
+	inline bool _SeparatedOnAxis(const Vector3 &a, const Vector3 &v0, const Vector3 &v1, const Vector3 &v2,
+		const Vector3 &extents)
+	{
+		float p0 = a.dot(v0), p1 = a.dot(v1), p2 = a.dot(v2);
+		float r = extents._x * fabsf(a._x) + extents._y * fabsf(a._y) + extents._z * fabsf(a._z);
+		return GU::min(p0, GU::min(p1, p2)) > r || GU::max(p0, GU::max(p1, p2)) < -r;
+	}
+
+	inline bool _TriangleBox(const Vector3 &a, const Vector3 &b, const Vector3 &c, const AABB &box)
+	{
+		Vector3 center = box.center(), e = box.extents();
+		Vector3 v0 = a - center, v1 = b - center, v2 = c - center;
+		Vector3 f[3] = { v1 - v0, v2 - v1, v0 - v2 };
+		const Vector3 axes[3] = { Vector3(1.0f, 0.0f, 0.0f), Vector3(0.0f, 1.0f, 0.0f), Vector3(0.0f, 0.0f, 1.0f) };
+
+		for(int i = 0; i < 3; i++)
+		{
+			if(_SeparatedOnAxis(axes[i], v0, v1, v2, e))
+				return false;
+			for(int j = 0; j < 3; j++)
+				if(_SeparatedOnAxis(axes[i].cross(f[j]), v0, v1, v2, e))
+					return false;
+		}
+		return !_SeparatedOnAxis(f[0].cross(f[1]), v0, v1, v2, e);
+	}
+
+	/*********************************************************/
+	// Result of a swept sphere or box. The normal points from the triangle
+	// to the swept shape, the point is the contact on the triangle.
+	struct SweepHit
+	{
+		float _t;
+		Vector3 _point;
+		Vector3 _normal;
+		uint32_t _triangle;
+	};
+
+	// First t in [0, tMax) where the moving point o + d * t is within r of
+	// the center c, 0 if it starts inside
+	inline bool _RaySphere(const Vector3 &o, const Vector3 &d, const Vector3 &c, float r, float tMax, float &t)
+	{
+		Vector3 m = o - c;
+		float b = m.dot(d), k = m.length2() - r * r;
+		if(k <= 0.0f)
+		{
+			t = 0.0f;
+			return true;
+		}
+		float a = d.length2(), disc = b * b - a * k;
+		if(b >= 0.0f || disc < 0.0f)
+			return false;
+		t = (-b - sqrtf(disc)) / a;
+		return t < tMax;
+	}
+
+	// Moving point against the side of the cylinder of radius r around
+	// the segment from p to q. s is the hit position along the segment in
+	// [0, 1], the caps are left to _RaySphere.
+	inline bool _RayCylinder(const Vector3 &o, const Vector3 &d, const Vector3 &p, const Vector3 &q, float r,
+		float tMax, float &t, float &s)
+	{
+		Vector3 e = q - p, m = o - p;
+		float ee = e.length2(), md = m.dot(e), nd = d.dot(e);
+		float a = ee * d.length2() - nd * nd;
+		float b = ee * m.dot(d) - md * nd;
+		float k = ee * (m.length2() - r * r) - md * md;
+		if(ee <= 0.0f)
+			return false;
+
+		if(k <= 0.0f)
+		{
+			t = 0.0f;
+			s = md / ee;
+			return s >= 0.0f && s <= 1.0f;
+		}
+		float disc = b * b - a * k;
+		if(a <= 0.0f || b >= 0.0f || disc < 0.0f)
+			return false;
+
+		t = (-b - sqrtf(disc)) / a;
+		s = (md + t * nd) / ee;
+		return t < tMax && s >= 0.0f && s <= 1.0f;
+	}
+
+	// True if p lies in the triangle, all points are in the triangle plane
+	inline bool _InTriangle(const Vector3 &p, const Vector3 &v0, const Vector3 &e1, const Vector3 &e2, const Vector3 &n)
+	{
+		Vector3 w = p - v0;
+		float u = w.cross(e2).dot(n), v = e1.cross(w).dot(n), area = n.length2();
+		return u >= 0.0f && v >= 0.0f && u + v <= area;
+	}
+
+	// Sphere of radius r moving from o along d against a two sided
+	// triangle, t in [0, tMax)
+	inline bool _SweepSphereTriangle(const Vector3 &o, const Vector3 &d, float r,
+		const Vector3 &v0, const Vector3 &e1, const Vector3 &e2, float tMax, float &t, Vector3 &normal)
+	{
+		Vector3 area = e1.cross(e2);
+		float l = area.length();
+		if(l > 0.0f)
+		{
+			Vector3 n = area / l;
+			float dist = (o - v0).dot(n);
+			if(dist < 0.0f)
+			{
+				n = -n;
+				dist = -dist;
+			}
+
+			// The sphere touches the inside of the face first
+			float dn = d.dot(n);
+			float tc = dist <= r ? 0.0f : dn < 0.0f ? (r - dist) / dn : 1e30f;
+			Vector3 c = o + d * tc;
+			if(tc < tMax && _InTriangle(c - n * (c - v0).dot(n), v0, e1, e2, area))
+			{
+				t = tc;
+				normal = n;
+				return true;
+			}
+		}
+
+		// Otherwise it touches an edge or a corner
+		const Vector3 v[3] = { v0, v0 + e1, v0 + e2 };
+		bool hit = false;
+		for(int i = 0; i < 3; i++)
+		{
+			float ti, s;
+			if(_RayCylinder(o, d, v[i], v[(i + 1) % 3], r, tMax, ti, s))
+			{
+				tMax = t = ti;
+				normal = (o + d * ti - (v[i] + (v[(i + 1) % 3] - v[i]) * s)).normalize();
+				hit = true;
+			}
+			if(_RaySphere(o, d, v[i], r, tMax, ti))
+			{
+				tMax = t = ti;
+				normal = (o + d * ti - v[i]).normalize();
+				hit = true;
+			}
+		}
+		return hit;
+	}
+
+	// Box with half extents h moving from o along d against a triangle,
+	// separating axis test with the entry and exit time on each axis
+	inline bool _SweepBoxTriangle(const Vector3 &o, const Vector3 &d, const Vector3 &h,
+		const Vector3 &v0, const Vector3 &e1, const Vector3 &e2, float tMax, float &t, Vector3 &normal)
+	{
+		const Vector3 v[3] = { v0 - o, v0 + e1 - o, v0 + e2 - o };
+		const Vector3 f[3] = { e1, e2 - e1, -e2 };
+		Vector3 axes[13] = { Vector3(1.0f, 0.0f, 0.0f), Vector3(0.0f, 1.0f, 0.0f), Vector3(0.0f, 0.0f, 1.0f), e1.cross(e2) };
+		for(int i = 0; i < 3; i++)
+			for(int j = 0; j < 3; j++)
+				axes[4 + 3 * i + j] = axes[i].cross(f[j]);
+
+		float enter = -1e30f, exit = tMax;
+		int axis = -1;
+		for(int i = 0; i < 13; i++)
+		{
+			const Vector3 &a = axes[i];
+			if(a.length2() < 1e-12f)
+				continue;
+
+			float p0 = a.dot(v[0]), p1 = a.dot(v[1]), p2 = a.dot(v[2]);
+			float r = h._x * fabsf(a._x) + h._y * fabsf(a._y) + h._z * fabsf(a._z);
+			float lower = GU::min(p0, GU::min(p1, p2)) - r, upper = GU::max(p0, GU::max(p1, p2)) + r;
+			float s = a.dot(d);
+			if(s == 0.0f)
+			{
+				if(lower > 0.0f || upper < 0.0f)
+					return false;
+				continue;
+			}
+
+			float t1 = lower / s, t2 = upper / s;
+			if(t1 > t2)
+				std::swap(t1, t2);
+			if(t1 > enter)
+			{
+				enter = t1;
+				axis = i;
+			}
+			exit = GU::min(exit, t2);
+			if(enter > exit || exit < 0.0f)
+				return false;
+		}
+		if(axis < 0)
+		{
+			// Overlapping on every axis without moving along any of them,
+			// the box touches the triangle at the start
+			t = 0.0f;
+			Vector3 n = axes[3].length2() >= 1e-12f ? axes[3] : -d;
+			if(n.length2() < 1e-12f)
+				n = Vector3(0.0f, 1.0f, 0.0f);
+			normal = n.normalize();
+			if(normal.dot(d) > 0.0f || (normal.dot(d) == 0.0f && normal.dot(v[0]) > 0.0f))
+				normal = -normal;
+			return tMax > 0.0f;
+		}
+
+		t = GU::max(enter, 0.0f);
+		normal = axes[axis].normalize();
+		if(normal.dot(d) > 0.0f)
+			normal = -normal;
+		return true;
+	}
+
+	/*********************************************************/
+	// 32 byte node. The first child of an interior node directly follows
+	// it, offset is the index of the second child. Leaves have count > 0
+	// triangles starting at offset.
+	struct BVHNode
+	{
+		Vector3 _min;
+		uint32_t _offset;
+		Vector3 _max;
+		uint32_t _count;
+
+		bool leaf() const { return _count > 0; }
+	};
+
+	static_assert(sizeof(BVHNode) == 32, "BVHNode must be 32 bytes");
+
+	/*********************************************************/
+	// Bounding volume hierarchy over a triangle mesh as produced by
+	// LoadObj. The nodes are built with a binned surface area heuristic
+	// and stored in depth first order, the triangles are copied in leaf
+	// order. Subtrees with more than GU_BVH_PARALLEL_GRAIN triangles are
+	// built on separate threads.
+	#ifndef GU_BVH_PARALLEL_GRAIN
+		#define GU_BVH_PARALLEL_GRAIN 65536
+	#endif
+
+	class MeshBVH
+	{
+		public:
+			static constexpr int Bins = 16;
+			static constexpr int MaxLeafSize = 8;
+			// Below SAHDepth the nodes are split in the middle, which
+			// bounds the depth of the tree and the traversal stacks
+			static constexpr int SAHDepth = 32;
+			static constexpr int MaxDepth = 64;
+			// Number of independent subtrees for refit() and rebuild()
+			static constexpr int RefitSubtrees = 64;
+			static constexpr uint32_t None = 0xFFFFFFFF;
+
+			void build(const std::vector<Vertex> &vertices, const std::vector<Index> &indices, unsigned threads = 1);
+
+			// Updates the bounds after the vertices moved, the indices must be
+			// the ones of build(). The subtrees are refit in parallel.
+			void refit(const std::vector<Vertex> &vertices, const std::vector<Index> &indices, unsigned threads = 1);
+			// SAH cost of the tree relative to its cost after build(). It is 1
+			// for a fresh tree and grows as refits degrade it.
+			float degradation() const { return _degradation; }
+			// Rebuilds the subtrees whose cost grew by more than threshold since
+			// they were built, returns the number of rebuilt subtrees
+			size_t rebuild(const std::vector<Vertex> &vertices, const std::vector<Index> &indices,
+				float threshold = 1.5f, unsigned threads = 1);
+
+			// Closest hit along the ray, hit._triangle is None on a miss
+			bool intersect(const Ray &ray, RayHit &hit, float tMax = 1e30f) const;
+			// Any hit closer than tMax
+			bool occluded(const Ray &ray, float tMax = 1e30f) const;
+
+			// Batch versions. tMax may be null (no limit) or hold one distance
+			// per ray, batches are split across the requested threads.
+			void intersect(const Ray* rays, size_t count, RayHit* hits, const float* tMax = nullptr,
+				RayMode mode = RayMode::Coherent, unsigned threads = 1) const;
+			void occluded(const Ray* rays, size_t count, bool* occluded, const float* tMax = nullptr,
+				RayMode mode = RayMode::Coherent, unsigned threads = 1) const;
+
+			// Sphere or box moving along the ray, t is measured in ray units
+			// like in intersect(). hit._triangle is None on a miss.
+			bool sweepSphere(const Ray &ray, float radius, SweepHit &hit, float tMax = 1e30f) const;
+			bool sweepBox(const Ray &ray, const Vector3 &halfExtents, SweepHit &hit, float tMax = 1e30f) const;
+			void sweepSphere(const Ray* rays, const float* radii, size_t count, SweepHit* hits,
+				const float* tMax = nullptr, unsigned threads = 1) const;
+			void sweepBox(const Ray* rays, const Vector3* halfExtents, size_t count, SweepHit* hits,
+				const float* tMax = nullptr, unsigned threads = 1) const;
+
+			// Calls func(triangle) for every triangle intersecting the box
+			template<typename Func>
+			void overlap(const AABB &box, Func func) const;
+			void overlap(const AABB &box, std::vector<uint32_t> &triangles) const;
+
+			AABB bounds() const;
+			const std::vector<BVHNode>& nodes() const { return _nodes; }
+			size_t triangleCount() const { return _ids.size(); }
+			void clear();
+
+		private:
+			struct _Triangle
+			{
+				Vector3 _v0, _e1, _e2;
+			};
+
+			struct _BuildData
+			{
+				std::vector<AABB> _bounds;
+				std::vector<Vector3> _centroids;
+			};
+
+			// Nodes [_root, _end) below the top of the tree
+			struct _Subtree
+			{
+				uint32_t _root, _end;
+				int _depth;
+				float _cost, _buildCost;	// SAH cost relative to the root area
+			};
+
+			void _build(const _BuildData &data, uint32_t begin, uint32_t end, int depth,
+				std::vector<BVHNode> &out, unsigned threads);
+			uint32_t _split(const _BuildData &data, uint32_t begin, uint32_t end, int depth,
+				const AABB &bounds, const AABB &centroids, unsigned threads);
+			void _loadTriangles(const std::vector<Vertex> &vertices, const std::vector<Index> &indices,
+				uint32_t begin, uint32_t end);
+			void _buildSubtrees();
+			float _refitRange(const std::vector<Vertex> &vertices, const std::vector<Index> &indices,
+				uint32_t root, uint32_t end);
+			float _rangeCost(uint32_t root, uint32_t end) const;
+			float _refitTop();
+
+			struct _Packet
+			{
+				FloatN _ox, _oy, _oz, _dx, _dy, _dz, _ix, _iy, _iz;
+				FloatN _tMax;
+				Vector3 _direction;
+			};
+
+			void _loadPacket(const Ray* rays, size_t n, const float* tMax, _Packet &p) const;
+			FloatN _boxPacket(const BVHNode &node, const _Packet &p) const;
+			FloatN _trianglePacket(const _Triangle &tri, const _Packet &p, FloatN &t, FloatN &u, FloatN &v) const;
+			template<bool AnyHit>
+			void _tracePacket(const Ray* rays, size_t n, const float* tMax, RayHit* hits, bool* occluded) const;
+			template<typename Test>
+			bool _sweep(const Ray &ray, const Vector3 &grow, SweepHit &hit, Test test) const;
+
+		private:
+			std::vector<BVHNode> _nodes;
+			std::vector<_Triangle> _triangles;
+			std::vector<uint32_t> _ids;
+
+			std::vector<uint32_t> _top;		// Nodes above the subtrees in breadth first order
+			std::vector<_Subtree> _subtrees;
+			float _buildCost = 0.0f;
+			float _degradation = 1.0f;
+	};
+
+	// Bounds of the triangles and of their centroids in [begin, end)
+	inline void _RangeBounds(const std::vector<AABB> &bounds, const std::vector<Vector3> &centroids,
+		const uint32_t* ids, uint32_t begin, uint32_t end, AABB &box, AABB &centroidBox, unsigned threads)
+	{
+		size_t chunks = threads > 1 && end - begin >= GU_BVH_PARALLEL_GRAIN ? threads : 1;
+		std::vector<AABB> b(chunks), c(chunks);
+		size_t step = (end - begin + chunks - 1) / chunks;
+		ParallelFor(chunks, 1, [&](size_t first, size_t last) {
+			for(size_t k = first; k < last; k++)
+			{
+				size_t e = begin + (k + 1) * step < end ? begin + (k + 1) * step : end;
+				for(size_t i = begin + k * step; i < e; i++)
+				{
+					b[k].grow(bounds[ids[i]]);
+					c[k].grow(centroids[ids[i]]);
+				}
+			}
+		}, (unsigned)chunks);
+
+		box = AABB();
+		centroidBox = AABB();
+		for(size_t k = 0; k < chunks; k++)
+		{
+			box.grow(b[k]);
+			centroidBox.grow(c[k]);
+		}
+	}
+
+	inline void MeshBVH::build(const std::vector<Vertex> &vertices, const std::vector<Index> &indices, unsigned threads)
+	{
+		threads = ThreadCount(threads);
+		uint32_t count = (uint32_t)(indices.size() / 3);
+
+		_BuildData data;
+		data._bounds.resize(count);
+		data._centroids.resize(count);
+		_ids.resize(count);
+		ParallelFor(count, GU_BATCH_GRAIN, [&](size_t begin, size_t end) {
+			for(size_t i = begin; i < end; i++)
+			{
+				AABB b;
+				b.grow(vertices[indices[3 * i]].pos);
+				b.grow(vertices[indices[3 * i + 1]].pos);
+				b.grow(vertices[indices[3 * i + 2]].pos);
+				data._bounds[i] = b;
+				data._centroids[i] = b.center();
+				_ids[i] = (uint32_t)i;
+			}
+		}, threads);
+
+		_nodes.clear();
+		if(count > 0)
+		{
+			_nodes.reserve(2 * count);
+			_build(data, 0, count, 0, _nodes, threads);
+		}
+
+		// Copy the triangles in leaf order
+		_triangles.resize(count);
+		ParallelFor(count, GU_BATCH_GRAIN, [&](size_t begin, size_t end) {
+			_loadTriangles(vertices, indices, (uint32_t)begin, (uint32_t)end);
+		}, threads);
+
+		_buildSubtrees();
+	}
+
+	inline void MeshBVH::_loadTriangles(const std::vector<Vertex> &vertices, const std::vector<Index> &indices,
+		uint32_t begin, uint32_t end)
+	{
+		for(uint32_t i = begin; i < end; i++)
+		{
+			const Vector3 &v0 = vertices[indices[3 * _ids[i]]].pos;
+			_triangles[i]._v0 = v0;
+			_triangles[i]._e1 = vertices[indices[3 * _ids[i] + 1]].pos - v0;
+			_triangles[i]._e2 = vertices[indices[3 * _ids[i] + 2]].pos - v0;
+		}
+	}
+
+	inline void MeshBVH::_build(const _BuildData &data, uint32_t begin, uint32_t end, int depth,
+		std::vector<BVHNode> &out, unsigned threads)
+	{
+		AABB box, centroids;
+		_RangeBounds(data._bounds, data._centroids, _ids.data(), begin, end, box, centroids, threads);
+
+		size_t index = out.size();
+		out.push_back(BVHNode());
+		out[index]._min = box._min;
+		out[index]._max = box._max;
+
+		uint32_t mid = end - begin > 1 ? _split(data, begin, end, depth, box, centroids, threads) : end;
+		if(mid == end)
+		{
+			out[index]._offset = begin;
+			out[index]._count = end - begin;
+			return;
+		}
+		out[index]._count = 0;
+
+		if(threads > 1 && end - begin >= GU_BVH_PARALLEL_GRAIN)
+		{
+			// The second child is built into its own array and appended
+			std::vector<BVHNode> right;
+			std::thread worker([&]() { _build(data, mid, end, depth + 1, right, threads - threads / 2); });
+			_build(data, begin, mid, depth + 1, out, threads / 2);
+			worker.join();
+
+			uint32_t base = (uint32_t)out.size();
+			out[index]._offset = base;
+			for(BVHNode &n : right)
+			{
+				if(!n.leaf())
+					n._offset += base;
+				out.push_back(n);
+			}
+		}
+		else
+		{
+			_build(data, begin, mid, depth + 1, out, 1);
+			out[index]._offset = (uint32_t)out.size();
+			_build(data, mid, end, depth + 1, out, 1);
+		}
+	}
+
+	// Partitions [begin, end) and returns the start of the second half,
+	// or end if a leaf is cheaper than the best split
+	inline uint32_t MeshBVH::_split(const _BuildData &data, uint32_t begin, uint32_t end, int depth,
+		const AABB &bounds, const AABB &centroids, unsigned threads)
+	{
+		uint32_t count = end - begin;
+		Vector3 extent = centroids._max - centroids._min;
+
+		if(extent._x <= 0.0f && extent._y <= 0.0f && extent._z <= 0.0f)
+			return count <= MaxLeafSize ? end : begin + count / 2;
+
+		if(depth >= SAHDepth)
+		{
+			int axis = extent._x >= extent._y && extent._x >= extent._z ? 0 : extent._y >= extent._z ? 1 : 2;
+			uint32_t* mid = _ids.data() + begin + count / 2;
+			std::nth_element(_ids.data() + begin, mid, _ids.data() + end, [&](uint32_t a, uint32_t b) {
+				return data._centroids[a][axis] < data._centroids[b][axis];
+			});
+			return count <= MaxLeafSize ? end : (uint32_t)(mid - _ids.data());
+		}
+
+		struct Bin { AABB _box[3][Bins]; uint32_t _count[3][Bins]; };
+		Vector3 scale;
+		for(int a = 0; a < 3; a++)
+			scale[a] = extent[a] > 0.0f ? Bins * 0.99999f / extent[a] : 0.0f;
+
+		// Bin the centroids on all three axes
+		size_t chunks = threads > 1 && count >= GU_BVH_PARALLEL_GRAIN ? threads : 1;
+		std::vector<Bin> bins(chunks);
+		size_t step = (count + chunks - 1) / chunks;
+		ParallelFor(chunks, 1, [&](size_t first, size_t last) {
+			for(size_t k = first; k < last; k++)
+			{
+				Bin &bin = bins[k];
+				for(int a = 0; a < 3; a++)
+					for(int b = 0; b < Bins; b++)
+						bin._count[a][b] = 0;
+
+				size_t e = begin + (k + 1) * step < end ? begin + (k + 1) * step : end;
+				for(size_t i = begin + k * step; i < e; i++)
+				{
+					uint32_t id = _ids[i];
+					for(int a = 0; a < 3; a++)
+					{
+						int b = (int)((data._centroids[id][a] - centroids._min[a]) * scale[a]);
+						bin._box[a][b].grow(data._bounds[id]);
+						bin._count[a][b]++;
+					}
+				}
+			}
+		}, (unsigned)chunks);
+
+		for(size_t k = 1; k < chunks; k++)
+		{
+			for(int a = 0; a < 3; a++)
+			{
+				for(int b = 0; b < Bins; b++)
+				{
+					bins[0]._box[a][b].grow(bins[k]._box[a][b]);
+					bins[0]._count[a][b] += bins[k]._count[a][b];
+				}
+			}
+		}
+
+		// Sweep the bins from both sides, a split after bin b puts the
+		// bins [0, b] to the left
+		const Bin &bin = bins[0];
+		float bestCost = 1e30f;
+		int bestAxis = -1, bestSplit = 0;
+		for(int a = 0; a < 3; a++)
+		{
+			if(extent[a] <= 0.0f)
+				continue;
+
+			float rightArea[Bins];
+			uint32_t rightCount[Bins];
+			AABB box;
+			uint32_t n = 0;
+			for(int b = Bins - 1; b > 0; b--)
+			{
+				box.grow(bin._box[a][b]);
+				n += bin._count[a][b];
+				rightArea[b] = n > 0 ? box.area() : 0.0f;
+				rightCount[b] = n;
+			}
+
+			box = AABB();
+			n = 0;
+			for(int b = 0; b < Bins - 1; b++)
+			{
+				box.grow(bin._box[a][b]);
+				n += bin._count[a][b];
+				if(n == 0 || rightCount[b + 1] == 0)
+					continue;
+				float cost = box.area() * n + rightArea[b + 1] * rightCount[b + 1];
+				if(cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = a;
+					bestSplit = b;
+				}
+			}
+		}
+
+		// Traversal cost 1, intersection cost 1 per triangle
+		float leafCost = (float)count;
+		float splitCost = 1.0f + bestCost / bounds.area();
+		if(bestAxis < 0 || (count <= MaxLeafSize && leafCost <= splitCost))
+			return count <= MaxLeafSize ? end : begin + count / 2;
+
+		float minA = centroids._min[bestAxis], scaleA = scale[bestAxis];
+		uint32_t* mid = std::partition(_ids.data() + begin, _ids.data() + end, [&](uint32_t id) {
+			return (int)((data._centroids[id][bestAxis] - minA) * scaleA) <= bestSplit;
+		});
+		if(mid == _ids.data() + begin || mid == _ids.data() + end)
+			return begin + count / 2;
+		return (uint32_t)(mid - _ids.data());
+	}
+
+	/*********************************************************/
+	// The top of the tree is split breadth first into RefitSubtrees
+	// subtrees, each a contiguous range of nodes in depth first order. The
+	// split only depends on the tree, so refits are identical for any
+	// number of threads.
+	inline void MeshBVH::_buildSubtrees()
+	{
+		_top.clear();
+		_subtrees.clear();
+		_buildCost = 0.0f;
+		_degradation = 1.0f;
+		if(_nodes.empty())
+			return;
+
+		std::vector<std::pair<uint32_t, int> > queue(1, std::make_pair(0u, 0));
+		for(size_t head = 0; head < queue.size(); head++)
+		{
+			uint32_t n = queue[head].first;
+			int depth = queue[head].second;
+			if(_nodes[n].leaf() || _subtrees.size() + queue.size() - head >= RefitSubtrees)
+			{
+				_subtrees.push_back({ n, 0, depth, 0.0f, 0.0f });
+				continue;
+			}
+			_top.push_back(n);
+			queue.push_back(std::make_pair(n + 1, depth + 1));
+			queue.push_back(std::make_pair(_nodes[n]._offset, depth + 1));
+		}
+
+		// A subtree ends where the next top node or subtree starts
+		std::vector<uint32_t> starts(_top);
+		for(const _Subtree &t : _subtrees)
+			starts.push_back(t._root);
+		std::sort(starts.begin(), starts.end());
+		std::sort(_subtrees.begin(), _subtrees.end(), [](const _Subtree &a, const _Subtree &b) {
+			return a._root < b._root;
+		});
+		for(_Subtree &t : _subtrees)
+		{
+			auto next = std::upper_bound(starts.begin(), starts.end(), t._root);
+			t._end = next != starts.end() ? *next : (uint32_t)_nodes.size();
+			t._cost = t._buildCost = _rangeCost(t._root, t._end);
+		}
+
+		_buildCost = _refitTop();
+	}
+
+	// SAH cost of the nodes [root, end) relative to the area of the root
+	inline float MeshBVH::_rangeCost(uint32_t root, uint32_t end) const
+	{
+		float cost = 0.0f;
+		for(uint32_t n = root; n < end; n++)
+			cost += AABB(_nodes[n]._min, _nodes[n]._max).area() * (_nodes[n].leaf() ? _nodes[n]._count : 1);
+		float area = AABB(_nodes[root]._min, _nodes[root]._max).area();
+		return area > 0.0f ? cost / area : 0.0f;
+	}
+
+	// Children follow their parents, so one backward pass updates the
+	// bounds bottom up. Returns the new cost of the range.
+	inline float MeshBVH::_refitRange(const std::vector<Vertex> &vertices, const std::vector<Index> &indices,
+		uint32_t root, uint32_t end)
+	{
+		float cost = 0.0f;
+		for(uint32_t n = end; n-- > root; )
+		{
+			BVHNode &node = _nodes[n];
+			AABB box;
+			if(node.leaf())
+			{
+				_loadTriangles(vertices, indices, node._offset, node._offset + node._count);
+				for(uint32_t i = node._offset; i < node._offset + node._count; i++)
+				{
+					const _Triangle &tri = _triangles[i];
+					box.grow(tri._v0);
+					box.grow(tri._v0 + tri._e1);
+					box.grow(tri._v0 + tri._e2);
+				}
+				cost += box.area() * node._count;
+			}
+			else
+			{
+				const BVHNode &a = _nodes[n + 1], &b = _nodes[node._offset];
+				box = AABB(a._min, a._max);
+				box.grow(AABB(b._min, b._max));
+				cost += box.area();
+			}
+			node._min = box._min;
+			node._max = box._max;
+		}
+		float area = AABB(_nodes[root]._min, _nodes[root]._max).area();
+		return area > 0.0f ? cost / area : 0.0f;
+	}
+
+	// Updates the nodes above the subtrees, returns the cost of the tree
+	inline float MeshBVH::_refitTop()
+	{
+		float cost = 0.0f;
+		for(const _Subtree &t : _subtrees)
+			cost += t._cost * AABB(_nodes[t._root]._min, _nodes[t._root]._max).area();
+
+		for(size_t i = _top.size(); i-- > 0; )
+		{
+			BVHNode &node = _nodes[_top[i]];
+			const BVHNode &a = _nodes[_top[i] + 1], &b = _nodes[node._offset];
+			AABB box(a._min, a._max);
+			box.grow(AABB(b._min, b._max));
+			node._min = box._min;
+			node._max = box._max;
+			cost += box.area();
+		}
+
+		float area = _nodes.empty() ? 0.0f : AABB(_nodes[0]._min, _nodes[0]._max).area();
+		return area > 0.0f ? cost / area : 0.0f;
+	}
+
+	inline void MeshBVH::refit(const std::vector<Vertex> &vertices, const std::vector<Index> &indices, unsigned threads)
+	{
+		ParallelFor(_subtrees.size(), 1, [&](size_t begin, size_t end) {
+			for(size_t i = begin; i < end; i++)
+				_subtrees[i]._cost = _refitRange(vertices, indices, _subtrees[i]._root, _subtrees[i]._end);
+		}, threads);
+
+		_degradation = _buildCost > 0.0f ? _refitTop() / _buildCost : 1.0f;
+	}
+
+	inline size_t MeshBVH::rebuild(const std::vector<Vertex> &vertices, const std::vector<Index> &indices,
+		float threshold, unsigned threads)
+	{
+		std::vector<uint32_t> selected;
+		for(uint32_t i = 0; i < (uint32_t)_subtrees.size(); i++)
+		{
+			const _Subtree &t = _subtrees[i];
+			if(!_nodes[t._root].leaf() && t._cost > threshold * t._buildCost)
+				selected.push_back(i);
+		}
+		if(selected.empty())
+			return 0;
+
+		// The leaves of a subtree hold a contiguous range of triangles,
+		// each subtree is rebuilt on its own
+		_BuildData data;
+		data._bounds.resize(_ids.size());
+		data._centroids.resize(_ids.size());
+		std::vector<std::vector<BVHNode> > built(selected.size());
+		ParallelFor(selected.size(), 1, [&](size_t begin, size_t end) {
+			for(size_t k = begin; k < end; k++)
+			{
+				const _Subtree &t = _subtrees[selected[k]];
+				uint32_t first = None, last = 0;
+				for(uint32_t n = t._root; n < t._end; n++)
+				{
+					if(_nodes[n].leaf())
+					{
+						first = std::min(first, _nodes[n]._offset);
+						last = std::max(last, _nodes[n]._offset + _nodes[n]._count);
+					}
+				}
+
+				for(uint32_t i = first; i < last; i++)
+				{
+					uint32_t id = _ids[i];
+					AABB b;
+					b.grow(vertices[indices[3 * id]].pos);
+					b.grow(vertices[indices[3 * id + 1]].pos);
+					b.grow(vertices[indices[3 * id + 2]].pos);
+					data._bounds[id] = b;
+					data._centroids[id] = b.center();
+				}
+				_build(data, first, last, t._depth, built[k], 1);
+				_loadTriangles(vertices, indices, first, last);
+			}
+		}, threads);
+
+		// Splice the new subtrees in and move the offsets behind them
+		std::vector<uint32_t> ends(selected.size());
+		std::vector<int64_t> shift(selected.size());
+		int64_t delta = 0;
+		for(size_t k = 0; k < selected.size(); k++)
+		{
+			const _Subtree &t = _subtrees[selected[k]];
+			delta += (int64_t)built[k].size() - (int64_t)(t._end - t._root);
+			ends[k] = t._end;
+			shift[k] = delta;
+		}
+		auto moved = [&](uint32_t n) {
+			size_t k = std::upper_bound(ends.begin(), ends.end(), n) - ends.begin();
+			return (uint32_t)(n + (k > 0 ? shift[k - 1] : 0));
+		};
+
+		std::vector<BVHNode> nodes;
+		nodes.reserve((size_t)(_nodes.size() + delta));
+		uint32_t n = 0;
+		for(size_t k = 0; k <= selected.size(); k++)
+		{
+			uint32_t stop = k < selected.size() ? _subtrees[selected[k]]._root : (uint32_t)_nodes.size();
+			for(; n < stop; n++)
+			{
+				BVHNode node = _nodes[n];
+				if(!node.leaf())
+					node._offset = moved(node._offset);
+				nodes.push_back(node);
+			}
+			if(k == selected.size())
+				break;
+
+			uint32_t base = (uint32_t)nodes.size();
+			for(BVHNode node : built[k])
+			{
+				if(!node.leaf())
+					node._offset += base;
+				nodes.push_back(node);
+			}
+			n = _subtrees[selected[k]]._end;
+		}
+		_nodes.swap(nodes);
+
+		for(uint32_t &t : _top)
+			t = moved(t);
+		for(_Subtree &t : _subtrees)
+		{
+			t._root = moved(t._root);
+			t._end = moved(t._end);
+		}
+		for(uint32_t i : selected)
+			_subtrees[i]._cost = _subtrees[i]._buildCost = _rangeCost(_subtrees[i]._root, _subtrees[i]._end);
+
+		_degradation = _buildCost > 0.0f ? _refitTop() / _buildCost : 1.0f;
+		return selected.size();
+	}
+
+	inline bool MeshBVH::intersect(const Ray &ray, RayHit &hit, float tMax) const
+	{
+		hit._t = tMax;
+		hit._triangle = None;
+		if(_nodes.empty())
+			return false;
+
+		const Vector3 &o = ray._origin, &d = ray._direction;
+		Vector3 inv(1.0f / d._x, 1.0f / d._y, 1.0f / d._z);
+
+		uint32_t stack[MaxDepth + 1];
+		int top = 0;
+		uint32_t n = 0;
+		float tEntry;
+		if(!_RayBox(_nodes[0]._min, _nodes[0]._max, o, inv, hit._t, tEntry))
+			return false;
+
+		while(true)
+		{
+			const BVHNode &node = _nodes[n];
+			if(node.leaf())
+			{
+				for(uint32_t i = node._offset; i < node._offset + node._count; i++)
+				{
+					const _Triangle &tri = _triangles[i];
+					float t, u, v;
+					if(_RayTriangle(o, d, tri._v0, tri._e1, tri._e2, hit._t, t, u, v))
+					{
+						hit._t = t;
+						hit._u = u;
+						hit._v = v;
+						hit._triangle = _ids[i];
+					}
+				}
+			}
+			else
+			{
+				// Visit the nearer child first
+				uint32_t a = n + 1, b = node._offset;
+				float ta, tb;
+				bool hitA = _RayBox(_nodes[a]._min, _nodes[a]._max, o, inv, hit._t, ta);
+				bool hitB = _RayBox(_nodes[b]._min, _nodes[b]._max, o, inv, hit._t, tb);
+				if(hitA && hitB)
+				{
+					if(tb < ta)
+						std::swap(a, b);
+					stack[top++] = b;
+					n = a;
+					continue;
+				}
+				if(hitA || hitB)
+				{
+					n = hitA ? a : b;
+					continue;
+				}
+			}
+
+			if(top == 0)
+				break;
+			n = stack[--top];
+		}
+		return hit._triangle != None;
+	}
+
+	inline bool MeshBVH::occluded(const Ray &ray, float tMax) const
+	{
+		if(_nodes.empty())
+			return false;
+
+		const Vector3 &o = ray._origin, &d = ray._direction;
+		Vector3 inv(1.0f / d._x, 1.0f / d._y, 1.0f / d._z);
+
+		uint32_t stack[MaxDepth + 1];
+		int top = 0;
+		stack[top++] = 0;
+		while(top > 0)
+		{
+			const BVHNode &node = _nodes[stack[--top]];
+			float tEntry;
+			if(!_RayBox(node._min, node._max, o, inv, tMax, tEntry))
+				continue;
+
+			if(node.leaf())
+			{
+				for(uint32_t i = node._offset; i < node._offset + node._count; i++)
+				{
+					const _Triangle &tri = _triangles[i];
+					float t, u, v;
+					if(_RayTriangle(o, d, tri._v0, tri._e1, tri._e2, tMax, t, u, v))
+						return true;
+				}
+			}
+			else
+			{
+				stack[top++] = node._offset;
+				stack[top++] = (uint32_t)(&node - _nodes.data()) + 1;
+			}
+		}
+		return false;
+	}
+
+	template<typename Func>
+	inline void MeshBVH::overlap(const AABB &box, Func func) const
+	{
+		if(_nodes.empty())
+			return;
+
+		uint32_t stack[MaxDepth + 1];
+		int top = 0;
+		stack[top++] = 0;
+		while(top > 0)
+		{
+			uint32_t n = stack[--top];
+			const BVHNode &node = _nodes[n];
+			if(!box.overlaps(AABB(node._min, node._max)))
+				continue;
+
+			if(node.leaf())
+			{
+				for(uint32_t i = node._offset; i < node._offset + node._count; i++)
+				{
+					const _Triangle &tri = _triangles[i];
+					if(_TriangleBox(tri._v0, tri._v0 + tri._e1, tri._v0 + tri._e2, box))
+						func(_ids[i]);
+				}
+			}
+			else
+			{
+				stack[top++] = node._offset;
+				stack[top++] = n + 1;
+			}
+		}
+	}
+
+	inline void MeshBVH::overlap(const AABB &box, std::vector<uint32_t> &triangles) const
+	{
+		overlap(box, [&triangles](uint32_t t) { triangles.push_back(t); });
+	}
+
+	/*********************************************************/
+	// Sweeps walk the tree like a ray against nodes grown by the extents
+	// of the shape, which is exact for boxes and conservative for spheres
+	template<typename Test>
+	inline bool MeshBVH::_sweep(const Ray &ray, const Vector3 &grow, SweepHit &hit, Test test) const
+	{
+		hit._triangle = None;
+		if(_nodes.empty())
+			return false;
+
+		const Vector3 &o = ray._origin, &d = ray._direction;
+		Vector3 inv(1.0f / d._x, 1.0f / d._y, 1.0f / d._z);
+
+		uint32_t stack[MaxDepth + 1];
+		int top = 0;
+		uint32_t n = 0;
+		float tEntry;
+		if(!_RayBox(_nodes[0]._min - grow, _nodes[0]._max + grow, o, inv, hit._t, tEntry))
+			return false;
+
+		while(true)
+		{
+			const BVHNode &node = _nodes[n];
+			if(node.leaf())
+			{
+				for(uint32_t i = node._offset; i < node._offset + node._count; i++)
+				{
+					const _Triangle &tri = _triangles[i];
+					float t;
+					Vector3 normal;
+					if(test(tri, hit._t, t, normal))
+					{
+						hit._t = t;
+						hit._normal = normal;
+						hit._triangle = _ids[i];
+					}
+				}
+			}
+			else
+			{
+				uint32_t a = n + 1, b = node._offset;
+				float ta, tb;
+				bool hitA = _RayBox(_nodes[a]._min - grow, _nodes[a]._max + grow, o, inv, hit._t, ta);
+				bool hitB = _RayBox(_nodes[b]._min - grow, _nodes[b]._max + grow, o, inv, hit._t, tb);
+				if(hitA && hitB)
+				{
+					if(tb < ta)
+						std::swap(a, b);
+					stack[top++] = b;
+					n = a;
+					continue;
+				}
+				if(hitA || hitB)
+				{
+					n = hitA ? a : b;
+					continue;
+				}
+			}
+
+			if(top == 0)
+				break;
+			n = stack[--top];
+		}
+		return hit._triangle != None;
+	}
+
+	inline bool MeshBVH::sweepSphere(const Ray &ray, float radius, SweepHit &hit, float tMax) const
+	{
+		hit._t = tMax;
+		bool found = _sweep(ray, Vector3(radius, radius, radius), hit, [&](const _Triangle &tri, float limit, float &t, Vector3 &n) {
+			return _SweepSphereTriangle(ray._origin, ray._direction, radius, tri._v0, tri._e1, tri._e2, limit, t, n);
+		});
+		if(found)
+			hit._point = ray.at(hit._t) - hit._normal * radius;
+		return found;
+	}
+
+	inline bool MeshBVH::sweepBox(const Ray &ray, const Vector3 &halfExtents, SweepHit &hit, float tMax) const
+	{
+		hit._t = tMax;
+		bool found = _sweep(ray, halfExtents, hit, [&](const _Triangle &tri, float limit, float &t, Vector3 &n) {
+			return _SweepBoxTriangle(ray._origin, ray._direction, halfExtents, tri._v0, tri._e1, tri._e2, limit, t, n);
+		});
+		if(found)
+		{
+			// The point where the face of the box touches the contact plane
+			const Vector3 &n = hit._normal;
+			float r = halfExtents._x * fabsf(n._x) + halfExtents._y * fabsf(n._y) + halfExtents._z * fabsf(n._z);
+			hit._point = ray.at(hit._t) - n * r;
+		}
+		return found;
+	}
+
+	inline void MeshBVH::sweepSphere(const Ray* rays, const float* radii, size_t count, SweepHit* hits,
+		const float* tMax, unsigned threads) const
+	{
+		ParallelFor(count, GU_BATCH_GRAIN / 16, [&](size_t begin, size_t end) {
+			for(size_t i = begin; i < end; i++)
+				sweepSphere(rays[i], radii[i], hits[i], tMax ? tMax[i] : 1e30f);
+		}, threads);
+	}
+
+	inline void MeshBVH::sweepBox(const Ray* rays, const Vector3* halfExtents, size_t count, SweepHit* hits,
+		const float* tMax, unsigned threads) const
+	{
+		ParallelFor(count, GU_BATCH_GRAIN / 16, [&](size_t begin, size_t end) {
+			for(size_t i = begin; i < end; i++)
+				sweepBox(rays[i], halfExtents[i], hits[i], tMax ? tMax[i] : 1e30f);
+		}, threads);
+	}
+
+	/*********************************************************/
+	// Rays of a packet are transposed into GU_LANES wide registers. Unused
+	// lanes get a negative tMax so that they never hit anything.
+	inline void MeshBVH::_loadPacket(const Ray* rays, size_t n, const float* tMax, _Packet &p) const
+	{
+		alignas(32) float a[10][GU_LANES];
+		for(size_t j = 0; j < GU_LANES; j++)
+		{
+			const Ray &r = rays[j < n ? j : n - 1];
+			a[0][j] = r._origin._x;
+			a[1][j] = r._origin._y;
+			a[2][j] = r._origin._z;
+			a[3][j] = r._direction._x;
+			a[4][j] = r._direction._y;
+			a[5][j] = r._direction._z;
+			a[6][j] = 1.0f / r._direction._x;
+			a[7][j] = 1.0f / r._direction._y;
+			a[8][j] = 1.0f / r._direction._z;
+			a[9][j] = j < n ? (tMax ? tMax[j] : 1e30f) : -1.0f;
+		}
+		p._ox = _LoadN(a[0]); p._oy = _LoadN(a[1]); p._oz = _LoadN(a[2]);
+		p._dx = _LoadN(a[3]); p._dy = _LoadN(a[4]); p._dz = _LoadN(a[5]);
+		p._ix = _LoadN(a[6]); p._iy = _LoadN(a[7]); p._iz = _LoadN(a[8]);
+		p._tMax = _LoadN(a[9]);
+		p._direction = rays[0]._direction;
+	}
+
+	// Mask of the lanes that enter the box before their current tMax
+	inline FloatN MeshBVH::_boxPacket(const BVHNode &node, const _Packet &p) const
+	{
+		FloatN x1 = _MulN(_SubN(_SetN(node._min._x), p._ox), p._ix), x2 = _MulN(_SubN(_SetN(node._max._x), p._ox), p._ix);
+		FloatN y1 = _MulN(_SubN(_SetN(node._min._y), p._oy), p._iy), y2 = _MulN(_SubN(_SetN(node._max._y), p._oy), p._iy);
+		FloatN z1 = _MulN(_SubN(_SetN(node._min._z), p._oz), p._iz), z2 = _MulN(_SubN(_SetN(node._max._z), p._oz), p._iz);
+		FloatN t0 = _MaxN(_MaxN(_MinN(x1, x2), _MinN(y1, y2)), _MaxN(_MinN(z1, z2), _SetN(0.0f)));
+		FloatN t1 = _MinN(_MinN(_MaxN(x1, x2), _MaxN(y1, y2)), _MinN(_MaxN(z1, z2), p._tMax));
+		return _CmpLeN(t0, t1);
+	}
+
+	// Möller-Trumbore for all lanes against one triangle, returns the
+	// mask of the lanes that hit it before their current tMax
+	inline FloatN MeshBVH::_trianglePacket(const _Triangle &tri, const _Packet &p, FloatN &t, FloatN &u, FloatN &v) const
+	{
+		FloatN e1x = _SetN(tri._e1._x), e1y = _SetN(tri._e1._y), e1z = _SetN(tri._e1._z);
+		FloatN e2x = _SetN(tri._e2._x), e2y = _SetN(tri._e2._y), e2z = _SetN(tri._e2._z);
+
+		FloatN px = _SubN(_MulN(p._dy, e2z), _MulN(p._dz, e2y));
+		FloatN py = _SubN(_MulN(p._dz, e2x), _MulN(p._dx, e2z));
+		FloatN pz = _SubN(_MulN(p._dx, e2y), _MulN(p._dy, e2x));
+		FloatN inv = _DivN(_SetN(1.0f), _AddN(_AddN(_MulN(e1x, px), _MulN(e1y, py)), _MulN(e1z, pz)));
+
+		FloatN sx = _SubN(p._ox, _SetN(tri._v0._x));
+		FloatN sy = _SubN(p._oy, _SetN(tri._v0._y));
+		FloatN sz = _SubN(p._oz, _SetN(tri._v0._z));
+		u = _MulN(_AddN(_AddN(_MulN(sx, px), _MulN(sy, py)), _MulN(sz, pz)), inv);
+
+		FloatN qx = _SubN(_MulN(sy, e1z), _MulN(sz, e1y));
+		FloatN qy = _SubN(_MulN(sz, e1x), _MulN(sx, e1z));
+		FloatN qz = _SubN(_MulN(sx, e1y), _MulN(sy, e1x));
+		v = _MulN(_AddN(_AddN(_MulN(p._dx, qx), _MulN(p._dy, qy)), _MulN(p._dz, qz)), inv);
+		t = _MulN(_AddN(_AddN(_MulN(e2x, qx), _MulN(e2y, qy)), _MulN(e2z, qz)), inv);
+
+		// A zero determinant gives NaN or infinite values, which fail the tests
+		FloatN zero = _SetN(0.0f);
+		FloatN m = _AndN(_CmpLeN(zero, u), _CmpLeN(zero, v));
+		m = _AndN(m, _CmpLeN(_AddN(u, v), _SetN(1.0f)));
+		return _AndN(m, _AndN(_CmpLeN(zero, t), _CmpLtN(t, p._tMax)));
+	}
+
+	template<bool AnyHit>
+	inline void MeshBVH::_tracePacket(const Ray* rays, size_t n, const float* tMax, RayHit* hits, bool* occluded) const
+	{
+		_Packet p;
+		_loadPacket(rays, n, tMax, p);
+		FloatN hu = _SetN(0.0f), hv = _SetN(0.0f);
+		uint32_t ids[GU_LANES];
+		for(int j = 0; j < GU_LANES; j++)
+			ids[j] = None;
+
+		int active = (1 << n) - 1, done = 0;
+		uint32_t stack[MaxDepth + 1];
+		int top = 0;
+		if(!_nodes.empty())
+			stack[top++] = 0;
+
+		while(top > 0 && done != active)
+		{
+			uint32_t index = stack[--top];
+			const BVHNode &node = _nodes[index];
+			if(_SignMaskN(_boxPacket(node, p)) == 0)
+				continue;
+
+			if(node.leaf())
+			{
+				for(uint32_t i = node._offset; i < node._offset + node._count; i++)
+				{
+					FloatN t, u, v;
+					FloatN m = _trianglePacket(_triangles[i], p, t, u, v);
+					int bits = _SignMaskN(m);
+					if(bits == 0)
+						continue;
+
+					if(AnyHit)
+					{
+						// Finished lanes get a negative tMax and drop out
+						done |= bits;
+						p._tMax = _SelectN(m, _SetN(-1.0f), p._tMax);
+					}
+					else
+					{
+						p._tMax = _SelectN(m, t, p._tMax);
+						hu = _SelectN(m, u, hu);
+						hv = _SelectN(m, v, hv);
+						for(; bits; bits &= bits - 1)
+							ids[_LowestBit(bits)] = _ids[i];
+					}
+				}
+			}
+			else
+			{
+				// Push the child farther along the first ray below the nearer one
+				uint32_t a = index + 1, b = node._offset;
+				Vector3 ca = _nodes[a]._min + _nodes[a]._max, cb = _nodes[b]._min + _nodes[b]._max;
+				if(p._direction.dot(cb - ca) < 0.0f)
+					std::swap(a, b);
+				stack[top++] = b;
+				stack[top++] = a;
+			}
+		}
+
+		if(AnyHit)
+		{
+			for(size_t j = 0; j < n; j++)
+				occluded[j] = (done >> j) & 1;
+		}
+		else
+		{
+			alignas(32) float t[GU_LANES], u[GU_LANES], v[GU_LANES];
+			_StoreN(t, p._tMax);
+			_StoreN(u, hu);
+			_StoreN(v, hv);
+			for(size_t j = 0; j < n; j++)
+			{
+				hits[j]._t = t[j];
+				hits[j]._u = u[j];
+				hits[j]._v = v[j];
+				hits[j]._triangle = ids[j];
+			}
+		}
+	}
+
+	inline void MeshBVH::intersect(const Ray* rays, size_t count, RayHit* hits, const float* tMax,
+		RayMode mode, unsigned threads) const
+	{
+		ParallelFor(count, GU_BATCH_GRAIN / 16, [&](size_t begin, size_t end) {
+			if(mode == RayMode::Coherent)
+			{
+				for(size_t i = begin; i < end; i += GU_LANES)
+					_tracePacket<false>(rays + i, end - i < GU_LANES ? end - i : GU_LANES,
+						tMax ? tMax + i : nullptr, hits + i, nullptr);
+			}
+			else
+			{
+				for(size_t i = begin; i < end; i++)
+					intersect(rays[i], hits[i], tMax ? tMax[i] : 1e30f);
+			}
+		}, threads);
+	}
+
+	inline void MeshBVH::occluded(const Ray* rays, size_t count, bool* occluded, const float* tMax,
+		RayMode mode, unsigned threads) const
+	{
+		ParallelFor(count, GU_BATCH_GRAIN / 16, [&](size_t begin, size_t end) {
+			if(mode == RayMode::Coherent)
+			{
+				for(size_t i = begin; i < end; i += GU_LANES)
+					_tracePacket<true>(rays + i, end - i < GU_LANES ? end - i : GU_LANES,
+						tMax ? tMax + i : nullptr, nullptr, occluded + i);
+			}
+			else
+			{
+				for(size_t i = begin; i < end; i++)
+					occluded[i] = this->occluded(rays[i], tMax ? tMax[i] : 1e30f);
+			}
+		}, threads);
+	}
+
+	inline AABB MeshBVH::bounds() const
+	{
+		return _nodes.empty() ? AABB() : AABB(_nodes[0]._min, _nodes[0]._max);
+	}
+
+	inline void MeshBVH::clear()
+	{
+		_nodes.clear();
+		_triangles.clear();
+		_ids.clear();
+		_buildSubtrees();
+	}
+
+	/*********************************************************/
+	struct ProxyPair
+	{
+		uint32_t _a, _b;	// _a < _b
+	};
+
+	inline uint64_t _PairKey(uint32_t a, uint32_t b)
+	{
+		return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+	}
+
+	// Finalizer of MurmurHash3
+	inline uint64_t _HashKey(uint64_t key)
+	{
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		key *= 0xc4ceb9fe1a85ec53ULL;
+		key ^= key >> 33;
+		return key;
+	}
+
+	// Open addressing hash map from pair keys to uint32_t values with
+	// linear probing and backward shift deletion
+	class _PairMap
+	{
+		public:
+			static constexpr uint64_t Empty = ~(uint64_t)0;
+
+			_PairMap() : _size(0) { }
+
+			uint32_t* find(uint64_t key);
+			// Returns false if the key was already present
+			bool insert(uint64_t key, uint32_t value);
+			bool erase(uint64_t key);
+			void clear();
+			size_t size() const { return _size; }
+
+		private:
+			size_t _slot(uint64_t key) const;
+			void _grow();
+
+		private:
+			std::vector<uint64_t> _keys;
+			std::vector<uint32_t> _values;
+			size_t _size;
+	};
+
+	inline size_t _PairMap::_slot(uint64_t key) const
+	{
+		return (size_t)_HashKey(key) & (_keys.size() - 1);
+	}
+
+	inline uint32_t* _PairMap::find(uint64_t key)
+	{
+		if(_size == 0)
+			return nullptr;
+		for(size_t i = _slot(key); _keys[i] != Empty; i = (i + 1) & (_keys.size() - 1))
+			if(_keys[i] == key)
+				return &_values[i];
+		return nullptr;
+	}
+
+	inline void _PairMap::_grow()
+	{
+		std::vector<uint64_t> keys;
+		std::vector<uint32_t> values;
+		keys.swap(_keys);
+		values.swap(_values);
+		_keys.assign(keys.empty() ? 64 : keys.size() * 2, Empty);
+		_values.resize(_keys.size());
+		_size = 0;
+		for(size_t i = 0; i < keys.size(); i++)
+			if(keys[i] != Empty)
+				insert(keys[i], values[i]);
+	}
+
+	inline bool _PairMap::insert(uint64_t key, uint32_t value)
+	{
+		if((_size + 1) * 2 > _keys.size())
+			_grow();
+
+		size_t i = _slot(key);
+		for(; _keys[i] != Empty; i = (i + 1) & (_keys.size() - 1))
+			if(_keys[i] == key)
+				return false;
+		_keys[i] = key;
+		_values[i] = value;
+		_size++;
+		return true;
+	}
+
+	inline bool _PairMap::erase(uint64_t key)
+	{
+		if(_size == 0)
+			return false;
+
+		size_t mask = _keys.size() - 1;
+		size_t i = _slot(key);
+		for(; _keys[i] != key; i = (i + 1) & mask)
+			if(_keys[i] == Empty)
+				return false;
+
+		// Move later entries of the probe sequence into the hole
+		for(size_t j = (i + 1) & mask; _keys[j] != Empty; j = (j + 1) & mask)
+		{
+			size_t home = _slot(_keys[j]);
+			if(((j - home) & mask) >= ((j - i) & mask))
+			{
+				_keys[i] = _keys[j];
+				_values[i] = _values[j];
+				i = j;
+			}
+		}
+		_keys[i] = Empty;
+		_size--;
+		return true;
+	}
+
+	inline void _PairMap::clear()
+	{
+		_keys.clear();
+		_values.clear();
+		_size = 0;
+	}
+
+	/*********************************************************/
+	// Incremental sweep and prune over AABBs. The endpoints of every axis
+	// are kept sorted in structure of arrays form and re-sorted with an
+	// insertion sort, so coherent motion costs about O(n). Endpoints that
+	// swap mark their pair, and only marked pairs are tested at the end of
+	// update(). After update() added() and removed() hold the pairs that
+	// started or stopped overlapping since the previous update, pairs()
+	// holds all overlapping pairs. Boxes that only touch do not overlap.
+	class SweepAndPrune
+	{
+		public:
+			typedef uint32_t Proxy;
+			static constexpr Proxy None = 0xFFFFFFFF;
+
+			SweepAndPrune() : _newProxies(0), _deadProxies(0), _published(false) { }
+
+			Proxy add(const AABB &box);
+			void remove(Proxy p);
+			void move(Proxy p, const AABB &box);
+			void update();
+
+			const std::vector<ProxyPair>& added() const { return _added; }
+			const std::vector<ProxyPair>& removed() const { return _removed; }
+			const std::vector<ProxyPair>& pairs() const { return _pairs; }
+
+			const AABB& box(Proxy p) const { return _boxes[p]; }
+			bool overlaps(Proxy a, Proxy b) const;
+			void clear();
+
+		private:
+			static uint32_t _endpoint(Proxy p, bool max) { return (p << 1) | (max ? 1 : 0); }
+			bool _less(int axis, size_t a, size_t b) const;
+			void _sortAxis(int axis);
+			void _rebuild();
+			void _compact();
+			void _beginEvents();
+			void _addPair(uint64_t key);
+			void _removePair(uint64_t key);
+
+		private:
+			// Sorted endpoints per axis, the value and (proxy << 1 | isMax)
+			std::vector<float> _values[3];
+			std::vector<uint32_t> _endpoints[3];
+			// Position of the min and max endpoint of each proxy per axis
+			std::vector<uint32_t> _positions[3][2];
+
+			std::vector<AABB> _boxes;
+			std::vector<Proxy> _free;
+			size_t _newProxies;
+			// Removed proxies whose endpoints are dropped by the next update()
+			std::vector<uint8_t> _dead;
+			size_t _deadProxies;
+
+			std::vector<uint64_t> _marked;
+			std::vector<ProxyPair> _pairs;
+			_PairMap _pairIndex;
+			std::vector<ProxyPair> _added;
+			std::vector<ProxyPair> _removed;
+			bool _published;
+	};
+
+	inline bool SweepAndPrune::overlaps(Proxy a, Proxy b) const
+	{
+		const AABB &x = _boxes[a], &y = _boxes[b];
+		return x._min._x < y._max._x && y._min._x < x._max._x &&
+			x._min._y < y._max._y && y._min._y < x._max._y &&
+			x._min._z < y._max._z && y._min._z < x._max._z;
+	}
+
+	// Ties put max endpoints before min endpoints, touching is no overlap
+	inline bool SweepAndPrune::_less(int axis, size_t a, size_t b) const
+	{
+		float va = _values[axis][a], vb = _values[axis][b];
+		return va < vb || (va == vb && (_endpoints[axis][a] & 1) > (_endpoints[axis][b] & 1));
+	}
+
+	inline void SweepAndPrune::_beginEvents()
+	{
+		if(_published)
+		{
+			_added.clear();
+			_removed.clear();
+			_published = false;
+		}
+	}
+
+	inline SweepAndPrune::Proxy SweepAndPrune::add(const AABB &box)
+	{
+		Proxy p;
+		if(!_free.empty())
+		{
+			p = _free.back();
+			_free.pop_back();
+			_boxes[p] = box;
+		}
+		else
+		{
+			p = (Proxy)_boxes.size();
+			_boxes.push_back(box);
+			_dead.push_back(0);
+			for(int a = 0; a < 3; a++)
+			{
+				_positions[a][0].push_back(0);
+				_positions[a][1].push_back(0);
+			}
+		}
+
+		// The endpoints are appended and sorted into place by update()
+		for(int a = 0; a < 3; a++)
+		{
+			for(int m = 0; m < 2; m++)
+			{
+				_positions[a][m][p] = (uint32_t)_values[a].size();
+				_values[a].push_back(m ? box._max[a] : box._min[a]);
+				_endpoints[a].push_back(_endpoint(p, m != 0));
+			}
+		}
+		_newProxies++;
+		return p;
+	}
+
+	inline void SweepAndPrune::move(Proxy p, const AABB &box)
+	{
+		_boxes[p] = box;
+		for(int a = 0; a < 3; a++)
+		{
+			_values[a][_positions[a][0][p]] = box._min[a];
+			_values[a][_positions[a][1][p]] = box._max[a];
+		}
+	}
+
+	// The proxy is only marked, the next update() drops the endpoints and
+	// pairs of all removed proxies in one pass and reports the pairs in
+	// removed(). The proxy is reused only after that.
+	inline void SweepAndPrune::remove(Proxy p)
+	{
+		_dead[p] = 1;
+		_deadProxies++;
+	}
+
+	inline void SweepAndPrune::_compact()
+	{
+		for(size_t i = 0; i < _pairs.size(); )
+		{
+			if(_dead[_pairs[i]._a] || _dead[_pairs[i]._b])
+				_removePair(_PairKey(_pairs[i]._a, _pairs[i]._b));
+			else
+				i++;
+		}
+
+		// Drop the endpoints and close the gaps
+		for(int a = 0; a < 3; a++)
+		{
+			size_t n = 0;
+			for(size_t i = 0; i < _values[a].size(); i++)
+			{
+				uint32_t e = _endpoints[a][i];
+				if(_dead[e >> 1])
+					continue;
+				_values[a][n] = _values[a][i];
+				_endpoints[a][n] = e;
+				_positions[a][e & 1][e >> 1] = (uint32_t)n;
+				n++;
+			}
+			_values[a].resize(n);
+			_endpoints[a].resize(n);
+		}
+
+		for(Proxy p = 0; p < (Proxy)_dead.size(); p++)
+		{
+			if(_dead[p])
+			{
+				_dead[p] = 0;
+				_free.push_back(p);
+			}
+		}
+		_deadProxies = 0;
+	}
+
+	inline void SweepAndPrune::_addPair(uint64_t key)
+	{
+		ProxyPair pair = { (uint32_t)(key >> 32), (uint32_t)key };
+		_pairIndex.insert(key, (uint32_t)_pairs.size());
+		_pairs.push_back(pair);
+		_added.push_back(pair);
+	}
+
+	inline void SweepAndPrune::_removePair(uint64_t key)
+	{
+		uint32_t i = *_pairIndex.find(key);
+		_removed.push_back(_pairs[i]);
+		_pairIndex.erase(key);
+		if(i + 1 < _pairs.size())
+		{
+			_pairs[i] = _pairs.back();
+			*_pairIndex.find(_PairKey(_pairs[i]._a, _pairs[i]._b)) = i;
+		}
+		_pairs.pop_back();
+	}
+
+	inline void SweepAndPrune::_sortAxis(int axis)
+	{
+		std::vector<float> &values = _values[axis];
+		std::vector<uint32_t> &endpoints = _endpoints[axis];
+
+		for(size_t i = 1; i < values.size(); i++)
+		{
+			for(size_t j = i; j > 0 && _less(axis, j, j - 1); j--)
+			{
+				// A min passing a max starts an overlap on this axis and a
+				// max passing a min ends one, either way the pair is marked
+				uint32_t e = endpoints[j], f = endpoints[j - 1];
+				if((e & 1) != (f & 1) && (e >> 1) != (f >> 1))
+					_marked.push_back(_PairKey(e >> 1, f >> 1));
+
+				std::swap(values[j], values[j - 1]);
+				std::swap(endpoints[j], endpoints[j - 1]);
+				_positions[axis][e & 1][e >> 1] = (uint32_t)(j - 1);
+				_positions[axis][f & 1][f >> 1] = (uint32_t)j;
+			}
+		}
+	}
+
+	// Full sort and sweep along x, used when many proxies were added
+	inline void SweepAndPrune::_rebuild()
+	{
+		for(int a = 0; a < 3; a++)
+		{
+			size_t n = _values[a].size();
+			std::vector<uint32_t> order(n);
+			for(size_t i = 0; i < n; i++)
+				order[i] = (uint32_t)i;
+			std::sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y) { return _less(a, x, y); });
+
+			std::vector<float> values(n);
+			std::vector<uint32_t> endpoints(n);
+			for(size_t i = 0; i < n; i++)
+			{
+				values[i] = _values[a][order[i]];
+				endpoints[i] = _endpoints[a][order[i]];
+				_positions[a][endpoints[i] & 1][endpoints[i] >> 1] = (uint32_t)i;
+			}
+			_values[a].swap(values);
+			_endpoints[a].swap(endpoints);
+		}
+
+		// Every pair that overlaps now or did before is marked
+		std::vector<Proxy> active;
+		for(uint32_t e : _endpoints[0])
+		{
+			Proxy p = e >> 1;
+			if(e & 1)
+			{
+				active.erase(std::find(active.begin(), active.end(), p));
+				continue;
+			}
+			for(Proxy q : active)
+				if(overlaps(p, q))
+					_marked.push_back(_PairKey(p, q));
+			active.push_back(p);
+		}
+		for(const ProxyPair &pair : _pairs)
+			_marked.push_back(_PairKey(pair._a, pair._b));
+	}
+
+	inline void SweepAndPrune::update()
+	{
+		_beginEvents();
+		if(_deadProxies)
+			_compact();
+
+		if(_newProxies > 64 && _newProxies * 8 > _boxes.size())
+		{
+			_rebuild();
+		}
+		else
+		{
+			for(int a = 0; a < 3; a++)
+				_sortAxis(a);
+		}
+		_newProxies = 0;
+
+		// Resolve the marked pairs against their current state
+		std::sort(_marked.begin(), _marked.end());
+		_marked.erase(std::unique(_marked.begin(), _marked.end()), _marked.end());
+		for(uint64_t key : _marked)
+		{
+			bool overlap = overlaps((Proxy)(key >> 32), (Proxy)key);
+			bool known = _pairIndex.find(key) != nullptr;
+			if(overlap && !known)
+				_addPair(key);
+			else if(!overlap && known)
+				_removePair(key);
+		}
+		_marked.clear();
+		_published = true;
+	}
+
+	inline void SweepAndPrune::clear()
+	{
+		for(int a = 0; a < 3; a++)
+		{
+			_values[a].clear();
+			_endpoints[a].clear();
+			_positions[a][0].clear();
+			_positions[a][1].clear();
+		}
+		_boxes.clear();
+		_free.clear();
+		_newProxies = 0;
+		_dead.clear();
+		_deadProxies = 0;
+		_marked.clear();
+		_pairs.clear();
+		_pairIndex.clear();
+		_added.clear();
+		_removed.clear();
+		_published = false;
+	}
+
+	/*********************************************************/
+	// Uniform grid over points, hashed into an open addressing cell table.
+	// build() sorts the points by cell with a counting sort so that every
+	// cell is a contiguous range. The table is split into shards and every
+	// thread owns a range of them, which makes the parallel build lock free
+	// and its result independent of the thread count. Cell coordinates wrap after
+	// 2^21 cells per axis, distant points then share a cell but queries
+	// still only return points within the radius.
+	class SpatialHashGrid
+	{
+		public:
+			static constexpr size_t Shards = 64;
+
+			explicit SpatialHashGrid(float cellSize = 1.0f) : _cellSize(cellSize) { }
+
+			void setCellSize(float cellSize) { _cellSize = cellSize; }
+			float cellSize() const { return _cellSize; }
+
+			void build(const Vector3* points, size_t count, unsigned threads = 1);
+			void build(const std::vector<Vector3> &points, unsigned threads = 1) { build(points.data(), points.size(), threads); }
+
+			// Calls func(index) for every point within radius of center
+			template<typename Func>
+			void query(const Vector3 &center, float radius, Func func) const;
+			void query(const Vector3 &center, float radius, std::vector<uint32_t> &indices) const;
+
+			// Neighbours of many query points. The indices of query i are
+			// indices[offsets[i]] to indices[offsets[i + 1] - 1].
+			void query(const Vector3* centers, size_t count, float radius,
+				std::vector<uint32_t> &offsets, std::vector<uint32_t> &indices, unsigned threads = 1) const;
+
+			size_t size() const { return _order.size(); }
+			const Vector3& point(size_t i) const { return _points[i]; }
+
+		private:
+			static constexpr uint64_t Empty = ~(uint64_t)0;
+
+			uint64_t _cellKey(int x, int y, int z) const;
+			int _cell(float v) const { return (int)floorf(v / _cellSize); }
+			size_t _find(uint64_t key, uint64_t hash) const;
+			size_t _shard(uint64_t hash) const { return (size_t)((hash >> 32) * Shards >> 32); }
+
+		private:
+			float _cellSize;
+			// First slot of every shard, each shard has a power of two size
+			// of at least twice its points, so it is at most half full
+			std::vector<size_t> _shardBase;
+
+			std::vector<uint64_t> _keys;
+			std::vector<uint32_t> _start;
+			std::vector<uint32_t> _count;
+
+			std::vector<Vector3> _points;	// Sorted by cell
+			std::vector<uint32_t> _order;	// Original index of the sorted points
+	};
+
+	inline uint64_t SpatialHashGrid::_cellKey(int x, int y, int z) const
+	{
+		return ((uint64_t)(x & 0x1FFFFF) << 42) | ((uint64_t)(y & 0x1FFFFF) << 21) | (uint64_t)(z & 0x1FFFFF);
+	}
+
+	// Slot of the key, or of the empty slot that ends its probe sequence
+	inline size_t SpatialHashGrid::_find(uint64_t key, uint64_t hash) const
+	{
+		size_t s = _shard(hash);
+		size_t base = _shardBase[s], mask = _shardBase[s + 1] - base - 1;
+		size_t i = (size_t)hash & mask;
+		while(_keys[base + i] != Empty && _keys[base + i] != key)
+			i = (i + 1) & mask;
+		return base + i;
+	}
+
+	inline void SpatialHashGrid::build(const Vector3* points, size_t count, unsigned threads)
+	{
+		threads = count >= GU_BATCH_GRAIN ? ThreadCount(threads) : 1;
+		std::vector<uint64_t> keys(count), hashes(count);
+		ParallelFor(count, GU_BATCH_GRAIN, [&](size_t begin, size_t end) {
+			for(size_t i = begin; i < end; i++)
+			{
+				keys[i] = _cellKey(_cell(points[i]._x), _cell(points[i]._y), _cell(points[i]._z));
+				hashes[i] = _HashKey(keys[i]);
+			}
+		}, threads);
+
+		// Counting sort of the points by shard over fixed batches, every
+		// shard lists its points in ascending order
+		size_t batches = (count + GU_BATCH_GRAIN - 1) / GU_BATCH_GRAIN;
+		std::vector<uint32_t> histogram(batches * Shards, 0);
+		ParallelFor(batches, 1, [&](size_t first, size_t last) {
+			for(size_t b = first; b < last; b++)
+			{
+				size_t end = (b + 1) * GU_BATCH_GRAIN < count ? (b + 1) * GU_BATCH_GRAIN : count;
+				for(size_t i = b * GU_BATCH_GRAIN; i < end; i++)
+					histogram[b * Shards + _shard(hashes[i])]++;
+			}
+		}, threads);
+
+		std::vector<uint32_t> shardStart(Shards + 1, 0);
+		uint32_t offset = 0;
+		for(size_t s = 0; s < Shards; s++)
+		{
+			shardStart[s] = offset;
+			for(size_t b = 0; b < batches; b++)
+			{
+				uint32_t n = histogram[b * Shards + s];
+				histogram[b * Shards + s] = offset;
+				offset += n;
+			}
+		}
+		shardStart[Shards] = offset;
+
+		// A shard has at most as many cells as points
+		_shardBase.assign(Shards + 1, 0);
+		for(size_t s = 0; s < Shards; s++)
+		{
+			size_t size = 16;
+			while(size < 2 * (size_t)(shardStart[s + 1] - shardStart[s]))
+				size *= 2;
+			_shardBase[s + 1] = _shardBase[s] + size;
+		}
+		_keys.assign(_shardBase[Shards], Empty);
+		_start.assign(_keys.size(), 0);
+		_count.assign(_keys.size(), 0);
+
+		std::vector<uint32_t> byShard(count);
+		ParallelFor(batches, 1, [&](size_t first, size_t last) {
+			for(size_t b = first; b < last; b++)
+			{
+				size_t end = (b + 1) * GU_BATCH_GRAIN < count ? (b + 1) * GU_BATCH_GRAIN : count;
+				for(size_t i = b * GU_BATCH_GRAIN; i < end; i++)
+					byShard[histogram[b * Shards + _shard(hashes[i])]++] = (uint32_t)i;
+			}
+		}, threads);
+
+		// Every thread owns a range of shards, it first counts the points
+		// of their cells and then scatters them
+		std::vector<uint32_t> slots(count);
+		ParallelFor(Shards, 1, [&](size_t first, size_t last) {
+			for(uint32_t j = shardStart[first]; j < shardStart[last]; j++)
+			{
+				uint32_t i = byShard[j];
+				size_t slot = _find(keys[i], hashes[i]);
+				_keys[slot] = keys[i];
+				_count[slot]++;
+				slots[i] = (uint32_t)slot;
+			}
+		}, threads);
+
+		_points.resize(count);
+		_order.resize(count);
+		ParallelFor(Shards, 1, [&](size_t first, size_t last) {
+			for(size_t s = first; s < last; s++)
+			{
+				uint32_t start = shardStart[s];
+				for(size_t slot = _shardBase[s]; slot < _shardBase[s + 1]; slot++)
+				{
+					_start[slot] = start;
+					start += _count[slot];
+				}
+			}
+
+			for(uint32_t j = shardStart[first]; j < shardStart[last]; j++)
+			{
+				uint32_t i = byShard[j];
+				uint32_t k = _start[slots[i]]++;
+				_points[k] = points[i];
+				_order[k] = i;
+			}
+
+			// The scatter moved every start to the end of its cell
+			for(size_t slot = _shardBase[first]; slot < _shardBase[last]; slot++)
+				_start[slot] -= _count[slot];
+		}, threads);
+	}
+
+	template<typename Func>
+	inline void SpatialHashGrid::query(const Vector3 &center, float radius, Func func) const
+	{
+		if(_order.empty())
+			return;
+
+		float r2 = radius * radius;
+		int x0 = _cell(center._x - radius), x1 = _cell(center._x + radius);
+		int y0 = _cell(center._y - radius), y1 = _cell(center._y + radius);
+		int z0 = _cell(center._z - radius), z1 = _cell(center._z + radius);
+		for(int x = x0; x <= x1; x++)
+		{
+			for(int y = y0; y <= y1; y++)
+			{
+				for(int z = z0; z <= z1; z++)
+				{
+					uint64_t key = _cellKey(x, y, z);
+					size_t slot = _find(key, _HashKey(key));
+					if(_keys[slot] == Empty)
+						continue;
+					for(uint32_t i = _start[slot]; i < _start[slot] + _count[slot]; i++)
+						if((_points[i] - center).length2() <= r2)
+							func(_order[i]);
+				}
+			}
+		}
+	}
+
+	inline void SpatialHashGrid::query(const Vector3 &center, float radius, std::vector<uint32_t> &indices) const
+	{
+		query(center, radius, [&indices](uint32_t i) { indices.push_back(i); });
+	}
+
+	// Runs func(i, results) for count queries and packs the results as
+	// offsets and indices. Chunks collect their results separately and are
+	// appended in order.
+	template<typename Func>
+	inline void _BatchQuery(size_t count, std::vector<uint32_t> &offsets, std::vector<uint32_t> &indices,
+		unsigned threads, Func func)
+	{
+		size_t chunks = count >= GU_BATCH_GRAIN / 16 ? 4 * (size_t)ThreadCount(threads) : 1;
+		size_t step = (count + chunks - 1) / chunks;
+		std::vector<std::vector<uint32_t> > results(chunks);
+		offsets.resize(count + 1);
+		ParallelFor(chunks, 1, [&](size_t first, size_t last) {
+			for(size_t k = first; k < last; k++)
+			{
+				size_t end = (k + 1) * step < count ? (k + 1) * step : count;
+				for(size_t i = k * step; i < end; i++)
+				{
+					offsets[i] = (uint32_t)results[k].size();
+					func(i, results[k]);
+				}
+			}
+		}, threads);
+
+		indices.clear();
+		for(size_t k = 0; k < chunks; k++)
+		{
+			size_t end = (k + 1) * step < count ? (k + 1) * step : count;
+			for(size_t i = k * step; i < end; i++)
+				offsets[i] += (uint32_t)indices.size();
+			indices.insert(indices.end(), results[k].begin(), results[k].end());
+		}
+		offsets[count] = (uint32_t)indices.size();
+	}
+
+	inline void SpatialHashGrid::query(const Vector3* centers, size_t count, float radius,
+		std::vector<uint32_t> &offsets, std::vector<uint32_t> &indices, unsigned threads) const
+	{
+		_BatchQuery(count, offsets, indices, threads, [&](size_t i, std::vector<uint32_t> &out) {
+			query(centers[i], radius, out);
+		});
+	}
+
+	/*********************************************************/
+	// Static k-d tree over points in an implicit left balanced layout:
+	// node i is a point and its children are the nodes 2i + 1 and 2i + 2,
+	// so the tree only stores the points in node order, their original
+	// indices and the split axes. Subtrees with more than GU_BATCH_GRAIN
+	// points are built on separate threads.
+	class KdTree
+	{
+		public:
+			static constexpr uint32_t None = 0xFFFFFFFF;
+
+			void build(const Vector3* points, size_t count, unsigned threads = 1);
+			void build(const std::vector<Vector3> &points, unsigned threads = 1) { build(points.data(), points.size(), threads); }
+
+			// Index of the nearest point, None if the tree is empty
+			uint32_t nearest(const Vector3 &p, float* distance2 = nullptr) const;
+			// Up to k nearest points closer than maxDistance, sorted by their
+			// distance. Returns the number of points found.
+			size_t nearest(const Vector3 &p, size_t k, uint32_t* indices, float* distances2 = nullptr,
+				float maxDistance = 1e30f) const;
+
+			// Calls func(index) for every point within radius of center
+			template<typename Func>
+			void query(const Vector3 &center, float radius, Func func) const;
+			void query(const Vector3 &center, float radius, std::vector<uint32_t> &indices) const;
+
+			// k nearest points of many query points, query i writes
+			// indices[i * k] to indices[i * k + k - 1], missing points are None
+			void nearest(const Vector3* points, size_t count, size_t k, uint32_t* indices,
+				float* distances2 = nullptr, float maxDistance = 1e30f, unsigned threads = 1) const;
+			// Same layout as SpatialHashGrid::query
+			void query(const Vector3* centers, size_t count, float radius,
+				std::vector<uint32_t> &offsets, std::vector<uint32_t> &indices, unsigned threads = 1) const;
+
+			size_t size() const { return _points.size(); }
+			void clear();
+
+		private:
+			struct _Entry
+			{
+				Vector3 _point;
+				uint32_t _id;
+			};
+
+			static size_t _LeftSize(size_t count);
+			void _build(_Entry* entries, size_t count, size_t node, unsigned threads);
+			size_t _nearest(const Vector3 &p, size_t k, float maxDistance2, uint32_t* indices, float* distances2) const;
+
+		private:
+			std::vector<Vector3> _points;	// In node order
+			std::vector<uint32_t> _ids;		// Original index of each node
+			std::vector<uint8_t> _axes;
+	};
+
+	// Size of the left subtree of a complete binary tree with count nodes
+	inline size_t KdTree::_LeftSize(size_t count)
+	{
+		if(count <= 1)
+			return 0;
+		size_t full = 1;
+		while(2 * full + 1 <= count)
+			full = 2 * full + 1;
+		// full nodes in the complete levels, the rest fills the last level
+		// from the left
+		size_t half = (full + 1) / 2;
+		size_t last = count - full;
+		return (half - 1) + (last < half ? last : half);
+	}
+
+	inline void KdTree::build(const Vector3* points, size_t count, unsigned threads)
+	{
+		// The points are partitioned together with their indices, which
+		// keeps the partitioning in contiguous memory
+		std::vector<_Entry> entries(count);
+		for(size_t i = 0; i < count; i++)
+			entries[i] = { points[i], (uint32_t)i };
+
+		_points.resize(count);
+		_ids.resize(count);
+		_axes.resize(count);
+		if(count > 0)
+			_build(entries.data(), count, 0, ThreadCount(threads));
+	}
+
+	inline void KdTree::_build(_Entry* entries, size_t count, size_t node, unsigned threads)
+	{
+		// Split the largest extent at the point that keeps the tree left balanced
+		AABB box;
+		for(size_t i = 0; i < count; i++)
+			box.grow(entries[i]._point);
+		Vector3 e = box._max - box._min;
+		int axis = e._x >= e._y && e._x >= e._z ? 0 : e._y >= e._z ? 1 : 2;
+
+		size_t left = _LeftSize(count);
+		std::nth_element(entries, entries + left, entries + count, [axis](const _Entry &a, const _Entry &b) {
+			return a._point[axis] < b._point[axis];
+		});
+		_points[node] = entries[left]._point;
+		_ids[node] = entries[left]._id;
+		_axes[node] = (uint8_t)axis;
+
+		size_t right = count - left - 1;
+		if(threads > 1 && count >= GU_BATCH_GRAIN && right > 0)
+		{
+			std::thread worker([&]() { _build(entries + left + 1, right, 2 * node + 2, threads - threads / 2); });
+			_build(entries, left, 2 * node + 1, threads / 2);
+			worker.join();
+			return;
+		}
+		if(left > 0)
+			_build(entries, left, 2 * node + 1, 1);
+		if(right > 0)
+			_build(entries + left + 1, right, 2 * node + 2, 1);
+	}
+
+	// The k best points are kept in a max heap on distances2
+	inline size_t KdTree::_nearest(const Vector3 &p, size_t k, float maxDistance2, uint32_t* indices, float* distances2) const
+	{
+		size_t n = 0;
+		if(k == 0 || _points.empty())
+			return 0;
+
+		auto swap = [&](size_t a, size_t b) {
+			std::swap(indices[a], indices[b]);
+			std::swap(distances2[a], distances2[b]);
+		};
+		auto siftDown = [&](size_t i, size_t size) {
+			while(2 * i + 1 < size)
+			{
+				size_t c = 2 * i + 1;
+				if(c + 1 < size && distances2[c + 1] > distances2[c])
+					c++;
+				if(distances2[c] <= distances2[i])
+					break;
+				swap(i, c);
+				i = c;
+			}
+		};
+
+		size_t stack[64];
+		float bound[64];
+		int top = 0;
+		stack[top] = 0;
+		bound[top++] = 0.0f;
+		while(top > 0)
+		{
+			top--;
+			size_t i = stack[top];
+			float b = bound[top];
+			float worst = n < k ? maxDistance2 : distances2[0];
+			if(b >= worst)
+				continue;
+
+			float d2 = (_points[i] - p).length2();
+			if(d2 < worst)
+			{
+				if(n < k)
+				{
+					// Sift the new point up
+					size_t c = n++;
+					indices[c] = _ids[i];
+					distances2[c] = d2;
+					for(; c > 0 && distances2[(c - 1) / 2] < distances2[c]; c = (c - 1) / 2)
+						swap(c, (c - 1) / 2);
+				}
+				else
+				{
+					indices[0] = _ids[i];
+					distances2[0] = d2;
+					siftDown(0, n);
+				}
+				worst = n < k ? maxDistance2 : distances2[0];
+			}
+
+			// Visit the side of the query point first
+			float diff = p[_axes[i]] - _points[i][_axes[i]];
+			size_t nearChild = diff < 0.0f ? 2 * i + 1 : 2 * i + 2, farChild = diff < 0.0f ? 2 * i + 2 : 2 * i + 1;
+			if(farChild < _points.size() && diff * diff < worst)
+			{
+				stack[top] = farChild;
+				bound[top++] = diff * diff;
+			}
+			if(nearChild < _points.size())
+			{
+				stack[top] = nearChild;
+				bound[top++] = b;
+			}
+		}
+
+		// Heap sort to ascending distances
+		for(size_t size = n; size > 1; size--)
+		{
+			swap(0, size - 1);
+			siftDown(0, size - 1);
+		}
+		return n;
+	}
+
+	inline size_t KdTree::nearest(const Vector3 &p, size_t k, uint32_t* indices, float* distances2, float maxDistance) const
+	{
+		float local[64];
+		std::vector<float> heap;
+		if(!distances2)
+		{
+			if(k > 64)
+				heap.resize(k);
+			distances2 = k > 64 ? heap.data() : local;
+		}
+		return _nearest(p, k, maxDistance < 1e15f ? maxDistance * maxDistance : 1e30f, indices, distances2);
+	}
+
+	inline uint32_t KdTree::nearest(const Vector3 &p, float* distance2) const
+	{
+		uint32_t index = None;
+		float d2 = 1e30f;
+		_nearest(p, 1, 1e30f, &index, &d2);
+		if(distance2)
+			*distance2 = d2;
+		return index;
+	}
+
+	template<typename Func>
+	inline void KdTree::query(const Vector3 &center, float radius, Func func) const
+	{
+		if(_points.empty())
+			return;
+
+		float r2 = radius * radius;
+		size_t stack[64];
+		int top = 0;
+		stack[top++] = 0;
+		while(top > 0)
+		{
+			size_t i = stack[--top];
+			if((_points[i] - center).length2() <= r2)
+				func(_ids[i]);
+
+			float diff = center[_axes[i]] - _points[i][_axes[i]];
+			if(2 * i + 2 < _points.size() && diff >= -radius)
+				stack[top++] = 2 * i + 2;
+			if(2 * i + 1 < _points.size() && diff <= radius)
+				stack[top++] = 2 * i + 1;
+		}
+	}
+
+	inline void KdTree::query(const Vector3 &center, float radius, std::vector<uint32_t> &indices) const
+	{
+		query(center, radius, [&indices](uint32_t i) { indices.push_back(i); });
+	}
+
+	inline void KdTree::nearest(const Vector3* points, size_t count, size_t k, uint32_t* indices,
+		float* distances2, float maxDistance, unsigned threads) const
+	{
+		ParallelFor(count, GU_BATCH_GRAIN / 16, [&](size_t begin, size_t end) {
+			std::vector<float> heap(distances2 ? 0 : k);
+			for(size_t i = begin; i < end; i++)
+			{
+				float* d = distances2 ? distances2 + i * k : heap.data();
+				size_t n = nearest(points[i], k, indices + i * k, d, maxDistance);
+				for(size_t j = n; j < k; j++)
+				{
+					indices[i * k + j] = None;
+					d[j] = 1e30f;
+				}
+			}
+		}, threads);
+	}
+
+	inline void KdTree::query(const Vector3* centers, size_t count, float radius,
+		std::vector<uint32_t> &offsets, std::vector<uint32_t> &indices, unsigned threads) const
+	{
+		_BatchQuery(count, offsets, indices, threads, [&](size_t i, std::vector<uint32_t> &out) {
+			query(centers[i], radius, out);
+		});
+	}
+
+	inline void KdTree::clear()
+	{
+		_points.clear();
+		_ids.clear();
+		_axes.clear();
+	}
+
+
+	/*********************************************************/
+	// Convex shapes for GJK and EPA, given in local space and placed with a
+	// rigid Affine (rotation and translation only). Spheres and capsules
+	// are a point and a segment with a radius, GJK works on these cores and
+	// adds the radius as a margin.
+	enum class ShapeType { Sphere, Box, Capsule, Hull };
+
+	class ConvexShape
+	{
+		public:
+			ConvexShape() : _type(ShapeType::Sphere), _radius(0.0f), _halfHeight(0.0f) { }
+
+			static ConvexShape sphere(float radius);
+			static ConvexShape box(const Vector3 &halfExtents);
+			// Segment from (0, -halfHeight, 0) to (0, halfHeight, 0)
+			static ConvexShape capsule(float radius, float halfHeight);
+			static ConvexShape hull(const Vector3* points, size_t count);
+
+			// Farthest point along d without and with the radius
+			Vector3 coreSupport(const Vector3 &d) const;
+			Vector3 support(const Vector3 &d) const;
+			// Radius of the sphere around the local origin that contains the shape
+			float boundingRadius() const;
+
+		public:
+			ShapeType _type;
+			float _radius;
+			float _halfHeight;
+			Vector3 _halfExtents;
+			std::vector<Vector3> _points;
+	};
+
+	inline ConvexShape ConvexShape::sphere(float radius)
+	{
+		ConvexShape s;
+		s._type = ShapeType::Sphere;
+		s._radius = radius;
+		return s;
+	}
+
+	inline ConvexShape ConvexShape::box(const Vector3 &halfExtents)
+	{
+		ConvexShape s;
+		s._type = ShapeType::Box;
+		s._halfExtents = halfExtents;
+		return s;
+	}
+
+	inline ConvexShape ConvexShape::capsule(float radius, float halfHeight)
+	{
+		ConvexShape s;
+		s._type = ShapeType::Capsule;
+		s._radius = radius;
+		s._halfHeight = halfHeight;
+		return s;
+	}
+
+	inline ConvexShape ConvexShape::hull(const Vector3* points, size_t count)
+	{
+		ConvexShape s;
+		s._type = ShapeType::Hull;
+		s._points.assign(points, points + count);
+		return s;
+	}
+
+	inline Vector3 ConvexShape::coreSupport(const Vector3 &d) const
+	{
+		switch(_type)
+		{
+			case ShapeType::Box:
+				return Vector3(d._x < 0.0f ? -_halfExtents._x : _halfExtents._x,
+					d._y < 0.0f ? -_halfExtents._y : _halfExtents._y,
+					d._z < 0.0f ? -_halfExtents._z : _halfExtents._z);
+			case ShapeType::Capsule:
+				return Vector3(0.0f, d._y < 0.0f ? -_halfHeight : _halfHeight, 0.0f);
+			case ShapeType::Hull:
+			{
+				size_t best = 0;
+				float bestDot = -1e30f;
+				for(size_t i = 0; i < _points.size(); i++)
+				{
+					float dot = _points[i].dot(d);
+					if(dot > bestDot)
+					{
+						bestDot = dot;
+						best = i;
+					}
+				}
+				return _points.empty() ? Vector3() : _points[best];
+			}
+			default:
+				return Vector3();
+		}
+	}
+
+	inline float ConvexShape::boundingRadius() const
+	{
+		switch(_type)
+		{
+			case ShapeType::Box:
+				return _halfExtents.length();
+			case ShapeType::Capsule:
+				return _halfHeight + _radius;
+			case ShapeType::Hull:
+			{
+				float r = 0.0f;
+				for(const Vector3 &p : _points)
+					r = max(r, p.length2());
+				return sqrtf(r);
+			}
+			default:
+				return _radius;
+		}
+	}
+
+	inline Vector3 ConvexShape::support(const Vector3 &d) const
+	{
+		Vector3 p = coreSupport(d);
+		float l = d.length();
+		return _radius > 0.0f && l > 0.0f ? p + d * (_radius / l) : p;
+	}
+
+	/*********************************************************/
+	// The simplex of the last query. Passing it to the next query of the
+	// same pair starts GJK close to the answer, for slowly moving shapes
+	// that takes one or two iterations.
+	struct GJKCache
+	{
+		Vector3 _localA[4], _localB[4];
+		int _count = 0;
+		int _iterations = 0;	// Support evaluations of the last query
+	};
+
+	struct ContactPoint
+	{
+		Vector3 _pointA, _pointB;	// Deepest points of A and B in world space
+		Vector3 _normal;			// From A to B
+		float _depth;				// Penetration depth
+	};
+
+	// Vertex of the Minkowski difference, w = a - b
+	struct _SimplexVertex
+	{
+		Vector3 _w, _a, _b, _localA, _localB;
+	};
+
+	struct _Simplex
+	{
+		_SimplexVertex _v[4];
+		float _l[4];	// Barycentric coordinates of the closest point
+		int _count;
+	};
+
+	// Direction d rotated into the frame of a rigid transform
+	inline Vector3 _InverseRotate(const Affine &t, const Vector3 &d)
+	{
+		return Vector3(t._m11 * d._x + t._m21 * d._y + t._m31 * d._z,
+			t._m12 * d._x + t._m22 * d._y + t._m32 * d._z,
+			t._m13 * d._x + t._m23 * d._y + t._m33 * d._z);
+	}
+
+	// Support of A - B along d
+	inline _SimplexVertex _Support(const ConvexShape &sa, const Affine &ta, const ConvexShape &sb, const Affine &tb,
+		const Vector3 &d, bool core)
+	{
+		_SimplexVertex v;
+		Vector3 da = _InverseRotate(ta, d), db = _InverseRotate(tb, -d);
+		v._localA = core ? sa.coreSupport(da) : sa.support(da);
+		v._localB = core ? sb.coreSupport(db) : sb.support(db);
+		v._a = ta.transformPoint(v._localA);
+		v._b = tb.transformPoint(v._localB);
+		v._w = v._a - v._b;
+		return v;
+	}
+
+	inline void _SimplexSet(_Simplex &s, const _SimplexVertex* const* v, const float* l, int count)
+	{
+		_SimplexVertex tmp[4];
+		for(int i = 0; i < count; i++)
+			tmp[i] = *v[i];
+		for(int i = 0; i < count; i++)
+		{
+			s._v[i] = tmp[i];
+			s._l[i] = l[i];
+		}
+		s._count = count;
+	}
+
+	// Closest point of the triangle abc to the origin, Ericson 5.1.5.
+	// Reduces the simplex to the feature that contains it.
+	inline Vector3 _ClosestTriangle(_Simplex &s, const _SimplexVertex &A, const _SimplexVertex &B, const _SimplexVertex &C)
+	{
+		const Vector3 &a = A._w, &b = B._w, &c = C._w;
+		Vector3 ab = b - a, ac = c - a;
+		const _SimplexVertex* v[3];
+		float l[3];
+
+		float d1 = -ab.dot(a), d2 = -ac.dot(a);
+		if(d1 <= 0.0f && d2 <= 0.0f)
+		{
+			v[0] = &A; l[0] = 1.0f;
+			_SimplexSet(s, v, l, 1);
+			return a;
+		}
+
+		float d3 = -ab.dot(b), d4 = -ac.dot(b);
+		if(d3 >= 0.0f && d4 <= d3)
+		{
+			v[0] = &B; l[0] = 1.0f;
+			_SimplexSet(s, v, l, 1);
+			return b;
+		}
+
+		float vc = d1 * d4 - d3 * d2;
+		if(vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		{
+			float t = d1 / (d1 - d3);
+			v[0] = &A; v[1] = &B; l[0] = 1.0f - t; l[1] = t;
+			_SimplexSet(s, v, l, 2);
+			return a + ab * t;
+		}
+
+		float d5 = -ab.dot(c), d6 = -ac.dot(c);
+		if(d6 >= 0.0f && d5 <= d6)
+		{
+			v[0] = &C; l[0] = 1.0f;
+			_SimplexSet(s, v, l, 1);
+			return c;
+		}
+
+		float vb = d5 * d2 - d1 * d6;
+		if(vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		{
+			float t = d2 / (d2 - d6);
+			v[0] = &A; v[1] = &C; l[0] = 1.0f - t; l[1] = t;
+			_SimplexSet(s, v, l, 2);
+			return a + ac * t;
+		}
+
+		float va = d3 * d6 - d5 * d4;
+		if(va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+		{
+			float t = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+			v[0] = &B; v[1] = &C; l[0] = 1.0f - t; l[1] = t;
+			_SimplexSet(s, v, l, 2);
+			return b + (c - b) * t;
+		}
+
+		float sum = va + vb + vc;
+		if(sum <= 0.0f)
+		{
+			// Degenerate triangle, keep the first edge
+			v[0] = &A; v[1] = &B; l[0] = 1.0f; l[1] = 0.0f;
+			_SimplexSet(s, v, l, 2);
+			return a;
+		}
+		float tb = vb / sum, tc = vc / sum;
+		v[0] = &A; v[1] = &B; v[2] = &C; l[0] = 1.0f - tb - tc; l[1] = tb; l[2] = tc;
+		_SimplexSet(s, v, l, 3);
+		return a + ab * tb + ac * tc;
+	}
+
+	// Closest point of the simplex to the origin. Returns false if the
+	// origin is inside the tetrahedron.
+	inline bool _SolveSimplex(_Simplex &s, Vector3 &closest)
+	{
+		_SimplexVertex* v = s._v;
+		switch(s._count)
+		{
+			case 1:
+				s._l[0] = 1.0f;
+				closest = v[0]._w;
+				return true;
+			case 2:
+			{
+				Vector3 ab = v[1]._w - v[0]._w;
+				float l2 = ab.length2();
+				float t = l2 > 0.0f ? -v[0]._w.dot(ab) / l2 : 0.0f;
+				if(t > 0.0f && t < 1.0f)
+				{
+					s._l[0] = 1.0f - t;
+					s._l[1] = t;
+					closest = v[0]._w + ab * t;
+					return true;
+				}
+				if(t >= 1.0f)
+					v[0] = v[1];
+				s._count = 1;
+				s._l[0] = 1.0f;
+				closest = v[0]._w;
+				return true;
+			}
+			case 3:
+			{
+				_SimplexVertex a = v[0], b = v[1], c = v[2];
+				closest = _ClosestTriangle(s, a, b, c);
+				return true;
+			}
+			default:
+			{
+				// Test the faces that separate the origin from the fourth vertex
+				_SimplexVertex t[4] = { v[0], v[1], v[2], v[3] };
+				static const int faces[4][4] = { { 0, 1, 2, 3 }, { 0, 2, 3, 1 }, { 0, 3, 1, 2 }, { 1, 3, 2, 0 } };
+				bool inside = true;
+				float best = 1e30f;
+				for(int f = 0; f < 4; f++)
+				{
+					const Vector3 &a = t[faces[f][0]]._w, &b = t[faces[f][1]]._w, &c = t[faces[f][2]]._w;
+					const Vector3 &d = t[faces[f][3]]._w;
+					Vector3 n = (b - a).cross(c - a);
+					float sideOrigin = -a.dot(n), sideD = (d - a).dot(n);
+					if(sideOrigin * sideD > 0.0f)
+						continue;
+
+					inside = false;
+					_Simplex face;
+					Vector3 p = _ClosestTriangle(face, t[faces[f][0]], t[faces[f][1]], t[faces[f][2]]);
+					if(p.length2() < best)
+					{
+						best = p.length2();
+						closest = p;
+						s = face;
+					}
+				}
+				return !inside;
+			}
+		}
+	}
+
+	// GJK on the Minkowski difference. Returns true if the shapes
+	// intersect, otherwise v is the closest point of A - B to the origin.
+	inline bool _GJK(const ConvexShape &sa, const Affine &ta, const ConvexShape &sb, const Affine &tb,
+		bool core, _Simplex &s, Vector3 &v, int &iterations)
+	{
+		iterations = 0;
+		if(s._count == 0)
+		{
+			Vector3 d = tb.translation() - ta.translation();
+			s._v[0] = _Support(sa, ta, sb, tb, d.length2() > 0.0f ? d : Vector3(1.0f, 0.0f, 0.0f), core);
+			s._count = 1;
+			iterations++;
+		}
+
+		while(iterations < 64)
+		{
+			if(!_SolveSimplex(s, v))
+				return true;
+			float v2 = v.length2();
+			if(v2 < 1e-12f)
+				return true;
+
+			_SimplexVertex w = _Support(sa, ta, sb, tb, -v, core);
+			iterations++;
+			if(v2 - v.dot(w._w) <= 1e-6f * v2)
+				return false;
+			for(int i = 0; i < s._count; i++)
+				if(s._v[i]._w == w._w)
+					return false;
+			s._v[s._count++] = w;
+		}
+		return false;
+	}
+
+	inline void _GJKWarmStart(const GJKCache* cache, const Affine &ta, const Affine &tb, _Simplex &s)
+	{
+		s._count = 0;
+		if(!cache)
+			return;
+		for(int i = 0; i < cache->_count; i++)
+		{
+			_SimplexVertex &v = s._v[i];
+			v._localA = cache->_localA[i];
+			v._localB = cache->_localB[i];
+			v._a = ta.transformPoint(v._localA);
+			v._b = tb.transformPoint(v._localB);
+			v._w = v._a - v._b;
+		}
+		s._count = cache->_count;
+	}
+
+	inline void _GJKStore(GJKCache* cache, const _Simplex &s, int iterations)
+	{
+		if(!cache)
+			return;
+		for(int i = 0; i < s._count; i++)
+		{
+			cache->_localA[i] = s._v[i]._localA;
+			cache->_localB[i] = s._v[i]._localB;
+		}
+		cache->_count = s._count;
+		cache->_iterations = iterations;
+	}
+
+	// EPA on a tetrahedron that contains the origin
+	inline bool _EPA(const ConvexShape &sa, const Affine &ta, const ConvexShape &sb, const Affine &tb,
+		const _Simplex &simplex, ContactPoint &contact)
+	{
+		struct Face { int _i[3]; Vector3 _n; float _d; };
+		std::vector<_SimplexVertex> vertices(simplex._v, simplex._v + simplex._count);
+
+		// Blow lower dimensional simplices up to a tetrahedron
+		static const Vector3 axes[6] = { Vector3(1.0f, 0.0f, 0.0f), Vector3(-1.0f, 0.0f, 0.0f), Vector3(0.0f, 1.0f, 0.0f),
+			Vector3(0.0f, -1.0f, 0.0f), Vector3(0.0f, 0.0f, 1.0f), Vector3(0.0f, 0.0f, -1.0f) };
+		for(int i = 0; i < 6 && vertices.size() < 4; i++)
+		{
+			_SimplexVertex w = _Support(sa, ta, sb, tb, axes[i], false);
+			bool independent = true;
+			if(vertices.size() == 1)
+				independent = (w._w - vertices[0]._w).length2() > 1e-12f;
+			else if(vertices.size() == 2)
+				independent = (vertices[1]._w - vertices[0]._w).cross(w._w - vertices[0]._w).length2() > 1e-12f;
+			else if(vertices.size() == 3)
+				independent = fabsf((vertices[1]._w - vertices[0]._w).cross(vertices[2]._w - vertices[0]._w)
+					.dot(w._w - vertices[0]._w)) > 1e-12f;
+			if(independent)
+				vertices.push_back(w);
+		}
+		if(vertices.size() < 4)
+			return false;
+
+		std::vector<Face> faces;
+		auto addFace = [&](int a, int b, int c) {
+			Face f = { { a, b, c }, Vector3(), 0.0f };
+			Vector3 n = (vertices[b]._w - vertices[a]._w).cross(vertices[c]._w - vertices[a]._w);
+			float l = n.length();
+			f._n = l > 0.0f ? n / l : Vector3();
+			f._d = f._n.dot(vertices[a]._w);
+			faces.push_back(f);
+		};
+
+		// Orient the faces of the tetrahedron outwards
+		if((vertices[1]._w - vertices[0]._w).cross(vertices[2]._w - vertices[0]._w).dot(vertices[3]._w - vertices[0]._w) > 0.0f)
+			std::swap(vertices[1], vertices[2]);
+		addFace(0, 1, 2);
+		addFace(0, 3, 1);
+		addFace(0, 2, 3);
+		addFace(1, 3, 2);
+
+		std::vector<std::pair<int, int> > edges;
+		size_t closest = 0;
+		auto findClosest = [&]() {
+			closest = 0;
+			for(size_t i = 1; i < faces.size(); i++)
+				if(faces[i]._d < faces[closest]._d)
+					closest = i;
+		};
+
+		bool converged = false;
+		for(int iteration = 0; iteration < 64; iteration++)
+		{
+			findClosest();
+			Face f = faces[closest];
+			_SimplexVertex w = _Support(sa, ta, sb, tb, f._n, false);
+			if(w._w.dot(f._n) - f._d < 1e-4f)
+			{
+				converged = true;
+				break;
+			}
+
+			// Remove the faces that see w and close the hole along the horizon
+			int index = (int)vertices.size();
+			vertices.push_back(w);
+			edges.clear();
+			for(size_t i = 0; i < faces.size(); )
+			{
+				if(faces[i]._n.dot(w._w - vertices[faces[i]._i[0]]._w) <= 0.0f)
+				{
+					i++;
+					continue;
+				}
+				for(int e = 0; e < 3; e++)
+				{
+					std::pair<int, int> edge(faces[i]._i[e], faces[i]._i[(e + 1) % 3]);
+					auto twin = std::find(edges.begin(), edges.end(), std::make_pair(edge.second, edge.first));
+					if(twin != edges.end())
+						edges.erase(twin);
+					else
+						edges.push_back(edge);
+				}
+				faces[i] = faces.back();
+				faces.pop_back();
+			}
+			for(const std::pair<int, int> &edge : edges)
+				addFace(edge.first, edge.second, index);
+			if(faces.empty())
+				return false;
+		}
+
+		// Without convergence the polytope changed after the last search,
+		// the closest face of the final polytope is the best estimate
+		if(!converged)
+			findClosest();
+
+		// Barycentric coordinates of the origin projected on the closest face
+		const Face &f = faces[closest];
+		const _SimplexVertex &a = vertices[f._i[0]], &b = vertices[f._i[1]], &c = vertices[f._i[2]];
+		Vector3 p = f._n * f._d;
+		Vector3 n = (b._w - a._w).cross(c._w - a._w);
+		float area = n.length2();
+		float lb = area > 0.0f ? (p - a._w).cross(c._w - a._w).dot(n) / area : 0.0f;
+		float lc = area > 0.0f ? (b._w - a._w).cross(p - a._w).dot(n) / area : 0.0f;
+		float la = 1.0f - lb - lc;
+
+		contact._pointA = a._a * la + b._a * lb + c._a * lc;
+		contact._pointB = a._b * la + b._b * lb + c._b * lc;
+		contact._normal = f._n;
+		contact._depth = f._d;
+		return true;
+	}
+
+	/*********************************************************/
+	// Distance of two convex shapes, 0 if they intersect. pointA and
+	// pointB are the closest points of separated shapes.
+	inline float GJKDistance(const ConvexShape &a, const Affine &ta, const ConvexShape &b, const Affine &tb,
+		Vector3 &pointA, Vector3 &pointB, GJKCache* cache = nullptr)
+	{
+		_Simplex s;
+		_GJKWarmStart(cache, ta, tb, s);
+		Vector3 v;
+		int iterations;
+		bool intersect = _GJK(a, ta, b, tb, true, s, v, iterations);
+		_GJKStore(cache, s, iterations);
+		if(intersect)
+			return 0.0f;
+
+		Vector3 pa, pb;
+		for(int i = 0; i < s._count; i++)
+		{
+			pa += s._v[i]._a * s._l[i];
+			pb += s._v[i]._b * s._l[i];
+		}
+
+		float d = v.length(), margin = a._radius + b._radius;
+		if(d <= margin)
+			return 0.0f;
+		Vector3 n = (pb - pa) / d;
+		pointA = pa + n * a._radius;
+		pointB = pb - n * b._radius;
+		return d - margin;
+	}
+
+	inline bool GJKIntersect(const ConvexShape &a, const Affine &ta, const ConvexShape &b, const Affine &tb,
+		GJKCache* cache = nullptr)
+	{
+		Vector3 pa, pb;
+		return GJKDistance(a, ta, b, tb, pa, pb, cache) == 0.0f;
+	}
+
+	// Contact of two overlapping shapes. Shallow contacts, where only the
+	// radii overlap, come from GJK, deeper ones from EPA.
+	inline bool Collide(const ConvexShape &a, const Affine &ta, const ConvexShape &b, const Affine &tb,
+		ContactPoint &contact, GJKCache* cache = nullptr)
+	{
+		_Simplex s;
+		_GJKWarmStart(cache, ta, tb, s);
+		Vector3 v;
+		int iterations;
+		bool intersect = _GJK(a, ta, b, tb, true, s, v, iterations);
+		_GJKStore(cache, s, iterations);
+
+		if(!intersect)
+		{
+			float d = v.length(), margin = a._radius + b._radius;
+			if(d >= margin)
+				return false;
+
+			Vector3 pa, pb;
+			for(int i = 0; i < s._count; i++)
+			{
+				pa += s._v[i]._a * s._l[i];
+				pb += s._v[i]._b * s._l[i];
+			}
+			contact._normal = (pb - pa) / d;
+			contact._pointA = pa + contact._normal * a._radius;
+			contact._pointB = pb - contact._normal * b._radius;
+			contact._depth = margin - d;
+			return true;
+		}
+
+		// The cores overlap, the core simplex lies inside the full shapes
+		return _EPA(a, ta, b, tb, s, contact);
+	}
+
+	/*********************************************************/
+	// Rigid motion over the time t, the rotation w (axis times angle)
+	// turns around the origin of the shape
+	inline Affine _Advance(const Affine &transform, const Vector3 &v, const Vector3 &w, float t)
+	{
+		Affine r = transform;
+		float angle = w.length() * t;
+		if(angle > 0.0f)
+		{
+			r._m14 = r._m24 = r._m34 = 0.0f;
+			r = AffineRotateAxis(w, angle) * r;
+		}
+		r._m14 = transform._m14 + v._x * t;
+		r._m24 = transform._m24 + v._y * t;
+		r._m34 = transform._m34 + v._z * t;
+		return r;
+	}
+
+	// Conservative advancement: the shapes move with the linear velocities
+	// v and angular velocities w for the time [0, 1]. Every step advances
+	// by the distance divided by an upper bound of the approach speed, so
+	// the shapes never pass through each other. toi is the first time at
+	// which they are closer than tolerance. Returns false if they do not
+	// touch in [0, 1] or the distance does not converge within 64 steps.
+	inline bool TimeOfImpact(const ConvexShape &a, const Affine &ta, const Vector3 &va, const Vector3 &wa,
+		const ConvexShape &b, const Affine &tb, const Vector3 &vb, const Vector3 &wb,
+		float &toi, float tolerance = 1e-3f)
+	{
+		float spin = wa.length() * a.boundingRadius() + wb.length() * b.boundingRadius();
+		GJKCache cache;
+		float t = 0.0f;
+		for(int i = 0; i < 64; i++)
+		{
+			Vector3 pa, pb;
+			float d = GJKDistance(a, _Advance(ta, va, wa, t), b, _Advance(tb, vb, wb, t), pa, pb, &cache);
+			if(d <= tolerance)
+			{
+				toi = t;
+				return true;
+			}
+
+			Vector3 n = (pb - pa) / d;
+			float speed = (va - vb).dot(n) + spin;
+			if(speed <= 0.0f)
+				return false;
+			t += d / speed;
+			if(t > 1.0f)
+				return false;
+		}
+		return false;
+	}
+
+	/*********************************************************/
+	// Up to four contact points of a pair, kept over several frames
+	struct ContactManifold
+	{
+		ContactPoint _points[4];
+		Vector3 _localA[4], _localB[4];
+		int _count = 0;
+		GJKCache _cache;
+		uint32_t _frame = 0;
+	};
+
+	// Persistent manifolds keyed by a pair id, e.g. _PairKey of two bodies.
+	// Every collide() warm starts GJK from the pair's previous simplex,
+	// refreshes the stored points with the new transforms and adds the new
+	// contact. Points that separate or slide farther than the breaking
+	// distance are dropped.
+	class ContactCache
+	{
+		public:
+			ContactCache() : _frame(1), _breakingDistance(0.02f) { }
+
+			void setBreakingDistance(float d) { _breakingDistance = d; }
+
+			const ContactManifold& collide(uint64_t pair, const ConvexShape &a, const Affine &ta,
+				const ConvexShape &b, const Affine &tb);
+			const ContactManifold* find(uint64_t pair) const;
+			ContactManifold* find(uint64_t pair);
+
+			// collide() in two steps. acquire() creates the manifold of a pair
+			// and marks it as used, update() may then run concurrently on
+			// different manifolds until the next acquire() or endFrame().
+			ContactManifold& acquire(uint64_t pair);
+			void update(ContactManifold &m, const ConvexShape &a, const Affine &ta,
+				const ConvexShape &b, const Affine &tb) const;
+
+			// Drops the manifolds that were not used since the last call
+			void endFrame();
+			size_t size() const { return _manifolds.size(); }
+			void clear();
+
+		private:
+			void _addPoint(ContactManifold &m, const ContactPoint &c, const Vector3 &localA, const Vector3 &localB) const;
+
+		private:
+			_PairMap _index;
+			std::vector<uint64_t> _keys;
+			std::vector<ContactManifold> _manifolds;
+			uint32_t _frame;
+			float _breakingDistance;
+	};
+
+	inline const ContactManifold* ContactCache::find(uint64_t pair) const
+	{
+		uint32_t* i = const_cast<_PairMap&>(_index).find(pair);
+		return i ? &_manifolds[*i] : nullptr;
+	}
+
+	inline ContactManifold* ContactCache::find(uint64_t pair)
+	{
+		uint32_t* i = _index.find(pair);
+		return i ? &_manifolds[*i] : nullptr;
+	}
+
+	inline ContactManifold& ContactCache::acquire(uint64_t pair)
+	{
+		uint32_t* found = _index.find(pair);
+		if(!found)
+		{
+			_index.insert(pair, (uint32_t)_manifolds.size());
+			_keys.push_back(pair);
+			_manifolds.push_back(ContactManifold());
+			found = _index.find(pair);
+		}
+		ContactManifold &m = _manifolds[*found];
+		m._frame = _frame;
+		return m;
+	}
+
+	inline const ContactManifold& ContactCache::collide(uint64_t pair, const ConvexShape &a, const Affine &ta,
+		const ConvexShape &b, const Affine &tb)
+	{
+		ContactManifold &m = acquire(pair);
+		update(m, a, ta, b, tb);
+		return m;
+	}
+
+	inline void ContactCache::update(ContactManifold &m, const ConvexShape &a, const Affine &ta,
+		const ConvexShape &b, const Affine &tb) const
+	{
+		ContactPoint c;
+		if(!Collide(a, ta, b, tb, c, &m._cache))
+		{
+			m._count = 0;
+			return;
+		}
+
+		// Refresh the stored points and drop the invalid ones
+		for(int i = 0; i < m._count; )
+		{
+			ContactPoint &p = m._points[i];
+			p._pointA = ta.transformPoint(m._localA[i]);
+			p._pointB = tb.transformPoint(m._localB[i]);
+			p._normal = c._normal;
+			Vector3 d = p._pointA - p._pointB;
+			p._depth = d.dot(c._normal);
+			Vector3 tangent = d - c._normal * p._depth;
+			if(p._depth < -_breakingDistance || tangent.length2() > _breakingDistance * _breakingDistance)
+			{
+				m._count--;
+				m._points[i] = m._points[m._count];
+				m._localA[i] = m._localA[m._count];
+				m._localB[i] = m._localB[m._count];
+			}
+			else
+			{
+				i++;
+			}
+		}
+
+		_addPoint(m, c, _InverseRotate(ta, c._pointA - ta.translation()), _InverseRotate(tb, c._pointB - tb.translation()));
+	}
+
+	// Largest area spanned by four points
+	inline float _Area4(const Vector3 &p0, const Vector3 &p1, const Vector3 &p2, const Vector3 &p3)
+	{
+		float a = (p0 - p1).cross(p2 - p3).length2();
+		float b = (p0 - p2).cross(p1 - p3).length2();
+		float c = (p0 - p3).cross(p1 - p2).length2();
+		return max(a, max(b, c));
+	}
+
+	inline void ContactCache::_addPoint(ContactManifold &m, const ContactPoint &c, const Vector3 &localA, const Vector3 &localB) const
+	{
+		// A new point close to a stored one replaces it
+		int slot = -1;
+		float best = _breakingDistance * _breakingDistance;
+		for(int i = 0; i < m._count; i++)
+		{
+			float d = (m._points[i]._pointA - c._pointA).length2();
+			if(d < best)
+			{
+				best = d;
+				slot = i;
+			}
+		}
+
+		if(slot < 0 && m._count < 4)
+			slot = m._count++;
+
+		if(slot < 0)
+		{
+			// Keep the deepest point and maximize the area of the other ones
+			int deepest = 0;
+			for(int i = 1; i < 4; i++)
+				if(m._points[i]._depth > m._points[deepest]._depth)
+					deepest = i;
+			if(c._depth > m._points[deepest]._depth)
+				deepest = -1;
+
+			float bestArea = -1.0f;
+			for(int i = 0; i < 4; i++)
+			{
+				if(i == deepest)
+					continue;
+				Vector3 p[4];
+				for(int j = 0; j < 4; j++)
+					p[j] = j == i ? c._pointA : m._points[j]._pointA;
+				float area = _Area4(p[0], p[1], p[2], p[3]);
+				if(area > bestArea)
+				{
+					bestArea = area;
+					slot = i;
+				}
+			}
+		}
+
+		m._points[slot] = c;
+		m._localA[slot] = localA;
+		m._localB[slot] = localB;
+	}
+
+	inline void ContactCache::endFrame()
+	{
+		for(size_t i = 0; i < _manifolds.size(); )
+		{
+			if(_manifolds[i]._frame == _frame)
+			{
+				i++;
+				continue;
+			}
+			_index.erase(_keys[i]);
+			if(i + 1 < _manifolds.size())
+			{
+				_manifolds[i] = _manifolds.back();
+				_keys[i] = _keys.back();
+				*_index.find(_keys[i]) = (uint32_t)i;
+			}
+			_manifolds.pop_back();
+			_keys.pop_back();
+		}
+		_frame++;
+	}
+
+	inline void ContactCache::clear()
+	{
+		_index.clear();
+		_keys.clear();
+		_manifolds.clear();
+	}
+
+	/*********************************************************/
+	// World space bounds of a placed shape from its support points
+	inline AABB ShapeBounds(const ConvexShape &s, const Affine &t)
+	{
+		AABB box;
+		for(int a = 0; a < 3; a++)
+		{
+			Vector3 d;
+			d[a] = 1.0f;
+			box._max[a] = t.transformPoint(s.support(_InverseRotate(t, d)))[a];
+			box._min[a] = t.transformPoint(s.support(_InverseRotate(t, -d)))[a];
+		}
+		return box;
+	}
+
+	/*********************************************************/
+	// Convex bodies with persistent contacts. step() runs one task graph
+	// on the world's thread pool: bounds of the moved bodies, sweep and
+	// prune, pair filtering by group and mask, narrowphase and the manifold
+	// update. The parallel stages use batches of a fixed size and merge
+	// their results in batch order, so the contacts are identical for any
+	// number of threads.
+	class CollisionWorld
+	{
+		public:
+			typedef uint32_t Body;
+			static constexpr size_t BodyBatch = 256;
+			static constexpr size_t PairBatch = 64;
+
+			struct Contact
+			{
+				Body _a, _b;
+				const ContactManifold* _manifold;	// Valid until the next step()
+			};
+
+			// Number of threads including the caller of step(), 0 = all
+			// hardware threads
+			explicit CollisionWorld(unsigned threads = 0);
+
+			CollisionWorld(const CollisionWorld&) = delete;
+			CollisionWorld& operator = (const CollisionWorld&) = delete;
+
+			// Bodies a and b collide if group of a is in mask of b and group
+			// of b is in mask of a
+			Body add(const ConvexShape &shape, const Affine &transform,
+				uint32_t group = 1, uint32_t mask = 0xFFFFFFFF);
+			void remove(Body b);
+			void setTransform(Body b, const Affine &transform);
+
+			const Affine& transform(Body b) const { return _transforms[b]; }
+			const AABB& bounds(Body b) const { return _sap.box(b); }
+
+			void step();
+
+			// Touching pairs of the last step, _a < _b
+			const std::vector<Contact>& contacts() const { return _contacts; }
+			const ContactCache& manifolds() const { return _cache; }
+			unsigned threads() const { return _pool.size(); }
+
+		private:
+			void _buildGraph();
+
+		private:
+			ThreadPool _pool;
+			TaskGraph _graph;
+
+			SweepAndPrune _sap;
+			ContactCache _cache;
+
+			std::vector<ConvexShape> _shapes;
+			std::vector<Affine> _transforms;
+			std::vector<AABB> _bounds;
+			std::vector<uint32_t> _groups, _masks;
+			std::vector<uint8_t> _moved;
+
+			std::vector<std::vector<ProxyPair> > _batchPairs;
+			std::vector<Contact> _contacts;
+			std::vector<ContactManifold*> _manifolds;
+	};
+
+	inline CollisionWorld::CollisionWorld(unsigned threads) : _pool(threads)
+	{
+		_buildGraph();
+	}
+
+	inline CollisionWorld::Body CollisionWorld::add(const ConvexShape &shape, const Affine &transform,
+		uint32_t group, uint32_t mask)
+	{
+		AABB box = ShapeBounds(shape, transform);
+		Body b = _sap.add(box);
+		if(b >= _shapes.size())
+		{
+			_shapes.resize(b + 1);
+			_transforms.resize(b + 1);
+			_bounds.resize(b + 1);
+			_groups.resize(b + 1);
+			_masks.resize(b + 1);
+			_moved.resize(b + 1);
+		}
+		_shapes[b] = shape;
+		_transforms[b] = transform;
+		_bounds[b] = box;
+		_groups[b] = group;
+		_masks[b] = mask;
+		_moved[b] = 0;
+		return b;
+	}
+
+	inline void CollisionWorld::remove(Body b)
+	{
+		_sap.remove(b);
+		_shapes[b] = ConvexShape();
+		_moved[b] = 0;
+	}
+
+	inline void CollisionWorld::setTransform(Body b, const Affine &transform)
+	{
+		_transforms[b] = transform;
+		_moved[b] = 1;
+	}
+
+	inline void CollisionWorld::_buildGraph()
+	{
+		// Bounds of the moved bodies
+		TaskGraph::Task bounds = _graph.addFor([this]() { return _moved.size(); }, BodyBatch,
+			[this](size_t begin, size_t end) {
+				for(size_t i = begin; i < end; i++)
+					if(_moved[i])
+						_bounds[i] = ShapeBounds(_shapes[i], _transforms[i]);
+			});
+
+		TaskGraph::Task broadphase = _graph.add([this]() {
+			for(Body b = 0; b < (Body)_moved.size(); b++)
+			{
+				if(_moved[b])
+				{
+					_sap.move(b, _bounds[b]);
+					_moved[b] = 0;
+				}
+			}
+			_sap.update();
+		});
+
+		// Every batch of pairs keeps its accepted pairs in its own list
+		TaskGraph::Task filter = _graph.addFor([this]() {
+				_batchPairs.resize((_sap.pairs().size() + PairBatch - 1) / PairBatch);
+				return _sap.pairs().size();
+			}, PairBatch, [this](size_t begin, size_t end) {
+				std::vector<ProxyPair> &out = _batchPairs[begin / PairBatch];
+				out.clear();
+				for(size_t i = begin; i < end; i++)
+				{
+					const ProxyPair &p = _sap.pairs()[i];
+					if((_groups[p._a] & _masks[p._b]) && (_groups[p._b] & _masks[p._a]))
+						out.push_back(p);
+				}
+			});
+
+		// Creates the manifolds of the pairs and drops the ones of the
+		// pairs that stopped overlapping
+		TaskGraph::Task acquire = _graph.add([this]() {
+			_contacts.clear();
+			for(const std::vector<ProxyPair> &batch : _batchPairs)
+			{
+				for(const ProxyPair &p : batch)
+				{
+					_cache.acquire(_PairKey(p._a, p._b));
+					_contacts.push_back({ p._a, p._b, nullptr });
+				}
+			}
+			_cache.endFrame();
+			_manifolds.resize(_contacts.size());
+			for(size_t i = 0; i < _contacts.size(); i++)
+			{
+				_manifolds[i] = _cache.find(_PairKey(_contacts[i]._a, _contacts[i]._b));
+				_contacts[i]._manifold = _manifolds[i];
+			}
+		});
+
+		TaskGraph::Task narrowphase = _graph.addFor([this]() { return _contacts.size(); }, PairBatch,
+			[this](size_t begin, size_t end) {
+				for(size_t i = begin; i < end; i++)
+				{
+					const Contact &c = _contacts[i];
+					_cache.update(*_manifolds[i], _shapes[c._a], _transforms[c._a], _shapes[c._b], _transforms[c._b]);
+				}
+			});
+
+		TaskGraph::Task contacts = _graph.add([this]() {
+			size_t n = 0;
+			for(const Contact &c : _contacts)
+				if(c._manifold->_count > 0)
+					_contacts[n++] = c;
+			_contacts.resize(n);
+		});
+
+		_graph.precede(bounds, broadphase);
+		_graph.precede(broadphase, filter);
+		_graph.precede(filter, acquire);
+		_graph.precede(acquire, narrowphase);
+		_graph.precede(narrowphase, contacts);
+	}
+
+	inline void CollisionWorld::step()
+	{
+		_pool.run(_graph);
+	}
 }
 
 #endif
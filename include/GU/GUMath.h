@@ -2,18 +2,42 @@
 #define _GUMATH_H_
 
 #include <math.h>
+#include <stddef.h>
+#include <type_traits>
+#include <utility>
+
+#include "GUParallel.h"
+
+#if !defined(GU_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+	#define GU_SSE
+	#include <emmintrin.h>
+	#if defined(__AVX__)
+		#define GU_AVX
+		#include <immintrin.h>
+	#endif
+#endif
+
+#if defined(__cpp_lib_is_constant_evaluated)
+	#define GU_CONSTANT_EVALUATED() std::is_constant_evaluated()
+#elif defined(__GNUC__) || defined(__clang__) || (defined(_MSC_VER) && _MSC_VER >= 1925)
+	#define GU_CONSTANT_EVALUATED() __builtin_is_constant_evaluated()
+#else
+	// Without detection the SIMD paths are always taken, only the
+	// non float 4 types can then be used in constant expressions
+	#define GU_CONSTANT_EVALUATED() false
+#endif
 
 namespace GU
 {
 	#define PI 3.1415926
 
 	/*********************************************************/
-	inline float det2x2(float m11, float m12, float m21, float m22)
+	constexpr float det2x2(float m11, float m12, float m21, float m22)
 	{
 		return m11 * m22 - m12 * m21;
 	}
 
-	inline float det3x3(float m11, float m12, float m13,
+	constexpr float det3x3(float m11, float m12, float m13,
 		float m21, float m22, float m23,
 		float m31, float m32, float m33)
 	{
@@ -24,7 +48,7 @@ namespace GU
 		return det;
 	}
 
-	inline float max(float a, float b)
+	constexpr float max(float a, float b)
 	{
 		if(a >= b)
 			return a;
@@ -32,7 +56,7 @@ namespace GU
 			return b;
 	}
 
-	inline float min(float a, float b)
+	constexpr float min(float a, float b)
 	{
 		if(a < b)
 			return a;
@@ -40,698 +64,1351 @@ namespace GU
 			return b;
 	}
 
-	inline float sat(float a)
+	constexpr float sat(float a)
 	{
 		return min(1.0f, max(0.0f, a));
 	}
 
 	/*********************************************************/
-	class Vector2;
-	class Vector3;
-	class Vector4;
-	/*********************************************************/
-	typedef Vector4 Vector;
-	/*********************************************************/
-	class Vector2
-	{
-		public:
-			Vector2() : _x(0), _y(0) { }
-			Vector2(const Vector2 &v) : _x(v._x), _y(v._y) { }
-			Vector2(float x, float y) : _x(x), _y(y) { }
-
-			float dot(const Vector2 &v);
-			float length();
-			float length2();
+#ifdef GU_SSE
+	#define GU_SHUFFLE(a, b, x, y, z, w) _mm_shuffle_ps(a, b, _MM_SHUFFLE(w, z, y, x))
+	#define GU_SWIZZLE(v, x, y, z, w) GU_SHUFFLE(v, v, x, y, z, w)
 
-			Vector2 reflect(const Vector2 &n);
-			Vector2 normalize();
-			Vector2 saturate();
-
-		public:
-			float _x, _y;
-	};
-
-	inline Vector2 operator + (const Vector2 &a, const Vector2 &b)
-	{ return Vector2(a._x + b._x, a._y + a._y); }
-	inline void operator += (Vector2 &a, const Vector2 &b)
-	{ a._x += b._x; a._y += b._y; }
-	inline Vector2 operator - (const Vector2 a)
-	{ return Vector2(-a._x, -a._y); }
-	inline Vector2 operator - (const Vector2 &a, const Vector2 &b)
-	{ return Vector2(a._x - b._x, a._y - a._y); }
-	inline void operator -= (Vector2 &a, const Vector2 &b)
-	{ a._x -= b._x; a._y -= b._y; }
-	inline Vector2 operator * (const Vector2 &a, const float &b)
-	{ return Vector2(a._x * b, a._y * b); }
-	inline Vector2 operator * (const float &a, const Vector2 &b)
-	{ return Vector2(b._x * a, b._y * a); }
-	inline Vector2 operator / (const Vector2 &a, const float b)
-	{ return Vector2(a._x / b, a._y / b); }
-	inline bool operator == (const Vector2 &a, const Vector2 &b)
-	{ 
-		if(a._x == b._x && a._y == b._y)
-			return true;
-		else
-			return false;
+	// Sum of the x, y and z products in the lowest lane
+	inline __m128 _Dot3(__m128 a, __m128 b)
+	{
+		__m128 m = _mm_mul_ps(a, b);
+		__m128 s = _mm_add_ss(m, GU_SWIZZLE(m, 1, 1, 1, 1));
+		return _mm_add_ss(s, GU_SWIZZLE(m, 2, 2, 2, 2));
 	}
-	inline bool operator != (const Vector2 &a, const Vector2 &b)
+
+	inline __m128 _Cross3(__m128 a, __m128 b)
 	{
-		if(a._x != b._x || a._y != b._y)
-			return true;
-		else
-			return false;
+		__m128 r = _mm_sub_ps(
+			_mm_mul_ps(a, GU_SWIZZLE(b, 1, 2, 0, 3)),
+			_mm_mul_ps(GU_SWIZZLE(a, 1, 2, 0, 3), b));
+		return GU_SWIZZLE(r, 1, 2, 0, 3);
 	}
 
-	inline float Vector2::dot(const Vector2 &v)
+	inline __m128 _SetW(__m128 v, float w)
 	{
-		return _x * v._x + _y * v._y;
+		// (z, z, w, w) then pick (x, y) from v and (z, w) from the mix
+		__m128 zw = _mm_unpackhi_ps(v, _mm_set1_ps(w));
+		return _mm_movelh_ps(v, zw);
 	}
 
-	inline float Vector2::length()
-	{ 
-		return (float)sqrt(_x * _x + _y * _y); 
+	// Linear combination of the rows b0..b3 with the lanes of a
+	inline __m128 _Combine(__m128 a, __m128 b0, __m128 b1, __m128 b2, __m128 b3)
+	{
+		__m128 r = _mm_mul_ps(GU_SWIZZLE(a, 0, 0, 0, 0), b0);
+		r = _mm_add_ps(r, _mm_mul_ps(GU_SWIZZLE(a, 1, 1, 1, 1), b1));
+		r = _mm_add_ps(r, _mm_mul_ps(GU_SWIZZLE(a, 2, 2, 2, 2), b2));
+		r = _mm_add_ps(r, _mm_mul_ps(GU_SWIZZLE(a, 3, 3, 3, 3), b3));
+		return r;
 	}
 
-	inline float Vector2::length2()
-	{ 
-		return _x * _x + _y * _y; 
+	// 2x2 row major matrices packed as (m11, m12, m21, m22)
+	inline __m128 _Mat2Mul(__m128 a, __m128 b)
+	{
+		return _mm_add_ps(_mm_mul_ps(a, GU_SWIZZLE(b, 0, 3, 0, 3)),
+			_mm_mul_ps(GU_SWIZZLE(a, 1, 0, 3, 2), GU_SWIZZLE(b, 2, 1, 2, 1)));
 	}
 
-	inline Vector2 Vector2::reflect(const Vector2 &n)
+	// adj(a) * b
+	inline __m128 _Mat2AdjMul(__m128 a, __m128 b)
 	{
-		float d = this->dot(n);
-		float x = _x - 2.0f * d * n._x;
-		float y = _y - 2.0f * d * n._y;
-		return Vector2(x, y);
+		return _mm_sub_ps(_mm_mul_ps(GU_SWIZZLE(a, 3, 3, 0, 0), b),
+			_mm_mul_ps(GU_SWIZZLE(a, 1, 1, 2, 2), GU_SWIZZLE(b, 2, 3, 0, 1)));
 	}
 
-	inline Vector2 Vector2::normalize()
+	// a * adj(b)
+	inline __m128 _Mat2MulAdj(__m128 a, __m128 b)
 	{
-		float l = this->length();
-		return Vector2(_x /= l, _y /= l);
+		return _mm_sub_ps(_mm_mul_ps(a, GU_SWIZZLE(b, 3, 0, 3, 0)),
+			_mm_mul_ps(GU_SWIZZLE(a, 1, 0, 3, 2), GU_SWIZZLE(b, 2, 1, 2, 1)));
 	}
-			
-	inline Vector2 Vector2::saturate()
+#endif
+
+	/*********************************************************/
+	// Widest float register of the target, used by the array kernels.
+	// GU_LANES floats are processed per iteration.
+#if defined(GU_AVX)
+	#define GU_LANES 8
+	typedef __m256 FloatN;
+	inline FloatN _LoadN(const float* p) { return _mm256_load_ps(p); }
+	inline FloatN _LoadUN(const float* p) { return _mm256_loadu_ps(p); }
+	inline void _StoreN(float* p, FloatN a) { _mm256_store_ps(p, a); }
+	inline void _StoreUN(float* p, FloatN a) { _mm256_storeu_ps(p, a); }
+	inline FloatN _SetN(float a) { return _mm256_set1_ps(a); }
+	inline FloatN _AddN(FloatN a, FloatN b) { return _mm256_add_ps(a, b); }
+	inline FloatN _SubN(FloatN a, FloatN b) { return _mm256_sub_ps(a, b); }
+	inline FloatN _MulN(FloatN a, FloatN b) { return _mm256_mul_ps(a, b); }
+	inline FloatN _DivN(FloatN a, FloatN b) { return _mm256_div_ps(a, b); }
+	inline FloatN _SqrtN(FloatN a) { return _mm256_sqrt_ps(a); }
+	inline FloatN _MinN(FloatN a, FloatN b) { return _mm256_min_ps(a, b); }
+	inline FloatN _MaxN(FloatN a, FloatN b) { return _mm256_max_ps(a, b); }
+	inline int _SignMaskN(FloatN a) { return _mm256_movemask_ps(a); }
+	inline FloatN _CmpLtN(FloatN a, FloatN b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	inline FloatN _CmpLeN(FloatN a, FloatN b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	inline FloatN _AndN(FloatN a, FloatN b) { return _mm256_and_ps(a, b); }
+	inline FloatN _SelectN(FloatN mask, FloatN a, FloatN b) { return _mm256_blendv_ps(b, a, mask); }
+#elif defined(GU_SSE)
+	#define GU_LANES 4
+	typedef __m128 FloatN;
+	inline FloatN _LoadN(const float* p) { return _mm_load_ps(p); }
+	inline FloatN _LoadUN(const float* p) { return _mm_loadu_ps(p); }
+	inline void _StoreN(float* p, FloatN a) { _mm_store_ps(p, a); }
+	inline void _StoreUN(float* p, FloatN a) { _mm_storeu_ps(p, a); }
+	inline FloatN _SetN(float a) { return _mm_set1_ps(a); }
+	inline FloatN _AddN(FloatN a, FloatN b) { return _mm_add_ps(a, b); }
+	inline FloatN _SubN(FloatN a, FloatN b) { return _mm_sub_ps(a, b); }
+	inline FloatN _MulN(FloatN a, FloatN b) { return _mm_mul_ps(a, b); }
+	inline FloatN _DivN(FloatN a, FloatN b) { return _mm_div_ps(a, b); }
+	inline FloatN _SqrtN(FloatN a) { return _mm_sqrt_ps(a); }
+	inline FloatN _MinN(FloatN a, FloatN b) { return _mm_min_ps(a, b); }
+	inline FloatN _MaxN(FloatN a, FloatN b) { return _mm_max_ps(a, b); }
+	inline int _SignMaskN(FloatN a) { return _mm_movemask_ps(a); }
+	inline FloatN _CmpLtN(FloatN a, FloatN b) { return _mm_cmplt_ps(a, b); }
+	inline FloatN _CmpLeN(FloatN a, FloatN b) { return _mm_cmple_ps(a, b); }
+	inline FloatN _AndN(FloatN a, FloatN b) { return _mm_and_ps(a, b); }
+	inline FloatN _SelectN(FloatN mask, FloatN a, FloatN b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+#else
+	#define GU_LANES 1
+	typedef float FloatN;
+	inline FloatN _LoadN(const float* p) { return *p; }
+	inline FloatN _LoadUN(const float* p) { return *p; }
+	inline void _StoreN(float* p, FloatN a) { *p = a; }
+	inline void _StoreUN(float* p, FloatN a) { *p = a; }
+	inline FloatN _SetN(float a) { return a; }
+	inline FloatN _AddN(FloatN a, FloatN b) { return a + b; }
+	inline FloatN _SubN(FloatN a, FloatN b) { return a - b; }
+	inline FloatN _MulN(FloatN a, FloatN b) { return a * b; }
+	inline FloatN _DivN(FloatN a, FloatN b) { return a / b; }
+	inline FloatN _SqrtN(FloatN a) { return (float)sqrt(a); }
+	inline FloatN _MinN(FloatN a, FloatN b) { return min(a, b); }
+	inline FloatN _MaxN(FloatN a, FloatN b) { return max(a, b); }
+	inline int _SignMaskN(FloatN a) { return signbit(a) ? 1 : 0; }
+	// Masks are -1 (true) or 0 (false) so that _SignMaskN reads them
+	inline FloatN _CmpLtN(FloatN a, FloatN b) { return a < b ? -1.0f : 0.0f; }
+	inline FloatN _CmpLeN(FloatN a, FloatN b) { return a <= b ? -1.0f : 0.0f; }
+	inline FloatN _AndN(FloatN a, FloatN b) { return a < 0.0f && b < 0.0f ? -1.0f : 0.0f; }
+	inline FloatN _SelectN(FloatN mask, FloatN a, FloatN b) { return mask < 0.0f ? a : b; }
+#endif
+
+	/*********************************************************/
+	// Vector and matrix templates. The storage of the common sizes is
+	// specialized so that the components keep their names (_x, _y, ...,
+	// _m11, _m12, ...), everything else is one generic implementation
+	// whose loops are unrolled at compile time through index sequences.
+	// All operations are constexpr except the ones that need sqrt. The
+	// float 4 and 4x4 cases switch to SSE outside of constant evaluation.
+	template<typename T, int N> class TVector;
+	template<typename T, int R, int C> class TMatrix;
+
+#ifdef GU_SSE
+	template<typename T, int N>
+	constexpr bool _IsSimd4 = std::is_same<T, float>::value && N == 4;
+#else
+	template<typename T, int N>
+	constexpr bool _IsSimd4 = false;
+#endif
+
+	template<int N>
+	using _Seq = std::make_integer_sequence<int, N>;
+
+	template<typename T>
+	constexpr T _Det2(T m11, T m12, T m21, T m22)
 	{
-		float x = sat(_x);
-		float y = sat(_y);
-		return Vector2(x, y);
+		return m11 * m22 - m12 * m21;
 	}
 
 	/*********************************************************/
-	class Vector3
+	template<typename T, int N>
+	class _VectorData
 	{
 		public:
-			Vector3() : _x(0), _y(0), _z(0) {}
-			Vector3(const Vector3 &v) : _x(v._x), _y(v._y), _z(v._z) {}
-			Vector3(float x, float y, float z) : _x(x), _y(y), _z(z) {}
+			constexpr _VectorData() : _v{} { }
+			template<typename... A, typename = std::enable_if_t<sizeof...(A) == N> >
+			constexpr _VectorData(A... a) : _v{ T(a)... } { }
 
-			float dot(const Vector3 &v);
-			float length();
-			float length2();
+			constexpr const T& operator [] (int i) const { return _v[i]; }
+			constexpr T& operator [] (int i) { return _v[i]; }
 
-			Vector3 reflect(const Vector3 &n);
-			Vector3 normalize();
-			Vector3 cross(const Vector3 &a);
-			Vector3 saturate();
+		public:
+			T _v[N];
+	};
 
+	template<typename T>
+	class _VectorData<T, 2>
+	{
 		public:
-			float _x, _y, _z;
+			constexpr _VectorData() : _x(0), _y(0) { }
+			constexpr _VectorData(T x, T y) : _x(x), _y(y) { }
+
+			constexpr const T& operator [] (int i) const { return i == 0 ? _x : _y; }
+			constexpr T& operator [] (int i) { return i == 0 ? _x : _y; }
 
+		public:
+			T _x, _y;
 	};
 
-	inline Vector3 operator + (const Vector3 &a, const Vector3 &b)
-	{ return Vector3(a._x + b._x, a._y + b._y, a._z + b._z); }
-	inline void operator += (Vector3 &a, const Vector3 &b)
-	{ a._x += b._x; a._y += b._y; a._z += b._z; }
-	inline Vector3 operator -(const Vector3 a)
-	{ return Vector3(-a._x, -a._y, -a._z); }
-	inline Vector3 operator - (const Vector3 &a, const Vector3 &b)
-	{ return Vector3(a._x - b._x, a._y - b._y, a._z - b._z); }
-	inline void operator -= (Vector3 &a, const Vector3 &b)
-	{ a._x -= b._x; a._y -= b._y; a._z -= b._z; }
-	inline Vector3 operator * (const Vector3 &a, const Vector3 &b)
-	{ return Vector3(a._x * b._x, a._y * b._y, a._z * b._z); }
-	inline Vector3 operator * (const Vector3 &a, const float &b)
-	{ return Vector3(a._x * b, a._y * b, a._z * b); }
-	inline Vector3 operator * (const float &a, const Vector3 &b)
-	{ return Vector3(b._x * a, b._y * a, b._z * a); }
-	inline Vector3 operator / (const Vector3 &a, const float b)
-	{ return Vector3(a._x / b, a._y / b, a._z / b); }
-	inline bool operator == (const Vector3 &a, const Vector3 &b)
-	{
-		if(a._x == b._x && a._y == b._y && a._z == b._z)
-			return true;
-		else
-			return false;
-	}
-	inline bool operator != (const Vector3 &a, const Vector3 &b)
+	template<typename T>
+	class _VectorData<T, 3>
 	{
-		if(a._x != b._x || a._y != b._y || a._z != b._z)
-			return true;
-		else
-			return false;
-	}
+		public:
+			constexpr _VectorData() : _x(0), _y(0), _z(0) { }
+			constexpr _VectorData(T x, T y, T z) : _x(x), _y(y), _z(z) { }
 
-	inline float Vector3::dot(const Vector3 &v)
-	{
-		return _x * v._x + _y * v._y + _z * v._z;
-	}
+			constexpr const T& operator [] (int i) const { return i == 0 ? _x : i == 1 ? _y : _z; }
+			constexpr T& operator [] (int i) { return i == 0 ? _x : i == 1 ? _y : _z; }
+
+		public:
+			T _x, _y, _z;
+	};
 
-	inline float Vector3::length()
+	template<typename T>
+	class alignas(16) _VectorData<T, 4>
 	{
-		return (float)sqrt(_x * _x + _y * _y + _z * _z);
-	}
+		public:
+			constexpr _VectorData() : _x(0), _y(0), _z(0), _w(0) { }
+			constexpr _VectorData(T x, T y, T z, T w) : _x(x), _y(y), _z(z), _w(w) { }
+			constexpr _VectorData(const TVector<T, 3> &v, T w = T(1))
+				: _x(v._x), _y(v._y), _z(v._z), _w(w) { }
+#ifdef GU_SSE
+			explicit _VectorData(__m128 v) { _mm_store_ps((float*)&_x, v); }
+
+			__m128 simd() const { return _mm_load_ps((const float*)&_x); }
+#endif
 
-	inline float Vector3::length2()
+			constexpr const T& operator [] (int i) const { return i == 0 ? _x : i == 1 ? _y : i == 2 ? _z : _w; }
+			constexpr T& operator [] (int i) { return i == 0 ? _x : i == 1 ? _y : i == 2 ? _z : _w; }
+
+		public:
+			T _x, _y, _z, _w;
+	};
+
+	/*********************************************************/
+	// Four component vectors are homogeneous: dot, length, reflect,
+	// normalize and cross only use x, y and z, the last three return w = 1.
+	template<typename T, int N>
+	class TVector : public _VectorData<T, N>
 	{
-		return _x * _x + _y * _y + _z * _z;
-	}
+		public:
+			using _VectorData<T, N>::_VectorData;
+			constexpr TVector() = default;
+
+			constexpr T dot(const TVector &v) const;
+			T length() const;
+			constexpr T length2() const;
+
+			constexpr TVector reflect(const TVector &n) const;
+			TVector normalize() const;
+			constexpr TVector cross(const TVector &a) const;
+			constexpr TVector saturate() const;
+
+			static constexpr int size() { return N; }
+
+		private:
+			template<typename Op, int... I>
+			static constexpr TVector _Map(const TVector &a, Op op, std::integer_sequence<int, I...>)
+			{ return TVector(op(a[I])...); }
+			template<typename Op, int... I>
+			static constexpr TVector _Map(const TVector &a, const TVector &b, Op op, std::integer_sequence<int, I...>)
+			{ return TVector(op(a[I], b[I])...); }
+			template<int... I>
+			static constexpr bool _Equal(const TVector &a, const TVector &b, std::integer_sequence<int, I...>)
+			{ return ((a[I] == b[I]) && ...); }
+			template<int... I>
+			static constexpr T _Dot(const TVector &a, const TVector &b, std::integer_sequence<int, I...>)
+			{ return ((a[I] * b[I]) + ...); }
+
+		public:
+			friend constexpr TVector operator + (const TVector &a, const TVector &b)
+			{
+#ifdef GU_SSE
+				if constexpr(_IsSimd4<T, N>)
+					if(!GU_CONSTANT_EVALUATED())
+						return TVector(_mm_add_ps(a.simd(), b.simd()));
+#endif
+				return _Map(a, b, [](T x, T y) { return x + y; }, _Seq<N>());
+			}
+			friend constexpr void operator += (TVector &a, const TVector &b)
+			{ a = a + b; }
+			friend constexpr TVector operator - (const TVector &a)
+			{
+#ifdef GU_SSE
+				if constexpr(_IsSimd4<T, N>)
+					if(!GU_CONSTANT_EVALUATED())
+						return TVector(_mm_sub_ps(_mm_setzero_ps(), a.simd()));
+#endif
+				return _Map(a, [](T x) { return -x; }, _Seq<N>());
+			}
+			friend constexpr TVector operator - (const TVector &a, const TVector &b)
+			{
+#ifdef GU_SSE
+				if constexpr(_IsSimd4<T, N>)
+					if(!GU_CONSTANT_EVALUATED())
+						return TVector(_mm_sub_ps(a.simd(), b.simd()));
+#endif
+				return _Map(a, b, [](T x, T y) { return x - y; }, _Seq<N>());
+			}
+			friend constexpr void operator -= (TVector &a, const TVector &b)
+			{ a = a - b; }
+			friend constexpr TVector operator * (const TVector &a, const TVector &b)
+			{
+#ifdef GU_SSE
+				if constexpr(_IsSimd4<T, N>)
+					if(!GU_CONSTANT_EVALUATED())
+						return TVector(_mm_mul_ps(a.simd(), b.simd()));
+#endif
+				return _Map(a, b, [](T x, T y) { return x * y; }, _Seq<N>());
+			}
+			friend constexpr TVector operator * (const TVector &a, const T &b)
+			{
+#ifdef GU_SSE
+				if constexpr(_IsSimd4<T, N>)
+					if(!GU_CONSTANT_EVALUATED())
+						return TVector(_mm_mul_ps(a.simd(), _mm_set1_ps(b)));
+#endif
+				return _Map(a, [b](T x) { return x * b; }, _Seq<N>());
+			}
+			friend constexpr TVector operator * (const T &a, const TVector &b)
+			{ return b * a; }
+			friend constexpr TVector operator / (const TVector &a, const T b)
+			{
+#ifdef GU_SSE
+				if constexpr(_IsSimd4<T, N>)
+					if(!GU_CONSTANT_EVALUATED())
+						return TVector(_mm_div_ps(a.simd(), _mm_set1_ps(b)));
+#endif
+				return _Map(a, [b](T x) { return x / b; }, _Seq<N>());
+			}
+			friend constexpr bool operator == (const TVector &a, const TVector &b)
+			{
+#ifdef GU_SSE
+				if constexpr(_IsSimd4<T, N>)
+					if(!GU_CONSTANT_EVALUATED())
+						return _mm_movemask_ps(_mm_cmpeq_ps(a.simd(), b.simd())) == 0xF;
+#endif
+				return _Equal(a, b, _Seq<N>());
+			}
+			friend constexpr bool operator != (const TVector &a, const TVector &b)
+			{ return !(a == b); }
+	};
 
-	inline Vector3 Vector3::reflect(const Vector3 &n)
+	template<typename T, int N>
+	constexpr T TVector<T, N>::dot(const TVector &v) const
 	{
-		float d = this->dot(n);
-		float x = _x - 2.0f * d * n._x;
-		float y = _y - 2.0f * d * n._y;
-		float z = _z - 2.0f * d * n._z;
-		return Vector3(x, y, z);
+#ifdef GU_SSE
+		if constexpr(_IsSimd4<T, N>)
+			if(!GU_CONSTANT_EVALUATED())
+				return _mm_cvtss_f32(_Dot3(this->simd(), v.simd()));
+#endif
+		if constexpr(N == 4)
+			return this->_x * v._x + this->_y * v._y + this->_z * v._z;
+		else
+			return _Dot(*this, v, _Seq<N>());
+	}
+
+	template<typename T, int N>
+	inline T TVector<T, N>::length() const
+	{
+#ifdef GU_SSE
+		if constexpr(_IsSimd4<T, N>)
+		{
+			__m128 v = this->simd();
+			return _mm_cvtss_f32(_mm_sqrt_ss(_Dot3(v, v)));
+		}
+#endif
+		return (T)sqrt(length2());
+	}
+
+	template<typename T, int N>
+	constexpr T TVector<T, N>::length2() const
+	{
+		return dot(*this);
+	}
+
+	template<typename T, int N>
+	constexpr TVector<T, N> TVector<T, N>::reflect(const TVector &n) const
+	{
+#ifdef GU_SSE
+		if constexpr(_IsSimd4<T, N>)
+		{
+			if(!GU_CONSTANT_EVALUATED())
+			{
+				__m128 v = this->simd();
+				__m128 d = _Dot3(v, n.simd());
+				d = GU_SWIZZLE(d, 0, 0, 0, 0);
+				__m128 r = _mm_sub_ps(v, _mm_mul_ps(_mm_add_ps(d, d), n.simd()));
+				return TVector(_SetW(r, 1.0f));
+			}
+		}
+#endif
+		TVector r = *this - n * (T(2) * dot(n));
+		if constexpr(N == 4)
+			r._w = T(1);
+		return r;
 	}
 
-	inline Vector3 Vector3::normalize()
-	{
-		float l = this->length();
-		return Vector3(_x / l, _y / l, _z / l);
+	template<typename T, int N>
+	inline TVector<T, N> TVector<T, N>::normalize() const
+	{
+#ifdef GU_SSE
+		if constexpr(_IsSimd4<T, N>)
+		{
+			__m128 v = this->simd();
+			__m128 l = _mm_sqrt_ss(_Dot3(v, v));
+			l = GU_SWIZZLE(l, 0, 0, 0, 0);
+			return TVector(_SetW(_mm_div_ps(v, l), 1.0f));
+		}
+#endif
+		TVector r = *this / length();
+		if constexpr(N == 4)
+			r._w = T(1);
+		return r;
 	}
 
-	inline Vector3 Vector3::cross(const Vector3 &a)
+	template<typename T, int N>
+	constexpr TVector<T, N> TVector<T, N>::cross(const TVector &a) const
 	{
-		return Vector3(_y * a._z - _z * a._y, _z * a._x - _x * a._z, _x * a._y - _y * a._x);
+		static_assert(N == 3 || N == 4, "cross product needs three components");
+#ifdef GU_SSE
+		if constexpr(_IsSimd4<T, N>)
+			if(!GU_CONSTANT_EVALUATED())
+				return TVector(_SetW(_Cross3(this->simd(), a.simd()), 1.0f));
+#endif
+		const TVector &v = *this;
+		if constexpr(N == 4)
+			return TVector(v._y * a._z - v._z * a._y, v._z * a._x - v._x * a._z, v._x * a._y - v._y * a._x, T(1));
+		else
+			return TVector(v._y * a._z - v._z * a._y, v._z * a._x - v._x * a._z, v._x * a._y - v._y * a._x);
 	}
 
-	inline Vector3 Vector3::saturate()
+	template<typename T, int N>
+	constexpr TVector<T, N> TVector<T, N>::saturate() const
 	{
-		float x = sat(_x);
-		float y = sat(_y);
-		float z = sat(_z);
-		return Vector3(x, y, z);
+#ifdef GU_SSE
+		if constexpr(_IsSimd4<T, N>)
+			if(!GU_CONSTANT_EVALUATED())
+				return TVector(_mm_min_ps(_mm_set1_ps(1.0f), _mm_max_ps(_mm_setzero_ps(), this->simd())));
+#endif
+		return _Map(*this, [](T x) { return x < T(0) ? T(0) : x > T(1) ? T(1) : x; }, _Seq<N>());
 	}
 
 	/*********************************************************/
-	class Vector4
+	// Generic matrix storage is row major, m(r, c) is row r and column c
+	template<typename T, int R, int C>
+	class _MatrixData
 	{
 		public:
-			Vector4() : _x(0), _y(0), _z(0), _w(0) { }
-			Vector4(const Vector4 &v) 
-				: _x(v._x), _y(v._y), _z(v._z), _w(v._w) { }
-			Vector4(float x, float y, float z, float w) 
-				: _x(x), _y(y), _z(z), _w(w) { }
-			Vector4(Vector3 v, float w)
-				: _x(v._x), _y(v._y), _z(v._z), _w(w) { }
-			Vector4(Vector3 v)
-				: _x(v._x), _y(v._y), _z(v._z), _w(1.0f) { }
-
-			float dot(const Vector4 &v);
-			float length();
-			float length2();
+			constexpr _MatrixData() : _m{} { for(int i = 0; i < R && i < C; i++) _m[i * C + i] = T(1); }
+			template<typename... A, typename = std::enable_if_t<sizeof...(A) == R * C> >
+			constexpr _MatrixData(A... a) : _m{ T(a)... } { }
 
-			Vector4 reflect(const Vector4 &n);
-			Vector4 normalize();
-			Vector4 cross(const Vector4 &a);
-			Vector4 saturate();
+			constexpr const T& _e(int i) const { return _m[i]; }
+			constexpr T& _e(int i) { return _m[i]; }
 
 		public:
-			float _x, _y, _z, _w;
-
-	}; 
-
-	inline Vector4 operator + (const Vector4 &a, const Vector4 &b)
-	{ return Vector4(a._x + b._x, a._y + a._y, a._z + b._z, a._w + b._w); }
-	inline void operator += (Vector4 &a, const Vector4 &b)
-	{ a._x += b._x; a._y += b._y; a._z += b._z; a._w += b._w; }
-	inline Vector4 operator -(const Vector4 a)
-	{ return Vector4(-a._x, -a._y, -a._z, -a._w); }
-	inline Vector4 operator - (const Vector4 &a, const Vector4 &b)
-	{ return Vector4(a._x - b._x, a._y - a._y, a._z - b._z, a._w - b._w); }
-	inline void operator -= (Vector4 &a, const Vector4 &b)
-	{ a._x -= b._x; a._y -= b._y; a._z -= b._z; a._w -= b._w; }
-	inline Vector4 operator * (const Vector4 &a, const float &b)
-	{ return Vector4(a._x * b, a._y * b, a._z * b, a._w * b); }
-	inline Vector4 operator * (const float &a, const Vector4 &b)
-	{ return Vector4(b._x * a, b._y * a, b._z * a, b._w * a); }
-	inline Vector4 operator / (const Vector4 &a, const float b)
-	{ return Vector4(a._x / b, a._y / b, a._z / b, a._w / b); }
-	inline bool operator == (const Vector4 &a, const Vector4 &b)
-	{
-		if(a._x == b._x && a._y == b._y && a._z == b._z && a._w == b._w)
-			return true;
-		else
-			return false;
-	}
-	inline bool operator != (const Vector4 &a, const Vector4 &b)
-	{
-		if(a._x != b._x || a._y != b._y || a._z != b._z || a._w != b._w)
-			return true;
-		else
-			return false;
-	}
+			T _m[R * C];
+	};
 
-	inline float Vector4::dot(const Vector4 &v)
+	template<typename T>
+	class _MatrixData<T, 2, 2>
 	{
-		return _x * v._x + _y * v._y + _z * v._z;
-	}
+		public:
+			constexpr _MatrixData() : _m11(1), _m12(0), _m21(0), _m22(1) { }
+			constexpr _MatrixData(T m11, T m12, T m21, T m22)
+				: _m11(m11), _m12(m12), _m21(m21), _m22(m22) { }
 
-	inline float Vector4::length()
-	{
-		return (float)sqrt(_x * _x + _y * _y + _z * _z);
-	}
+			constexpr const T& _e(int i) const
+			{
+				return i == 0 ? _m11 : i == 1 ? _m12 : i == 2 ? _m21 : _m22;
+			}
+			constexpr T& _e(int i)
+			{
+				return const_cast<T&>(static_cast<const _MatrixData&>(*this)._e(i));
+			}
 
-	inline float Vector4::length2()
-	{
-		return _x * _x + _y * _y + _z * _z;
-	}
+		public:
+			T _m11, _m12;
+			T _m21, _m22;
+	};
 
-	inline Vector4 Vector4::reflect(const Vector4 &n)
+	template<typename T>
+	class _MatrixData<T, 3, 3>
 	{
-		float d = this->dot(n);
-		float x = _x - 2.0f * d * n._x;
-		float y = _y - 2.0f * d * n._y;
-		float z = _z - 2.0f * d * n._z;
-		return Vector4(x, y, z, 1);
-	}
+		public:
+			constexpr _MatrixData()
+				: _m11(1), _m12(0), _m13(0),
+				_m21(0), _m22(1), _m23(0),
+				_m31(0), _m32(0), _m33(1) { }
+			constexpr _MatrixData(T m11, T m12, T m13,
+				T m21, T m22, T m23,
+				T m31, T m32, T m33)
+				: _m11(m11), _m12(m12), _m13(m13),
+				_m21(m21), _m22(m22), _m23(m23),
+				_m31(m31), _m32(m32), _m33(m33) { }
 
-	inline Vector4 Vector4::normalize()
-	{
-		float l = this->length();
-		return Vector4(_x / l, _y / l, _z / l, 1.0);
-	}
+			constexpr const T& _e(int i) const
+			{
+				switch(i)
+				{
+				case 0: return _m11; case 1: return _m12; case 2: return _m13;
+				case 3: return _m21; case 4: return _m22; case 5: return _m23;
+				case 6: return _m31; case 7: return _m32; default: return _m33;
+				}
+			}
+			constexpr T& _e(int i)
+			{
+				return const_cast<T&>(static_cast<const _MatrixData&>(*this)._e(i));
+			}
 
-	inline Vector4 Vector4::cross(const Vector4 &a)
-	{
-		return Vector4(_y * a._z - _z * a._y, _z * a._x - _x * a._z, _x * a._y - _y * a._x, 1.0);
-	}
+		public:
+			T _m11, _m12, _m13;
+			T _m21, _m22, _m23;
+			T _m31, _m32, _m33;
+	};
 
-	inline Vector4 Vector4::saturate()
+	template<typename T>
+	class alignas(16) _MatrixData<T, 3, 4>
 	{
-		float x = sat(_x);
-		float y = sat(_y);
-		float z = sat(_z);
-		float w = sat(_w);
-		return Vector4(x, y, z, w);		
-	}
+		public:
+			constexpr _MatrixData()
+				: _m11(1), _m12(0), _m13(0), _m14(0),
+				_m21(0), _m22(1), _m23(0), _m24(0),
+				_m31(0), _m32(0), _m33(1), _m34(0) { }
+			constexpr _MatrixData(T m11, T m12, T m13, T m14,
+				T m21, T m22, T m23, T m24,
+				T m31, T m32, T m33, T m34)
+				: _m11(m11), _m12(m12), _m13(m13), _m14(m14),
+				_m21(m21), _m22(m22), _m23(m23), _m24(m24),
+				_m31(m31), _m32(m32), _m33(m33), _m34(m34) { }
+#ifdef GU_SSE
+			_MatrixData(__m128 r1, __m128 r2, __m128 r3)
+			{
+				_mm_store_ps((float*)&_m11, r1);
+				_mm_store_ps((float*)&_m21, r2);
+				_mm_store_ps((float*)&_m31, r3);
+			}
+
+			__m128 row(const int i) const { return _mm_load_ps((const float*)&_m11 + 4 * i); }
+#endif
+
+			constexpr const T& _e(int i) const
+			{
+				switch(i)
+				{
+				case 0: return _m11; case 1: return _m12; case 2: return _m13; case 3: return _m14;
+				case 4: return _m21; case 5: return _m22; case 6: return _m23; case 7: return _m24;
+				case 8: return _m31; case 9: return _m32; case 10: return _m33; default: return _m34;
+				}
+			}
+			constexpr T& _e(int i)
+			{
+				return const_cast<T&>(static_cast<const _MatrixData&>(*this)._e(i));
+			}
 
-	/*********************************************************/
+		public:
+			T _m11, _m12, _m13, _m14;
+			T _m21, _m22, _m23, _m24;
+			T _m31, _m32, _m33, _m34;
+	};
 
+	template<typename T>
+	class alignas(16) _MatrixData<T, 4, 4>
+	{
+		public:
+			constexpr _MatrixData()
+				: _m11(1), _m12(0), _m13(0), _m14(0),
+				_m21(0), _m22(1), _m23(0), _m24(0),
+				_m31(0), _m32(0), _m33(1), _m34(0),
+				_m41(0), _m42(0), _m43(0), _m44(1) { }
+			constexpr _MatrixData(T m11, T m12, T m13, T m14,
+				T m21, T m22, T m23, T m24,
+				T m31, T m32, T m33, T m34,
+				T m41, T m42, T m43, T m44)
+				: _m11(m11), _m12(m12), _m13(m13), _m14(m14),
+				_m21(m21), _m22(m22), _m23(m23), _m24(m24),
+				_m31(m31), _m32(m32), _m33(m33), _m34(m34),
+				_m41(m41), _m42(m42), _m43(m43), _m44(m44) { }
+#ifdef GU_SSE
+			_MatrixData(__m128 r1, __m128 r2, __m128 r3, __m128 r4)
+			{
+				_mm_store_ps((float*)&_m11, r1);
+				_mm_store_ps((float*)&_m21, r2);
+				_mm_store_ps((float*)&_m31, r3);
+				_mm_store_ps((float*)&_m41, r4);
+			}
+
+			__m128 row(const int i) const { return _mm_load_ps((const float*)&_m11 + 4 * i); }
+#endif
+
+			constexpr const T& _e(int i) const
+			{
+				switch(i)
+				{
+				case 0: return _m11; case 1: return _m12; case 2: return _m13; case 3: return _m14;
+				case 4: return _m21; case 5: return _m22; case 6: return _m23; case 7: return _m24;
+				case 8: return _m31; case 9: return _m32; case 10: return _m33; case 11: return _m34;
+				case 12: return _m41; case 13: return _m42; case 14: return _m43; default: return _m44;
+				}
+			}
+			constexpr T& _e(int i)
+			{
+				return const_cast<T&>(static_cast<const _MatrixData&>(*this)._e(i));
+			}
 
+		public:
+			T _m11, _m12, _m13, _m14;
+			T _m21, _m22, _m23, _m24;
+			T _m31, _m32, _m33, _m34;
+			T _m41, _m42, _m43, _m44;
+	};
 
 	/*********************************************************/
-	class Matrix2x2;
-	class Matrix3x3;
-	class Matrix4x4;
-	/*********************************************************/
-	typedef Matrix4x4 Matrix;
-	/*********************************************************/
-	class Matrix2x2
+	// The default constructor builds the identity
+	template<typename T, int R, int C>
+	class TMatrix : public _MatrixData<T, R, C>
 	{
 		public:
-			Matrix2x2() : _m11(1), _m12(0), _m21(0), _m22(1) { }
-			Matrix2x2(const Matrix2x2 &m)
-				: _m11(m._m11), _m12(m._m12), 
-				_m21(m._m21), _m22(m._m22) { }
-			Matrix2x2(float m11, float m12, float m21, float m22)
-				: _m11(m11), _m12(m12), _m21(m21), _m22(m22) { }
+			using _MatrixData<T, R, C>::_MatrixData;
+			constexpr TMatrix() = default;
 
-			Matrix2x2 inverse();
-			Matrix2x2 transpose();
+			constexpr const T& operator () (int r, int c) const { return this->_e(r * C + c); }
+			constexpr T& operator () (int r, int c) { return this->_e(r * C + c); }
 
-		public:
-			float _m11, _m12;
-			float _m21, _m22;
+			constexpr TMatrix inverse() const;
+			constexpr TMatrix<T, C, R> transpose() const;
+
+			static constexpr int rows() { return R; }
+			static constexpr int columns() { return C; }
 
+		private:
+			template<typename Op, int... I>
+			static constexpr TMatrix _Map(const TMatrix &a, Op op, std::integer_sequence<int, I...>)
+			{ return TMatrix(op(a._e(I))...); }
+			template<typename Op, int... I>
+			static constexpr TMatrix _Map(const TMatrix &a, const TMatrix &b, Op op, std::integer_sequence<int, I...>)
+			{ return TMatrix(op(a._e(I), b._e(I))...); }
+			template<int... I>
+			static constexpr TMatrix<T, C, R> _Transpose(const TMatrix &a, std::integer_sequence<int, I...>)
+			{ return TMatrix<T, C, R>(a(I % R, I / R)...); }
+
+		public:
+			friend constexpr TMatrix operator + (const TMatrix &a, const TMatrix &b)
+			{
+#ifdef GU_SSE
+				if constexpr(_IsSimd4<T, R> && R == C)
+					if(!GU_CONSTANT_EVALUATED())
+						return TMatrix(
+							_mm_add_ps(a.row(0), b.row(0)), _mm_add_ps(a.row(1), b.row(1)),
+							_mm_add_ps(a.row(2), b.row(2)), _mm_add_ps(a.row(3), b.row(3)));
+#endif
+				return _Map(a, b, [](T x, T y) { return x + y; }, _Seq<R * C>());
+			}
+			friend constexpr TMatrix operator - (const TMatrix &a, const TMatrix &b)
+			{
+#ifdef GU_SSE
+				if constexpr(_IsSimd4<T, R> && R == C)
+					if(!GU_CONSTANT_EVALUATED())
+						return TMatrix(
+							_mm_sub_ps(a.row(0), b.row(0)), _mm_sub_ps(a.row(1), b.row(1)),
+							_mm_sub_ps(a.row(2), b.row(2)), _mm_sub_ps(a.row(3), b.row(3)));
+#endif
+				return _Map(a, b, [](T x, T y) { return x - y; }, _Seq<R * C>());
+			}
+			friend constexpr TMatrix operator * (const TMatrix &a, const T s)
+			{
+#ifdef GU_SSE
+				if constexpr(_IsSimd4<T, R> && R == C)
+				{
+					if(!GU_CONSTANT_EVALUATED())
+					{
+						__m128 v = _mm_set1_ps(s);
+						return TMatrix(
+							_mm_mul_ps(a.row(0), v), _mm_mul_ps(a.row(1), v),
+							_mm_mul_ps(a.row(2), v), _mm_mul_ps(a.row(3), v));
+					}
+				}
+#endif
+				return _Map(a, [s](T x) { return x * s; }, _Seq<R * C>());
+			}
+			friend constexpr TMatrix operator * (const T s, const TMatrix &a)
+			{ return a * s; }
+			friend constexpr TMatrix operator / (const TMatrix &a, const T s)
+			{
+#ifdef GU_SSE
+				if constexpr(_IsSimd4<T, R> && R == C)
+				{
+					if(!GU_CONSTANT_EVALUATED())
+					{
+						__m128 v = _mm_set1_ps(s);
+						return TMatrix(
+							_mm_div_ps(a.row(0), v), _mm_div_ps(a.row(1), v),
+							_mm_div_ps(a.row(2), v), _mm_div_ps(a.row(3), v));
+					}
+				}
+#endif
+				return _Map(a, [s](T x) { return x / s; }, _Seq<R * C>());
+			}
 	};
 
-	inline Matrix2x2 operator + (const Matrix2x2 &a, const Matrix2x2 &b)
+	template<typename T, int R, int C>
+	constexpr TMatrix<T, C, R> TMatrix<T, R, C>::transpose() const
 	{
-		return Matrix2x2(
-			a._m11 + b._m11, a._m12 + b._m12,
-			a._m21 + b._m21, a._m22 + b._m22
-		);
+#ifdef GU_SSE
+		if constexpr(_IsSimd4<T, R> && R == C)
+		{
+			if(!GU_CONSTANT_EVALUATED())
+			{
+				__m128 r1 = this->row(0), r2 = this->row(1), r3 = this->row(2), r4 = this->row(3);
+				_MM_TRANSPOSE4_PS(r1, r2, r3, r4);
+				return TMatrix(r1, r2, r3, r4);
+			}
+		}
+#endif
+		return _Transpose(*this, _Seq<R * C>());
 	}
-	inline Matrix2x2 operator - (const Matrix2x2 &a, const Matrix2x2 &b)
+
+	template<typename T, int R, int C>
+	constexpr TMatrix<T, R, C> TMatrix<T, R, C>::inverse() const
 	{
-		return Matrix2x2(
-			a._m11 - b._m11, a._m12 - b._m12,
-			a._m21 - b._m21, a._m22 - b._m22
-		);
+		static_assert(R == C && R >= 2 && R <= 4, "inverse needs a 2x2, 3x3 or 4x4 matrix");
+		return _Inverse(*this);
 	}
-	inline Matrix2x2 operator * (const Matrix2x2 &a, const float s)
-	{
-		return Matrix2x2(
-			a._m11 * s, a._m12 * s,
-			a._m21 * s, a._m22 * s
-		);
+
+	/*********************************************************/
+	template<typename T, int R, int K, int C, int... I>
+	constexpr T _MulElement(const TMatrix<T, R, K> &a, const TMatrix<T, K, C> &b, int r, int c,
+		std::integer_sequence<int, I...>)
+	{
+		return ((a(r, I) * b(I, c)) + ...);
+	}
+
+	template<typename T, int R, int K, int C, int... I>
+	constexpr TMatrix<T, R, C> _Mul(const TMatrix<T, R, K> &a, const TMatrix<T, K, C> &b,
+		std::integer_sequence<int, I...>)
+	{
+		return TMatrix<T, R, C>(_MulElement(a, b, I / C, I % C, _Seq<K>())...);
+	}
+
+	template<typename T, int R, int C, int... I>
+	constexpr T _MulRow(const TMatrix<T, R, C> &a, const TVector<T, C> &b, int r,
+		std::integer_sequence<int, I...>)
+	{
+		return ((a(r, I) * b[I]) + ...);
+	}
+
+	template<typename T, int R, int C, int... I>
+	constexpr TVector<T, R> _Mul(const TMatrix<T, R, C> &a, const TVector<T, C> &b,
+		std::integer_sequence<int, I...>)
+	{
+		return TVector<T, R>(_MulRow(a, b, I, _Seq<C>())...);
+	}
+
+	template<typename T, int R, int K, int C>
+	constexpr TMatrix<T, R, C> operator * (const TMatrix<T, R, K> &a, const TMatrix<T, K, C> &b)
+	{
+#ifdef GU_SSE
+		if constexpr(_IsSimd4<T, R> && R == K && K == C)
+		{
+			if(!GU_CONSTANT_EVALUATED())
+			{
+#ifdef GU_AVX
+				// Two rows of a per iteration, each row of b broadcast to both lanes
+				__m256 b1 = _mm256_broadcast_ps((const __m128*)&b._m11);
+				__m256 b2 = _mm256_broadcast_ps((const __m128*)&b._m21);
+				__m256 b3 = _mm256_broadcast_ps((const __m128*)&b._m31);
+				__m256 b4 = _mm256_broadcast_ps((const __m128*)&b._m41);
+
+				TMatrix<T, R, C> r;
+				const float* src[2] = { &a._m11, &a._m31 };
+				float* dst[2] = { &r._m11, &r._m31 };
+				for(int i = 0; i < 2; i++)
+				{
+					__m256 a12 = _mm256_loadu_ps(src[i]);
+					__m256 t = _mm256_mul_ps(_mm256_shuffle_ps(a12, a12, 0x00), b1);
+					t = _mm256_add_ps(t, _mm256_mul_ps(_mm256_shuffle_ps(a12, a12, 0x55), b2));
+					t = _mm256_add_ps(t, _mm256_mul_ps(_mm256_shuffle_ps(a12, a12, 0xAA), b3));
+					t = _mm256_add_ps(t, _mm256_mul_ps(_mm256_shuffle_ps(a12, a12, 0xFF), b4));
+					_mm256_storeu_ps(dst[i], t);
+				}
+				return r;
+#else
+				__m128 b1 = b.row(0), b2 = b.row(1), b3 = b.row(2), b4 = b.row(3);
+				return TMatrix<T, R, C>(
+					_Combine(a.row(0), b1, b2, b3, b4),
+					_Combine(a.row(1), b1, b2, b3, b4),
+					_Combine(a.row(2), b1, b2, b3, b4),
+					_Combine(a.row(3), b1, b2, b3, b4)
+				);
+#endif
+			}
+		}
+#endif
+		return _Mul(a, b, _Seq<R * C>());
+	}
+
+	template<typename T, int R, int C>
+	constexpr TVector<T, R> operator * (const TMatrix<T, R, C> &a, const TVector<T, C> &b)
+	{
+#ifdef GU_SSE
+		if constexpr(_IsSimd4<T, R> && R == C)
+		{
+			if(!GU_CONSTANT_EVALUATED())
+			{
+				__m128 v = b.simd();
+				__m128 x = _mm_mul_ps(a.row(0), v);
+				__m128 y = _mm_mul_ps(a.row(1), v);
+				__m128 z = _mm_mul_ps(a.row(2), v);
+				__m128 w = _mm_mul_ps(a.row(3), v);
+				_MM_TRANSPOSE4_PS(x, y, z, w);
+				return TVector<T, R>(_mm_add_ps(_mm_add_ps(x, y), _mm_add_ps(z, w)));
+			}
+		}
+#endif
+		return _Mul(a, b, _Seq<R>());
 	}
-	inline Matrix2x2 operator * (const float s, const Matrix2x2 &a)
+
+	/*********************************************************/
+	template<typename T>
+	constexpr TMatrix<T, 2, 2> _Inverse(const TMatrix<T, 2, 2> &m)
 	{
-		return Matrix2x2(
-			a._m11 * s, a._m12 * s,
-			a._m21 * s, a._m22 * s
-		);
+		T det = _Det2(m._m11, m._m12, m._m21, m._m22);
+		return TMatrix<T, 2, 2>(m._m22 / det, -m._m12 / det, -m._m21 / det, m._m11 / det);
 	}
-	inline Matrix2x2 operator * (const Matrix2x2 &a, const Matrix2x2 &b)
-	{
-		Matrix2x2 r;
-
-		r._m11 = a._m11 * b._m11 + a._m12 * b._m21;
-		r._m12 = a._m11 * b._m21 + a._m12 * b._m22;
-		r._m21 = a._m21 * b._m11 + a._m22 * b._m21;
-		r._m22 = a._m21 * b._m21 + a._m22 * b._m22;
 
-		return r;
-	}
-	inline Vector2 operator * (const Matrix2x2 &a, const Vector2 &b)
+	template<typename T>
+	constexpr TMatrix<T, 3, 3> _Inverse(const TMatrix<T, 3, 3> &m)
 	{
-		Vector2 r;
+		// Adjugate over the cofactors of the first row
+		T c11 = _Det2(m._m22, m._m23, m._m32, m._m33);
+		T c12 = -_Det2(m._m21, m._m23, m._m31, m._m33);
+		T c13 = _Det2(m._m21, m._m22, m._m31, m._m32);
+		T inv = T(1) / (m._m11 * c11 + m._m12 * c12 + m._m13 * c13);
 
-		r._x = a._m11 * b._x + a._m12 * b._y;
-		r._y = a._m21 * b._x + a._m22 * b._y;
+		return TMatrix<T, 3, 3>(
+			c11 * inv,
+			-_Det2(m._m12, m._m13, m._m32, m._m33) * inv,
+			_Det2(m._m12, m._m13, m._m22, m._m23) * inv,
 
-		return r;
+			c12 * inv,
+			_Det2(m._m11, m._m13, m._m31, m._m33) * inv,
+			-_Det2(m._m11, m._m13, m._m21, m._m23) * inv,
+
+			c13 * inv,
+			-_Det2(m._m11, m._m12, m._m31, m._m32) * inv,
+			_Det2(m._m11, m._m12, m._m21, m._m22) * inv
+		);
 	}
-	inline Matrix2x2 operator / (const Matrix2x2 &a, const float s)
-	{
-		return Matrix2x2(
-			a._m11 / s, a._m12 / s,
-			a._m21 / s, a._m22 / s
+
+	template<typename T>
+	constexpr TMatrix<T, 4, 4> _Inverse(const TMatrix<T, 4, 4> &m)
+	{
+#ifdef GU_SSE
+		if constexpr(_IsSimd4<T, 4>)
+		{
+			if(!GU_CONSTANT_EVALUATED())
+			{
+				// Block wise inverse over the 2x2 sub matrices
+				// | A B |
+				// | C D |
+				__m128 r1 = m.row(0), r2 = m.row(1), r3 = m.row(2), r4 = m.row(3);
+				__m128 A = _mm_movelh_ps(r1, r2);
+				__m128 B = _mm_movehl_ps(r2, r1);
+				__m128 C = _mm_movelh_ps(r3, r4);
+				__m128 D = _mm_movehl_ps(r4, r3);
+
+				// (|A|, |B|, |C|, |D|)
+				__m128 detSub = _mm_sub_ps(
+					_mm_mul_ps(GU_SHUFFLE(r1, r3, 0, 2, 0, 2), GU_SHUFFLE(r2, r4, 1, 3, 1, 3)),
+					_mm_mul_ps(GU_SHUFFLE(r1, r3, 1, 3, 1, 3), GU_SHUFFLE(r2, r4, 0, 2, 0, 2))
+				);
+				__m128 detA = GU_SWIZZLE(detSub, 0, 0, 0, 0);
+				__m128 detB = GU_SWIZZLE(detSub, 1, 1, 1, 1);
+				__m128 detC = GU_SWIZZLE(detSub, 2, 2, 2, 2);
+				__m128 detD = GU_SWIZZLE(detSub, 3, 3, 3, 3);
+
+				__m128 DC = _Mat2AdjMul(D, C);
+				__m128 AB = _Mat2AdjMul(A, B);
+				__m128 X = _mm_sub_ps(_mm_mul_ps(detD, A), _Mat2Mul(B, DC));
+				__m128 W = _mm_sub_ps(_mm_mul_ps(detA, D), _Mat2Mul(C, AB));
+				__m128 Y = _mm_sub_ps(_mm_mul_ps(detB, C), _Mat2MulAdj(D, AB));
+				__m128 Z = _mm_sub_ps(_mm_mul_ps(detC, B), _Mat2MulAdj(A, DC));
+
+				// |M| = |A||D| + |B||C| - tr(adj(A)B adj(D)C)
+				__m128 detM = _mm_add_ps(_mm_mul_ps(detA, detD), _mm_mul_ps(detB, detC));
+				__m128 tr = _mm_mul_ps(AB, GU_SWIZZLE(DC, 0, 2, 1, 3));
+				tr = _mm_add_ps(tr, GU_SWIZZLE(tr, 2, 3, 0, 1));
+				tr = _mm_add_ps(tr, GU_SWIZZLE(tr, 1, 0, 3, 2));
+				detM = _mm_sub_ps(detM, tr);
+
+				__m128 rDetM = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), detM);
+				X = _mm_mul_ps(X, rDetM);
+				Y = _mm_mul_ps(Y, rDetM);
+				Z = _mm_mul_ps(Z, rDetM);
+				W = _mm_mul_ps(W, rDetM);
+
+				return TMatrix<T, 4, 4>(
+					GU_SHUFFLE(X, Y, 3, 1, 3, 1),
+					GU_SHUFFLE(X, Y, 2, 0, 2, 0),
+					GU_SHUFFLE(Z, W, 3, 1, 3, 1),
+					GU_SHUFFLE(Z, W, 2, 0, 2, 0)
+				);
+			}
+		}
+#endif
+		// 2x2 minors of the upper and lower two rows
+		T s0 = _Det2(m._m11, m._m12, m._m21, m._m22);
+		T s1 = _Det2(m._m11, m._m13, m._m21, m._m23);
+		T s2 = _Det2(m._m11, m._m14, m._m21, m._m24);
+		T s3 = _Det2(m._m12, m._m13, m._m22, m._m23);
+		T s4 = _Det2(m._m12, m._m14, m._m22, m._m24);
+		T s5 = _Det2(m._m13, m._m14, m._m23, m._m24);
+
+		T c5 = _Det2(m._m33, m._m34, m._m43, m._m44);
+		T c4 = _Det2(m._m32, m._m34, m._m42, m._m44);
+		T c3 = _Det2(m._m32, m._m33, m._m42, m._m43);
+		T c2 = _Det2(m._m31, m._m34, m._m41, m._m44);
+		T c1 = _Det2(m._m31, m._m33, m._m41, m._m43);
+		T c0 = _Det2(m._m31, m._m32, m._m41, m._m42);
+
+		T det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+		T inv = T(1) / det;
+
+		return TMatrix<T, 4, 4>(
+			( m._m22 * c5 - m._m23 * c4 + m._m24 * c3) * inv,
+			(-m._m12 * c5 + m._m13 * c4 - m._m14 * c3) * inv,
+			( m._m42 * s5 - m._m43 * s4 + m._m44 * s3) * inv,
+			(-m._m32 * s5 + m._m33 * s4 - m._m34 * s3) * inv,
+
+			(-m._m21 * c5 + m._m23 * c2 - m._m24 * c1) * inv,
+			( m._m11 * c5 - m._m13 * c2 + m._m14 * c1) * inv,
+			(-m._m41 * s5 + m._m43 * s2 - m._m44 * s1) * inv,
+			( m._m31 * s5 - m._m33 * s2 + m._m34 * s1) * inv,
+
+			( m._m21 * c4 - m._m22 * c2 + m._m24 * c0) * inv,
+			(-m._m11 * c4 + m._m12 * c2 - m._m14 * c0) * inv,
+			( m._m41 * s4 - m._m42 * s2 + m._m44 * s0) * inv,
+			(-m._m31 * s4 + m._m32 * s2 - m._m34 * s0) * inv,
+
+			(-m._m21 * c3 + m._m22 * c1 - m._m23 * c0) * inv,
+			( m._m11 * c3 - m._m12 * c1 + m._m13 * c0) * inv,
+			(-m._m41 * s3 + m._m42 * s1 - m._m43 * s0) * inv,
+			( m._m31 * s3 - m._m32 * s1 + m._m33 * s0) * inv
 		);
 	}
 
-	inline Matrix2x2 Matrix2x2::inverse()
-	{
-		float det = _m11 * _m22 - _m12 * _m21;
-		Matrix2x2 i;
+	/*********************************************************/
+	typedef TVector<float, 2> Vector2;
+	typedef TVector<float, 3> Vector3;
+	typedef TVector<float, 4> Vector4;
+	/*********************************************************/
+	typedef Vector4 Vector;
+	/*********************************************************/
+	typedef TMatrix<float, 2, 2> Matrix2x2;
+	typedef TMatrix<float, 3, 3> Matrix3x3;
+	typedef TMatrix<float, 4, 4> Matrix4x4;
+	/*********************************************************/
+	typedef Matrix4x4 Matrix;
 
-		i._m11 = _m22 / det;
-		i._m12 = -_m12 / det;
-		i._m21 = -_m21 / det;
-		i._m22 = _m11 / det;
+	/*********************************************************/
+	// Affine transform stored as the upper 3x4 part of a 4x4 matrix, the
+	// last row is always (0, 0, 0, 1) and never stored or multiplied.
+	template<typename T>
+	class TAffine : public _MatrixData<T, 3, 4>
+	{
+		public:
+			using _MatrixData<T, 3, 4>::_MatrixData;
+			constexpr TAffine() = default;
+			explicit constexpr TAffine(const TMatrix<T, 4, 4> &m)
+				: _MatrixData<T, 3, 4>(
+					m._m11, m._m12, m._m13, m._m14,
+					m._m21, m._m22, m._m23, m._m24,
+					m._m31, m._m32, m._m33, m._m34) { }
+
+			constexpr const T& operator () (int r, int c) const { return this->_e(r * 4 + c); }
+			constexpr T& operator () (int r, int c) { return this->_e(r * 4 + c); }
+
+			constexpr TMatrix<T, 4, 4> toMatrix() const;
+			constexpr TVector<T, 3> translation() const { return TVector<T, 3>(this->_m14, this->_m24, this->_m34); }
+
+			constexpr TVector<T, 3> transformPoint(const TVector<T, 3> &p) const;
+			constexpr TVector<T, 3> transformVector(const TVector<T, 3> &v) const;
+
+			constexpr TAffine inverse() const;
+			// Only valid without scale, the 3x3 part is transposed
+			constexpr TAffine inverseRigid() const;
+
+			friend constexpr TAffine operator * (const TAffine &a, const TAffine &b)
+			{
+#ifdef GU_SSE
+				if constexpr(std::is_same<T, float>::value)
+				{
+					if(!GU_CONSTANT_EVALUATED())
+					{
+						__m128 b1 = b.row(0), b2 = b.row(1), b3 = b.row(2);
+						__m128 b4 = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+						return TAffine(
+							_Combine(a.row(0), b1, b2, b3, b4),
+							_Combine(a.row(1), b1, b2, b3, b4),
+							_Combine(a.row(2), b1, b2, b3, b4));
+					}
+				}
+#endif
+				return TAffine(
+					a._m11 * b._m11 + a._m12 * b._m21 + a._m13 * b._m31,
+					a._m11 * b._m12 + a._m12 * b._m22 + a._m13 * b._m32,
+					a._m11 * b._m13 + a._m12 * b._m23 + a._m13 * b._m33,
+					a._m11 * b._m14 + a._m12 * b._m24 + a._m13 * b._m34 + a._m14,
+
+					a._m21 * b._m11 + a._m22 * b._m21 + a._m23 * b._m31,
+					a._m21 * b._m12 + a._m22 * b._m22 + a._m23 * b._m32,
+					a._m21 * b._m13 + a._m22 * b._m23 + a._m23 * b._m33,
+					a._m21 * b._m14 + a._m22 * b._m24 + a._m23 * b._m34 + a._m24,
+
+					a._m31 * b._m11 + a._m32 * b._m21 + a._m33 * b._m31,
+					a._m31 * b._m12 + a._m32 * b._m22 + a._m33 * b._m32,
+					a._m31 * b._m13 + a._m32 * b._m23 + a._m33 * b._m33,
+					a._m31 * b._m14 + a._m32 * b._m24 + a._m33 * b._m34 + a._m34);
+			}
+	};
 
-		return i;
+	template<typename T>
+	constexpr TMatrix<T, 4, 4> TAffine<T>::toMatrix() const
+	{
+		return TMatrix<T, 4, 4>(
+			this->_m11, this->_m12, this->_m13, this->_m14,
+			this->_m21, this->_m22, this->_m23, this->_m24,
+			this->_m31, this->_m32, this->_m33, this->_m34,
+			T(0), T(0), T(0), T(1));
+	}
+
+	template<typename T>
+	constexpr TVector<T, 3> TAffine<T>::transformPoint(const TVector<T, 3> &p) const
+	{
+#ifdef GU_SSE
+		if constexpr(std::is_same<T, float>::value)
+		{
+			if(!GU_CONSTANT_EVALUATED())
+			{
+				__m128 v = _mm_setr_ps(p._x, p._y, p._z, 1.0f);
+				__m128 x = _mm_mul_ps(this->row(0), v);
+				__m128 y = _mm_mul_ps(this->row(1), v);
+				__m128 z = _mm_mul_ps(this->row(2), v);
+				__m128 w = _mm_setzero_ps();
+				_MM_TRANSPOSE4_PS(x, y, z, w);
+				alignas(16) float r[4] = {};
+				_mm_store_ps(r, _mm_add_ps(_mm_add_ps(x, y), _mm_add_ps(z, w)));
+				return TVector<T, 3>(r[0], r[1], r[2]);
+			}
+		}
+#endif
+		return TVector<T, 3>(
+			this->_m11 * p._x + this->_m12 * p._y + this->_m13 * p._z + this->_m14,
+			this->_m21 * p._x + this->_m22 * p._y + this->_m23 * p._z + this->_m24,
+			this->_m31 * p._x + this->_m32 * p._y + this->_m33 * p._z + this->_m34);
+	}
+
+	template<typename T>
+	constexpr TVector<T, 3> TAffine<T>::transformVector(const TVector<T, 3> &v) const
+	{
+		return TVector<T, 3>(
+			this->_m11 * v._x + this->_m12 * v._y + this->_m13 * v._z,
+			this->_m21 * v._x + this->_m22 * v._y + this->_m23 * v._z,
+			this->_m31 * v._x + this->_m32 * v._y + this->_m33 * v._z);
+	}
+
+	template<typename T>
+	constexpr TAffine<T> TAffine<T>::inverse() const
+	{
+		// inverse(L | t) = inverse(L) | -inverse(L) t
+		TMatrix<T, 3, 3> l = TMatrix<T, 3, 3>(
+			this->_m11, this->_m12, this->_m13,
+			this->_m21, this->_m22, this->_m23,
+			this->_m31, this->_m32, this->_m33).inverse();
+		TVector<T, 3> t = -(l * translation());
+
+		return TAffine(
+			l._m11, l._m12, l._m13, t._x,
+			l._m21, l._m22, l._m23, t._y,
+			l._m31, l._m32, l._m33, t._z);
+	}
+
+	template<typename T>
+	constexpr TAffine<T> TAffine<T>::inverseRigid() const
+	{
+		TAffine r(
+			this->_m11, this->_m21, this->_m31, T(0),
+			this->_m12, this->_m22, this->_m32, T(0),
+			this->_m13, this->_m23, this->_m33, T(0));
+		TVector<T, 3> t = -r.transformVector(translation());
+		r._m14 = t._x;
+		r._m24 = t._y;
+		r._m34 = t._z;
+		return r;
 	}
 
-	inline Matrix2x2 Matrix2x2::transpose()
-	{
-		Matrix2x2 t;
-		t._m11 = _m11;
-		t._m12 = _m21;
-		t._m21 = _m12;
-		t._m22 = _m22;
-
-		return t;
+	// Full 4x4 math only for the projection step
+	template<typename T>
+	constexpr TMatrix<T, 4, 4> operator * (const TMatrix<T, 4, 4> &a, const TAffine<T> &b)
+	{
+#ifdef GU_SSE
+		if constexpr(std::is_same<T, float>::value)
+		{
+			if(!GU_CONSTANT_EVALUATED())
+			{
+				__m128 b1 = b.row(0), b2 = b.row(1), b3 = b.row(2);
+				__m128 b4 = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+				return TMatrix<T, 4, 4>(
+					_Combine(a.row(0), b1, b2, b3, b4),
+					_Combine(a.row(1), b1, b2, b3, b4),
+					_Combine(a.row(2), b1, b2, b3, b4),
+					_Combine(a.row(3), b1, b2, b3, b4));
+			}
+		}
+#endif
+		return a * b.toMatrix();
+	}
+
+	template<typename T>
+	constexpr TVector<T, 4> operator * (const TAffine<T> &a, const TVector<T, 4> &b)
+	{
+		return TVector<T, 4>(
+			a._m11 * b._x + a._m12 * b._y + a._m13 * b._z + a._m14 * b._w,
+			a._m21 * b._x + a._m22 * b._y + a._m23 * b._z + a._m24 * b._w,
+			a._m31 * b._x + a._m32 * b._y + a._m33 * b._z + a._m34 * b._w,
+			b._w);
 	}
 
 	/*********************************************************/
-	class Matrix3x3
-	{
-		public:
-			Matrix3x3()
-				: _m11(1), _m12(0), _m13(0),
-				_m21(0), _m22(1), _m23(0),
-				_m31(0), _m32(0), _m33(1) { }
-			Matrix3x3(const Matrix3x3 &m)
-				: _m11(m._m11), _m12(m._m12), _m13(m._m13),
-				_m21(m._m21), _m22(m._m22), _m23(m._m23),
-				_m31(m._m31), _m32(m._m32), _m33(m._m33) { }
-			Matrix3x3(float m11, float m12, float m13,
-				float m21, float m22, float m23,
-				float m31, float m32, float m33)
-				: _m11(m11), _m12(m12), _m13(m13),
-				_m21(m21), _m22(m22), _m23(m23),
-				_m31(m31), _m32(m32), _m33(m33) { }
-
-			Matrix3x3 inverse();
-			Matrix3x3 transpose();
+	typedef TAffine<float> Affine;
 
+	/*********************************************************/
+	// Rotation quaternion, (x, y, z) is the vector part and w the scalar
+	// part. The rotations follow the Matrix builders, q * p applies p first.
+	template<typename T>
+	class TQuaternion : public _VectorData<T, 4>
+	{
 		public:
-			float _m11, _m12, _m13;
-			float _m21, _m22, _m23;
-			float _m31, _m32, _m33;
-
+			constexpr TQuaternion() : _VectorData<T, 4>(T(0), T(0), T(0), T(1)) { }
+			constexpr TQuaternion(T x, T y, T z, T w) : _VectorData<T, 4>(x, y, z, w) { }
+#ifdef GU_SSE
+			explicit TQuaternion(__m128 v) : _VectorData<T, 4>(v) { }
+#endif
+
+			constexpr T dot(const TQuaternion &q) const;
+			T length() const;
+
+			TQuaternion normalize() const;
+			constexpr TQuaternion conjugate() const;
+			constexpr TQuaternion inverse() const;
+
+			constexpr TVector<T, 3> rotate(const TVector<T, 3> &v) const;
+			constexpr TMatrix<T, 4, 4> toMatrix() const;
+			constexpr TAffine<T> toAffine() const;
+
+			friend constexpr TQuaternion operator + (const TQuaternion &a, const TQuaternion &b)
+			{
+#ifdef GU_SSE
+				if constexpr(_IsSimd4<T, 4>)
+					if(!GU_CONSTANT_EVALUATED())
+						return TQuaternion(_mm_add_ps(a.simd(), b.simd()));
+#endif
+				return TQuaternion(a._x + b._x, a._y + b._y, a._z + b._z, a._w + b._w);
+			}
+			friend constexpr TQuaternion operator - (const TQuaternion &a, const TQuaternion &b)
+			{
+#ifdef GU_SSE
+				if constexpr(_IsSimd4<T, 4>)
+					if(!GU_CONSTANT_EVALUATED())
+						return TQuaternion(_mm_sub_ps(a.simd(), b.simd()));
+#endif
+				return TQuaternion(a._x - b._x, a._y - b._y, a._z - b._z, a._w - b._w);
+			}
+			friend constexpr TQuaternion operator * (const TQuaternion &a, const T s)
+			{
+#ifdef GU_SSE
+				if constexpr(_IsSimd4<T, 4>)
+					if(!GU_CONSTANT_EVALUATED())
+						return TQuaternion(_mm_mul_ps(a.simd(), _mm_set1_ps(s)));
+#endif
+				return TQuaternion(a._x * s, a._y * s, a._z * s, a._w * s);
+			}
+			friend constexpr TQuaternion operator * (const T s, const TQuaternion &a)
+			{ return a * s; }
+			friend constexpr TQuaternion operator * (const TQuaternion &a, const TQuaternion &b)
+			{
+#ifdef GU_SSE
+				if constexpr(_IsSimd4<T, 4>)
+				{
+					if(!GU_CONSTANT_EVALUATED())
+					{
+						__m128 va = a.simd(), vb = b.simd();
+						__m128 r = _mm_mul_ps(GU_SWIZZLE(va, 3, 3, 3, 3), vb);
+						r = _mm_add_ps(r, _mm_mul_ps(
+							_mm_mul_ps(GU_SWIZZLE(va, 0, 0, 0, 0), GU_SWIZZLE(vb, 3, 2, 1, 0)),
+							_mm_setr_ps(1.0f, -1.0f, 1.0f, -1.0f)));
+						r = _mm_add_ps(r, _mm_mul_ps(
+							_mm_mul_ps(GU_SWIZZLE(va, 1, 1, 1, 1), GU_SWIZZLE(vb, 2, 3, 0, 1)),
+							_mm_setr_ps(1.0f, 1.0f, -1.0f, -1.0f)));
+						r = _mm_add_ps(r, _mm_mul_ps(
+							_mm_mul_ps(GU_SWIZZLE(va, 2, 2, 2, 2), GU_SWIZZLE(vb, 1, 0, 3, 2)),
+							_mm_setr_ps(-1.0f, 1.0f, 1.0f, -1.0f)));
+						return TQuaternion(r);
+					}
+				}
+#endif
+				return TQuaternion(
+					a._w * b._x + a._x * b._w + a._y * b._z - a._z * b._y,
+					a._w * b._y - a._x * b._z + a._y * b._w + a._z * b._x,
+					a._w * b._z + a._x * b._y - a._y * b._x + a._z * b._w,
+					a._w * b._w - a._x * b._x - a._y * b._y - a._z * b._z);
+			}
+			friend constexpr bool operator == (const TQuaternion &a, const TQuaternion &b)
+			{ return a._x == b._x && a._y == b._y && a._z == b._z && a._w == b._w; }
+			friend constexpr bool operator != (const TQuaternion &a, const TQuaternion &b)
+			{ return !(a == b); }
 	};
 
-	inline Matrix3x3 operator + (const Matrix3x3 &a, const Matrix3x3 &b)
+	template<typename T>
+	constexpr T TQuaternion<T>::dot(const TQuaternion &q) const
 	{
-		return Matrix3x3(
-			a._m11 + b._m11, a._m12 + b._m12, a._m13 + b._m13,
-			a._m21 + b._m21, a._m22 + b._m22, a._m23 + b._m23,
-			a._m31 + b._m31, a._m32 + b._m32, a._m33 + b._m33
-		);
+		return this->_x * q._x + this->_y * q._y + this->_z * q._z + this->_w * q._w;
 	}
-	inline Matrix3x3 operator - (const Matrix3x3 &a, const Matrix3x3 &b)
+
+	template<typename T>
+	inline T TQuaternion<T>::length() const
 	{
-		return Matrix3x3(
-			a._m11 - b._m11, a._m12 - b._m12, a._m13 - b._m13,
-			a._m21 - b._m21, a._m22 - b._m22, a._m23 - b._m23,
-			a._m31 - b._m31, a._m32 - b._m32, a._m33 - b._m33
-		);
+		return (T)sqrt(dot(*this));
 	}
-	inline Matrix3x3 operator * (const Matrix3x3 &a, const float s)
-	{
-		return Matrix3x3(
-			a._m11 * s, a._m12 * s, a._m13 * s,
-			a._m21 * s, a._m22 * s, a._m23 * s,
-			a._m31 * s, a._m32 * s, a._m33 * s
 
-		);
-	}
-	inline Matrix3x3 operator * (const float s, const Matrix3x3 &a)
+	template<typename T>
+	inline TQuaternion<T> TQuaternion<T>::normalize() const
 	{
-		return Matrix3x3(
-			a._m11 * s, a._m12 * s, a._m13 * s,
-			a._m21 * s, a._m22 * s, a._m23 * s,
-			a._m31 * s, a._m32 * s, a._m33 * s
-
-		);
+		return *this * (T(1) / length());
 	}
-	inline Matrix3x3 operator * (const Matrix3x3 &a, const Matrix3x3 &b)
-	{
-		Matrix3x3 r;
-		r._m11 = a._m11 * b._m11 + a._m12 * b._m21 + a._m13 * b._m31;
-		r._m12 = a._m11 * b._m12 + a._m12 + b._m22 + a._m13 + b._m32;
-		r._m13 = a._m11 * b._m13 + a._m12 * b._m23 + a._m13 * b._m33;
 
-		r._m21 = a._m21 * b._m11 + a._m22 * b._m21 + a._m23 * b._m31;
-		r._m22 = a._m21 * b._m12 + a._m22 * b._m22 + a._m23 * b._m32;
-		r._m23 = a._m21 * b._m13 + a._m22 * b._m23 + a._m23 * b._m33;
-
-		r._m31 = a._m31 * b._m11 + a._m32 * b._m21 + a._m33 * b._m31;
-		r._m32 = a._m31 * b._m12 + a._m32 * b._m22 + a._m33 * b._m32;
-		r._m33 = a._m31 * b._m13 + a._m32 * b._m23 + a._m33 * b._m33;
-		return r;
-	}
-	inline Vector3 operator * (const Matrix3x3 &a, const Vector3 &b)
+	template<typename T>
+	constexpr TQuaternion<T> TQuaternion<T>::conjugate() const
 	{
-		return Vector3(
-			a._m11 * b._x + a._m12 * b._y + a._m13 * b._z,
-			a._m21 * b._x + a._m22 * b._y + a._m23 * b._z,
-			a._m31 * b._x + a._m32 * b._y + a._m33 * b._z		
-		);
+		return TQuaternion(-this->_x, -this->_y, -this->_z, this->_w);
 	}
-	inline Matrix3x3 operator / (const Matrix3x3 &a, const float s)
+
+	template<typename T>
+	constexpr TQuaternion<T> TQuaternion<T>::inverse() const
 	{
-		return Matrix3x3(
-			a._m11 / s, a._m12 / s, a._m13 / s,
-			a._m21 / s, a._m22 / s, a._m23 / s,
-			a._m31 / s, a._m32 / s, a._m33 / s
-		);
+		return conjugate() * (T(1) / dot(*this));
 	}
 
-	inline Matrix3x3 Matrix3x3::inverse()
+	template<typename T>
+	constexpr TVector<T, 3> TQuaternion<T>::rotate(const TVector<T, 3> &v) const
 	{
-		Matrix3x3 i;
-
-		float det = 0.0f;
-		det += _m11 * det2x2(_m22, _m32, _m32, _m33);
-		det -= _m12 * det2x2(_m21, _m31, _m23, _m33);
-		det += _m13 * det2x2(_m21, _m31, _m22, _m32);
-
-		i._m11 = det2x2(_m22, _m32, _m23, _m33) / det;
-		i._m21 = -det2x2(_m21, _m31, _m23, _m33) / det;
-		i._m31 = det2x2(_m21, _m31, _m22, _m32) / det;
-
-		i._m12 = -det2x2(_m12, _m32, _m13, _m33) / det;
-		i._m22 = det2x2(_m11, _m31, _m13, _m33) / det;
-		i._m32 = -det2x2(_m11, _m31, _m12, _m32) / det;
+		// v + 2w (q x v) + 2 q x (q x v)
+		TVector<T, 3> q(this->_x, this->_y, this->_z);
+		TVector<T, 3> t = q.cross(v) * T(2);
+		return v + t * this->_w + q.cross(t);
+	}
 
-		i._m13 = det2x2(_m12, _m22, _m13, _m23) / det;
-		i._m23 = -det2x2(_m11, _m21, _m13, _m23) / det;
-		i._m33 = det2x2(_m11, _m21, _m12, _m22) / det;
+	template<typename T>
+	constexpr TAffine<T> TQuaternion<T>::toAffine() const
+	{
+		T x = this->_x, y = this->_y, z = this->_z, w = this->_w;
+		T xx = x * x, yy = y * y, zz = z * z;
+		T xy = x * y, xz = x * z, yz = y * z;
+		T wx = w * x, wy = w * y, wz = w * z;
 
-		return i;
+		return TAffine<T>(
+			T(1) - T(2) * (yy + zz), T(2) * (xy - wz), T(2) * (xz + wy), T(0),
+			T(2) * (xy + wz), T(1) - T(2) * (xx + zz), T(2) * (yz - wx), T(0),
+			T(2) * (xz - wy), T(2) * (yz + wx), T(1) - T(2) * (xx + yy), T(0));
 	}
 
-	inline Matrix3x3 Matrix3x3::transpose()
+	template<typename T>
+	constexpr TMatrix<T, 4, 4> TQuaternion<T>::toMatrix() const
 	{
-		Matrix3x3 t;
-		t._m11 = _m11; t._m12 = _m21; t._m13 = _m31;
-		t._m21 = _m12; t._m22 = _m22; t._m23 = _m32;
-		t._m31 = _m13; t._m32 = _m23; t._m33 = _m33;
-		return t;
+		return toAffine().toMatrix();
 	}
 
 	/*********************************************************/
-	class Matrix4x4
-	{
-		public:
-			Matrix4x4()
-				: _m11(1), _m12(0), _m13(0), _m14(0),
-				_m21(0), _m22(1), _m23(0), _m24(0),
-				_m31(0), _m32(0), _m33(1), _m34(0),
-				_m41(0), _m42(0), _m43(0), _m44(1) { }
-			Matrix4x4(const Matrix4x4 &m)
-				: _m11(m._m11), _m12(m._m12), _m13(m._m13), _m14(m._m14), 
-				_m21(m._m21), _m22(m._m22), _m23(m._m23), _m24(m._m24),
-				_m31(m._m31), _m32(m._m32), _m33(m._m33), _m34(m._m34),
-				_m41(m._m41), _m42(m._m42), _m43(m._m43), _m44(m._m44) { }
-			Matrix4x4(float m11, float m12, float m13, float m14,
-				float m21, float m22, float m23, float m24,
-				float m31, float m32, float m33, float m34,
-				float m41, float m42, float m43, float m44)
-				: _m11(m11), _m12(m12), _m13(m13), _m14(m14),
-				_m21(m21), _m22(m22), _m23(m23), _m24(m24),
-				_m31(m31), _m32(m32), _m33(m33), _m34(m34),
-				_m41(m41), _m42(m42), _m43(m43), _m44(m44) { }
-
-			Matrix4x4 inverse();
-			Matrix4x4 transpose();
+	typedef TQuaternion<float> Quaternion;
 
-		public:
-			float _m11, _m12, _m13, _m14;
-			float _m21, _m22, _m23, _m24;
-			float _m31, _m32, _m33, _m34;
-			float _m41, _m42, _m43, _m44;
-
-	};
+	/*********************************************************/
+	// Closed form rotations. The elementary rotations are applied to the
+	// columns of a 3x3 block directly instead of multiplying 4x4 matrices,
+	// and sin and cos are evaluated once per angle.
+	enum class EulerOrder { XYZ, XZY, YXZ, YZX, ZXY, ZYX };
 
-	inline Matrix4x4 operator + (const Matrix4x4 &a, const Matrix4x4 &b)
-	{
-		return Matrix4x4(
-			a._m11 + b._m11, a._m12 + b._m12, a._m13 + b._m13, a._m14 + b._m14,
-			a._m21 + b._m21, a._m22 + b._m22, a._m23 + b._m23, a._m24 + b._m24,
-			a._m31 + b._m31, a._m32 + b._m32, a._m33 + b._m33, a._m34 + b._m34,
-			a._m41 + b._m41, a._m42 + b._m42, a._m43 + b._m43, a._m44 + b._m44
-		);
-	}
-	inline Matrix4x4 operator - (const Matrix4x4 &a, const Matrix4x4 &b)
-	{
-		return Matrix4x4(
-			a._m11 - b._m11, a._m12 - b._m12, a._m13 - b._m13, a._m14 - b._m14,
-			a._m21 - b._m21, a._m22 - b._m22, a._m23 - b._m23, a._m24 - b._m24,
-			a._m31 - b._m31, a._m32 - b._m32, a._m33 - b._m33, a._m34 - b._m34,
-			a._m41 - b._m41, a._m42 - b._m42, a._m43 - b._m43, a._m44 - b._m44
-		);
-	}
-	inline Matrix4x4 operator * (const Matrix4x4 &a, const float s)
-	{
-		return Matrix4x4(
-			a._m11 * s, a._m12 * s, a._m13 * s, a._m14 * s,
-			a._m21 * s, a._m22 * s, a._m23 * s, a._m24 * s,
-			a._m31 * s, a._m32 * s, a._m33 * s, a._m34 * s,
-			a._m41 * s, a._m42 * s, a._m43 * s, a._m44 * s
-		);
-	}
-	inline Matrix4x4 operator * (const float s, const Matrix4x4 &a)
+	// m = m * R, where R rotates in the plane of the columns p and q
+	inline void _RotateColumns(float m[3][3], int p, int q, float c, float s)
 	{
-		return Matrix4x4(
-			a._m11 * s, a._m12 * s, a._m13 * s, a._m14 * s,
-			a._m21 * s, a._m22 * s, a._m23 * s, a._m24 * s,
-			a._m31 * s, a._m32 * s, a._m33 * s, a._m34 * s,
-			a._m41 * s, a._m42 * s, a._m43 * s, a._m44 * s
-		);
+		for(int r = 0; r < 3; r++)
+		{
+			float a = m[r][p], b = m[r][q];
+			m[r][p] = a * c + b * s;
+			m[r][q] = b * c - a * s;
+		}
 	}
-	inline Matrix4x4 operator * (const Matrix4x4 &a, const Matrix4x4 &b)
+
+	// XYZ is RotateX * RotateY * RotateZ, the other orders accordingly
+	inline void _EulerRotation(float m[3][3], const float c[3], const float s[3], EulerOrder order)
 	{
-		Matrix4x4 r;
-		r._m11 = a._m11 * b._m11 + a._m12 * b._m21 + a._m13 * b._m31 + a._m14 * b._m41;
-		r._m12 = a._m11 * b._m12 + a._m12 * b._m22 + a._m13 * b._m32 + a._m14 * b._m42;
-		r._m13 = a._m11 * b._m13 + a._m12 * b._m23 + a._m13 * b._m33 + a._m14 * b._m43;
-		r._m14 = a._m11 * b._m14 + a._m12 * b._m24 + a._m13 * b._m34 + a._m14 * b._m44;
+		static const int axes[6][3] = { { 0, 1, 2 }, { 0, 2, 1 }, { 1, 0, 2 }, { 1, 2, 0 }, { 2, 0, 1 }, { 2, 1, 0 } };
+		static const int planes[3][2] = { { 1, 2 }, { 0, 2 }, { 0, 1 } };
+		const int* a = axes[(int)order];
 
-		r._m21 = a._m21 * b._m11 + a._m22 * b._m21 + a._m23 * b._m31 + a._m24 * b._m41;
-		r._m21 = a._m21 * b._m12 + a._m22 * b._m22 + a._m23 * b._m32 + a._m24 * b._m42;
-		r._m21 = a._m21 * b._m13 + a._m22 * b._m23 + a._m23 * b._m33 + a._m24 * b._m43;
-		r._m21 = a._m21 * b._m14 + a._m22 * b._m24 + a._m23 * b._m34 + a._m24 * b._m44;
+		int p = planes[a[0]][0], q = planes[a[0]][1], k = 3 - p - q;
+		m[p][p] = c[a[0]];	m[p][q] = -s[a[0]];	m[p][k] = 0.0f;
+		m[q][p] = s[a[0]];	m[q][q] = c[a[0]];	m[q][k] = 0.0f;
+		m[k][p] = 0.0f;		m[k][q] = 0.0f;		m[k][k] = 1.0f;
 
-		r._m31 = a._m31 * b._m11 + a._m32 * b._m21 + a._m33 * b._m31 + a._m34 * b._m41;
-		r._m31 = a._m31 * b._m12 + a._m32 * b._m22 + a._m33 * b._m32 + a._m34 * b._m42;
-		r._m31 = a._m31 * b._m13 + a._m32 * b._m23 + a._m33 * b._m33 + a._m34 * b._m43;
-		r._m31 = a._m31 * b._m14 + a._m32 * b._m24 + a._m33 * b._m34 + a._m34 * b._m44;
+		_RotateColumns(m, planes[a[1]][0], planes[a[1]][1], c[a[1]], s[a[1]]);
+		_RotateColumns(m, planes[a[2]][0], planes[a[2]][1], c[a[2]], s[a[2]]);
+	}
 
-		r._m41 = a._m41 * b._m11 + a._m42 * b._m21 + a._m43 * b._m31 + a._m24 * b._m41;
-		r._m41 = a._m41 * b._m12 + a._m42 * b._m22 + a._m43 * b._m32 + a._m44 * b._m42;
-		r._m41 = a._m41 * b._m13 + a._m42 * b._m23 + a._m43 * b._m33 + a._m44 * b._m43;
-		r._m41 = a._m41 * b._m14 + a._m42 * b._m24 + a._m43 * b._m34 + a._m44 * b._m44;
-		return r;
+	// Rodrigues' formula, same direction as QuaternionRotateAxis
+	inline void _AxisRotation(float m[3][3], const Vector3 &axis, float c, float s)
+	{
+		Vector3 a = axis.normalize();
+		float t = 1.0f - c;
+		float xy = a._x * a._y * t, xz = a._x * a._z * t, yz = a._y * a._z * t;
+		m[0][0] = a._x * a._x * t + c;	m[0][1] = xy - a._z * s;		m[0][2] = xz + a._y * s;
+		m[1][0] = xy + a._z * s;		m[1][1] = a._y * a._y * t + c;	m[1][2] = yz - a._x * s;
+		m[2][0] = xz - a._y * s;		m[2][1] = yz + a._x * s;		m[2][2] = a._z * a._z * t + c;
 	}
-	inline Vector4 operator * (const Matrix4x4 &a, const Vector4 &b)
+
+	// Writes the 3x3 block of a Matrix4x4 or Affine, the rest is left as is
+	template<typename M>
+	inline void _SetRotation(M &out, const float m[3][3])
 	{
-		return Vector4(
-			a._m11 * b._x + a._m12 * b._y + a._m13 * b._z + a._m14 * b._w,
-			a._m21 * b._x + a._m22 * b._y + a._m23 * b._z + a._m24 * b._w,
-			a._m31 * b._x + a._m32 * b._y + a._m33 * b._z + a._m34 * b._w,
-			a._m41 * b._x + a._m42 * b._y + a._m43 * b._z + a._m44 * b._w
-		);
+		out._m11 = m[0][0];	out._m12 = m[0][1];	out._m13 = m[0][2];
+		out._m21 = m[1][0];	out._m22 = m[1][1];	out._m23 = m[1][2];
+		out._m31 = m[2][0];	out._m32 = m[2][1];	out._m33 = m[2][2];
 	}
-	inline Matrix4x4 operator / (const Matrix4x4 &a, const float s)
+
+	template<typename M>
+	inline M _RotateEuler(float x, float y, float z, EulerOrder order)
 	{
-		return Matrix4x4(
-			a._m11 / s, a._m12 / s, a._m13 / s, a._m14 / s,
-			a._m21 / s, a._m22 / s, a._m23 / s, a._m24 / s,
-			a._m31 / s, a._m32 / s, a._m33 / s, a._m34 / s,
-			a._m41 / s, a._m42 / s, a._m43 / s, a._m44 / s
-		);
+		float c[3] = { (float)cos(x), (float)cos(y), (float)cos(z) };
+		float s[3] = { (float)sin(x), (float)sin(y), (float)sin(z) };
+		float m[3][3];
+		_EulerRotation(m, c, s, order);
+		M r;
+		_SetRotation(r, m);
+		return r;
 	}
 
-	inline Matrix4x4 Matrix4x4::inverse()
+	template<typename M>
+	inline M _RotateAxis(const Vector3 &axis, float angle)
 	{
-		float det = 0.0f;
-		det += _m11 * det3x3(_m22, _m32, _m42, _m23, _m33, _m43, _m24, _m34, _m44);
-		det -= _m12 * det3x3(_m21, _m31, _m41, _m23, _m33, _m43, _m24, _m34, _m44);
-		det += _m13 * det3x3(_m21, _m31, _m41, _m22, _m32, _m42, _m24, _m34, _m44);
-		det -= _m14 * det3x3(_m21, _m31, _m41, _m22, _m32, _m42, _m23, _m33, _m43);
-
-		Matrix4x4 i;
-		i._m11 = det3x3(_m22, _m32, _m42, _m23, _m33, _m43, _m24, _m34, _m44) / det;
-		i._m21 = -det3x3(_m21, _m31, _m41, _m23, _m33, _m43, _m24, _m34, _m44) / det;
-		i._m31 = det3x3(_m21, _m31, _m41, _m22, _m32, _m42, _m24, _m34, _m44) / det;
-		i._m41 = -det3x3(_m21, _m31, _m41, _m22, _m32, _m42, _m23, _m33, _m43) / det;
-
-		i._m12 = -det3x3(_m12, _m32, _m42, _m13, _m33, _m43, _m41, _m34, _m44) / det;
-		i._m22 = det3x3(_m11, _m31, _m41, _m13, _m33, _m43, _m14, _m34, _m44) / det;
-		i._m32 = -det3x3(_m11, _m31, _m41, _m12, _m32, _m42, _m14, _m34, _m44) / det;
-		i._m42 = det3x3(_m11, _m31, _m41, _m12, _m32, _m42, _m13, _m33, _m43) / det;
-
-		i._m13 = det3x3(_m12, _m22, _m42, _m13, _m23, _m43, _m14, _m24, _m44) / det;
-		i._m23 = -det3x3(_m11, _m21, _m41, _m13, _m23, _m43, _m14, _m24, _m44) / det;
-		i._m33 = det3x3(_m11, _m21, _m41, _m12, _m22, _m42, _m14, _m24, _m44) / det;
-		i._m43 = -det3x3(_m11, _m21, _m41, _m12, _m22, _m42, _m13, _m23, _m43) / det;
-
-		i._m14 = -det3x3(_m12, _m22, _m32, _m13, _m23, _m33, _m14, _m24, _m34) / det;
-		i._m24 = det3x3(_m11, _m21, _m31, _m13, _m23, _m33, _m14, _m24, _m34) / det;
-		i._m34 = -det3x3(_m11, _m21, _m31, _m12, _m22, _m32, _m14, _m24, _m34) / det;
-		i._m44 = det3x3(_m11, _m21, _m31, _m12, _m22, _m32, _m13, _m23, _m33) / det;
-
-		return i;
-	}
-
-	inline Matrix4x4 Matrix4x4::transpose()
-	{
-		return Matrix4x4(
-			_m11, _m21, _m31, _m41, 
-			_m12, _m22, _m32, _m42,
-			_m13, _m23, _m33, _m34,
-			_m14, _m24, _m34, _m44
-		);
+		float m[3][3];
+		_AxisRotation(m, axis, (float)cos(angle), (float)sin(angle));
+		M r;
+		_SetRotation(r, m);
+		return r;
 	}
+
 	/*********************************************************/
 
 	inline Matrix MatrixTranslate(float x, float y, float z)
@@ -778,10 +1455,20 @@ namespace GU
 
 	inline Matrix MatrixRotateXYZ(float x, float y, float z)
 	{
-		return MatrixRotateX(x) * MatrixRotateY(y) * MatrixRotateZ(z);
+		return _RotateEuler<Matrix>(x, y, z, EulerOrder::XYZ);
+	}
+
+	inline Matrix MatrixRotateEuler(float x, float y, float z, EulerOrder order)
+	{
+		return _RotateEuler<Matrix>(x, y, z, order);
 	}
 
-	inline Matrix MatrixLookAt(Vector &eye, Vector &lookAt, Vector &up)
+	inline Matrix MatrixRotateAxis(const Vector3 &axis, float angle)
+	{
+		return _RotateAxis<Matrix>(axis, angle);
+	}
+
+	inline Matrix MatrixLookAt(const Vector &eye, const Vector &lookAt, const Vector &up)
 	{
 		Vector Z = (eye - lookAt).normalize();
 		Vector X = up.cross(Z);
@@ -804,6 +1491,578 @@ namespace GU
 		return view;
 	}
 
+	/*********************************************************/
+	inline Affine AffineTranslate(float x, float y, float z)
+	{
+		Affine t;
+		t._m14 = x;
+		t._m24 = y;
+		t._m34 = z;
+		return t;
+	}
+
+	inline Affine AffineScale(float x, float y, float z)
+	{
+		Affine s;
+		s._m11 = x;
+		s._m22 = y;
+		s._m33 = z;
+		return s;
+	}
+
+	inline Affine AffineRotateX(float x)
+	{
+		Affine r;
+		r._m22 = (float)cos(x);	r._m23 = (float)-sin(x);
+		r._m32 = (float)sin(x);	r._m33 = (float)cos(x);
+		return r;
+	}
+
+	inline Affine AffineRotateY(float y)
+	{
+		Affine r;
+		r._m11 = (float)cos(y);	r._m13 = (float)-sin(y);
+		r._m31 = (float)sin(y);	r._m33 = (float)cos(y);
+		return r;
+	}
+
+	inline Affine AffineRotateZ(float z)
+	{
+		Affine r;
+		r._m11 = (float)cos(z);	r._m12 = (float)-sin(z);
+		r._m21 = (float)sin(z);	r._m22 = (float)cos(z);
+		return r;
+	}
+
+	inline Affine AffineRotateXYZ(float x, float y, float z)
+	{
+		return _RotateEuler<Affine>(x, y, z, EulerOrder::XYZ);
+	}
+
+	inline Affine AffineRotateEuler(float x, float y, float z, EulerOrder order)
+	{
+		return _RotateEuler<Affine>(x, y, z, order);
+	}
+
+	inline Affine AffineRotateAxis(const Vector3 &axis, float angle)
+	{
+		return _RotateAxis<Affine>(axis, angle);
+	}
+
+	inline Affine AffineLookAt(const Vector &eye, const Vector &lookAt, const Vector &up)
+	{
+		return Affine(MatrixLookAt(eye, lookAt, up));
+	}
+
+	/*********************************************************/
+	inline Quaternion QuaternionRotateAxis(const Vector3 &axis, float angle)
+	{
+		Vector3 a = axis.normalize() * (float)sin(angle * 0.5f);
+		return Quaternion(a._x, a._y, a._z, (float)cos(angle * 0.5f));
+	}
+
+	inline Quaternion QuaternionRotateX(float x)
+	{
+		return Quaternion((float)sin(x * 0.5f), 0.0f, 0.0f, (float)cos(x * 0.5f));
+	}
+
+	// Same direction as MatrixRotateY
+	inline Quaternion QuaternionRotateY(float y)
+	{
+		return Quaternion(0.0f, (float)-sin(y * 0.5f), 0.0f, (float)cos(y * 0.5f));
+	}
+
+	inline Quaternion QuaternionRotateZ(float z)
+	{
+		return Quaternion(0.0f, 0.0f, (float)sin(z * 0.5f), (float)cos(z * 0.5f));
+	}
+
+	inline Quaternion QuaternionRotateXYZ(float x, float y, float z)
+	{
+		return QuaternionRotateX(x) * QuaternionRotateY(y) * QuaternionRotateZ(z);
+	}
+
+	// Interpolation along the shorter arc, t in [0, 1]
+	inline Quaternion Nlerp(const Quaternion &a, const Quaternion &b, float t)
+	{
+		float s = a.dot(b) < 0.0f ? -t : t;
+		return (a * (1.0f - t) + b * s).normalize();
+	}
+
+	inline Quaternion Slerp(const Quaternion &a, const Quaternion &b, float t)
+	{
+		float d = a.dot(b);
+		float sign = d < 0.0f ? -1.0f : 1.0f;
+		d *= sign;
+
+		float wa = 1.0f - t, wb = t;
+		if(d < 0.9995f)
+		{
+			float theta = (float)acos(d);
+			float s = (float)sin(theta);
+			wa = (float)sin(wa * theta) / s;
+			wb = (float)sin(wb * theta) / s;
+		}
+		return (a * wa + b * (wb * sign)).normalize();
+	}
+
+#ifdef GU_SSE
+	inline __m128 _Select(__m128 mask, __m128 a, __m128 b)
+	{
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+
+	// acos(x) for x in [0, 1], Abramowitz and Stegun 4.4.46
+	inline __m128 _AcosPositive(__m128 x)
+	{
+		__m128 p = _mm_set1_ps(-0.0012624911f);
+		p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(0.0066700901f));
+		p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(-0.0170881256f));
+		p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(0.0308918810f));
+		p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(-0.0501743046f));
+		p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(0.0889789874f));
+		p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(-0.2145988016f));
+		p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(1.5707963050f));
+		return _mm_mul_ps(p, _mm_sqrt_ps(_mm_sub_ps(_mm_set1_ps(1.0f), x)));
+	}
+
+	// sin(x) for x in [-pi/2, pi/2]
+	inline __m128 _SinHalfPi(__m128 x)
+	{
+		__m128 x2 = _mm_mul_ps(x, x);
+		__m128 p = _mm_set1_ps(-2.5052108e-8f);
+		p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(2.7557319e-6f));
+		p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(-1.9841270e-4f));
+		p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(8.3333333e-3f));
+		p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(-1.6666667e-1f));
+		p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(1.0f));
+		return _mm_mul_ps(p, x);
+	}
+
+	// Four interpolations at once, the quaternions are transposed to
+	// x, y, z and w registers
+	template<bool Spherical>
+	inline void _Interpolate4(const Quaternion* a, const Quaternion* b, __m128 t, Quaternion* out)
+	{
+		__m128 ax = a[0].simd(), ay = a[1].simd(), az = a[2].simd(), aw = a[3].simd();
+		__m128 bx = b[0].simd(), by = b[1].simd(), bz = b[2].simd(), bw = b[3].simd();
+		_MM_TRANSPOSE4_PS(ax, ay, az, aw);
+		_MM_TRANSPOSE4_PS(bx, by, bz, bw);
+
+		__m128 d = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+			_mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+		__m128 sign = _mm_and_ps(d, _mm_set1_ps(-0.0f));
+		d = _mm_xor_ps(d, sign);
+
+		__m128 wa = _mm_sub_ps(_mm_set1_ps(1.0f), t);
+		__m128 wb = t;
+		if(Spherical)
+		{
+			__m128 theta = _AcosPositive(_mm_min_ps(d, _mm_set1_ps(1.0f)));
+			__m128 s = _SinHalfPi(theta);
+			__m128 sa = _mm_div_ps(_SinHalfPi(_mm_mul_ps(wa, theta)), s);
+			__m128 sb = _mm_div_ps(_SinHalfPi(_mm_mul_ps(wb, theta)), s);
+			__m128 linear = _mm_cmpgt_ps(d, _mm_set1_ps(0.9995f));
+			wa = _Select(linear, wa, sa);
+			wb = _Select(linear, wb, sb);
+		}
+		wb = _mm_xor_ps(wb, sign);
+
+		__m128 x = _mm_add_ps(_mm_mul_ps(ax, wa), _mm_mul_ps(bx, wb));
+		__m128 y = _mm_add_ps(_mm_mul_ps(ay, wa), _mm_mul_ps(by, wb));
+		__m128 z = _mm_add_ps(_mm_mul_ps(az, wa), _mm_mul_ps(bz, wb));
+		__m128 w = _mm_add_ps(_mm_mul_ps(aw, wa), _mm_mul_ps(bw, wb));
+
+		__m128 l = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+			_mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+		l = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(l));
+		x = _mm_mul_ps(x, l);
+		y = _mm_mul_ps(y, l);
+		z = _mm_mul_ps(z, l);
+		w = _mm_mul_ps(w, l);
+
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+		_mm_store_ps(&out[0]._x, x);
+		_mm_store_ps(&out[1]._x, y);
+		_mm_store_ps(&out[2]._x, z);
+		_mm_store_ps(&out[3]._x, w);
+	}
+#endif
+
+	// Batch interpolation of keyframe arrays, out[i] = nlerp(a[i], b[i], t[i])
+	inline void Nlerp(const Quaternion* a, const Quaternion* b, const float* t, Quaternion* out, size_t count)
+	{
+		size_t i = 0;
+#ifdef GU_SSE
+		for(; i + 4 <= count; i += 4)
+			_Interpolate4<false>(a + i, b + i, _mm_loadu_ps(t + i), out + i);
+#endif
+		for(; i < count; i++)
+			out[i] = Nlerp(a[i], b[i], t[i]);
+	}
+
+	// Batch interpolation of keyframe arrays, out[i] = slerp(a[i], b[i], t[i])
+	inline void Slerp(const Quaternion* a, const Quaternion* b, const float* t, Quaternion* out, size_t count)
+	{
+		size_t i = 0;
+#ifdef GU_SSE
+		for(; i + 4 <= count; i += 4)
+			_Interpolate4<true>(a + i, b + i, _mm_loadu_ps(t + i), out + i);
+#endif
+		for(; i < count; i++)
+			out[i] = Slerp(a[i], b[i], t[i]);
+	}
+
+#ifdef GU_SSE
+	// sin and cos of four angles. The angles are reduced to [-pi/4, pi/4]
+	// and evaluated with the Cephes sinf/cosf polynomials, the error is a
+	// few ulp for |x| < 8192.
+	inline void _SinCos(__m128 x, __m128 &s, __m128 &c)
+	{
+		__m128i q = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.63661977f)));
+		__m128 k = _mm_cvtepi32_ps(q);
+		__m128 r = _mm_sub_ps(x, _mm_mul_ps(k, _mm_set1_ps(1.5703125f)));
+		r = _mm_sub_ps(r, _mm_mul_ps(k, _mm_set1_ps(4.8375129699707031e-4f)));
+		r = _mm_sub_ps(r, _mm_mul_ps(k, _mm_set1_ps(7.5497899548918822e-8f)));
+		__m128 r2 = _mm_mul_ps(r, r);
+
+		__m128 ps = _mm_set1_ps(-1.9515295891e-4f);
+		ps = _mm_add_ps(_mm_mul_ps(ps, r2), _mm_set1_ps(8.3321608736e-3f));
+		ps = _mm_add_ps(_mm_mul_ps(ps, r2), _mm_set1_ps(-1.6666654611e-1f));
+		ps = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(ps, r2), r), r);
+
+		__m128 pc = _mm_set1_ps(2.443315711809948e-5f);
+		pc = _mm_add_ps(_mm_mul_ps(pc, r2), _mm_set1_ps(-1.388731625493765e-3f));
+		pc = _mm_add_ps(_mm_mul_ps(pc, r2), _mm_set1_ps(4.166664568298827e-2f));
+		pc = _mm_mul_ps(_mm_mul_ps(pc, r2), r2);
+		pc = _mm_add_ps(_mm_sub_ps(pc, _mm_mul_ps(r2, _mm_set1_ps(0.5f))), _mm_set1_ps(1.0f));
+
+		// Quadrant: odd ones swap sin and cos, the sign bits come from bit 1
+		__m128i one = _mm_set1_epi32(1), two = _mm_set1_epi32(2);
+		__m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, one), one));
+		__m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(q, two), 30));
+		__m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(q, one), two), 30));
+		s = _mm_xor_ps(_Select(swap, pc, ps), sinSign);
+		c = _mm_xor_ps(_Select(swap, ps, pc), cosSign);
+	}
+#endif
+
+	template<typename M>
+	inline void _RotateEulerBatch(const Vector3* angles, M* out, size_t count, EulerOrder order)
+	{
+		size_t i = 0;
+#ifdef GU_SSE
+		for(; i + 4 <= count; i += 4)
+		{
+			const Vector3* a = angles + i;
+			alignas(16) float c[3][4], s[3][4];
+			__m128 sv, cv;
+			_SinCos(_mm_setr_ps(a[0]._x, a[1]._x, a[2]._x, a[3]._x), sv, cv);
+			_mm_store_ps(s[0], sv); _mm_store_ps(c[0], cv);
+			_SinCos(_mm_setr_ps(a[0]._y, a[1]._y, a[2]._y, a[3]._y), sv, cv);
+			_mm_store_ps(s[1], sv); _mm_store_ps(c[1], cv);
+			_SinCos(_mm_setr_ps(a[0]._z, a[1]._z, a[2]._z, a[3]._z), sv, cv);
+			_mm_store_ps(s[2], sv); _mm_store_ps(c[2], cv);
+
+			for(int j = 0; j < 4; j++)
+			{
+				float cj[3] = { c[0][j], c[1][j], c[2][j] };
+				float sj[3] = { s[0][j], s[1][j], s[2][j] };
+				float m[3][3];
+				_EulerRotation(m, cj, sj, order);
+				out[i + j] = M();
+				_SetRotation(out[i + j], m);
+			}
+		}
+#endif
+		for(; i < count; i++)
+			out[i] = _RotateEuler<M>(angles[i]._x, angles[i]._y, angles[i]._z, order);
+	}
+
+	template<typename M>
+	inline void _RotateAxisBatch(const Vector3* axes, const float* angles, M* out, size_t count)
+	{
+		size_t i = 0;
+#ifdef GU_SSE
+		for(; i + 4 <= count; i += 4)
+		{
+			alignas(16) float c[4], s[4];
+			__m128 sv, cv;
+			_SinCos(_mm_loadu_ps(angles + i), sv, cv);
+			_mm_store_ps(s, sv);
+			_mm_store_ps(c, cv);
+
+			for(int j = 0; j < 4; j++)
+			{
+				float m[3][3];
+				_AxisRotation(m, axes[i + j], c[j], s[j]);
+				out[i + j] = M();
+				_SetRotation(out[i + j], m);
+			}
+		}
+#endif
+		for(; i < count; i++)
+			out[i] = _RotateAxis<M>(axes[i], angles[i]);
+	}
+
+	// Batch rotation builders, out[i] = MatrixRotateEuler(angles[i], order) etc.
+	inline void MatrixRotateEuler(const Vector3* angles, Matrix4x4* out, size_t count, EulerOrder order)
+	{
+		_RotateEulerBatch(angles, out, count, order);
+	}
+
+	inline void AffineRotateEuler(const Vector3* angles, Affine* out, size_t count, EulerOrder order)
+	{
+		_RotateEulerBatch(angles, out, count, order);
+	}
+
+	inline void MatrixRotateAxis(const Vector3* axes, const float* angles, Matrix4x4* out, size_t count)
+	{
+		_RotateAxisBatch(axes, angles, out, count);
+	}
+
+	inline void AffineRotateAxis(const Vector3* axes, const float* angles, Affine* out, size_t count)
+	{
+		_RotateAxisBatch(axes, angles, out, count);
+	}
+
+	/*********************************************************/
+	// Batch transforms over contiguous arrays. The stride is given in bytes
+	// so that e.g. the positions inside a std::vector<Vertex> can be
+	// transformed in place. Input and output may be the same array.
+	// Batches larger than GU_BATCH_GRAIN elements are split across
+	// the requested number of threads (0 = all hardware threads).
+	#ifndef GU_BATCH_GRAIN
+		#define GU_BATCH_GRAIN 16384
+	#endif
+
+	template<bool Divide>
+	inline void _TransformBatch3(const Matrix4x4 &m, const char* in, char* out,
+		size_t begin, size_t end, size_t stride, float w)
+	{
+#ifdef GU_SSE
+		// Columns of m, so that a point is a linear combination of them
+		Matrix4x4 t = m.transpose();
+		__m128 c1 = t.row(0), c2 = t.row(1), c3 = t.row(2);
+		__m128 c4 = _mm_mul_ps(t.row(3), _mm_set1_ps(w));
+		for(size_t i = begin; i < end; i++)
+		{
+			const float* p = (const float*)(in + i * stride);
+			__m128 r = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p[0]), c1), _mm_mul_ps(_mm_set1_ps(p[1]), c2)),
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p[2]), c3), c4));
+			if(Divide)
+				r = _mm_div_ps(r, GU_SWIZZLE(r, 3, 3, 3, 3));
+
+			float* q = (float*)(out + i * stride);
+			_mm_storel_pi((__m64*)q, r);
+			_mm_store_ss(q + 2, _mm_movehl_ps(r, r));
+		}
+#else
+		for(size_t i = begin; i < end; i++)
+		{
+			const Vector3 &p = *(const Vector3*)(in + i * stride);
+			float x = m._m11 * p._x + m._m12 * p._y + m._m13 * p._z + m._m14 * w;
+			float y = m._m21 * p._x + m._m22 * p._y + m._m23 * p._z + m._m24 * w;
+			float z = m._m31 * p._x + m._m32 * p._y + m._m33 * p._z + m._m34 * w;
+			if(Divide)
+			{
+				float iw = 1.0f / (m._m41 * p._x + m._m42 * p._y + m._m43 * p._z + m._m44 * w);
+				x *= iw; y *= iw; z *= iw;
+			}
+
+			Vector3 &q = *(Vector3*)(out + i * stride);
+			q._x = x; q._y = y; q._z = z;
+		}
+#endif
+	}
+
+	template<bool Divide>
+	inline void _TransformBatch4(const Matrix4x4 &m, const Vector4* in, Vector4* out,
+		size_t begin, size_t end)
+	{
+#ifdef GU_SSE
+		Matrix4x4 t = m.transpose();
+		__m128 c1 = t.row(0), c2 = t.row(1), c3 = t.row(2), c4 = t.row(3);
+		for(size_t i = begin; i < end; i++)
+		{
+			__m128 r = _Combine(in[i].simd(), c1, c2, c3, c4);
+			if(Divide)
+				r = _mm_div_ps(r, GU_SWIZZLE(r, 3, 3, 3, 3));
+			_mm_store_ps(&out[i]._x, r);
+		}
+#else
+		for(size_t i = begin; i < end; i++)
+		{
+			Vector4 r = m * in[i];
+			out[i] = Divide ? r / r._w : r;
+		}
+#endif
+	}
+
+	// Positions, w = 1
+	inline void TransformPoints(const Matrix4x4 &m, const Vector3* in, Vector3* out, size_t count,
+		size_t stride = sizeof(Vector3), unsigned threads = 1)
+	{
+		ParallelFor(count, GU_BATCH_GRAIN, [&](size_t begin, size_t end) {
+			_TransformBatch3<false>(m, (const char*)in, (char*)out, begin, end, stride, 1.0f);
+		}, threads);
+	}
+
+	// Positions, w = 1, followed by the perspective divide
+	inline void ProjectPoints(const Matrix4x4 &m, const Vector3* in, Vector3* out, size_t count,
+		size_t stride = sizeof(Vector3), unsigned threads = 1)
+	{
+		ParallelFor(count, GU_BATCH_GRAIN, [&](size_t begin, size_t end) {
+			_TransformBatch3<true>(m, (const char*)in, (char*)out, begin, end, stride, 1.0f);
+		}, threads);
+	}
+
+	// Directions, w = 0
+	inline void TransformDirections(const Matrix4x4 &m, const Vector3* in, Vector3* out, size_t count,
+		size_t stride = sizeof(Vector3), unsigned threads = 1)
+	{
+		ParallelFor(count, GU_BATCH_GRAIN, [&](size_t begin, size_t end) {
+			_TransformBatch3<false>(m, (const char*)in, (char*)out, begin, end, stride, 0.0f);
+		}, threads);
+	}
+
+	inline void TransformVectors(const Matrix4x4 &m, const Vector4* in, Vector4* out, size_t count,
+		bool perspectiveDivide = false, unsigned threads = 1)
+	{
+		ParallelFor(count, GU_BATCH_GRAIN, [&](size_t begin, size_t end) {
+			if(perspectiveDivide)
+				_TransformBatch4<true>(m, in, out, begin, end);
+			else
+				_TransformBatch4<false>(m, in, out, begin, end);
+		}, threads);
+	}
+
+	/*********************************************************/
+	// Fused operations, evaluated in one pass without intermediate
+	// vectors. The array versions work on float vectors of any size and
+	// follow the threading rules of the batch transforms above.
+	template<typename T, int N, int... I>
+	constexpr TVector<T, N> _MulAdd(const TVector<T, N> &a, const TVector<T, N> &b, const TVector<T, N> &c,
+		std::integer_sequence<int, I...>)
+	{ return TVector<T, N>((a[I] + b[I] * c[I])...); }
+	template<typename T, int N, int... I>
+	constexpr TVector<T, N> _MulAdd(const TVector<T, N> &a, const TVector<T, N> &b, T s,
+		std::integer_sequence<int, I...>)
+	{ return TVector<T, N>((a[I] + b[I] * s)...); }
+	template<typename T, int N, int... I>
+	constexpr TVector<T, N> _Lerp(const TVector<T, N> &a, const TVector<T, N> &b, T t,
+		std::integer_sequence<int, I...>)
+	{ return TVector<T, N>((a[I] + (b[I] - a[I]) * t)...); }
+
+	// a + b * c
+	template<typename T, int N>
+	constexpr TVector<T, N> MulAdd(const TVector<T, N> &a, const TVector<T, N> &b, const TVector<T, N> &c)
+	{
+#ifdef GU_SSE
+		if constexpr(_IsSimd4<T, N>)
+			if(!GU_CONSTANT_EVALUATED())
+				return TVector<T, N>(_mm_add_ps(a.simd(), _mm_mul_ps(b.simd(), c.simd())));
+#endif
+		return _MulAdd(a, b, c, _Seq<N>());
+	}
+
+	// a + b * s
+	template<typename T, int N>
+	constexpr TVector<T, N> MulAdd(const TVector<T, N> &a, const TVector<T, N> &b, T s)
+	{
+#ifdef GU_SSE
+		if constexpr(_IsSimd4<T, N>)
+			if(!GU_CONSTANT_EVALUATED())
+				return TVector<T, N>(_mm_add_ps(a.simd(), _mm_mul_ps(b.simd(), _mm_set1_ps(s))));
+#endif
+		return _MulAdd(a, b, s, _Seq<N>());
+	}
+
+	constexpr float Lerp(float a, float b, float t)
+	{
+		return a + (b - a) * t;
+	}
+
+	// a + (b - a) * t, all components including w
+	template<typename T, int N>
+	constexpr TVector<T, N> Lerp(const TVector<T, N> &a, const TVector<T, N> &b, T t)
+	{
+#ifdef GU_SSE
+		if constexpr(_IsSimd4<T, N>)
+		{
+			if(!GU_CONSTANT_EVALUATED())
+			{
+				__m128 va = a.simd();
+				return TVector<T, N>(_mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(b.simd(), va), _mm_set1_ps(t))));
+			}
+		}
+#endif
+		return _Lerp(a, b, t, _Seq<N>());
+	}
+
+	// Runs opN on GU_LANES floats and op on single floats of [0, count)
+	template<typename OpN, typename Op>
+	inline void _FusedBatch(size_t count, unsigned threads, OpN opN, Op op)
+	{
+		ParallelFor(count, GU_BATCH_GRAIN, [&](size_t begin, size_t end) {
+			size_t i = begin;
+			for(; i + GU_LANES <= end; i += GU_LANES)
+				opN(i);
+			for(; i < end; i++)
+				op(i);
+		}, threads);
+	}
+
+	// out[i] = a[i] + b[i] * c[i]
+	template<int N>
+	inline void MulAdd(const TVector<float, N>* a, const TVector<float, N>* b, const TVector<float, N>* c,
+		TVector<float, N>* out, size_t count, unsigned threads = 1)
+	{
+		static_assert(sizeof(TVector<float, N>) == N * sizeof(float), "vectors must be packed");
+		const float *fa = (const float*)a, *fb = (const float*)b, *fc = (const float*)c;
+		float* fo = (float*)out;
+		_FusedBatch(count * N, threads, [&](size_t i) {
+			_StoreUN(fo + i, _AddN(_LoadUN(fa + i), _MulN(_LoadUN(fb + i), _LoadUN(fc + i))));
+		}, [&](size_t i) {
+			fo[i] = fa[i] + fb[i] * fc[i];
+		});
+	}
+
+	// out[i] = a[i] + b[i] * s
+	template<int N>
+	inline void MulAdd(const TVector<float, N>* a, const TVector<float, N>* b, float s,
+		TVector<float, N>* out, size_t count, unsigned threads = 1)
+	{
+		static_assert(sizeof(TVector<float, N>) == N * sizeof(float), "vectors must be packed");
+		const float *fa = (const float*)a, *fb = (const float*)b;
+		float* fo = (float*)out;
+		FloatN v = _SetN(s);
+		_FusedBatch(count * N, threads, [&](size_t i) {
+			_StoreUN(fo + i, _AddN(_LoadUN(fa + i), _MulN(_LoadUN(fb + i), v)));
+		}, [&](size_t i) {
+			fo[i] = fa[i] + fb[i] * s;
+		});
+	}
+
+	// out[i] = a[i] + (b[i] - a[i]) * t
+	template<int N>
+	inline void Lerp(const TVector<float, N>* a, const TVector<float, N>* b, float t,
+		TVector<float, N>* out, size_t count, unsigned threads = 1)
+	{
+		static_assert(sizeof(TVector<float, N>) == N * sizeof(float), "vectors must be packed");
+		const float *fa = (const float*)a, *fb = (const float*)b;
+		float* fo = (float*)out;
+		FloatN v = _SetN(t);
+		_FusedBatch(count * N, threads, [&](size_t i) {
+			FloatN x = _LoadUN(fa + i);
+			_StoreUN(fo + i, _AddN(x, _MulN(_SubN(_LoadUN(fb + i), x), v)));
+		}, [&](size_t i) {
+			fo[i] = fa[i] + (fb[i] - fa[i]) * t;
+		});
+	}
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,342 @@
+#ifndef _GUMESHFILE_H_
+#define _GUMESHFILE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "GUWavefrontObj.h"
+
+namespace GU
+{
+	/*********************************************************/
+	// Binary mesh file with the output of LoadObj. The blocks are stored
+	// in the byte order and layout of the writing program, so a mapped
+	// file is used in place. Files of other versions or with a different
+	// Vertex or Index size are rejected.
+	//
+	// Header, vertices, indices, subsets, names (material file followed
+	// by the materials, each one as uint32_t length and characters). Every
+	// block starts at a multiple of _MeshAlignment.
+	static constexpr uint32_t _MeshVersion = 2;
+	static constexpr uint64_t _MeshAlignment = 64;
+
+	struct _MeshHeader
+	{
+		char Magic[4];			// "GUMF"
+		uint32_t Version;
+		uint32_t VertexSize;
+		uint32_t IndexSize;
+		uint32_t Flags;			// LoadObj options of the source, see _MeshFlags
+		uint32_t Reserved;
+		uint64_t SourceSize;
+		uint64_t SourceTime;	// Modification time of the source file, see _FileInfo
+		uint64_t Vertices, Indices, Subsets, Materials;
+		uint64_t VertexOffset, IndexOffset, SubsetOffset, NameOffset;
+		uint64_t FileSize;
+	};
+
+	static_assert(std::is_trivially_copyable<Vertex>::value, "Vertex is written as raw bytes");
+
+	inline uint32_t _MeshFlags(bool isRhCoordSystem, bool calculateNormals)
+	{
+		return (isRhCoordSystem ? 1u : 0u) | (calculateNormals ? 2u : 0u);
+	}
+
+	inline uint64_t _MeshAlign(uint64_t offset)
+	{
+		return (offset + _MeshAlignment - 1) & ~(_MeshAlignment - 1);
+	}
+
+	// Size and modification time of a file, false if it does not exist.
+	// The time is in 100 ns units on Windows and in nanoseconds otherwise.
+	inline bool _FileInfo(const char* filename, uint64_t& size, uint64_t& time)
+	{
+#if defined(_WIN32)
+		WIN32_FILE_ATTRIBUTE_DATA info;
+		if(!GetFileAttributesExA(filename, GetFileExInfoStandard, &info))
+			return false;
+		size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+		time = ((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+#else
+		struct stat info;
+		if(stat(filename, &info) != 0)
+			return false;
+		size = (uint64_t)info.st_size;
+#if defined(__APPLE__)
+		time = (uint64_t)info.st_mtimespec.tv_sec * 1000000000ull + (uint64_t)info.st_mtimespec.tv_nsec;
+#else
+		time = (uint64_t)info.st_mtim.tv_sec * 1000000000ull + (uint64_t)info.st_mtim.tv_nsec;
+#endif
+#endif
+		return true;
+	}
+
+	/*********************************************************/
+	// Contents of a mesh file. The uint64_t elements keep the blocks
+	// aligned when the contents are used from memory.
+	struct _MeshBytes
+	{
+		std::vector<uint64_t> Data;
+		size_t Size = 0;
+	};
+
+	inline _MeshBytes _SerializeMesh(const std::vector<Vertex>& vertices, const std::vector<Index>& indices,
+		const std::vector<Index>& subsets, const std::string& materialFile, const std::vector<std::string>& materials,
+		uint64_t sourceSize, uint64_t sourceTime, uint32_t flags)
+	{
+		_MeshHeader header = {};
+		memcpy(header.Magic, "GUMF", 4);
+		header.Version = _MeshVersion;
+		header.VertexSize = sizeof(Vertex);
+		header.IndexSize = sizeof(Index);
+		header.Flags = flags;
+		header.SourceSize = sourceSize;
+		header.SourceTime = sourceTime;
+		header.Vertices = vertices.size();
+		header.Indices = indices.size();
+		header.Subsets = subsets.size();
+		header.Materials = materials.size();
+
+		std::string names;
+		auto addName = [&names](const std::string& name) {
+			uint32_t length = (uint32_t)name.size();
+			names.append((const char*)&length, 4);
+			names.append(name);
+		};
+		addName(materialFile);
+		for(const std::string& material : materials)
+			addName(material);
+
+		header.VertexOffset = _MeshAlign(sizeof(_MeshHeader));
+		header.IndexOffset = _MeshAlign(header.VertexOffset + vertices.size() * sizeof(Vertex));
+		header.SubsetOffset = _MeshAlign(header.IndexOffset + indices.size() * sizeof(Index));
+		header.NameOffset = _MeshAlign(header.SubsetOffset + subsets.size() * sizeof(Index));
+		header.FileSize = header.NameOffset + names.size();
+
+		// The padding in front of the blocks stays zero
+		_MeshBytes bytes;
+		bytes.Size = (size_t)header.FileSize;
+		bytes.Data.assign((bytes.Size + 7) / 8, 0);
+		char* data = (char*)bytes.Data.data();
+		auto copy = [data](uint64_t offset, const void* block, size_t size) {
+			if(size)
+				memcpy(data + offset, block, size);
+		};
+		copy(0, &header, sizeof(header));
+		copy(header.VertexOffset, vertices.data(), vertices.size() * sizeof(Vertex));
+		copy(header.IndexOffset, indices.data(), indices.size() * sizeof(Index));
+		copy(header.SubsetOffset, subsets.data(), subsets.size() * sizeof(Index));
+		copy(header.NameOffset, names.data(), names.size());
+		return bytes;
+	}
+
+	// Writes a temporary file next to filename and renames it over
+	// filename. Readers see either the old or the new file, never a partial
+	// one, and mappings of the old file stay valid.
+	inline bool _ReplaceFile(const char* filename, const void* data, size_t size)
+	{
+		static std::atomic<uint32_t> counter(0);
+#if defined(_WIN32)
+		unsigned long process = GetCurrentProcessId();
+#else
+		unsigned long process = (unsigned long)getpid();
+#endif
+		std::string temp = std::string(filename) + "." + std::to_string(process) + "." +
+			std::to_string(counter++) + ".tmp";
+
+		FILE* file = fopen(temp.c_str(), "wb");
+		if(!file)
+			return false;
+		bool written = fwrite(data, 1, size, file) == size;
+		written = fclose(file) == 0 && written;
+#if defined(_WIN32)
+		bool replaced = written && MoveFileExA(temp.c_str(), filename, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		bool replaced = written && rename(temp.c_str(), filename) == 0;
+#endif
+		if(!replaced)
+			remove(temp.c_str());
+		return replaced;
+	}
+
+	// Writes the output of LoadObj. sourceSize, sourceTime and flags
+	// describe where the mesh came from and are checked by LoadObjCached.
+	// An existing file is replaced as a whole, see _ReplaceFile.
+	inline bool SaveMesh(const char* filename, const std::vector<Vertex>& vertices, const std::vector<Index>& indices,
+		const std::vector<Index>& subsets, const std::string& materialFile, const std::vector<std::string>& materials,
+		uint64_t sourceSize = 0, uint64_t sourceTime = 0, uint32_t flags = 0)
+	{
+		_MeshBytes bytes = _SerializeMesh(vertices, indices, subsets, materialFile, materials, sourceSize,
+			sourceTime, flags);
+		return _ReplaceFile(filename, bytes.Data.data(), bytes.Size);
+	}
+
+	/*********************************************************/
+	// Memory mapped mesh file. The vertex, index and subset arrays point
+	// into the mapping and are valid until the file is closed. A mesh that
+	// could not be written is held in memory instead, see LoadObjCached.
+	class MeshFile
+	{
+		public:
+			MeshFile() : _data(nullptr), _header(nullptr) { }
+
+			bool open(const char* filename);
+			// Uses the contents of a mesh file from memory
+			bool open(_MeshBytes&& bytes);
+			void close();
+			bool isOpen() const { return _header != nullptr; }
+			bool isMapped() const { return _header != nullptr && _file.data() != nullptr; }
+
+			const Vertex* vertices() const { return (const Vertex*)(_data + _header->VertexOffset); }
+			size_t vertexCount() const { return (size_t)_header->Vertices; }
+			const Index* indices() const { return (const Index*)(_data + _header->IndexOffset); }
+			size_t indexCount() const { return (size_t)_header->Indices; }
+			// First index of every subset followed by the index count
+			const Index* subsets() const { return (const Index*)(_data + _header->SubsetOffset); }
+			size_t subsetCount() const { return (size_t)_header->Subsets; }
+
+			const std::string& materialFile() const { return _materialFile; }
+			const std::vector<std::string>& materials() const { return _materials; }
+
+			uint64_t sourceSize() const { return _header->SourceSize; }
+			uint64_t sourceTime() const { return _header->SourceTime; }
+			uint32_t flags() const { return _header->Flags; }
+
+		private:
+			bool _open(const char* data, size_t size);
+			bool _readNames();
+
+		private:
+			_MappedFile _file;
+			std::vector<uint64_t> _memory;
+			const char* _data;
+			const _MeshHeader* _header;
+			std::string _materialFile;
+			std::vector<std::string> _materials;
+	};
+
+	inline bool MeshFile::open(const char* filename)
+	{
+		close();
+		return _file.open(filename) && _open(_file.data(), _file.size());
+	}
+
+	inline bool MeshFile::open(_MeshBytes&& bytes)
+	{
+		close();
+		_memory.swap(bytes.Data);
+		return _open((const char*)_memory.data(), bytes.Size);
+	}
+
+	// Checks the header and the bounds of the blocks
+	inline bool MeshFile::_open(const char* data, size_t size)
+	{
+		if(size < sizeof(_MeshHeader))
+		{
+			close();
+			return false;
+		}
+
+		const _MeshHeader* h = (const _MeshHeader*)data;
+		bool valid = memcmp(h->Magic, "GUMF", 4) == 0 && h->Version == _MeshVersion &&
+			h->VertexSize == sizeof(Vertex) && h->IndexSize == sizeof(Index) && h->FileSize == size &&
+			h->VertexOffset % _MeshAlignment == 0 && h->IndexOffset % _MeshAlignment == 0 &&
+			h->SubsetOffset % _MeshAlignment == 0 &&
+			h->VertexOffset <= h->FileSize && h->Vertices <= (h->FileSize - h->VertexOffset) / sizeof(Vertex) &&
+			h->IndexOffset <= h->FileSize && h->Indices <= (h->FileSize - h->IndexOffset) / sizeof(Index) &&
+			h->SubsetOffset <= h->FileSize && h->Subsets <= (h->FileSize - h->SubsetOffset) / sizeof(Index) &&
+			h->NameOffset <= h->FileSize;
+		if(!valid)
+		{
+			close();
+			return false;
+		}
+
+		_data = data;
+		_header = h;
+		if(!_readNames())
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	inline bool MeshFile::_readNames()
+	{
+		const char* p = _data + _header->NameOffset;
+		const char* end = _data + _header->FileSize;
+		for(uint64_t i = 0; i <= _header->Materials; i++)
+		{
+			uint32_t length;
+			if(end - p < 4)
+				return false;
+			memcpy(&length, p, 4);
+			p += 4;
+			if((uint64_t)(end - p) < length)
+				return false;
+
+			if(i == 0)
+				_materialFile.assign(p, length);
+			else
+				_materials.push_back(std::string(p, length));
+			p += length;
+		}
+		return true;
+	}
+
+	inline void MeshFile::close()
+	{
+		_file.close();
+		std::vector<uint64_t>().swap(_memory);
+		_data = nullptr;
+		_header = nullptr;
+		_materialFile.clear();
+		_materials.clear();
+	}
+
+	/*********************************************************/
+	// Loads an .obj file through a binary cache. The cache is used if it
+	// was written from a file of the same size and modification time with
+	// the same options. Otherwise the .obj file is loaded with LoadObj and
+	// the cache is rewritten. If the cache cannot be written, for example in
+	// a read only directory, the mesh is held in memory (isMapped() is
+	// false). Returns false only if the .obj file cannot be loaded.
+	inline bool LoadObjCached(const char* filename, const char* cacheFilename, MeshFile& mesh,
+		bool isRhCoordSystem = true, bool calculateNormals = false, unsigned threads = 1)
+	{
+		uint32_t flags = _MeshFlags(isRhCoordSystem, calculateNormals);
+		uint64_t sourceSize, sourceTime;
+		if(!_FileInfo(filename, sourceSize, sourceTime))
+			return false;
+
+		if(mesh.open(cacheFilename))
+		{
+			if(mesh.sourceSize() == sourceSize && mesh.sourceTime() == sourceTime && mesh.flags() == flags)
+				return true;
+		}
+		mesh.close();
+
+		std::vector<Vertex> vertices;
+		std::vector<Index> indices, subsets;
+		std::string materialFile;
+		std::vector<std::string> materials;
+		if(!LoadObj(filename, vertices, indices, subsets, materialFile, materials, isRhCoordSystem,
+			calculateNormals, threads))
+			return false;
+
+		_MeshBytes bytes = _SerializeMesh(vertices, indices, subsets, materialFile, materials, sourceSize,
+			sourceTime, flags);
+		if(_ReplaceFile(cacheFilename, bytes.Data.data(), bytes.Size) && mesh.open(cacheFilename))
+			return true;
+		return mesh.open(std::move(bytes));
+	}
+}
+
+#endif
@@ -0,0 +1,336 @@
+#ifndef _GUPARALLEL_H_
+#define _GUPARALLEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace GU
+{
+	/*********************************************************/
+	// 0 selects one thread per hardware thread
+	inline unsigned ThreadCount(unsigned threads)
+	{
+		if(threads == 0)
+			threads = std::thread::hardware_concurrency();
+		return threads > 0 ? threads : 1;
+	}
+
+	// Splits [0, count) into contiguous ranges of at least minBatch
+	// elements and calls func(begin, end) for each of them. The calling
+	// thread processes the first range.
+	template<typename Func>
+	inline void ParallelFor(size_t count, size_t minBatch, Func func, unsigned threads = 0)
+	{
+		if(count == 0)
+			return;
+
+		size_t n = ThreadCount(threads);
+		size_t batches = minBatch > 0 ? count / minBatch : count;
+		if(batches < n)
+			n = batches;
+
+		if(n <= 1)
+		{
+			func((size_t)0, count);
+			return;
+		}
+
+		size_t step = (count + n - 1) / n;
+		std::vector<std::thread> workers;
+		workers.reserve(n - 1);
+		for(size_t begin = step; begin < count; begin += step)
+		{
+			size_t end = begin + step < count ? begin + step : count;
+			workers.emplace_back([&func, begin, end]() { func(begin, end); });
+		}
+
+		func((size_t)0, step);
+
+		for(auto &worker : workers)
+			worker.join();
+	}
+
+	/*********************************************************/
+	// Tasks with dependencies, run by a ThreadPool. A task is either a
+	// single function or a parallel loop that is split into batches of
+	// a fixed size, so the batches do not depend on the number of threads.
+	// The graph can be run any number of times.
+	class TaskGraph
+	{
+		public:
+			typedef uint32_t Task;
+
+			Task add(std::function<void()> func);
+			// Calls func(begin, end) for batches of [0, count()), count is
+			// called when all predecessors of the task have finished
+			Task addFor(std::function<size_t()> count, size_t batch, std::function<void(size_t, size_t)> func);
+			// after starts when before has finished
+			void precede(Task before, Task after);
+
+			size_t size() const { return _nodes.size(); }
+			void clear() { _nodes.clear(); }
+
+		private:
+			friend class ThreadPool;
+
+			struct _Node
+			{
+				std::function<void()> _func;
+				std::function<size_t()> _count;
+				std::function<void(size_t, size_t)> _for;
+				size_t _batch = 0;
+				std::vector<_Node*> _successors;
+				uint32_t _predecessors = 0;
+
+				std::atomic<uint32_t> _pending;
+				std::atomic<size_t> _batches;
+			};
+
+		private:
+			std::vector<std::unique_ptr<_Node> > _nodes;
+	};
+
+	inline TaskGraph::Task TaskGraph::add(std::function<void()> func)
+	{
+		_nodes.emplace_back(new _Node());
+		_nodes.back()->_func = std::move(func);
+		return (Task)(_nodes.size() - 1);
+	}
+
+	inline TaskGraph::Task TaskGraph::addFor(std::function<size_t()> count, size_t batch,
+		std::function<void(size_t, size_t)> func)
+	{
+		_nodes.emplace_back(new _Node());
+		_nodes.back()->_count = std::move(count);
+		_nodes.back()->_batch = batch > 0 ? batch : 1;
+		_nodes.back()->_for = std::move(func);
+		return (Task)(_nodes.size() - 1);
+	}
+
+	inline void TaskGraph::precede(Task before, Task after)
+	{
+		_nodes[before]->_successors.push_back(_nodes[after].get());
+		_nodes[after]->_predecessors++;
+	}
+
+	/*********************************************************/
+	// Persistent worker threads with one job queue each. Workers take jobs
+	// from the back of their own queue and steal from the front of the
+	// other queues when it is empty. The thread that calls run() works as
+	// worker 0 until the graph is done.
+	class ThreadPool
+	{
+		public:
+			// Total number of threads including the caller of run(), 0 = all
+			// hardware threads
+			explicit ThreadPool(unsigned threads = 0);
+			~ThreadPool();
+
+			ThreadPool(const ThreadPool&) = delete;
+			ThreadPool& operator = (const ThreadPool&) = delete;
+
+			unsigned size() const { return (unsigned)_queues.size(); }
+
+			// Runs all tasks of the graph, one graph at a time
+			void run(TaskGraph &graph);
+
+		private:
+			struct _Job
+			{
+				TaskGraph::_Node* _node;
+				size_t _begin, _end;
+			};
+
+			struct _Queue
+			{
+				std::mutex _mutex;
+				std::deque<_Job> _jobs;
+			};
+
+			void _push(unsigned worker, const _Job &job);
+			bool _pop(unsigned worker, _Job &job);
+			void _ready(unsigned worker, TaskGraph::_Node* node);
+			void _finish(unsigned worker, TaskGraph::_Node* node);
+			void _execute(unsigned worker, const _Job &job);
+			void _worker(unsigned index);
+
+		private:
+			std::vector<std::unique_ptr<_Queue> > _queues;
+			std::vector<std::thread> _threads;
+
+			std::mutex _mutex;
+			std::condition_variable _wake;
+			std::atomic<size_t> _queued;
+			std::atomic<size_t> _remaining;
+			bool _stop;
+	};
+
+	inline ThreadPool::ThreadPool(unsigned threads) : _queued(0), _remaining(0), _stop(false)
+	{
+		threads = ThreadCount(threads);
+		for(unsigned i = 0; i < threads; i++)
+			_queues.emplace_back(new _Queue());
+		for(unsigned i = 1; i < threads; i++)
+			_threads.emplace_back([this, i]() { _worker(i); });
+	}
+
+	inline ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_wake.notify_all();
+		for(auto &thread : _threads)
+			thread.join();
+	}
+
+	inline void ThreadPool::_push(unsigned worker, const _Job &job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_queues[worker]->_mutex);
+			_queues[worker]->_jobs.push_back(job);
+		}
+		_queued++;
+		if(!_threads.empty())
+		{
+			// Taking the lock orders the push before the wait of a sleeping worker
+			{ std::lock_guard<std::mutex> lock(_mutex); }
+			_wake.notify_one();
+		}
+	}
+
+	inline bool ThreadPool::_pop(unsigned worker, _Job &job)
+	{
+		if(_queued == 0)
+			return false;
+
+		for(unsigned i = 0; i < _queues.size(); i++)
+		{
+			_Queue &q = *_queues[(worker + i) % _queues.size()];
+			std::lock_guard<std::mutex> lock(q._mutex);
+			if(q._jobs.empty())
+				continue;
+
+			if(i == 0)
+			{
+				job = q._jobs.back();
+				q._jobs.pop_back();
+			}
+			else
+			{
+				job = q._jobs.front();
+				q._jobs.pop_front();
+			}
+			_queued--;
+			return true;
+		}
+		return false;
+	}
+
+	inline void ThreadPool::_ready(unsigned worker, TaskGraph::_Node* node)
+	{
+		if(!node->_for)
+		{
+			_push(worker, { node, 0, 0 });
+			return;
+		}
+
+		size_t count = node->_count ? node->_count() : 0;
+		size_t batches = (count + node->_batch - 1) / node->_batch;
+		if(batches == 0)
+		{
+			_finish(worker, node);
+			return;
+		}
+
+		node->_batches = batches;
+		for(size_t b = batches; b-- > 0; )
+		{
+			size_t begin = b * node->_batch;
+			_push(worker, { node, begin, begin + node->_batch < count ? begin + node->_batch : count });
+		}
+	}
+
+	inline void ThreadPool::_finish(unsigned worker, TaskGraph::_Node* node)
+	{
+		for(TaskGraph::_Node* next : node->_successors)
+			if(--next->_pending == 0)
+				_ready(worker, next);
+
+		if(--_remaining == 0)
+		{
+			{ std::lock_guard<std::mutex> lock(_mutex); }
+			_wake.notify_all();
+		}
+	}
+
+	inline void ThreadPool::_execute(unsigned worker, const _Job &job)
+	{
+		TaskGraph::_Node* node = job._node;
+		if(!node->_for)
+		{
+			node->_func();
+			_finish(worker, node);
+			return;
+		}
+
+		node->_for(job._begin, job._end);
+		if(--node->_batches == 0)
+			_finish(worker, node);
+	}
+
+	inline void ThreadPool::_worker(unsigned index)
+	{
+		while(true)
+		{
+			_Job job;
+			if(_pop(index, job))
+			{
+				_execute(index, job);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [this]() { return _stop || _queued > 0; });
+			if(_stop)
+				return;
+		}
+	}
+
+	inline void ThreadPool::run(TaskGraph &graph)
+	{
+		if(graph._nodes.empty())
+			return;
+
+		_remaining = graph._nodes.size();
+		for(auto &node : graph._nodes)
+			node->_pending = node->_predecessors;
+		for(auto &node : graph._nodes)
+			if(node->_predecessors == 0)
+				_ready(0, node.get());
+
+		while(_remaining > 0)
+		{
+			_Job job;
+			if(_pop(0, job))
+			{
+				_execute(0, job);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [this]() { return _remaining == 0 || _queued > 0; });
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,351 @@
+#ifndef _GUSTREAM_H_
+#define _GUSTREAM_H_
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <new>
+#include <vector>
+
+#include "GUMath.h"
+
+namespace GU
+{
+	/*********************************************************/
+	// Every stream is padded to GU_STREAM_PADDING elements and aligned to
+	// GU_STREAM_PADDING floats, wide enough for any GU_LANES setting.
+	#define GU_STREAM_PADDING 8
+
+	template<typename T, size_t Alignment>
+	class AlignedAllocator
+	{
+		public:
+			typedef T value_type;
+
+			template<typename U>
+			struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+			AlignedAllocator() { }
+			template<typename U>
+			AlignedAllocator(const AlignedAllocator<U, Alignment>&) { }
+
+			T* allocate(size_t n)
+			{
+				// Keep the offset to the real allocation in front of the block
+				void* raw = malloc(n * sizeof(T) + Alignment + sizeof(void*));
+				if(!raw)
+					throw std::bad_alloc();
+				uintptr_t p = ((uintptr_t)raw + sizeof(void*) + Alignment - 1) & ~(uintptr_t)(Alignment - 1);
+				((void**)p)[-1] = raw;
+				return (T*)p;
+			}
+
+			void deallocate(T* p, size_t)
+			{
+				if(p)
+					free(((void**)p)[-1]);
+			}
+	};
+
+	template<typename T, typename U, size_t A>
+	inline bool operator == (const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&) { return true; }
+	template<typename T, typename U, size_t A>
+	inline bool operator != (const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&) { return false; }
+
+	typedef std::vector<float, AlignedAllocator<float, GU_STREAM_PADDING * sizeof(float)> > FloatStream;
+
+	inline size_t PaddedSize(size_t count)
+	{
+		return (count + GU_STREAM_PADDING - 1) & ~(size_t)(GU_STREAM_PADDING - 1);
+	}
+
+	/*********************************************************/
+	// Structure of arrays storage for Vector3, the x, y and z components
+	// are stored in separate padded arrays.
+	class Vector3Stream
+	{
+		public:
+			Vector3Stream() : _count(0) { }
+			explicit Vector3Stream(size_t count) : _count(0) { resize(count); }
+			Vector3Stream(const Vector3* data, size_t count) : _count(0) { assign(data, count); }
+			Vector3Stream(const std::vector<Vector3> &v) : _count(0) { assign(v.data(), v.size()); }
+
+			void resize(size_t count);
+			void assign(const Vector3* data, size_t count);
+			void store(Vector3* data) const;
+			std::vector<Vector3> toVector() const;
+
+			Vector3 get(size_t i) const { return Vector3(_x[i], _y[i], _z[i]); }
+			void set(size_t i, const Vector3 &v) { _x[i] = v._x; _y[i] = v._y; _z[i] = v._z; }
+
+			size_t size() const { return _count; }
+			size_t padded() const { return _x.size(); }
+
+			float* x() { return _x.data(); }
+			float* y() { return _y.data(); }
+			float* z() { return _z.data(); }
+			const float* x() const { return _x.data(); }
+			const float* y() const { return _y.data(); }
+			const float* z() const { return _z.data(); }
+
+		private:
+			size_t _count;
+			FloatStream _x, _y, _z;
+	};
+
+	inline void Vector3Stream::resize(size_t count)
+	{
+		// The padding is zero even if the stream shrinks within it
+		size_t padded = PaddedSize(count);
+		_count = count;
+		_x.resize(padded, 0.0f);
+		_y.resize(padded, 0.0f);
+		_z.resize(padded, 0.0f);
+		for(size_t i = count; i < padded; i++)
+			_x[i] = _y[i] = _z[i] = 0.0f;
+	}
+
+	inline void Vector3Stream::assign(const Vector3* data, size_t count)
+	{
+		resize(count);
+		size_t i = 0;
+#ifdef GU_SSE
+		// Four Vector3 are three registers, transpose them to x, y and z
+		const float* src = (const float*)data;
+		for(; i + 4 <= count; i += 4, src += 12)
+		{
+			__m128 a = _mm_loadu_ps(src);
+			__m128 b = _mm_loadu_ps(src + 4);
+			__m128 c = _mm_loadu_ps(src + 8);
+
+			__m128 t = GU_SHUFFLE(a, b, 0, 3, 2, 3);
+			__m128 x = GU_SHUFFLE(t, GU_SHUFFLE(t, c, 2, 3, 1, 1), 0, 1, 0, 2);
+			t = GU_SHUFFLE(a, b, 1, 2, 0, 3);
+			__m128 y = GU_SHUFFLE(t, GU_SHUFFLE(t, c, 2, 3, 2, 2), 0, 2, 1, 2);
+			__m128 z = GU_SHUFFLE(GU_SHUFFLE(a, b, 2, 2, 1, 1), GU_SHUFFLE(c, c, 0, 3, 0, 3), 0, 2, 0, 1);
+
+			_mm_store_ps(&_x[i], x);
+			_mm_store_ps(&_y[i], y);
+			_mm_store_ps(&_z[i], z);
+		}
+#endif
+		for(; i < count; i++)
+			set(i, data[i]);
+	}
+
+	inline void Vector3Stream::store(Vector3* data) const
+	{
+		size_t i = 0;
+#ifdef GU_SSE
+		float* dst = (float*)data;
+		for(; i + 4 <= _count; i += 4, dst += 12)
+		{
+			__m128 x = _mm_load_ps(&_x[i]);
+			__m128 y = _mm_load_ps(&_y[i]);
+			__m128 z = _mm_load_ps(&_z[i]);
+
+			__m128 lo = _mm_unpacklo_ps(x, y);
+			__m128 hi = _mm_unpackhi_ps(x, y);
+			_mm_storeu_ps(dst, GU_SHUFFLE(lo, GU_SHUFFLE(z, lo, 0, 0, 2, 2), 0, 1, 0, 2));
+			_mm_storeu_ps(dst + 4, GU_SHUFFLE(GU_SHUFFLE(lo, z, 3, 3, 1, 1), hi, 0, 2, 0, 1));
+			_mm_storeu_ps(dst + 8, GU_SHUFFLE(GU_SHUFFLE(z, hi, 2, 2, 2, 2), GU_SHUFFLE(hi, z, 3, 3, 3, 3), 0, 2, 0, 2));
+		}
+#endif
+		for(; i < _count; i++)
+			data[i] = get(i);
+	}
+
+	inline std::vector<Vector3> Vector3Stream::toVector() const
+	{
+		std::vector<Vector3> v(_count);
+		if(_count)
+			store(v.data());
+		return v;
+	}
+
+	/*********************************************************/
+	// Bulk operations. Results may alias the inputs, streams are resized
+	// to the input size and scalar results need room for a.size() floats.
+	// The second operand must have at least a.size() elements.
+	inline void _StreamStore(float* out, size_t i, size_t count, FloatN v)
+	{
+		if(i + GU_LANES <= count)
+		{
+			_StoreUN(out + i, v);
+		}
+		else
+		{
+			alignas(32) float tmp[GU_LANES];
+			_StoreN(tmp, v);
+			for(size_t j = 0; i + j < count; j++)
+				out[i + j] = tmp[j];
+		}
+	}
+
+	inline FloatN _StreamDot(const Vector3Stream &a, const Vector3Stream &b, size_t i)
+	{
+		FloatN d = _MulN(_LoadN(a.x() + i), _LoadN(b.x() + i));
+		d = _AddN(d, _MulN(_LoadN(a.y() + i), _LoadN(b.y() + i)));
+		return _AddN(d, _MulN(_LoadN(a.z() + i), _LoadN(b.z() + i)));
+	}
+
+	inline void Dot(const Vector3Stream &a, const Vector3Stream &b, float* out)
+	{
+		assert(b.size() >= a.size());
+		for(size_t i = 0; i < a.size(); i += GU_LANES)
+			_StreamStore(out, i, a.size(), _StreamDot(a, b, i));
+	}
+
+	inline void Length(const Vector3Stream &a, float* out)
+	{
+		for(size_t i = 0; i < a.size(); i += GU_LANES)
+			_StreamStore(out, i, a.size(), _SqrtN(_StreamDot(a, a, i)));
+	}
+
+	inline void Length2(const Vector3Stream &a, float* out)
+	{
+		for(size_t i = 0; i < a.size(); i += GU_LANES)
+			_StreamStore(out, i, a.size(), _StreamDot(a, a, i));
+	}
+
+	inline void Cross(const Vector3Stream &a, const Vector3Stream &b, Vector3Stream &out)
+	{
+		assert(b.size() >= a.size());
+		out.resize(a.size());
+		for(size_t i = 0; i < a.padded(); i += GU_LANES)
+		{
+			FloatN ax = _LoadN(a.x() + i), ay = _LoadN(a.y() + i), az = _LoadN(a.z() + i);
+			FloatN bx = _LoadN(b.x() + i), by = _LoadN(b.y() + i), bz = _LoadN(b.z() + i);
+			_StoreN(out.x() + i, _SubN(_MulN(ay, bz), _MulN(az, by)));
+			_StoreN(out.y() + i, _SubN(_MulN(az, bx), _MulN(ax, bz)));
+			_StoreN(out.z() + i, _SubN(_MulN(ax, by), _MulN(ay, bx)));
+		}
+	}
+
+	// Normalizes GU_LANES vectors, zero vectors stay zero
+	inline void _NormalizeN(FloatN &x, FloatN &y, FloatN &z)
+	{
+		FloatN zero = _SetN(0.0f);
+		FloatN l2 = _AddN(_AddN(_MulN(x, x), _MulN(y, y)), _MulN(z, z));
+		FloatN s = _SelectN(_CmpLtN(zero, l2), _DivN(_SetN(1.0f), _SqrtN(l2)), zero);
+		x = _MulN(x, s);
+		y = _MulN(y, s);
+		z = _MulN(z, s);
+	}
+
+	// Zero vectors stay zero, so the padding stays zero as well
+	inline void Normalize(const Vector3Stream &a, Vector3Stream &out)
+	{
+		out.resize(a.size());
+		for(size_t i = 0; i < a.padded(); i += GU_LANES)
+		{
+			FloatN x = _LoadN(a.x() + i), y = _LoadN(a.y() + i), z = _LoadN(a.z() + i);
+			_NormalizeN(x, y, z);
+			_StoreN(out.x() + i, x);
+			_StoreN(out.y() + i, y);
+			_StoreN(out.z() + i, z);
+		}
+	}
+
+	inline void Reflect(const Vector3Stream &a, const Vector3Stream &n, Vector3Stream &out)
+	{
+		assert(n.size() >= a.size());
+		out.resize(a.size());
+		for(size_t i = 0; i < a.padded(); i += GU_LANES)
+		{
+			FloatN d = _StreamDot(a, n, i);
+			d = _AddN(d, d);
+			_StoreN(out.x() + i, _SubN(_LoadN(a.x() + i), _MulN(d, _LoadN(n.x() + i))));
+			_StoreN(out.y() + i, _SubN(_LoadN(a.y() + i), _MulN(d, _LoadN(n.y() + i))));
+			_StoreN(out.z() + i, _SubN(_LoadN(a.z() + i), _MulN(d, _LoadN(n.z() + i))));
+		}
+	}
+
+	inline void Saturate(const Vector3Stream &a, Vector3Stream &out)
+	{
+		out.resize(a.size());
+		FloatN zero = _SetN(0.0f), one = _SetN(1.0f);
+		for(size_t i = 0; i < a.padded(); i += GU_LANES)
+		{
+			_StoreN(out.x() + i, _MinN(one, _MaxN(zero, _LoadN(a.x() + i))));
+			_StoreN(out.y() + i, _MinN(one, _MaxN(zero, _LoadN(a.y() + i))));
+			_StoreN(out.z() + i, _MinN(one, _MaxN(zero, _LoadN(a.z() + i))));
+		}
+	}
+
+	template<typename Op>
+	inline void _StreamBinary(const Vector3Stream &a, const Vector3Stream &b, Vector3Stream &out, Op op)
+	{
+		assert(b.size() >= a.size());
+		out.resize(a.size());
+		for(size_t i = 0; i < a.padded(); i += GU_LANES)
+		{
+			_StoreN(out.x() + i, op(_LoadN(a.x() + i), _LoadN(b.x() + i)));
+			_StoreN(out.y() + i, op(_LoadN(a.y() + i), _LoadN(b.y() + i)));
+			_StoreN(out.z() + i, op(_LoadN(a.z() + i), _LoadN(b.z() + i)));
+		}
+	}
+
+	inline void Add(const Vector3Stream &a, const Vector3Stream &b, Vector3Stream &out)
+	{ _StreamBinary(a, b, out, _AddN); }
+	inline void Sub(const Vector3Stream &a, const Vector3Stream &b, Vector3Stream &out)
+	{ _StreamBinary(a, b, out, _SubN); }
+	inline void Mul(const Vector3Stream &a, const Vector3Stream &b, Vector3Stream &out)
+	{ _StreamBinary(a, b, out, _MulN); }
+
+	inline void Mul(const Vector3Stream &a, float s, Vector3Stream &out)
+	{
+		out.resize(a.size());
+		FloatN v = _SetN(s);
+		for(size_t i = 0; i < a.padded(); i += GU_LANES)
+		{
+			_StoreN(out.x() + i, _MulN(_LoadN(a.x() + i), v));
+			_StoreN(out.y() + i, _MulN(_LoadN(a.y() + i), v));
+			_StoreN(out.z() + i, _MulN(_LoadN(a.z() + i), v));
+		}
+	}
+
+	// out = a + b * s
+	inline void MulAdd(const Vector3Stream &a, const Vector3Stream &b, float s, Vector3Stream &out)
+	{
+		assert(b.size() >= a.size());
+		out.resize(a.size());
+		FloatN v = _SetN(s);
+		for(size_t i = 0; i < a.padded(); i += GU_LANES)
+		{
+			_StoreN(out.x() + i, _AddN(_LoadN(a.x() + i), _MulN(_LoadN(b.x() + i), v)));
+			_StoreN(out.y() + i, _AddN(_LoadN(a.y() + i), _MulN(_LoadN(b.y() + i), v)));
+			_StoreN(out.z() + i, _AddN(_LoadN(a.z() + i), _MulN(_LoadN(b.z() + i), v)));
+		}
+	}
+
+	// out = a + b * c
+	inline void MulAdd(const Vector3Stream &a, const Vector3Stream &b, const Vector3Stream &c, Vector3Stream &out)
+	{
+		assert(b.size() >= a.size() && c.size() >= a.size());
+		out.resize(a.size());
+		for(size_t i = 0; i < a.padded(); i += GU_LANES)
+		{
+			_StoreN(out.x() + i, _AddN(_LoadN(a.x() + i), _MulN(_LoadN(b.x() + i), _LoadN(c.x() + i))));
+			_StoreN(out.y() + i, _AddN(_LoadN(a.y() + i), _MulN(_LoadN(b.y() + i), _LoadN(c.y() + i))));
+			_StoreN(out.z() + i, _AddN(_LoadN(a.z() + i), _MulN(_LoadN(b.z() + i), _LoadN(c.z() + i))));
+		}
+	}
+
+	// out = a + (b - a) * t
+	inline void Lerp(const Vector3Stream &a, const Vector3Stream &b, float t, Vector3Stream &out)
+	{
+		assert(b.size() >= a.size());
+		out.resize(a.size());
+		FloatN v = _SetN(t);
+		for(size_t i = 0; i < a.padded(); i += GU_LANES)
+		{
+			FloatN x = _LoadN(a.x() + i), y = _LoadN(a.y() + i), z = _LoadN(a.z() + i);
+			_StoreN(out.x() + i, _AddN(x, _MulN(_SubN(_LoadN(b.x() + i), x), v)));
+			_StoreN(out.y() + i, _AddN(y, _MulN(_SubN(_LoadN(b.y() + i), y), v)));
+			_StoreN(out.z() + i, _AddN(z, _MulN(_SubN(_LoadN(b.z() + i), z), v)));
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef _GUTRANSFORM_H_
+#define _GUTRANSFORM_H_
+
+#include <assert.h>
+#include <stdint.h>
+#include <vector>
+
+#include "GUMath.h"
+#include "GUParallel.h"
+
+namespace GU
+{
+	/*********************************************************/
+	// Transform hierarchy in flat arrays. A parent is always added before
+	// its children, so the node order is parent sorted and one pass over
+	// the arrays updates the whole graph. Only nodes whose local transform
+	// changed, and their subtrees, are recomputed.
+	class TransformGraph
+	{
+		public:
+			typedef uint32_t Node;
+			static constexpr Node None = 0xFFFFFFFF;
+
+			// parent is None for a root or an already added node, otherwise
+			// nothing is added and None is returned
+			Node add(Node parent, const Vector3 &translation = Vector3(),
+				const Quaternion &rotation = Quaternion(), const Vector3 &scale = Vector3(1.0f, 1.0f, 1.0f));
+
+			void setTranslation(Node n, const Vector3 &t) { _translation[n] = t; _dirty[n] = 1; }
+			void setRotation(Node n, const Quaternion &r) { _rotation[n] = r; _dirty[n] = 1; }
+			void setScale(Node n, const Vector3 &s) { _scale[n] = s; _dirty[n] = 1; }
+
+			const Vector3& translation(Node n) const { return _translation[n]; }
+			const Quaternion& rotation(Node n) const { return _rotation[n]; }
+			const Vector3& scale(Node n) const { return _scale[n]; }
+			Node parent(Node n) const { return _parent[n]; }
+
+			// Recomputes the world transforms of all changed subtrees. With more
+			// than one thread the graph is updated level by level and wide
+			// levels are split across the threads (0 = all hardware threads).
+			void update(unsigned threads = 1);
+
+			// True if the world transform of n changed in the last update
+			bool changed(Node n) const { return _changed[n] != 0; }
+
+			const Affine& world(Node n) const { return _world[n]; }
+			const Affine* worlds() const { return _world.data(); }
+			void worldMatrices(Matrix4x4* out) const;
+
+			size_t size() const { return _parent.size(); }
+			void clear();
+
+		private:
+			Affine _local(Node n) const;
+			void _updateNode(Node n);
+			void _buildLevels();
+
+		private:
+			std::vector<Node> _parent;
+			std::vector<Vector3> _translation;
+			std::vector<Quaternion> _rotation;
+			std::vector<Vector3> _scale;
+			std::vector<Affine> _world;
+			std::vector<uint8_t> _dirty;
+			std::vector<uint8_t> _changed;
+
+			// Nodes grouped by depth, rebuilt after nodes were added
+			std::vector<uint32_t> _depth;
+			std::vector<Node> _levelNodes;
+			std::vector<size_t> _levelStart;
+			bool _levelsDirty = false;
+	};
+
+	inline TransformGraph::Node TransformGraph::add(Node parent, const Vector3 &translation,
+		const Quaternion &rotation, const Vector3 &scale)
+	{
+		Node n = (Node)_parent.size();
+		assert(parent == None || parent < n);
+		if(parent != None && parent >= n)
+			return None;
+
+		_parent.push_back(parent);
+		_translation.push_back(translation);
+		_rotation.push_back(rotation);
+		_scale.push_back(scale);
+		_world.push_back(Affine());
+		_dirty.push_back(1);
+		_changed.push_back(0);
+		_depth.push_back(_parent[n] == None ? 0 : _depth[_parent[n]] + 1);
+		_levelsDirty = true;
+		return n;
+	}
+
+	inline Affine TransformGraph::_local(Node n) const
+	{
+		// T * R * S, the scale multiplies the columns of the rotation
+		Affine a = _rotation[n].toAffine();
+		const Vector3 &s = _scale[n];
+		const Vector3 &t = _translation[n];
+		a._m11 *= s._x; a._m12 *= s._y; a._m13 *= s._z; a._m14 = t._x;
+		a._m21 *= s._x; a._m22 *= s._y; a._m23 *= s._z; a._m24 = t._y;
+		a._m31 *= s._x; a._m32 *= s._y; a._m33 *= s._z; a._m34 = t._z;
+		return a;
+	}
+
+	inline void TransformGraph::_updateNode(Node n)
+	{
+		Node p = _parent[n];
+		bool parentChanged = p != None && _changed[p];
+		if(!_dirty[n] && !parentChanged)
+		{
+			_changed[n] = 0;
+			return;
+		}
+
+		_world[n] = p != None ? _world[p] * _local(n) : _local(n);
+		_dirty[n] = 0;
+		_changed[n] = 1;
+	}
+
+	inline void TransformGraph::_buildLevels()
+	{
+		// Counting sort of the nodes by depth
+		_levelStart.assign(1, 0);
+		for(uint32_t d : _depth)
+		{
+			if(d + 2 > _levelStart.size())
+				_levelStart.resize(d + 2, 0);
+			_levelStart[d + 1]++;
+		}
+		for(size_t i = 1; i < _levelStart.size(); i++)
+			_levelStart[i] += _levelStart[i - 1];
+
+		std::vector<size_t> next(_levelStart.begin(), _levelStart.end() - 1);
+		_levelNodes.resize(_depth.size());
+		for(Node n = 0; n < (Node)_depth.size(); n++)
+			_levelNodes[next[_depth[n]]++] = n;
+
+		_levelsDirty = false;
+	}
+
+	inline void TransformGraph::update(unsigned threads)
+	{
+		if(ThreadCount(threads) == 1)
+		{
+			for(Node n = 0; n < (Node)_parent.size(); n++)
+				_updateNode(n);
+			return;
+		}
+
+		if(_levelsDirty)
+			_buildLevels();
+
+		for(size_t l = 0; l + 1 < _levelStart.size(); l++)
+		{
+			const Node* nodes = &_levelNodes[_levelStart[l]];
+			ParallelFor(_levelStart[l + 1] - _levelStart[l], 1024, [&](size_t begin, size_t end) {
+				for(size_t i = begin; i < end; i++)
+					_updateNode(nodes[i]);
+			}, threads);
+		}
+	}
+
+	inline void TransformGraph::worldMatrices(Matrix4x4* out) const
+	{
+		for(size_t i = 0; i < _world.size(); i++)
+			out[i] = _world[i].toMatrix();
+	}
+
+	inline void TransformGraph::clear()
+	{
+		_parent.clear();
+		_translation.clear();
+		_rotation.clear();
+		_scale.clear();
+		_world.clear();
+		_dirty.clear();
+		_changed.clear();
+		_depth.clear();
+		_levelsDirty = true;
+	}
+}
+
+#endif
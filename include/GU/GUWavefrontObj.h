@@ -1,11 +1,30 @@
 #ifndef _GUWAVEFRONTOBJ_H_
 #define _GUWAVEFRONTOBJ_H_
 
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
 #include <string>
 #include <vector>
-#include <fstream>
+
+#if defined(_WIN32)
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
 
 #include "GUMath.h"
+#include "GUParallel.h"
+#include "GUStream.h"
 
 namespace GU
 {
@@ -24,210 +43,1076 @@ namespace GU
 
 
 	/*********************************************************/
-	struct _Face
+	// Read only view of a whole file. Empty files map to data() == nullptr
+	// and size() == 0.
+	class _MappedFile
 	{
-		_Face(std::string one, std::string two, std::string three)
-		{
-			Vert[0] = one;
-			Vert[1] = two;
-			Vert[2] = three;
-		}
+	public:
+		_MappedFile() : _data(nullptr), _size(0) { }
+		~_MappedFile() { close(); }
+
+		_MappedFile(const _MappedFile&) = delete;
+		_MappedFile& operator = (const _MappedFile&) = delete;
 
-		std::string Vert[3];
+		bool open(const char* filename);
+		void close();
+
+		const char* data() const { return _data; }
+		size_t size() const { return _size; }
+
+	private:
+		const char* _data;
+		size_t _size;
+#if defined(_WIN32)
+		HANDLE _file = INVALID_HANDLE_VALUE;
+		HANDLE _mapping = nullptr;
+#endif
 	};
 
-	struct _ObjMesh
+	inline bool _MappedFile::open(const char* filename)
 	{
-		std::vector<Vector3> Pos;
-		std::vector<Vector2> Tex;
-		std::vector<Vector3> Nor;
-		std::vector<_Face> Fac;
-		std::string Material;
-		bool hasTexture;
-		bool hasNormal;
-	};
+		close();
+#if defined(_WIN32)
+		_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (_file == INVALID_HANDLE_VALUE)
+			return false;
 
-	struct _Index
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(_file, &size))
+		{
+			close();
+			return false;
+		}
+		_size = (size_t)size.QuadPart;
+		if (_size == 0)
+			return true;
+
+		_mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (_mapping)
+			_data = (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+		int fd = ::open(filename, O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat info;
+		if (fstat(fd, &info) != 0)
+		{
+			::close(fd);
+			return false;
+		}
+		_size = (size_t)info.st_size;
+		if (_size == 0)
+		{
+			::close(fd);
+			return true;
+		}
+
+		// Prefault the pages in one call instead of one fault per page
+		int flags = MAP_PRIVATE;
+#if defined(MAP_POPULATE)
+		flags |= MAP_POPULATE;
+#endif
+		void* data = mmap(nullptr, _size, PROT_READ, flags, fd, 0);
+		::close(fd);
+		if (data != MAP_FAILED)
+		{
+			madvise(data, _size, MADV_SEQUENTIAL);
+			_data = (const char*)data;
+		}
+#endif
+		if (!_data)
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	inline void _MappedFile::close()
 	{
-		int Pos;
-		int Tex;
-		int Nor;
-	};
+#if defined(_WIN32)
+		if (_data)
+			UnmapViewOfFile(_data);
+		if (_mapping)
+			CloseHandle(_mapping);
+		if (_file != INVALID_HANDLE_VALUE)
+			CloseHandle(_file);
+		_mapping = nullptr;
+		_file = INVALID_HANDLE_VALUE;
+#else
+		if (_data)
+			munmap((void*)_data, _size);
+#endif
+		_data = nullptr;
+		_size = 0;
+	}
 
 	/*********************************************************/
+	// Number parsing on [p, end) without locale, p is moved behind the
+	// number. Returns false if there is no number at p.
+	inline bool _ParseInt(const char*& p, const char* end, int& value)
+	{
+		bool negative = p < end && *p == '-';
+		if (p < end && (*p == '-' || *p == '+'))
+			p++;
+		if (p == end || (unsigned)(*p - '0') > 9)
+			return false;
 
+		int v = 0;
+		for (; p < end && (unsigned)(*p - '0') <= 9; p++)
+			v = v * 10 + (*p - '0');
+		value = negative ? -v : v;
+		return true;
+	}
 
-    inline bool LoadObj(const char* filename, std::vector<Vertex>& vertices, std::vector<Index>& indices,
-		std::vector<Index>& subsets, std::string& materialFile, std::vector<std::string>& materials,
-		bool isRhCoordSystem = true, bool calculateNormals = false)
-    {
-		// Step 1: Read in the .obj-File
-		std::ifstream fileIn;
-		fileIn.open(filename);
+	inline double _Scale(double v, int exponent)
+	{
+		static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
 
-		std::vector<_ObjMesh> meshes;
-		_ObjMesh tempMesh;
-		tempMesh.hasTexture = false;
-		tempMesh.hasNormal = false;
-		bool newMesh = false;
+		if (exponent < 0)
+		{
+			for (; exponent < -22; exponent += 22)
+				v /= 1e22;
+			return v / powers[-exponent];
+		}
+		for (; exponent > 22; exponent -= 22)
+			v *= 1e22;
+		return v * powers[exponent];
+	}
 
-		// Temp data
-		float x, y, z;
-		std::string tempFace[3];
+	inline bool _ParseFloat(const char*& p, const char* end, float& value)
+	{
+		const char* s = p;
+		bool negative = s < end && *s == '-';
+		if (s < end && (*s == '-' || *s == '+'))
+			s++;
 
-		if (!fileIn.good())
+		// Digits with the decimal point removed, the exponent moves it back
+		uint64_t mantissa = 0;
+		int exponent = 0;
+		const char* first = s;
+		while (s < end && (unsigned)(*s - '0') <= 9)
+			mantissa = mantissa * 10 + (*s++ - '0');
+		int digits = (int)(s - first);
+		if (s < end && *s == '.')
+		{
+			const char* fraction = ++s;
+			while (s < end && (unsigned)(*s - '0') <= 9)
+				mantissa = mantissa * 10 + (*s++ - '0');
+			exponent = -(int)(s - fraction);
+			digits -= exponent;
+		}
+		if (digits == 0)
 			return false;
 
-		wchar_t checkChar;
+		if (digits > 19)
+		{
+			// The mantissa overflowed, keep the first 19 significant digits
+			mantissa = 0;
+			exponent = 0;
+			int kept = 0;
+			bool fraction = false;
+			for (const char* c = first; c < s; c++)
+			{
+				if (*c == '.')
+					fraction = true;
+				else if (kept < 19)
+				{
+					mantissa = mantissa * 10 + (*c - '0');
+					kept += mantissa > 0;
+					exponent -= fraction;
+				}
+				else
+					exponent += !fraction;
+			}
+		}
+
+		if (s < end && (*s == 'e' || *s == 'E'))
+		{
+			const char* e = s + 1;
+			int scale;
+			if (_ParseInt(e, end, scale))
+			{
+				exponent += scale;
+				s = e;
+			}
+		}
+
+		// Exact operands give a correctly rounded result with one operation
+		static const float powers[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+		if (mantissa <= (1u << 24) && exponent >= -10 && exponent <= 10)
+		{
+			float v = exponent < 0 ? (float)mantissa / powers[-exponent] : (float)mantissa * powers[exponent];
+			value = negative ? -v : v;
+		}
+		else
+		{
+			double v = _Scale((double)mantissa, exponent);
+			value = (float)(negative ? -v : v);
+		}
+		p = s;
+		return true;
+	}
+
+	inline void _SkipSpaces(const char*& p, const char* end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t'))
+			p++;
+	}
+
+	inline void _SkipLine(const char*& p, const char* end)
+	{
+		const char* n = (const char*)memchr(p, '\n', (size_t)(end - p));
+		p = n ? n + 1 : end;
+	}
+
+	// Rest of the line without surrounding white space
+	inline std::string _ParseName(const char*& p, const char* end)
+	{
+		_SkipSpaces(p, end);
+		const char* start = p;
+		const char* n = p < end ? (const char*)memchr(p, '\n', (size_t)(end - p)) : nullptr;
+		p = n ? n : end;
+		const char* last = p;
+		while (last > start && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r'))
+			last--;
+		return std::string(start, last);
+	}
+
+	/*********************************************************/
+	struct _Index
+	{
+		int Pos;
+		int Tex;	// -1 if the corner has no texture coordinate
+		int Nor;	// -1 if the corner has no normal
+	};
+
+	// Triangles of all faces that use the same material
+	struct _ObjGroup
+	{
+		std::string Material;
+		size_t Start;	// First corner in _ObjData::Fac
+	};
+
+	struct _ObjData
+	{
+		std::vector<Vector3> Pos;
+		std::vector<Vector2> Tex;
+		std::vector<Vector3> Nor;
+		std::vector<_Index> Fac;	// Three corners per triangle, zero based
+		std::vector<_ObjGroup> Groups;
+		std::string MaterialFile;
+
+		// Fac * 3 + element (position, texture, normal) of the corners that
+		// used relative indices, and whether the first group was created
+		// for faces without a usemtl statement
+		std::vector<size_t> Relative;
+		bool DefaultGroup = false;
+	};
+
+	// Reserves the elements of a large file from the lines of a few evenly
+	// spaced samples, so that the arrays rarely grow during the parse
+	inline void _ReserveObj(const char* data, size_t size, _ObjData& obj)
+	{
+		const size_t samples = 16, sampleSize = 4096;
+		if (size < 4 * samples * sampleSize)
+			return;
 
-		while (fileIn)
+		// Positions, texture coordinates, normals and triangle corners
+		size_t counts[4] = { 0, 0, 0, 0 };
+		size_t sampled = 0;
+		for (size_t i = 0; i < samples; i++)
 		{
-			checkChar = fileIn.get();
-			switch (checkChar)
+			const char* p = data + size / samples * i;
+			const char* end = p + sampleSize;
+			if (i > 0)
+				_SkipLine(p, end);
+			const char* first = p;
+
+			// Whole lines only
+			for (const char* n; p < end && (n = (const char*)memchr(p, '\n', (size_t)(end - p))) != nullptr; p = n + 1)
 			{
-			// Skip comments
-			case '#':
-				do
+				_SkipSpaces(p, n);
+				if (n - p > 1 && p[0] == 'v')
 				{
-					checkChar = fileIn.get();
-				} while (checkChar != ('\n'));
-				break;
-			case 's':
-				do
+					if (p[1] == ' ' || p[1] == '\t')
+						counts[0]++;
+					else if (p[1] == 't')
+						counts[1]++;
+					else if (p[1] == 'n')
+						counts[2]++;
+				}
+				else if (n - p > 1 && p[0] == 'f')
 				{
-					checkChar = fileIn.get();
-				} while (checkChar != '\n');
+					int words = 0;
+					for (const char* c = p + 1; c < n; c++)
+						words += (c[-1] == ' ' || c[-1] == '\t') && c[0] != ' ' && c[0] != '\t' && c[0] != '\r';
+					counts[3] += words > 2 ? 3 * (size_t)(words - 2) : 0;
+				}
+			}
+			sampled += (size_t)(p - first);
+		}
+		if (sampled == 0)
+			return;
+
+		// A small margin for the variation between the samples
+		double scale = 1.1 * (double)size / (double)sampled;
+		obj.Pos.reserve((size_t)(scale * (double)counts[0]));
+		obj.Tex.reserve((size_t)(scale * (double)counts[1]));
+		obj.Nor.reserve((size_t)(scale * (double)counts[2]));
+		obj.Fac.reserve((size_t)(scale * (double)counts[3]));
+	}
+
+	// One pass over the file contents. Polygons are split into triangle
+	// fans, relative (negative) indices are resolved against the elements
+	// read so far. A chunk of _ParseObjParallel lists the corners with
+	// relative indices in Relative, a whole file does not need them.
+	inline void _ParseObj(const char* data, size_t size, bool isRhCoordSystem, bool chunk, _ObjData& obj)
+	{
+		const char* p = data;
+		const char* end = data + size;
+		float zSign = isRhCoordSystem ? -1.0f : 1.0f;
+		_Index corners[3];
+		int relative[3] = { 0, 0, 0 };
+		_ReserveObj(data, size, obj);
+
+		while (p < end)
+		{
+			_SkipSpaces(p, end);
+			if (p == end)
 				break;
 
+			switch (*p)
+			{
 			// Vectors
 			case 'v':
-				checkChar = fileIn.get();
-				if (newMesh)
-				{
-					newMesh = false;
-					if (!tempMesh.hasTexture)
-						tempMesh.Tex.push_back(Vector2(0.0f, 0.0f));
-
-					if (!tempMesh.hasNormal)
-						tempMesh.Nor.push_back(Vector3(0.0f, 0.0f, 0.0f));
-					meshes.push_back(tempMesh);
-					tempMesh = _ObjMesh();
-					tempMesh.hasNormal = false;
-					tempMesh.hasTexture = false;
-				}
-				switch (checkChar)
-				{
-				case ' ':		// Position
-					fileIn >> x >> y >> z;
-					if (isRhCoordSystem)
-						tempMesh.Pos.push_back(Vector3(x, y, z * -1.0f));
-					else
-						tempMesh.Pos.push_back(Vector3(x, y, z));
-					break;
-				case 't':		// Texture
-					tempMesh.hasTexture = true;
-					fileIn >> x >> y;
-					if (isRhCoordSystem)
-						tempMesh.Tex.push_back(Vector2(x, 1.0f - y));
-					else
-						tempMesh.Tex.push_back(Vector2(x, 1.0f - y));
-					break;
-				case 'n':		// Normal
-					tempMesh.hasNormal = true;
-					fileIn >> x >> y >> z;
-					if (isRhCoordSystem)
-						tempMesh.Nor.push_back(Vector3(x, y, z * -1.0f));
-					else
-						tempMesh.Nor.push_back(Vector3(x, y, z));
+			{
+				p++;
+				char type = p < end ? *p : '\n';
+				if (type == 't' || type == 'n')
+					p++;
+				else if (type != ' ' && type != '\t')
 					break;
+
+				float v[3] = { 0.0f, 0.0f, 0.0f };
+				for (int i = 0; i < 3; i++)
+				{
+					_SkipSpaces(p, end);
+					if (!_ParseFloat(p, end, v[i]))
+						break;
 				}
+
+				if (type == 't')
+					obj.Tex.push_back(Vector2(v[0], 1.0f - v[1]));
+				else if (type == 'n')
+					obj.Nor.push_back(Vector3(v[0], v[1], v[2] * zSign));
+				else
+					obj.Pos.push_back(Vector3(v[0], v[1], v[2] * zSign));
 				break;
+			}
 
 			// Face
 			case 'f':
-				newMesh = true;
-				fileIn >> tempFace[0] >> tempFace[1] >> tempFace[2];
-				tempMesh.Fac.push_back(_Face(tempFace[0], tempFace[1], tempFace[2]));
-				break;
-
-			//Store the material libraries file name
-			case 'm':
-				checkChar = fileIn.get();
-				if (checkChar == 't')
+			{
+				p++;
+				int count = 0;
+				int sizes[3] = { (int)obj.Pos.size(), (int)obj.Tex.size(), (int)obj.Nor.size() };
+				while (true)
 				{
-					checkChar = fileIn.get();
-					if (checkChar == 'l')
+					_SkipSpaces(p, end);
+					int value[3] = { 0, 0, 0 };
+					if (!_ParseInt(p, end, value[0]))
+						break;
+					if (p < end && *p == '/')
 					{
-						checkChar = fileIn.get();
-						if (checkChar == 'l')
+						p++;
+						_ParseInt(p, end, value[1]);
+						if (p < end && *p == '/')
 						{
-							checkChar = fileIn.get();
-							if (checkChar == 'i')
-							{
-								checkChar = fileIn.get();
-								if (checkChar == 'b')
-								{
-									checkChar = fileIn.get();
-									if (checkChar == ' ')
-									{
-										fileIn >> materialFile;
-									}
-								}
-							}
+							p++;
+							_ParseInt(p, end, value[2]);
 						}
 					}
+
+					// 1 based or negative from the end, 0 = missing
+					int mask = 0;
+					for (int i = 0; i < 3; i++)
+					{
+						mask |= (value[i] < 0) << i;
+						value[i] = value[i] > 0 ? value[i] - 1 : value[i] < 0 ? sizes[i] + value[i] : -1;
+					}
+					_Index corner = { value[0], value[1], value[2] };
+
+					if (count < 3)
+					{
+						corners[count] = corner;
+						relative[count] = chunk ? mask : 0;
+					}
+					else
+					{
+						corners[1] = corners[2];
+						relative[1] = relative[2];
+						corners[2] = corner;
+						relative[2] = chunk ? mask : 0;
+					}
+					if (++count >= 3)
+					{
+						if (obj.Groups.empty())
+						{
+							obj.Groups.push_back({ std::string(), 0 });
+							obj.DefaultGroup = true;
+						}
+						if (relative[0] | relative[1] | relative[2])
+						{
+							for (int k = 0; k < 3; k++)
+								for (int i = 0; i < 3; i++)
+									if (relative[k] & (1 << i))
+										obj.Relative.push_back((obj.Fac.size() + k) * 3 + i);
+						}
+						obj.Fac.push_back(corners[0]);
+						obj.Fac.push_back(corners[1]);
+						obj.Fac.push_back(corners[2]);
+					}
+				}
+				break;
+			}
+
+			// Store the material libraries file name
+			case 'm':
+				if (end - p > 6 && memcmp(p, "mtllib", 6) == 0 && (p[6] == ' ' || p[6] == '\t'))
+				{
+					p += 6;
+					obj.MaterialFile = _ParseName(p, end);
 				}
 				break;
 
-			//Store the material name
+			// Store the material name
 			case 'u':
-				checkChar = fileIn.get();
-				if (checkChar == 's')
+				if (end - p > 6 && memcmp(p, "usemtl", 6) == 0 && (p[6] == ' ' || p[6] == '\t'))
 				{
-					checkChar = fileIn.get();
-					if (checkChar == 'e')
+					p += 6;
+					obj.Groups.push_back({ _ParseName(p, end), obj.Fac.size() });
+				}
+				break;
+			}
+
+			// Comments, groups, smoothing and unknown statements, a parsed
+			// statement usually stops right at the line break
+			if (p < end && *p == '\n')
+				p++;
+			else
+				_SkipLine(p, end);
+		}
+	}
+
+	// Parses newline aligned chunks of the file in parallel and appends
+	// them in file order, so the result equals the one of _ParseObj.
+	// Relative indices of a chunk were resolved against its own elements
+	// and are moved by the element counts of all earlier chunks.
+	inline void _ParseObjParallel(const char* data, size_t size, bool isRhCoordSystem, unsigned threads,
+		_ObjData& obj)
+	{
+		const size_t minChunk = 1 << 20;
+		size_t chunks = ThreadCount(threads);
+		if (size / minChunk < chunks)
+			chunks = size / minChunk;
+		if (chunks <= 1)
+		{
+			_ParseObj(data, size, isRhCoordSystem, false, obj);
+			return;
+		}
+
+		// A chunk ends behind the first line break after its share of the file
+		const char* end = data + size;
+		std::vector<const char*> bounds(chunks + 1, end);
+		bounds[0] = data;
+		for (size_t c = 1; c < chunks; c++)
+		{
+			const char* p = data + size / chunks * c;
+			if (p < bounds[c - 1])
+				p = bounds[c - 1];
+			_SkipLine(p, end);
+			bounds[c] = p;
+		}
+
+		std::vector<_ObjData> parts(chunks);
+		ParallelFor(chunks, 1, [&](size_t begin, size_t last) {
+			for (size_t c = begin; c < last; c++)
+				_ParseObj(bounds[c], (size_t)(bounds[c + 1] - bounds[c]), isRhCoordSystem, true, parts[c]);
+		}, threads);
+
+		// Offsets of the chunks in the merged arrays
+		std::vector<size_t> pos(chunks + 1, 0), tex(chunks + 1, 0), nor(chunks + 1, 0), fac(chunks + 1, 0);
+		for (size_t c = 0; c < chunks; c++)
+		{
+			pos[c + 1] = pos[c] + parts[c].Pos.size();
+			tex[c + 1] = tex[c] + parts[c].Tex.size();
+			nor[c + 1] = nor[c] + parts[c].Nor.size();
+			fac[c + 1] = fac[c] + parts[c].Fac.size();
+		}
+		obj.Pos.resize(pos[chunks]);
+		obj.Tex.resize(tex[chunks]);
+		obj.Nor.resize(nor[chunks]);
+		obj.Fac.resize(fac[chunks]);
+
+		ParallelFor(chunks, 1, [&](size_t begin, size_t last) {
+			for (size_t c = begin; c < last; c++)
+			{
+				const _ObjData& part = parts[c];
+				std::copy(part.Pos.begin(), part.Pos.end(), obj.Pos.begin() + pos[c]);
+				std::copy(part.Tex.begin(), part.Tex.end(), obj.Tex.begin() + tex[c]);
+				std::copy(part.Nor.begin(), part.Nor.end(), obj.Nor.begin() + nor[c]);
+				std::copy(part.Fac.begin(), part.Fac.end(), obj.Fac.begin() + fac[c]);
+
+				int base[3] = { (int)pos[c], (int)tex[c], (int)nor[c] };
+				for (size_t r : part.Relative)
+				{
+					_Index& corner = obj.Fac[fac[c] + r / 3];
+					int& value = r % 3 == 0 ? corner.Pos : r % 3 == 1 ? corner.Tex : corner.Nor;
+					value += base[r % 3];
+				}
+			}
+		}, threads);
+
+		// Faces before the first usemtl of a chunk continue the last group
+		for (size_t c = 0; c < chunks; c++)
+		{
+			const _ObjData& part = parts[c];
+			for (size_t g = 0; g < part.Groups.size(); g++)
+			{
+				if (g == 0 && part.DefaultGroup && !obj.Groups.empty())
+					continue;
+				obj.Groups.push_back({ part.Groups[g].Material, part.Groups[g].Start + fac[c] });
+			}
+			if (!part.MaterialFile.empty())
+				obj.MaterialFile = part.MaterialFile;
+		}
+	}
+
+	/*********************************************************/
+	// Open addressing table from corners to vertex numbers with linear
+	// probing. Slots keep the corner next to its vertex, so a lookup
+	// touches one cache line.
+	class _CornerMap
+	{
+		public:
+			static constexpr uint32_t Empty = 0xFFFFFFFF;
+
+			explicit _CornerMap(size_t expected);
+
+			// Returns the vertex of the corner, or inserts the corner with
+			// vertex and returns vertex
+			uint32_t findOrInsert(const _Index& corner, uint32_t vertex);
+
+		private:
+			struct _Slot
+			{
+				_Index Corner;
+				uint32_t Vertex;
+			};
+
+			static size_t _hash(const _Index& corner);
+			void _grow();
+
+		private:
+			std::vector<_Slot> _slots;
+			size_t _size;
+	};
+
+	inline _CornerMap::_CornerMap(size_t expected) : _size(0)
+	{
+		size_t slots = 64;
+		while (slots < expected * 2)
+			slots *= 2;
+		_slots.assign(slots, { { 0, 0, 0 }, Empty });
+	}
+
+	inline size_t _CornerMap::_hash(const _Index& corner)
+	{
+		// Finalizer of MurmurHash3 over the packed indices
+		uint64_t key = (((uint64_t)(uint32_t)corner.Pos << 32) | (uint32_t)corner.Tex) ^
+			((uint64_t)(uint32_t)corner.Nor * 0x9e3779b97f4a7c15ULL);
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		key *= 0xc4ceb9fe1a85ec53ULL;
+		key ^= key >> 33;
+		return (size_t)key;
+	}
+
+	inline void _CornerMap::_grow()
+	{
+		std::vector<_Slot> slots(_slots.size() * 2, { { 0, 0, 0 }, Empty });
+		slots.swap(_slots);
+		size_t mask = _slots.size() - 1;
+		for (const _Slot& slot : slots)
+		{
+			if (slot.Vertex == Empty)
+				continue;
+			size_t i = _hash(slot.Corner) & mask;
+			while (_slots[i].Vertex != Empty)
+				i = (i + 1) & mask;
+			_slots[i] = slot;
+		}
+	}
+
+	inline uint32_t _CornerMap::findOrInsert(const _Index& corner, uint32_t vertex)
+	{
+		if ((_size + 1) * 2 > _slots.size())
+			_grow();
+
+		size_t mask = _slots.size() - 1;
+		size_t i = _hash(corner) & mask;
+		for (; _slots[i].Vertex != Empty; i = (i + 1) & mask)
+		{
+			const _Index& c = _slots[i].Corner;
+			if (c.Pos == corner.Pos && c.Tex == corner.Tex && c.Nor == corner.Nor)
+				return _slots[i].Vertex;
+		}
+		_slots[i] = { corner, vertex };
+		_size++;
+		return vertex;
+	}
+
+	// Turns the parsed triangles into one vertex per unique corner and
+	// three indices per triangle. Subsets holds the first index of every
+	// non empty material group followed by the total number of indices,
+	// materials the name of every group. Triangles with a missing or out of
+	// range position index, also a relative one that points before the
+	// start of the file, are dropped. Missing or invalid texture
+	// coordinates and normals are zero.
+	inline void _IndexObj(const _ObjData& obj, bool flipWinding, std::vector<Vertex>& vertices,
+		std::vector<Index>& indices, std::vector<Index>& subsets, std::vector<std::string>& materials)
+	{
+		vertices.clear();
+		indices.clear();
+		subsets.clear();
+		materials.clear();
+		indices.resize(obj.Fac.size());
+		vertices.reserve(obj.Pos.size());
+
+		// Most meshes have about one vertex per position. The first vertex
+		// of every position is found directly, the table only holds the
+		// corners that share a position with an earlier, different corner.
+		struct _First
+		{
+			uint32_t Vertex;
+			int Tex;
+			int Nor;
+		};
+		std::vector<_First> first(obj.Pos.size(), { _CornerMap::Empty, 0, 0 });
+		_CornerMap map(0);
+		int sizes[3] = { (int)obj.Pos.size(), (int)obj.Tex.size(), (int)obj.Nor.size() };
+		size_t count = 0;
+
+		// The z flip of a right handed file mirrors the mesh, reversing the
+		// corner order keeps the triangles facing outwards
+		const int order[2][3] = { { 0, 1, 2 }, { 0, 2, 1 } };
+		const int* corners = order[flipWinding ? 1 : 0];
+
+		for (size_t g = 0; g < obj.Groups.size(); g++)
+		{
+			size_t start = obj.Groups[g].Start;
+			size_t end = g + 1 < obj.Groups.size() ? obj.Groups[g + 1].Start : obj.Fac.size();
+			size_t groupStart = count;
+			for (size_t t = start; t < end; t += 3)
+			{
+				const _Index* tri = &obj.Fac[t];
+				if ((unsigned)tri[0].Pos >= (unsigned)sizes[0] || (unsigned)tri[1].Pos >= (unsigned)sizes[0] ||
+					(unsigned)tri[2].Pos >= (unsigned)sizes[0])
+					continue;
+
+				for (int k = 0; k < 3; k++)
+				{
+					const _Index& c = tri[corners[k]];
+					uint32_t vertex = (uint32_t)vertices.size();
+					_First& f = first[c.Pos];
+					if (f.Vertex == _CornerMap::Empty)
+						f = { vertex, c.Tex, c.Nor };
+					else if (f.Tex == c.Tex && f.Nor == c.Nor)
+						vertex = f.Vertex;
+					else
+						vertex = map.findOrInsert(c, vertex);
+
+					if (vertex == vertices.size())
 					{
-						checkChar = fileIn.get();
-						if (checkChar == 'm')
-						{
-							checkChar = fileIn.get();
-							if (checkChar == 't')
-							{
-								checkChar = fileIn.get();
-								if (checkChar == 'l')
-								{
-									checkChar = fileIn.get();
-									if (checkChar == ' ')
-									{
-										fileIn >> tempMesh.Material;
-									}
-								}
-							}
-						}
+						Vertex v = {};
+						v.pos = obj.Pos[c.Pos];
+						if ((unsigned)c.Tex < (unsigned)sizes[1])
+							v.texCoord = obj.Tex[c.Tex];
+						if ((unsigned)c.Nor < (unsigned)sizes[2])
+							v.normal = obj.Nor[c.Nor];
+						vertices.push_back(v);
 					}
+					indices[count++] = vertex;
 				}
-				break;
 			}
 
+			if (count > groupStart)
+			{
+				subsets.push_back((Index)groupStart);
+				materials.push_back(obj.Groups[g].Material);
+			}
 		}
+		indices.resize(count);
+		if (!subsets.empty())
+			subsets.push_back((Index)count);
+	}
 
+	/*********************************************************/
+	enum class NormalWeight
+	{
+		Area,	// Faces contribute by their area
+		Angle	// Faces contribute by their angle at the vertex
+	};
+
+	inline FloatN _ClampN(FloatN a, float low, float high)
+	{
+		return _MinN(_MaxN(a, _SetN(low)), _SetN(high));
+	}
 
-		if (!tempMesh.hasTexture)
-			tempMesh.Tex.push_back(Vector2(0.0f, 0.0f));
+	// Unit normal, tangent and bitangent of a triangle and the weights of
+	// its three corners. Kept together because the vertices read them in
+	// random order.
+	struct _FaceFrame
+	{
+		float Normal[3];
+		float Tangent[3];
+		float Bitangent[3];
+		float Weight[3];
+	};
 
-		if (!tempMesh.hasNormal)
-			tempMesh.Nor.push_back(Vector3(0.0f, 0.0f, 0.0f));
+	// Blocks of triangles are gathered into local structure of arrays and
+	// computed GU_LANES at a time
+	inline void _CalculateFaceFrames(const std::vector<Vertex>& vertices, const std::vector<Index>& indices,
+		NormalWeight weight, bool tangents, unsigned threads, std::vector<_FaceFrame>& faces)
+	{
+		const size_t block = 64;
+		size_t count = indices.size() / 3;
+		faces.resize(count);
 
-		newMesh = false;
-		meshes.push_back(tempMesh);
-		fileIn.close();
+		ParallelFor((count + block - 1) / block, GU_BATCH_GRAIN / block, [&](size_t begin, size_t end) {
+			// Rows of r: normal, tangent, bitangent and weight components
+			alignas(32) float p[9][block], uv[6][block], r[12][block];
+			for (size_t b = begin; b < end; b++)
+			{
+				size_t first = b * block;
+				size_t n = count - first < block ? count - first : block;
+				for (size_t t = 0; t < block; t++)
+				{
+					for (int k = 0; k < 3; k++)
+					{
+						const Vertex* v = t < n ? &vertices[indices[(first + t) * 3 + k]] : nullptr;
+						p[k * 3 + 0][t] = v ? v->pos._x : 0.0f;
+						p[k * 3 + 1][t] = v ? v->pos._y : 0.0f;
+						p[k * 3 + 2][t] = v ? v->pos._z : 0.0f;
+						uv[k * 2 + 0][t] = v ? v->texCoord._x : 0.0f;
+						uv[k * 2 + 1][t] = v ? v->texCoord._y : 0.0f;
+					}
+				}
 
-		// Step 2: Convert mesh
-		for (auto mesh : meshes)
+				// Whole registers, the lanes behind the last triangle hold zeros
+				size_t lanes = (n + GU_LANES - 1) / GU_LANES * GU_LANES;
+				for (size_t t = 0; t < lanes; t += GU_LANES)
+				{
+					FloatN e1x = _SubN(_LoadN(p[3] + t), _LoadN(p[0] + t));
+					FloatN e1y = _SubN(_LoadN(p[4] + t), _LoadN(p[1] + t));
+					FloatN e1z = _SubN(_LoadN(p[5] + t), _LoadN(p[2] + t));
+					FloatN e2x = _SubN(_LoadN(p[6] + t), _LoadN(p[0] + t));
+					FloatN e2y = _SubN(_LoadN(p[7] + t), _LoadN(p[1] + t));
+					FloatN e2z = _SubN(_LoadN(p[8] + t), _LoadN(p[2] + t));
+
+					// The length of the cross product is twice the area
+					FloatN nx = _SubN(_MulN(e1y, e2z), _MulN(e1z, e2y));
+					FloatN ny = _SubN(_MulN(e1z, e2x), _MulN(e1x, e2z));
+					FloatN nz = _SubN(_MulN(e1x, e2y), _MulN(e1y, e2x));
+					FloatN area = _SqrtN(_AddN(_AddN(_MulN(nx, nx), _MulN(ny, ny)), _MulN(nz, nz)));
+					_NormalizeN(nx, ny, nz);
+					_StoreN(r[0] + t, nx);
+					_StoreN(r[1] + t, ny);
+					_StoreN(r[2] + t, nz);
+
+					if (weight == NormalWeight::Area)
+					{
+						_StoreN(r[9] + t, area);
+						_StoreN(r[10] + t, area);
+						_StoreN(r[11] + t, area);
+					}
+					else
+					{
+						// Cosines of the corner angles from the unit edges
+						FloatN e3x = _SubN(e2x, e1x), e3y = _SubN(e2y, e1y), e3z = _SubN(e2z, e1z);
+						FloatN a1x = e1x, a1y = e1y, a1z = e1z, a2x = e2x, a2y = e2y, a2z = e2z;
+						_NormalizeN(a1x, a1y, a1z);
+						_NormalizeN(a2x, a2y, a2z);
+						_NormalizeN(e3x, e3y, e3z);
+						FloatN c0 = _AddN(_AddN(_MulN(a1x, a2x), _MulN(a1y, a2y)), _MulN(a1z, a2z));
+						FloatN c1 = _SubN(_SetN(0.0f), _AddN(_AddN(_MulN(a1x, e3x), _MulN(a1y, e3y)), _MulN(a1z, e3z)));
+						FloatN c2 = _AddN(_AddN(_MulN(a2x, e3x), _MulN(a2y, e3y)), _MulN(a2z, e3z));
+						_StoreN(r[9] + t, _ClampN(c0, -1.0f, 1.0f));
+						_StoreN(r[10] + t, _ClampN(c1, -1.0f, 1.0f));
+						_StoreN(r[11] + t, _ClampN(c2, -1.0f, 1.0f));
+					}
+
+					if (!tangents)
+						continue;
+
+					// Solve e1 = du1 * T + dv1 * B, e2 = du2 * T + dv2 * B, the scale
+					// of the determinant is removed by the normalization
+					FloatN du1 = _SubN(_LoadN(uv[2] + t), _LoadN(uv[0] + t));
+					FloatN dv1 = _SubN(_LoadN(uv[3] + t), _LoadN(uv[1] + t));
+					FloatN du2 = _SubN(_LoadN(uv[4] + t), _LoadN(uv[0] + t));
+					FloatN dv2 = _SubN(_LoadN(uv[5] + t), _LoadN(uv[1] + t));
+					FloatN det = _SubN(_MulN(du1, dv2), _MulN(du2, dv1));
+					FloatN s = _SelectN(_CmpLtN(det, _SetN(0.0f)), _SetN(-1.0f),
+						_SelectN(_CmpLtN(_SetN(0.0f), det), _SetN(1.0f), _SetN(0.0f)));
+
+					FloatN tx = _MulN(_SubN(_MulN(e1x, dv2), _MulN(e2x, dv1)), s);
+					FloatN ty = _MulN(_SubN(_MulN(e1y, dv2), _MulN(e2y, dv1)), s);
+					FloatN tz = _MulN(_SubN(_MulN(e1z, dv2), _MulN(e2z, dv1)), s);
+					FloatN bx = _MulN(_SubN(_MulN(e2x, du1), _MulN(e1x, du2)), s);
+					FloatN by = _MulN(_SubN(_MulN(e2y, du1), _MulN(e1y, du2)), s);
+					FloatN bz = _MulN(_SubN(_MulN(e2z, du1), _MulN(e1z, du2)), s);
+					_NormalizeN(tx, ty, tz);
+					_NormalizeN(bx, by, bz);
+					_StoreN(r[3] + t, tx);
+					_StoreN(r[4] + t, ty);
+					_StoreN(r[5] + t, tz);
+					_StoreN(r[6] + t, bx);
+					_StoreN(r[7] + t, by);
+					_StoreN(r[8] + t, bz);
+				}
+
+				if (weight == NormalWeight::Angle)
+				{
+					for (int k = 9; k < 12; k++)
+						for (size_t t = 0; t < n; t++)
+							r[k][t] = acosf(r[k][t]);
+				}
+
+				for (size_t t = 0; t < n; t++)
+				{
+					_FaceFrame& f = faces[first + t];
+					for (int j = 0; j < 3; j++)
+					{
+						f.Normal[j] = r[j][t];
+						f.Tangent[j] = tangents ? r[3 + j][t] : 0.0f;
+						f.Bitangent[j] = tangents ? r[6 + j][t] : 0.0f;
+						f.Weight[j] = r[9 + j][t];
+					}
+				}
+			}
+		}, threads);
+	}
+
+	// Corners of the triangles around every vertex in compressed rows, the
+	// corners of vertex v are corners[offsets[v]] to corners[offsets[v + 1]]
+	// in ascending order
+	inline void _VertexCorners(const std::vector<Index>& indices, size_t vertexCount,
+		std::vector<uint32_t>& offsets, std::vector<uint32_t>& corners)
+	{
+		size_t count = indices.size() / 3 * 3;
+		offsets.assign(vertexCount + 1, 0);
+		for (size_t c = 0; c < count; c++)
+			offsets[indices[c] + 1]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			offsets[v + 1] += offsets[v];
+
+		std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+		corners.resize(count);
+		for (size_t c = 0; c < count; c++)
+			corners[next[indices[c]]++] = (uint32_t)c;
+	}
+
+	// Weighted sums of the face normals, tangents and bitangents over the
+	// corners of every vertex. Every thread gathers its own vertices, so
+	// the sums need no atomics and do not depend on the thread count.
+	inline void _GatherCorners(const std::vector<uint32_t>& offsets, const std::vector<uint32_t>& corners,
+		const std::vector<_FaceFrame>& faces, bool tangents, unsigned threads,
+		Vector3Stream& normal, Vector3Stream& tangent, Vector3Stream& bitangent)
+	{
+		size_t count = offsets.size() - 1;
+		normal.resize(count);
+		tangent.resize(tangents ? count : 0);
+		bitangent.resize(tangents ? count : 0);
+
+		ParallelFor(count, GU_BATCH_GRAIN, [&](size_t begin, size_t end) {
+			for (size_t v = begin; v < end; v++)
+			{
+				float n[3] = {}, t[3] = {}, b[3] = {};
+				for (uint32_t i = offsets[v]; i < offsets[v + 1]; i++)
+				{
+					const _FaceFrame& f = faces[corners[i] / 3];
+					float s = f.Weight[corners[i] % 3];
+					for (int j = 0; j < 3; j++)
+					{
+						n[j] += f.Normal[j] * s;
+						t[j] += f.Tangent[j] * s;
+						b[j] += f.Bitangent[j] * s;
+					}
+				}
+				normal.set(v, Vector3(n[0], n[1], n[2]));
+				if (tangents)
+				{
+					tangent.set(v, Vector3(t[0], t[1], t[2]));
+					bitangent.set(v, Vector3(b[0], b[1], b[2]));
+				}
+			}
+		}, threads);
+	}
+
+	// Smooth normals and tangent frames of an indexed triangle list. The
+	// normals are shared by all vertices at the same position, also across
+	// texture seams. Tangents point along +u and are orthogonal to the
+	// normal, the bitangent is the cross product of normal and tangent,
+	// negated where the texture is mirrored.
+	inline void _CalculateFrames(std::vector<Vertex>& vertices, const std::vector<Index>& indices,
+		NormalWeight weight, bool normals, bool tangents, unsigned threads)
+	{
+		size_t count = vertices.size();
+		if (count == 0 || indices.size() < 3)
+			return;
+
+		std::vector<_FaceFrame> faces;
+		_CalculateFaceFrames(vertices, indices, weight, tangents, threads, faces);
+
+		std::vector<uint32_t> offsets, corners;
+		_VertexCorners(indices, count, offsets, corners);
+
+		Vector3Stream normal, tangent, bitangent;
+		_GatherCorners(offsets, corners, faces, tangents, threads, normal, tangent, bitangent);
+
+		if (normals)
 		{
+			// Sum the vertices with the same position bits
+			_CornerMap map(count);
+			std::vector<uint32_t> keys(count);
+			Vector3Stream sum(count);
+			uint32_t keyCount = 0;
+			for (size_t v = 0; v < count; v++)
+			{
+				float x = vertices[v].pos._x + 0.0f, y = vertices[v].pos._y + 0.0f, z = vertices[v].pos._z + 0.0f;
+				_Index bits;
+				memcpy(&bits.Pos, &x, 4);
+				memcpy(&bits.Tex, &y, 4);
+				memcpy(&bits.Nor, &z, 4);
+				uint32_t k = keys[v] = map.findOrInsert(bits, keyCount);
+				keyCount += k == keyCount;
+				sum.x()[k] += normal.x()[v];
+				sum.y()[k] += normal.y()[v];
+				sum.z()[k] += normal.z()[v];
+			}
 
+			for (size_t i = 0; i < sum.padded(); i += GU_LANES)
+			{
+				FloatN x = _LoadN(sum.x() + i), y = _LoadN(sum.y() + i), z = _LoadN(sum.z() + i);
+				_NormalizeN(x, y, z);
+				_StoreN(sum.x() + i, x);
+				_StoreN(sum.y() + i, y);
+				_StoreN(sum.z() + i, z);
+			}
+			for (size_t v = 0; v < count; v++)
+			{
+				normal.set(v, sum.get(keys[v]));
+				vertices[v].normal = normal.get(v);
+			}
 		}
 
+		if (!tangents)
+			return;
+
+		if (!normals)
+		{
+			for (size_t v = 0; v < count; v++)
+				normal.set(v, vertices[v].normal);
+		}
+
+		// Gram-Schmidt against the normal, GU_LANES vertices at a time
+		ParallelFor(normal.padded() / GU_LANES, GU_BATCH_GRAIN / GU_LANES, [&](size_t begin, size_t end) {
+			for (size_t i = begin * GU_LANES; i < end * GU_LANES; i += GU_LANES)
+			{
+				FloatN nx = _LoadN(normal.x() + i), ny = _LoadN(normal.y() + i), nz = _LoadN(normal.z() + i);
+				FloatN tx = _LoadN(tangent.x() + i), ty = _LoadN(tangent.y() + i), tz = _LoadN(tangent.z() + i);
+				FloatN d = _AddN(_AddN(_MulN(nx, tx), _MulN(ny, ty)), _MulN(nz, tz));
+				tx = _SubN(tx, _MulN(nx, d));
+				ty = _SubN(ty, _MulN(ny, d));
+				tz = _SubN(tz, _MulN(nz, d));
+				_NormalizeN(tx, ty, tz);
+
+				FloatN cx = _SubN(_MulN(ny, tz), _MulN(nz, ty));
+				FloatN cy = _SubN(_MulN(nz, tx), _MulN(nx, tz));
+				FloatN cz = _SubN(_MulN(nx, ty), _MulN(ny, tx));
+				FloatN h = _AddN(_AddN(_MulN(cx, _LoadN(bitangent.x() + i)), _MulN(cy, _LoadN(bitangent.y() + i))),
+					_MulN(cz, _LoadN(bitangent.z() + i)));
+				FloatN s = _SelectN(_CmpLtN(h, _SetN(0.0f)), _SetN(-1.0f), _SetN(1.0f));
+
+				_StoreN(tangent.x() + i, tx);
+				_StoreN(tangent.y() + i, ty);
+				_StoreN(tangent.z() + i, tz);
+				_StoreN(bitangent.x() + i, _MulN(cx, s));
+				_StoreN(bitangent.y() + i, _MulN(cy, s));
+				_StoreN(bitangent.z() + i, _MulN(cz, s));
+			}
+		}, threads);
+
+		for (size_t v = 0; v < count; v++)
+		{
+			vertices[v].tangent = tangent.get(v);
+			vertices[v].bitangent = bitangent.get(v);
+		}
+	}
+
+	// Replaces the normals of the vertices by smooth normals of the faces
+	// around their position, see _CalculateFrames. Lists with more than
+	// GU_BATCH_GRAIN elements are split across the requested number of
+	// threads (0 = all hardware threads).
+	inline void CalculateNormals(std::vector<Vertex>& vertices, const std::vector<Index>& indices,
+		NormalWeight weight = NormalWeight::Angle, unsigned threads = 1)
+	{
+		_CalculateFrames(vertices, indices, weight, true, false, threads);
+	}
+
+	// Calculates tangents and bitangents from the texture coordinates and
+	// the existing normals, see _CalculateFrames
+	inline void CalculateTangents(std::vector<Vertex>& vertices, const std::vector<Index>& indices,
+		NormalWeight weight = NormalWeight::Angle, unsigned threads = 1)
+	{
+		_CalculateFrames(vertices, indices, weight, false, true, threads);
+	}
+
+	/*********************************************************/
+	// Loads the triangles of a Wavefront .obj file. With isRhCoordSystem
+	// the file is converted from a right to a left handed system (z and
+	// the winding are flipped), texture coordinates always get v = 1 - v.
+	// Subsets and materials are described at _IndexObj. calculateNormals
+	// replaces the normals of the file by angle weighted smooth normals
+	// and calculates tangents and bitangents. Files larger than
+	// a few MB are parsed in chunks on the requested number of threads
+	// (0 = all hardware threads), the result does not depend on it.
+    inline bool LoadObj(const char* filename, std::vector<Vertex>& vertices, std::vector<Index>& indices,
+		std::vector<Index>& subsets, std::string& materialFile, std::vector<std::string>& materials,
+		bool isRhCoordSystem = true, bool calculateNormals = false, unsigned threads = 1)
+    {
+		// Step 1: Read in the .obj-File
+		_MappedFile file;
+		if (!file.open(filename))
+			return false;
+
+		_ObjData obj;
+		_ParseObjParallel(file.data(), file.size(), isRhCoordSystem, threads, obj);
+		file.close();
+		materialFile = obj.MaterialFile;
+
+		// Step 2: Convert mesh
+		_IndexObj(obj, isRhCoordSystem, vertices, indices, subsets, materials);
+
+		// Step 3: Tangent space
+		if (calculateNormals)
+			_CalculateFrames(vertices, indices, NormalWeight::Angle, true, true, threads);
+
 		return true;
     }
 
@@ -0,0 +1,274 @@
+// Checks the Vector4 and Matrix4x4 operators and the Vector3Stream
+// normalization against the double precision reference of the benchmarks.
+// The file is built once per code path (SSE, AVX and GU_NO_SIMD, see
+// CMakeLists.txt), GU_TEST_SIMD names the path the build is expected to
+// take.
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <GU/GUMath.h>
+#include <GU/GUStream.h>
+
+#include "GUMathReference.h"
+
+using namespace GU;
+using namespace GURef;
+
+namespace
+{
+	constexpr int Samples = 10000;
+	int failures = 0;
+
+	void Expect(bool passed, const char* what)
+	{
+		if(!passed)
+		{
+			printf("FAILED: %s\n", what);
+			failures++;
+		}
+	}
+
+	void ExpectError(double error, double tolerance, const char* what)
+	{
+		if(!(error <= tolerance))
+		{
+			printf("FAILED: %s, error %.3e above %.3e\n", what, error, tolerance);
+			failures++;
+		}
+	}
+
+	// Maximum error of test(random) over Samples samples
+	template<typename Test>
+	void ExpectSamples(double tolerance, const char* what, Test test)
+	{
+		Random random(5);
+		double e = 0.0;
+		for(int i = 0; i < Samples; i++)
+			e = fmax(e, test(random));
+		ExpectError(e, tolerance, what);
+	}
+
+	const char* SimdName()
+	{
+#if defined(GU_AVX)
+		return "avx";
+#elif defined(GU_SSE)
+		return "sse";
+#else
+		return "none";
+#endif
+	}
+
+	static_assert(alignof(Vector4) == 16 && sizeof(Vector4) == 16, "Vector4 is one aligned register");
+	static_assert(alignof(Matrix4x4) == 16 && sizeof(Matrix4x4) == 64, "Matrix4x4 is four aligned registers");
+
+	// The constant evaluated paths
+	constexpr Matrix4x4 ConstA(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16);
+	constexpr Matrix4x4 ConstB(2, 0, 0, 1, 0, 3, 0, 2, 0, 0, 4, 3, 0, 0, 0, 1);
+	static_assert((ConstA * ConstB)._m14 == 1 + 4 + 9 + 4, "constexpr Matrix4x4 * Matrix4x4");
+	static_assert((ConstA * Vector4(1, 0, 0, 1))._y == 5 + 8, "constexpr Matrix4x4 * Vector4");
+	static_assert(ConstA.transpose()._m12 == 5 && ConstA.transpose()._m41 == 4, "constexpr transpose");
+	static_assert((ConstB.inverse() * ConstB)._m11 == 1.0f, "constexpr inverse");
+
+	/*********************************************************/
+	void TestVector4()
+	{
+		ExpectSamples(1e-6, "Vector4 + Vector4", [](Random &r) {
+			Vector4 a = r.vector4(), b = r.vector4();
+			return Error(a + b, Add(ToDouble(a), ToDouble(b)));
+		});
+		ExpectSamples(1e-6, "Vector4 += Vector4", [](Random &r) {
+			Vector4 a = r.vector4(), b = r.vector4(), c = a;
+			c += b;
+			return Error(c, Add(ToDouble(a), ToDouble(b)));
+		});
+		ExpectSamples(1e-6, "Vector4 - Vector4", [](Random &r) {
+			Vector4 a = r.vector4(), b = r.vector4();
+			return Error(a - b, Sub(ToDouble(a), ToDouble(b)));
+		});
+		ExpectSamples(1e-6, "Vector4 -= Vector4", [](Random &r) {
+			Vector4 a = r.vector4(), b = r.vector4(), c = a;
+			c -= b;
+			return Error(c, Sub(ToDouble(a), ToDouble(b)));
+		});
+		ExpectSamples(0.0, "-Vector4", [](Random &r) {
+			Vector4 a = r.vector4();
+			return Error(-a, Scale(ToDouble(a), -1.0));
+		});
+		ExpectSamples(1e-6, "Vector4 * Vector4", [](Random &r) {
+			Vector4 a = r.vector4(), b = r.vector4();
+			return Error(a * b, Mul(ToDouble(a), ToDouble(b)));
+		});
+		ExpectSamples(1e-6, "Vector4 * float", [](Random &r) {
+			Vector4 a = r.vector4();
+			float s = r.uniform(-4.0f, 4.0f);
+			return fmax(Error(a * s, Scale(ToDouble(a), s)), Error(s * a, Scale(ToDouble(a), s)));
+		});
+		ExpectSamples(1e-6, "Vector4 / float", [](Random &r) {
+			Vector4 a = r.vector4();
+			float s = r.uniform(0.5f, 4.0f);
+			return Error(a / s, Scale(ToDouble(a), 1.0 / s));
+		});
+		ExpectSamples(1e-6, "Vector4::dot", [](Random &r) {
+			Vector4 a = r.vector4(), b = r.vector4();
+			return Error(a.dot(b), Dot3(ToDouble(a), ToDouble(b)));
+		});
+		ExpectSamples(1e-6, "Vector4::length", [](Random &r) {
+			Vector4 a = r.vector4();
+			return fmax(Error(a.length(), Length3(ToDouble(a))), Error(a.length2(), Dot3(ToDouble(a), ToDouble(a))));
+		});
+		ExpectSamples(1e-6, "Vector4::cross", [](Random &r) {
+			Vector4 a = r.vector4(), b = r.vector4();
+			return Error(a.cross(b), Cross3(ToDouble(a), ToDouble(b)));
+		});
+		ExpectSamples(1e-6, "Vector4::normalize", [](Random &r) {
+			Vector4 a = r.vector4(0.1f, 1.0f);
+			return Error(a.normalize(), Normalize3(ToDouble(a)));
+		});
+		ExpectSamples(1e-6, "Vector4::reflect", [](Random &r) {
+			Vector4 a = r.vector4(), n = r.vector4(0.1f, 1.0f).normalize();
+			return Error(a.reflect(n), Reflect3(ToDouble(a), ToDouble(n)));
+		});
+		ExpectSamples(0.0, "Vector4::saturate", [](Random &r) {
+			Vector4 a = r.vector4(-2.0f, 2.0f);
+			Vec4 ref = ToDouble(a);
+			for(double &v : ref.v)
+				v = v < 0.0 ? 0.0 : v > 1.0 ? 1.0 : v;
+			return Error(a.saturate(), ref);
+		});
+
+		Vector4 a(1.0f, 2.0f, 3.0f, 4.0f);
+		Expect(a == Vector4(1.0f, 2.0f, 3.0f, 4.0f), "Vector4 == Vector4");
+		Expect(a != Vector4(1.0f, 2.0f, 3.0f, 5.0f), "Vector4 != Vector4 on w");
+		Expect(!(a != a), "Vector4 != itself");
+	}
+
+	/*********************************************************/
+	void TestMatrix4x4()
+	{
+		ExpectSamples(1e-6, "Matrix4x4 * Matrix4x4", [](Random &r) {
+			Matrix4x4 a = r.matrix(), b = r.matrix();
+			return Error(a * b, Mul(ToDouble(a), ToDouble(b)));
+		});
+		// The result may be assigned to either operand
+		ExpectSamples(1e-6, "Matrix4x4 * Matrix4x4 in place", [](Random &r) {
+			Matrix4x4 a = r.matrix(), b = r.matrix(), c = a, d = b;
+			Mat4 ref = Mul(ToDouble(a), ToDouble(b));
+			c = c * b;
+			d = a * d;
+			return fmax(Error(c, ref), Error(d, ref));
+		});
+		ExpectSamples(0.0, "Matrix4x4 * identity", [](Random &r) {
+			Matrix4x4 a = r.matrix();
+			return fmax(Error(a * Matrix4x4(), ToDouble(a)), Error(Matrix4x4() * a, ToDouble(a)));
+		});
+		ExpectSamples(1e-6, "Matrix4x4 * Vector4", [](Random &r) {
+			Matrix4x4 a = r.matrix();
+			Vector4 b = r.vector4();
+			return Error(a * b, Mul(ToDouble(a), ToDouble(b)));
+		});
+		ExpectSamples(1e-6, "Matrix4x4 * float", [](Random &r) {
+			Matrix4x4 a = r.matrix();
+			float s = r.uniform(-4.0f, 4.0f);
+			Mat4 ref = ToDouble(a);
+			for(auto &row : ref.m)
+				for(double &v : row)
+					v *= s;
+			return fmax(Error(a * s, ref), Error(s * a, ref));
+		});
+		ExpectSamples(1e-6, "Matrix4x4 + Matrix4x4", [](Random &r) {
+			Matrix4x4 a = r.matrix(), b = r.matrix();
+			Mat4 ref = ToDouble(a), db = ToDouble(b);
+			for(int i = 0; i < 4; i++)
+				for(int j = 0; j < 4; j++)
+					ref.m[i][j] += db.m[i][j];
+			return Error(a + b, ref);
+		});
+		ExpectSamples(0.0, "Matrix4x4::transpose", [](Random &r) {
+			Matrix4x4 a = r.matrix();
+			return fmax(Error(a.transpose(), Transpose(ToDouble(a))), Error(a.transpose().transpose(), ToDouble(a)));
+		});
+
+		// Accuracy relative to the magnitude of the inverse
+		ExpectSamples(1e-5, "Matrix4x4::inverse", [](Random &r) {
+			Matrix4x4 a = r.invertible();
+			Mat4 inv;
+			Inverse(ToDouble(a), inv);
+			return NormError(a.inverse(), inv);
+		});
+		ExpectSamples(1e-5, "Matrix4x4::inverse * Matrix4x4", [](Random &r) {
+			Matrix4x4 a = r.invertible();
+			return fmax(Error(a.inverse() * a, Identity()), Error(a * a.inverse(), Identity()));
+		});
+		// Any entries, skipping the nearly singular ones
+		ExpectSamples(1e-3, "Matrix4x4::inverse of general matrices", [](Random &r) {
+			Matrix4x4 a = r.matrix();
+			Mat4 inv;
+			if(!Inverse(ToDouble(a), inv))
+				return 0.0;
+			double size = 0.0;
+			for(auto &row : inv.m)
+				for(double v : row)
+					size = fmax(size, fabs(v));
+			return size > 100.0 ? 0.0 : NormError(a.inverse(), inv);
+		});
+		ExpectSamples(1e-6, "Matrix4x4::inverse of rotations", [](Random &r) {
+			Matrix4x4 a = MatrixRotateXYZ(r.uniform(-3.0f, 3.0f), r.uniform(-3.0f, 3.0f), r.uniform(-3.0f, 3.0f));
+			return Error(a.inverse(), Transpose(ToDouble(a)));
+		});
+
+		// The runtime paths agree with the constant evaluated ones
+		Matrix4x4 a = ConstA, b = ConstB;
+		ExpectError(Error(a * b, ToDouble(ConstA * ConstB)), 0.0, "Matrix4x4 * Matrix4x4 constexpr");
+		ExpectError(Error(a.transpose(), ToDouble(ConstA.transpose())), 0.0, "Matrix4x4::transpose constexpr");
+		ExpectError(Error(b.inverse(), ToDouble(ConstB.inverse())), 1e-6, "Matrix4x4::inverse constexpr");
+	}
+
+	/*********************************************************/
+	void TestVector3Stream()
+	{
+		// Five elements leave padding in every code path, one of them is zero
+		Random random(7);
+		Vector3 v[5];
+		for(Vector3 &e : v)
+			e = random.vector3(0.1f, 1.0f);
+		v[2] = Vector3(0.0f, 0.0f, 0.0f);
+		Vector3Stream a(v, 5), out;
+		Normalize(a, out);
+
+		double e = 0.0;
+		bool zero = true;
+		for(size_t i = 0; i < out.padded(); i++)
+		{
+			Vector3 n = out.get(i);
+			if(i < 5 && i != 2)
+				e = fmax(e, Error(Vector4(n._x, n._y, n._z, 1.0f), Normalize3(ToDouble(Vector4(v[i]._x, v[i]._y, v[i]._z, 0.0f)))));
+			else
+				zero = zero && n._x == 0.0f && n._y == 0.0f && n._z == 0.0f;
+		}
+		ExpectError(e, 1e-6, "Normalize(Vector3Stream)");
+		Expect(zero, "Normalize(Vector3Stream) keeps zero vectors and the padding zero");
+	}
+}
+
+int main()
+{
+	printf("simd: %s\n", SimdName());
+#ifdef GU_TEST_SIMD
+	Expect(strcmp(SimdName(), GU_TEST_SIMD) == 0, "built for the expected instruction set");
+#endif
+
+	TestVector4();
+	TestMatrix4x4();
+	TestVector3Stream();
+
+	if(failures)
+	{
+		printf("%d failed\n", failures);
+		return 1;
+	}
+	printf("passed\n");
+	return 0;
+}